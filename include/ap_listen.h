@@ -110,6 +110,15 @@ AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
                                                 ap_listen_rec ***buckets,
                                                 int *num_buckets);
 
+/**
+ * Bind the calling process (and the threads it creates afterwards) to the
+ * CPUs of the given listeners bucket, when configured to (see
+ * ListenCoresBucketsAffinity) and there is more than one bucket.
+ * MPMs call this in a new child, before any thread is created.
+ * @param bucket The bucket of the child.
+ */
+AP_DECLARE(void) ap_listen_bucket_affinity(int bucket);
+
 /**
  * Loop through the global ap_listen_rec list and close each of the sockets.
  */
@@ -135,6 +144,7 @@ AP_DECLARE_NONSTD(int) ap_close_selected_listeners(ap_slave_t *);
  */
 AP_DECLARE_NONSTD(const char *) ap_set_listenbacklog(cmd_parms *cmd, void *dummy, const char *arg);
 AP_DECLARE_NONSTD(const char *) ap_set_listencbratio(cmd_parms *cmd, void *dummy, const char *arg);
+AP_DECLARE_NONSTD(const char *) ap_set_listencbaffinity(cmd_parms *cmd, void *dummy, const char *arg);
 AP_DECLARE_NONSTD(const char *) ap_set_listener(cmd_parms *cmd, void *dummy,
                                                 int argc, char *const argv[]);
 AP_DECLARE_NONSTD(const char *) ap_set_send_buffer_size(cmd_parms *cmd, void *dummy,
@@ -148,6 +158,8 @@ AP_INIT_TAKE1("ListenBacklog", ap_set_listenbacklog, NULL, RSRC_CONF, \
   "Maximum length of the queue of pending connections, as used by listen(2)"), \
 AP_INIT_TAKE1("ListenCoresBucketsRatio", ap_set_listencbratio, NULL, RSRC_CONF, \
   "Ratio between the number of CPU cores (online) and the number of listeners buckets"), \
+AP_INIT_TAKE1("ListenCoresBucketsAffinity", ap_set_listencbaffinity, NULL, RSRC_CONF, \
+  "Off, On to bind children to the CPU cores of their listeners bucket, or IncomingCPU to also steer connections by CPU"), \
 AP_INIT_TAKE_ARGV("Listen", ap_set_listener, NULL, RSRC_CONF, \
   "A port number or a numeric IP address and a port number, and an optional protocol"), \
 AP_INIT_TAKE1("SendBufferSize", ap_set_send_buffer_size, NULL, RSRC_CONF, \
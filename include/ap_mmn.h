@@ -476,6 +476,35 @@
  * 20140627.9 (2.5.0-dev)  Add cgi_pass_auth and AP_CGI_PASS_AUTH_* to 
  *                         core_dir_config
  * 20140627.10 (2.5.0-dev) Add ap_proxy_de_socketfy to mod_proxy.h
+ * 20140627.11 (2.5.0-dev) Add write_coalescing to core_server_config,
+ *                         write_count to worker_score
+ * 20140627.12 (2.5.0-dev) Add accept_count to process_score, add
+ *                         ap_listen_bucket_affinity() and
+ *                         ap_set_listencbaffinity() to ap_listen.h.
+ * 20140627.13 (2.5.0-dev) Add proxy_splice_t, ap_proxy_splice_create() and
+ *                         ap_proxy_splice_transfer() to mod_proxy.h
+ * 20140627.14 (2.5.0-dev) Add ap_scan_http_line() and ap_parse_http_fields()
+ * 20140627.15 (2.5.0-dev) Add ap_header_e, ap_header_name() and
+ *                         ap_get_request_header() to httpd.h,
+ *                         AP_NOTE_HEADERS_IN to http_core.h
+ * 20140627.16 (2.5.0-dev) Add free_request_pool to conn_rec, pool_count
+ *                         and pool_reuse_count to worker_score, pool_count
+ *                         to process_score
+ * 20140627.17 (2.5.0-dev) Add CACHE_HASH_LEN and ap_cache_hash() to
+ *                         mod_cache.h
+ * 20140627.18 (2.5.0-dev) Add ap_cache_is_slice() to mod_cache.h
+ * 20140627.19 (2.5.0-dev) Add open_file_cache and open_file_cache_valid
+ *                         to core_server_config
+ * 20140627.20 (2.5.0-dev) Add ap_cache_vary_value() to mod_cache.h
+ * 20140627.21 (2.5.0-dev) Add ap_proxy_suspended_done() to mod_proxy.h
+ * 20140627.22 (2.5.0-dev) Add stack to proxy_conn_pool, validated to
+ *                         proxy_conn_rec, pool_hits, pool_misses and
+ *                         connect_hist to proxy_worker_shared in mod_proxy.h
+ * 20140627.23 (2.5.0-dev) Add PROXY_LBMETHOD_LOCKLESS, and ttfb to
+ *                         proxy_worker_shared in mod_proxy.h
+ * 20140627.24 (2.5.0-dev) Add the hkey argument to ap_cache_hash(), and
+ *                         CACHE_HASH_KEY_LEN and
+ *                         ap_cache_generate_keyed_name() to mod_cache.h
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -483,7 +512,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20140627
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 10                 /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 24                 /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
@@ -417,7 +417,8 @@ typedef struct {
 #define AP_NOTE_LOCATION_WALK  1
 #define AP_NOTE_FILE_WALK      2
 #define AP_NOTE_IF_WALK        3
-#define AP_NUM_STD_NOTES       4
+#define AP_NOTE_HEADERS_IN     4
+#define AP_NUM_STD_NOTES       5
 
 /**
  * Reserve an element in the core_request_config->notes array
@@ -706,6 +707,17 @@ typedef struct {
 #define AP_HTTP_EXPECT_STRICT_ENABLE   1
 #define AP_HTTP_EXPECT_STRICT_DISABLE  2
     int http_expect_strict;
+
+#define AP_WRITE_COALESCING_UNSET    0
+#define AP_WRITE_COALESCING_ENABLE   1
+#define AP_WRITE_COALESCING_DISABLE  2
+    int write_coalescing;
+
+    /** OpenFileCache: number of files each child keeps open, or 0 */
+    int open_file_cache;
+    /** OpenFileCacheValid: how long before a cached file is stat'ed again */
+#define AP_OPEN_FILE_CACHE_VALID apr_time_from_sec(1)
+    apr_interval_time_t open_file_cache_valid;
 } core_server_config;
 
 /* for AddOutputFiltersByType in core.c */
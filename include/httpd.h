@@ -1181,6 +1181,10 @@ struct conn_rec {
 
     /** Context under which this connection was suspended */
     void *suspended_baton;
+
+    /** A cleared request pool kept for the next request on this connection
+     *  (see ap_read_request() and the EOR bucket) */
+    apr_pool_t *free_request_pool;
 };
 
 struct conn_slave_rec {
@@ -2356,6 +2360,106 @@ AP_DECLARE(void) ap_bin2hex(const void *src, apr_size_t srclen, char *dest)
 AP_DECLARE(int) ap_has_cntrl(const char *str)
                 AP_FN_ATTR_NONNULL_ALL;
 
+/**
+ * Find the end of the first line of a HTTP message head held in memory
+ * @param s the start of the line
+ * @param len the number of bytes available from @a s
+ * @return the length of the line including its terminating (CR)LF, 0 if
+ *         there is no LF within @a len bytes, or -1 if a control character
+ *         other than HTAB, or a CR not followed by LF, comes before it
+ */
+AP_DECLARE(apr_ssize_t) ap_scan_http_line(const char *s, apr_size_t len)
+                        AP_FN_ATTR_NONNULL_ALL;
+
+/**
+ * Parse the header fields of a HTTP message head held in memory, in place:
+ * names and values are NUL terminated inside @a buf and added to @a fields
+ * without being copied, with the OWS around values stripped.  This is a
+ * fast path for well formed heads only, anything unusual (a name which is
+ * not a token, obsolete line folding, control characters, exceeded limits)
+ * is left to the line based parser.
+ * @param buf the fields, from the start of the first field line
+ * @param len the number of bytes available in @a buf
+ * @param max_line the maximum length of a field line, (CR)LF included
+ * @param max_fields the maximum number of fields, 0 for no limit
+ * @param fields the table to add the fields to
+ * @param consumed set to the length of the fields and of the empty line
+ *        which ends them
+ * @return APR_SUCCESS, APR_INCOMPLETE if the end of the fields is not in
+ *         @a buf, or APR_EINVAL if they need the line based parser
+ * @note @a buf is modified and @a fields may be partially filled whatever
+ *       the outcome.
+ */
+AP_DECLARE(apr_status_t) ap_parse_http_fields(char *buf, apr_size_t len,
+                                              apr_size_t max_line,
+                                              int max_fields,
+                                              apr_table_t *fields,
+                                              apr_size_t *consumed)
+                         AP_FN_ATTR_NONNULL_ALL;
+
+/**
+ * Identifiers of the well-known request header fields, which can be looked
+ * up with ap_get_request_header() rather than by name.
+ */
+typedef enum {
+    AP_HEADER_ACCEPT,
+    AP_HEADER_ACCEPT_CHARSET,
+    AP_HEADER_ACCEPT_ENCODING,
+    AP_HEADER_ACCEPT_LANGUAGE,
+    AP_HEADER_AUTHORIZATION,
+    AP_HEADER_CACHE_CONTROL,
+    AP_HEADER_CONNECTION,
+    AP_HEADER_CONTENT_ENCODING,
+    AP_HEADER_CONTENT_LENGTH,
+    AP_HEADER_CONTENT_RANGE,
+    AP_HEADER_CONTENT_TYPE,
+    AP_HEADER_COOKIE,
+    AP_HEADER_EXPECT,
+    AP_HEADER_HOST,
+    AP_HEADER_IF_MATCH,
+    AP_HEADER_IF_MODIFIED_SINCE,
+    AP_HEADER_IF_NONE_MATCH,
+    AP_HEADER_IF_RANGE,
+    AP_HEADER_IF_UNMODIFIED_SINCE,
+    AP_HEADER_MAX_FORWARDS,
+    AP_HEADER_ORIGIN,
+    AP_HEADER_PRAGMA,
+    AP_HEADER_PROXY_AUTHORIZATION,
+    AP_HEADER_RANGE,
+    AP_HEADER_REFERER,
+    AP_HEADER_TE,
+    AP_HEADER_TRANSFER_ENCODING,
+    AP_HEADER_UPGRADE,
+    AP_HEADER_USER_AGENT,
+    AP_HEADER_VIA,
+    AP_HEADER_X_FORWARDED_FOR,
+    AP_HEADER_X_FORWARDED_HOST,
+    AP_HEADER_X_FORWARDED_SERVER,
+    AP_HEADER_MAX               /**< not a header, the number of IDs */
+} ap_header_e;
+
+/**
+ * Get the canonical name of a well-known header field
+ * @param id the header ID
+ * @return the name, e.g. "Content-Length" for AP_HEADER_CONTENT_LENGTH
+ */
+AP_DECLARE(const char *) ap_header_name(ap_header_e id);
+
+/**
+ * Get the value of a well-known field of r->headers_in, as
+ * apr_table_get(r->headers_in, ap_header_name(id)) would.
+ * The first call indexes the well-known fields of the table in one pass,
+ * following calls are constant time as long as the table is not modified
+ * (the index is checked against the table and rebuilt when needed, so
+ * r->headers_in can still be changed or replaced freely).
+ * @param r the current request
+ * @param id the header ID
+ * @return the value of the first such field, or NULL if there is none
+ */
+AP_DECLARE(const char *) ap_get_request_header(request_rec *r,
+                                               ap_header_e id)
+                         AP_FN_ATTR_NONNULL((1));
+
 /**
  * Wrapper for @a apr_password_validate() to cache expensive calculations
  * @param r the current request
@@ -115,6 +115,9 @@ struct worker_score {
     char client[40];            /* Keep 'em small... but large enough to hold an IPv6 address */
     char request[64];           /* We just want an idea... */
     char vhost[32];             /* What virtual host is being accessed? */
+    unsigned long write_count;  /* writes to the network (ExtendedStatus) */
+    unsigned long pool_count;   /* request pools used (ExtendedStatus) */
+    unsigned long pool_reuse_count; /* ...of which were recycled */
 };
 
 typedef struct {
@@ -143,6 +146,8 @@ struct process_score {
     apr_uint32_t keep_alive;        /* async connections in keep alive */
     apr_uint32_t suspended;         /* connections suspended by some module */
     int bucket;             /* Listener bucket used by this child */
+    apr_uint32_t accept_count;      /* connections accepted by this child */
+    apr_uint32_t pool_count;        /* transaction pools it created */
 };
 
 /* Scoreboard is now in 'local' memory, since it isn't updated once created,
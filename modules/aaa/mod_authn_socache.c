@@ -113,14 +113,18 @@ static int authn_cache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         }
     }
 
-    rv = ap_global_mutex_create(&authn_cache_mutex, NULL,
-                                authn_cache_id, NULL, s, pconf, 0);
-    if (rv != APR_SUCCESS) {
-        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(01675)
-                      "failed to create %s mutex", authn_cache_id);
-        return 500; /* An HTTP status would be a misnomer! */
+    /* Providers doing their own locking don't need our mutex */
+    if (socache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&authn_cache_mutex, NULL,
+                                    authn_cache_id, NULL, s, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(01675)
+                          "failed to create %s mutex", authn_cache_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+        apr_pool_cleanup_register(pconf, NULL, remove_lock,
+                                  apr_pool_cleanup_null);
     }
-    apr_pool_cleanup_register(pconf, NULL, remove_lock, apr_pool_cleanup_null);
 
     rv = socache_provider->init(socache_instance, authn_cache_id,
                                 &authn_cache_hints, s, pconf);
@@ -136,7 +140,7 @@ static void authn_cache_child_init(apr_pool_t *p, server_rec *s)
 {
     const char *lock;
     apr_status_t rv;
-    if (!configured) {
+    if (!configured || !authn_cache_mutex) {
         return;       /* don't waste the overhead of creating mutex & cache */
     }
     lock = apr_global_mutex_lockfile(authn_cache_mutex);
@@ -312,18 +316,21 @@ static void ap_authn_cache_store(request_rec *r, const char *module,
     }
 
     /* OK, we're on.  Grab mutex to do our business */
-    rv = apr_global_mutex_trylock(authn_cache_mutex);
-    if (APR_STATUS_IS_EBUSY(rv)) {
-        /* don't wait around; just abandon it */
-        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(01679)
-                      "authn credentials for %s not cached (mutex busy)", user);
-        return;
-    }
-    else if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01680)
-                      "Failed to cache authn credentials for %s in %s",
-                      module, dcfg->context);
-        return;
+    if (authn_cache_mutex) {
+        rv = apr_global_mutex_trylock(authn_cache_mutex);
+        if (APR_STATUS_IS_EBUSY(rv)) {
+            /* don't wait around; just abandon it */
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(01679)
+                          "authn credentials for %s not cached (mutex busy)",
+                          user);
+            return;
+        }
+        else if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01680)
+                          "Failed to cache authn credentials for %s in %s",
+                          module, dcfg->context);
+            return;
+        }
     }
 
     /* We have the mutex, so go ahead */
@@ -347,9 +354,12 @@ static void ap_authn_cache_store(request_rec *r, const char *module,
     }
 
     /* We're done with the mutex */
-    rv = apr_global_mutex_unlock(authn_cache_mutex);
-    if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01683) "Failed to release mutex!");
+    if (authn_cache_mutex) {
+        rv = apr_global_mutex_unlock(authn_cache_mutex);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01683)
+                          "Failed to release mutex!");
+        }
     }
     return;
 }
@@ -26,6 +26,8 @@
 #ifndef CACHE_COMMON_H
 #define CACHE_COMMON_H
 
+#include "apr.h"
+
 /* a cache control header breakdown */
 typedef struct cache_control {
     unsigned int parsed:1;
@@ -52,5 +54,93 @@ typedef struct cache_control {
     apr_int64_t s_maxage_value; /* if positive, then set */
 } cache_control_t;
 
+/*
+ * SipHash-2-4 with its 128 bit output, by Jean-Philippe Aumasson and
+ * Daniel J. Bernstein (public domain), behind ap_cache_hash() and shared
+ * with htcacheclean, which has to name the files of the disk cache the
+ * same way.  Keyed so that whoever does not know the key cannot come up
+ * with cache keys whose names collide.
+ */
+#define CACHE_HASH_KEY_LEN 16
+
+#define CACHE_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define CACHE_SIPROUND(v0, v1, v2, v3) do {                  \
+    v0 += v1; v1 = CACHE_ROTL64(v1, 13); v1 ^= v0;           \
+    v0 = CACHE_ROTL64(v0, 32);                               \
+    v2 += v3; v3 = CACHE_ROTL64(v3, 16); v3 ^= v2;           \
+    v0 += v3; v3 = CACHE_ROTL64(v3, 21); v3 ^= v0;           \
+    v2 += v1; v1 = CACHE_ROTL64(v1, 17); v1 ^= v2;           \
+    v2 = CACHE_ROTL64(v2, 32);                               \
+} while (0)
+
+/* little endian whatever the platform, so that names stay the same */
+static APR_INLINE apr_uint64_t cache_hash_block(const unsigned char *p)
+{
+    return (apr_uint64_t)p[0] | ((apr_uint64_t)p[1] << 8)
+        | ((apr_uint64_t)p[2] << 16) | ((apr_uint64_t)p[3] << 24)
+        | ((apr_uint64_t)p[4] << 32) | ((apr_uint64_t)p[5] << 40)
+        | ((apr_uint64_t)p[6] << 48) | ((apr_uint64_t)p[7] << 56);
+}
+
+static APR_INLINE void cache_hash_siphash(const unsigned char *hkey,
+                                          const char *key, apr_size_t len,
+                                          unsigned char *hash)
+{
+    const unsigned char *data = (const unsigned char *)key;
+    const unsigned char *tail = data + (len & ~(apr_size_t)7);
+    apr_uint64_t k0 = cache_hash_block(hkey);
+    apr_uint64_t k1 = cache_hash_block(hkey + 8);
+    apr_uint64_t v0 = k0 ^ APR_UINT64_C(0x736f6d6570736575);
+    apr_uint64_t v1 = k1 ^ APR_UINT64_C(0x646f72616e646f6d) ^ 0xee;
+    apr_uint64_t v2 = k0 ^ APR_UINT64_C(0x6c7967656e657261);
+    apr_uint64_t v3 = k1 ^ APR_UINT64_C(0x7465646279746573);
+    apr_uint64_t m, h1, h2;
+    int i;
+
+    for (; data < tail; data += 8) {
+        m = cache_hash_block(data);
+        v3 ^= m;
+        CACHE_SIPROUND(v0, v1, v2, v3);
+        CACHE_SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    m = (apr_uint64_t)len << 56;
+    switch (len & 7) {
+    case 7: m |= (apr_uint64_t)tail[6] << 48; /* fall through */
+    case 6: m |= (apr_uint64_t)tail[5] << 40; /* fall through */
+    case 5: m |= (apr_uint64_t)tail[4] << 32; /* fall through */
+    case 4: m |= (apr_uint64_t)tail[3] << 24; /* fall through */
+    case 3: m |= (apr_uint64_t)tail[2] << 16; /* fall through */
+    case 2: m |= (apr_uint64_t)tail[1] << 8;  /* fall through */
+    case 1: m |= (apr_uint64_t)tail[0];
+    }
+    v3 ^= m;
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+
+    v2 ^= 0xee;
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    h1 = v0 ^ v1 ^ v2 ^ v3;
+
+    v1 ^= 0xdd;
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    CACHE_SIPROUND(v0, v1, v2, v3);
+    h2 = v0 ^ v1 ^ v2 ^ v3;
+
+    for (i = 0; i < 8; i++) {
+        hash[i] = (unsigned char)(h1 >> (i * 8));
+        hash[i + 8] = (unsigned char)(h2 >> (i * 8));
+    }
+}
+
+
 #endif /* CACHE_COMMON_H */
 /** @} */
@@ -33,6 +33,35 @@
 #define CACHE_DATA_SUFFIX   ".data"
 #define CACHE_VDIR_SUFFIX   ".vary"
 
+/*
+ * The journal is a text file in the cache root, to which each entity
+ * stored or removed is appended as a single line:
+ *
+ *   + <expire> <response_time> <time> <header size> <data size> <name>
+ *   - <time> <name>
+ *   ~ <expire> <time> <header size> <name>
+ *
+ * where the times are in microseconds, and name is the path of the
+ * entity relative to the cache root, without CACHE_HEADER_SUFFIX or
+ * CACHE_DATA_SUFFIX. The last form is that of a vary header file,
+ * whose variants live in the CACHE_VDIR_SUFFIX directory next to it.
+ *
+ * A record that could not be appended leaves CACHE_JOURNAL_GAP behind,
+ * telling htcacheclean that the journal is incomplete.
+ */
+#define CACHE_JOURNAL_FILE   "cache.journal"
+#define CACHE_JOURNAL_GAP    CACHE_JOURNAL_FILE ".gap"
+#define CACHE_JOURNAL_STORE  '+'
+#define CACHE_JOURNAL_REMOVE '-'
+#define CACHE_JOURNAL_VARY   '~'
+
+/*
+ * The key of the hash naming the files of a cache root, CACHE_HASH_KEY_LEN
+ * random bytes created along with the cache root, and read by htcacheclean
+ * to find the files of an URL.
+ */
+#define CACHE_HASH_KEY_FILE  "cache.key"
+
 #define AP_TEMPFILE_PREFIX "/"
 #define AP_TEMPFILE_BASE   "aptmp"
 #define AP_TEMPFILE_SUFFIX "XXXXXX"
@@ -286,8 +286,10 @@ int cache_select(cache_request_rec *cache, request_rec *r)
                  * is this header in the request and the header in the cached
                  * request identical? If not, we give up and do a straight get
                  */
-                h1 = cache_table_getm(r->pool, r->headers_in, vary);
-                h2 = cache_table_getm(r->pool, h->req_hdrs, vary);
+                h1 = ap_cache_vary_value(r, vary,
+                        cache_table_getm(r->pool, r->headers_in, vary));
+                h2 = ap_cache_vary_value(r, vary,
+                        cache_table_getm(r->pool, h->req_hdrs, vary));
                 if (h1 == h2) {
                     /* both headers NULL, so a match - do nothing */
                 }
@@ -385,9 +387,12 @@ int cache_select(cache_request_rec *cache, request_rec *r)
                         /*
                          * Do not do Range requests with our own conditionals: If
                          * we get 304 the Range does not matter and otherwise the
-                         * entity changed and we want to have the complete entity
+                         * entity changed and we want to have the complete entity.
+                         * A slice is all there is to the entity we cache though.
                          */
-                        apr_table_unset(r->headers_in, "Range");
+                        if (!cache->slice) {
+                            apr_table_unset(r->headers_in, "Range");
+                        }
 
                     }
 
@@ -18,6 +18,13 @@
 
 #include "cache_util.h"
 #include <ap_provider.h>
+#include "ap_mpm.h"
+
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#endif
 
 APLOG_USE_MODULE(cache);
 
@@ -27,6 +34,19 @@ extern APR_OPTIONAL_FN_TYPE(ap_cache_generate_key) *cache_generate_key;
 
 extern module AP_MODULE_DECLARE_DATA cache_module;
 
+#if APR_HAS_THREADS
+/* The cache locks held by the threads of this child, so that the threads
+ * waiting for them are woken up as soon as they are released.
+ */
+static apr_thread_mutex_t *lock_wait_mutex = NULL;
+static apr_thread_cond_t *lock_wait_cond = NULL;
+static apr_hash_t *lock_wait_names = NULL;
+#endif
+
+/* Polling interval bounds of the lock files held by other children */
+#define CACHE_LOCK_POLL_MIN apr_time_from_msec(2)
+#define CACHE_LOCK_POLL_MAX apr_time_from_msec(50)
+
 /* Determine if "url" matches the hostname, scheme and port and path
  * in "filter". All but the path comparisons are case-insensitive.
  */
@@ -236,6 +256,45 @@ CACHE_DECLARE(apr_int64_t) ap_cache_current_age(cache_info *info,
     return apr_time_sec(current_age);
 }
 
+/* The name of the lock file of the request's key, in a simple two level
+ * directory structure under the lock path: lock files represent discrete
+ * just-went-stale URLs "in flight", more is overkill.
+ */
+static const char *cache_lock_name(cache_server_conf *conf,
+        cache_request_rec *cache, request_rec *r)
+{
+    const char *lockname;
+    char dir[5];
+
+    /* create the key if it doesn't exist */
+    if (!cache->key) {
+        cache_generate_key(r, r->pool, &cache->key);
+    }
+
+    /* create a hashed filename from the key */
+    lockname = ap_cache_generate_name(r->pool, 0, 0, cache->key);
+
+    dir[0] = '/';
+    dir[1] = lockname[0];
+    dir[2] = '/';
+    dir[3] = lockname[1];
+    dir[4] = 0;
+
+    return apr_pstrcat(r->pool, conf->lockpath, dir, "/", lockname, NULL);
+}
+
+#if APR_HAS_THREADS
+static apr_status_t cache_lock_release(void *data)
+{
+    apr_thread_mutex_lock(lock_wait_mutex);
+    apr_hash_set(lock_wait_names, data, APR_HASH_KEY_STRING, NULL);
+    apr_thread_cond_broadcast(lock_wait_cond);
+    apr_thread_mutex_unlock(lock_wait_mutex);
+
+    return APR_SUCCESS;
+}
+#endif
+
 /**
  * Try obtain a cache wide lock on the given cache key.
  *
@@ -263,7 +322,6 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
     apr_status_t status;
     const char *lockname;
     const char *path;
-    char dir[5];
     apr_time_t now = apr_time_now();
     apr_finfo_t finfo;
     apr_file_t *lockfile;
@@ -276,6 +334,11 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
         return APR_SUCCESS;
     }
 
+    /* a revalidation runs under its main request's lock */
+    if (cache->revalidation) {
+        return APR_SUCCESS;
+    }
+
     /* lock already obtained earlier? if so, success */
     apr_pool_userdata_get(&dummy, CACHE_LOCKFILE_KEY, r->pool);
     if (dummy) {
@@ -300,25 +363,13 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
             (h->cache_obj->key != NULL)) {
             cache->key = apr_pstrdup(r->pool, h->cache_obj->key);
         }
-        else {
-            cache_generate_key(r, r->pool, &cache->key);
-        }
     }
 
     /* create a hashed filename from the key, and save it for later */
-    lockname = ap_cache_generate_name(r->pool, 0, 0, cache->key);
-
-    /* lock files represent discrete just-went-stale URLs "in flight", so
-     * we support a simple two level directory structure, more is overkill.
-     */
-    dir[0] = '/';
-    dir[1] = lockname[0];
-    dir[2] = '/';
-    dir[3] = lockname[1];
-    dir[4] = 0;
+    lockname = cache_lock_name(conf, cache, r);
 
     /* make the directories */
-    path = apr_pstrcat(r->pool, conf->lockpath, dir, NULL);
+    path = ap_make_dirstr_parent(r->pool, lockname);
     if (APR_SUCCESS != (status = apr_dir_make_recursive(path,
             APR_UREAD|APR_UWRITE|APR_UEXECUTE, r->pool))) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00778)
@@ -326,7 +377,6 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
                 path);
         return status;
     }
-    lockname = apr_pstrcat(r->pool, path, "/", lockname, NULL);
     apr_pool_userdata_set(lockname, CACHE_LOCKNAME_KEY, NULL, r->pool);
 
     /* is an existing lock file too old? */
@@ -351,6 +401,17 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
             APR_WRITE | APR_CREATE | APR_EXCL | APR_DELONCLOSE,
             APR_UREAD | APR_UWRITE, r->pool))) {
         apr_pool_userdata_set(lockfile, CACHE_LOCKFILE_KEY, NULL, r->pool);
+#if APR_HAS_THREADS
+        /* let the threads of this child waiting for it know when it's done */
+        if (lock_wait_mutex) {
+            apr_thread_mutex_lock(lock_wait_mutex);
+            apr_hash_set(lock_wait_names, lockname, APR_HASH_KEY_STRING,
+                         lockname);
+            apr_thread_mutex_unlock(lock_wait_mutex);
+            apr_pool_cleanup_register(r->pool, lockname, cache_lock_release,
+                                      apr_pool_cleanup_null);
+        }
+#endif
     }
     return status;
 
@@ -378,6 +439,10 @@ apr_status_t cache_remove_lock(cache_server_conf *conf,
         /* no locks configured, leave */
         return APR_SUCCESS;
     }
+    if (cache->revalidation) {
+        /* the lock is the main request's to remove */
+        return APR_SUCCESS;
+    }
     if (bb) {
         apr_bucket *e;
         int eos_found = 0;
@@ -399,33 +464,119 @@ apr_status_t cache_remove_lock(cache_server_conf *conf,
     }
     apr_pool_userdata_get(&dummy, CACHE_LOCKFILE_KEY, r->pool);
     if (dummy) {
-        return apr_file_close((apr_file_t *)dummy);
+        apr_file_t *lockfile = (apr_file_t *)dummy;
+#if APR_HAS_THREADS
+        if (lock_wait_mutex) {
+            apr_pool_userdata_get(&dummy, CACHE_LOCKNAME_KEY, r->pool);
+            apr_pool_cleanup_run(r->pool, dummy, cache_lock_release);
+        }
+#endif
+        return apr_file_close(lockfile);
     }
     apr_pool_userdata_get(&dummy, CACHE_LOCKNAME_KEY, r->pool);
     lockname = (const char *)dummy;
     if (!lockname) {
-        char dir[5];
+        lockname = cache_lock_name(conf, cache, r);
+    }
+    return apr_file_remove(lockname, r->pool);
+}
 
-        /* create the key if it doesn't exist */
-        if (!cache->key) {
-            cache_generate_key(r, r->pool, &cache->key);
-        }
+apr_status_t cache_wait_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r)
+{
+    apr_status_t status;
+    const char *lockname;
+    apr_finfo_t finfo;
+    apr_time_t now, deadline, interval;
 
-        /* create a hashed filename from the key, and save it for later */
-        lockname = ap_cache_generate_name(r->pool, 0, 0, cache->key);
+    if (!conf || !conf->lock || !conf->lockpath || !conf->lockwait) {
+        /* no waiting configured, leave */
+        return APR_NOTFOUND;
+    }
 
-        /* lock files represent discrete just-went-stale URLs "in flight", so
-         * we support a simple two level directory structure, more is overkill.
-         */
-        dir[0] = '/';
-        dir[1] = lockname[0];
-        dir[2] = '/';
-        dir[3] = lockname[1];
-        dir[4] = 0;
+    /* the client wants it from the backend anyway */
+    if (cache->control_in.no_cache && !conf->ignorecachecontrol) {
+        return APR_NOTFOUND;
+    }
 
-        lockname = apr_pstrcat(r->pool, conf->lockpath, dir, "/", lockname, NULL);
+    /* the lock is our main request's, which waits for us */
+    if (cache->revalidation) {
+        return APR_NOTFOUND;
     }
-    return apr_file_remove(lockname, r->pool);
+
+    lockname = cache_lock_name(conf, cache, r);
+    now = apr_time_now();
+    deadline = now + (conf->lockwait < conf->lockmaxage ? conf->lockwait
+                                                        : conf->lockmaxage);
+
+#if APR_HAS_THREADS
+    /* held by this child? wait to be told */
+    if (lock_wait_mutex) {
+        apr_thread_mutex_lock(lock_wait_mutex);
+        if (apr_hash_get(lock_wait_names, lockname, APR_HASH_KEY_STRING)) {
+            while (apr_hash_get(lock_wait_names, lockname, APR_HASH_KEY_STRING)
+                   && (now = apr_time_now()) < deadline) {
+                apr_thread_cond_timedwait(lock_wait_cond, lock_wait_mutex,
+                                          deadline - now);
+            }
+            status = apr_hash_get(lock_wait_names, lockname,
+                                  APR_HASH_KEY_STRING) ? APR_TIMEUP
+                                                       : APR_SUCCESS;
+            apr_thread_mutex_unlock(lock_wait_mutex);
+            return status;
+        }
+        apr_thread_mutex_unlock(lock_wait_mutex);
+    }
+#endif
+
+    /* held by another child? poll the lock file until it goes away */
+    status = apr_stat(&finfo, lockname, APR_FINFO_MTIME, r->pool);
+    if (status != APR_SUCCESS) {
+        return APR_NOTFOUND;
+    }
+    if ((now - finfo.mtime) > conf->lockmaxage || now < finfo.mtime) {
+        /* too old, it's about to be removed */
+        return APR_NOTFOUND;
+    }
+    interval = CACHE_LOCK_POLL_MIN;
+    while ((now = apr_time_now()) < deadline) {
+        apr_sleep(interval < deadline - now ? interval : deadline - now);
+        status = apr_stat(&finfo, lockname, APR_FINFO_MTIME, r->pool);
+        if (APR_STATUS_IS_ENOENT(status)) {
+            return APR_SUCCESS;
+        }
+        if (status != APR_SUCCESS) {
+            return status;
+        }
+        if (interval < CACHE_LOCK_POLL_MAX) {
+            interval *= 2;
+        }
+    }
+    return APR_TIMEUP;
+}
+
+void cache_lock_child_init(apr_pool_t *p)
+{
+#if APR_HAS_THREADS
+    apr_pool_t *pool;
+    int threaded;
+
+    if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded) != APR_SUCCESS
+            || !threaded) {
+        return;
+    }
+
+    /* the names are only allocated with the mutex held */
+    apr_pool_create(&pool, p);
+    apr_pool_tag(pool, "cache_lock_wait");
+    if (apr_thread_mutex_create(&lock_wait_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                pool) != APR_SUCCESS
+            || apr_thread_cond_create(&lock_wait_cond, pool) != APR_SUCCESS) {
+        lock_wait_mutex = NULL;
+        return;
+    }
+    lock_wait_names = apr_hash_make(pool);
+#endif
 }
 
 int ap_cache_check_no_cache(cache_request_rec *cache, request_rec *r)
@@ -511,6 +662,33 @@ int ap_cache_check_no_store(cache_request_rec *cache, request_rec *r)
     return 1;
 }
 
+/*
+ * The stale-while-revalidate window of a cached response in seconds, as
+ * per RFC5861, or -1 if it has none.
+ */
+static apr_int64_t cache_stale_while_revalidate(cache_handle_t *h,
+        request_rec *r)
+{
+    const char *cc, *token;
+    char *last;
+
+    cc = cache_table_getm(r->pool, h->resp_hdrs, "Cache-Control");
+    if (!cc) {
+        return -1;
+    }
+
+    token = cache_strqtok(apr_pstrdup(r->pool, cc), CACHE_SEPARATOR, &last);
+    while (token) {
+        if (!strncasecmp(token, "stale-while-revalidate", 22)
+                && token[22] == '=' && apr_isdigit(token[23])) {
+            return apr_atoi64(token + 23);
+        }
+        token = cache_strqtok(NULL, CACHE_SEPARATOR, &last);
+    }
+
+    return -1;
+}
+
 int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         request_rec *r)
 {
@@ -526,6 +704,8 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
     cache_server_conf *conf =
       (cache_server_conf *)ap_get_module_config(r->server->module_config,
                                                 &cache_module);
+    cache_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
+                                                 &cache_module);
 
     /*
      * We now want to check if our cached data is still fresh. This depends
@@ -562,11 +742,16 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
      */
 
     /* This value comes from the client's initial request. */
-    cc_req = apr_table_get(r->headers_in, "Cache-Control");
-    pragma = apr_table_get(r->headers_in, "Pragma");
+    cc_req = ap_get_request_header(r, AP_HEADER_CACHE_CONTROL);
+    pragma = ap_get_request_header(r, AP_HEADER_PRAGMA);
 
     ap_cache_control(r, &cache->control_in, cc_req, pragma, r->headers_in);
 
+    /* We are here to revalidate the entity, whatever its freshness */
+    if (cache->revalidation) {
+        return 0;
+    }
+
     if (cache->control_in.no_cache) {
 
         if (!conf->ignorecachecontrol) {
@@ -745,6 +930,39 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
      * request gets to make a new lock and try again.
      */
     status = cache_try_lock(conf, cache, r);
+    if (APR_SUCCESS == status && dconf->stale_while_revalidate && !r->main
+            && r->proxyreq != PROXYREQ_PROXY
+            && !h->cache_obj->info.control.must_revalidate
+            && !h->cache_obj->info.control.proxy_revalidate) {
+        apr_int64_t swr = cache_stale_while_revalidate(h, r);
+        apr_int64_t lifetime = maxage;
+
+        if (lifetime == -1 && info->expire != APR_DATE_BAD) {
+            lifetime = apr_time_sec(info->expire - info->date);
+        }
+
+        /*
+         * RFC5861: within its stale-while-revalidate window the stale
+         * entity goes to the client straight away, and the request
+         * that holds the lock revalidates it once it has been sent.
+         */
+        if (swr >= 0 && lifetime != -1 && age < lifetime + swr) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02877)
+                    "Cache lock obtained for stale cached URL, serving it "
+                    "and revalidating it after the response: %s",
+                    r->unparsed_uri);
+
+            warn_head = apr_table_get(h->resp_hdrs, "Warning");
+            if ((warn_head == NULL) ||
+                ((warn_head != NULL) && (ap_strstr_c(warn_head, "110") == NULL))) {
+                apr_table_mergen(h->resp_hdrs, "Warning",
+                                 "110 Response is stale");
+            }
+
+            cache->revalidate = 1;
+            return 1;
+        }
+    }
     if (APR_SUCCESS == status) {
         /* we obtained a lock, follow the stale path */
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00782)
@@ -848,19 +1066,48 @@ CACHE_DECLARE(void) ap_cache_usec2hex(apr_time_t j, char *y)
     y[sizeof(j) * 2] = '\0';
 }
 
-static void cache_hash(const char *it, char *val, int ndepth, int nlength)
+/* The key of the hash for callers without one, see cache_hash_key_init() */
+static const unsigned char *cache_hash_key = NULL;
+
+apr_status_t cache_hash_key_init(void)
+{
+    void *key = ap_retained_data_get(CACHE_HASH_KEY);
+
+    if (key == NULL) {
+        apr_status_t rv;
+
+        key = ap_retained_data_create(CACHE_HASH_KEY, CACHE_HASH_KEY_LEN);
+#if APR_HAS_RANDOM
+        rv = apr_generate_random_bytes(key, CACHE_HASH_KEY_LEN);
+#else
+#error APR random number support is missing
+#endif
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+    cache_hash_key = key;
+    return APR_SUCCESS;
+}
+
+CACHE_DECLARE(void) ap_cache_hash(const unsigned char *hkey,
+                                  const char *key, apr_size_t len,
+                                  unsigned char *hash)
+{
+    cache_hash_siphash(hkey ? hkey : cache_hash_key, key, len, hash);
+}
+
+static void cache_hash(const unsigned char *hkey, const char *it, char *val,
+                       int ndepth, int nlength)
 {
-    apr_md5_ctx_t context;
-    unsigned char digest[16];
+    unsigned char digest[CACHE_HASH_LEN];
     char tmp[22];
     int i, k, d;
     unsigned int x;
     static const char enc_table[64] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_@";
 
-    apr_md5_init(&context);
-    apr_md5_update(&context, (const unsigned char *) it, strlen(it));
-    apr_md5_final(digest, &context);
+    ap_cache_hash(hkey, it, strlen(it), digest);
 
     /* encode 128 bits as 22 characters, using a modified uuencoding
      * the encoding is 3 bytes -> 4 characters* i.e. 128 bits is
@@ -890,14 +1137,23 @@ static void cache_hash(const char *it, char *val, int ndepth, int nlength)
     val[i + 22 - k] = '\0';
 }
 
-CACHE_DECLARE(char *)ap_cache_generate_name(apr_pool_t *p, int dirlevels,
-                                            int dirlength, const char *name)
+CACHE_DECLARE(char *)ap_cache_generate_keyed_name(apr_pool_t *p,
+                                                  const unsigned char *hkey,
+                                                  int dirlevels,
+                                                  int dirlength,
+                                                  const char *name)
 {
     char hashfile[66];
-    cache_hash(name, hashfile, dirlevels, dirlength);
+    cache_hash(hkey, name, hashfile, dirlevels, dirlength);
     return apr_pstrdup(p, hashfile);
 }
 
+CACHE_DECLARE(char *)ap_cache_generate_name(apr_pool_t *p, int dirlevels,
+                                            int dirlength, const char *name)
+{
+    return ap_cache_generate_keyed_name(p, NULL, dirlevels, dirlength, name);
+}
+
 /**
  * String tokenizer that ignores separator characters within quoted strings
  * and escaped characters, as per RFC2616 section 2.2.
@@ -1266,6 +1522,79 @@ CACHE_DECLARE(apr_table_t *)ap_cache_cacheable_headers_out(request_rec *r)
     return headers_out;
 }
 
+/*
+ * Is this subrequest fetching a slice of a large entity for its main
+ * request?
+ */
+CACHE_DECLARE(int) ap_cache_is_slice(request_rec *r)
+{
+    void *ctx = NULL;
+
+    if (r->main) {
+        apr_pool_userdata_get(&ctx, CACHE_SLICE_KEY, r->main->pool);
+    }
+    return ctx != NULL;
+}
+
+/*
+ * The value a variant is keyed on for the given request header. With
+ * CacheEncodingVariants, Accept-Encoding collapses to "gzip" when the
+ * client takes gzip, and to "identity" otherwise, so that only those two
+ * variants get cached however browsers spell the header. Normalizing an
+ * already normalized value returns it unchanged.
+ */
+CACHE_DECLARE(const char *) ap_cache_vary_value(request_rec *r,
+                                                const char *name,
+                                                const char *value)
+{
+    cache_server_conf *conf;
+    const char *list;
+    char *item, *param;
+
+    if (strcasecmp(name, "Accept-Encoding")) {
+        return value;
+    }
+    conf = ap_get_module_config(r->server->module_config, &cache_module);
+    if (!conf->encoding_variants) {
+        return value;
+    }
+
+    /* ap_get_list_item() lowercases the items and removes the whitespace
+     * around their ';' and '=', mod_deflate's "*" is not taken for gzip.
+     */
+    list = value ? value : "";
+    while ((item = ap_get_list_item(r->pool, &list)) != NULL) {
+        param = strchr(item, ';');
+        if (param) {
+            *param++ = '\0';
+        }
+        if (strcmp(item, "gzip") && strcmp(item, "x-gzip")) {
+            continue;
+        }
+        while (param) {
+            char *next = strchr(param, ';');
+            if (next) {
+                *next++ = '\0';
+            }
+            if (param[0] == 'q' && param[1] == '=') {
+                const char *q = param + 2;
+                if (*q++ == '0' && (!*q || *q++ == '.')) {
+                    q += strspn(q, "0");
+                    if (!*q) {
+                        break;
+                    }
+                }
+            }
+            param = next;
+        }
+        if (!param) {
+            return "gzip";
+        }
+    }
+
+    return "identity";
+}
+
 apr_table_t *cache_merge_headers_out(request_rec *r)
 {
     apr_table_t *headers_out;
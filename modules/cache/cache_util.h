@@ -95,10 +95,14 @@ extern "C" {
 #define DEFAULT_X_CACHE         0
 #define DEFAULT_X_CACHE_DETAIL  0
 #define DEFAULT_CACHE_STALE_ON_ERROR 1
+#define DEFAULT_CACHE_STALE_WHILE_REVALIDATE 0
 #define DEFAULT_CACHE_LOCKPATH "mod_cache-lock"
 #define CACHE_LOCKNAME_KEY "mod_cache-lockname"
 #define CACHE_LOCKFILE_KEY "mod_cache-lockfile"
 #define CACHE_CTX_KEY "mod_cache-ctx"
+#define CACHE_REVALIDATION_KEY "mod_cache-revalidation"
+#define CACHE_SLICE_KEY "mod_cache-slice"
+#define CACHE_HASH_KEY "mod_cache-hash-key"
 #define CACHE_SEPARATOR ",   "
 
 /**
@@ -126,7 +130,12 @@ typedef struct {
     apr_array_header_t *ignore_session_id;
     const char *lockpath;
     apr_time_t lockmaxage;
+    apr_time_t lockwait;
     apr_uri_t *base_uri;
+    /** size of the slices ranges of large entities are cached in, or 0 */
+    apr_off_t slice_size;
+    /** key Accept-Encoding variants on gzip or identity only */
+    unsigned int encoding_variants:1;
     /** ignore client's requests for uncached responses */
     unsigned int ignorecachecontrol:1;
     /** ignore query-string when caching */
@@ -152,8 +161,11 @@ typedef struct {
     unsigned int lock_set:1;
     unsigned int lockpath_set:1;
     unsigned int lockmaxage_set:1;
+    unsigned int lockwait_set:1;
     unsigned int x_cache_set:1;
     unsigned int x_cache_detail_set:1;
+    unsigned int slice_size_set:1;
+    unsigned int encoding_variants_set:1;
 } cache_server_conf;
 
 typedef struct {
@@ -174,6 +186,8 @@ typedef struct {
     unsigned int x_cache_detail:1;
     /* serve stale on error */
     unsigned int stale_on_error:1;
+    /* serve stale, then revalidate after the response */
+    unsigned int stale_while_revalidate:1;
     /** ignore the last-modified header when deciding to cache this request */
     unsigned int no_last_mod_ignore:1;
     /** ignore expiration date from server */
@@ -189,6 +203,7 @@ typedef struct {
     unsigned int x_cache_set:1;
     unsigned int x_cache_detail_set:1;
     unsigned int stale_on_error_set:1;
+    unsigned int stale_while_revalidate_set:1;
     unsigned int no_last_mod_ignore_set:1;
     unsigned int store_expired_set:1;
     unsigned int store_private_set:1;
@@ -230,6 +245,13 @@ typedef struct {
     apr_off_t size;                     /* the content length from the headers, or -1 */
     apr_bucket_brigade *out;            /* brigade to reuse for upstream responses */
     cache_control_t control_in;         /* cache control incoming */
+    unsigned int revalidate:1;          /* stale entity served, revalidate
+                                         * it once the response is sent
+                                         */
+    unsigned int revalidation:1;        /* we are that revalidation */
+    unsigned int slice:1;               /* we fetch a slice of the entity
+                                         * for the main request
+                                         */
 } cache_request_rec;
 
 /**
@@ -299,6 +321,33 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
 apr_status_t cache_remove_lock(cache_server_conf *conf,
         cache_request_rec *cache, request_rec *r, apr_bucket_brigade *bb);
 
+/**
+ * Wait for the request holding the cache lock on the given cache key to
+ * be done with it, so that a cold miss can be served from what that
+ * request cached rather than going to the backend too.
+ *
+ * Requests of this child are woken up as soon as the lock is released,
+ * the lock file of a request of another child is polled.
+ *
+ * If we return APR_SUCCESS, the lock was released and the cache should be
+ * looked up again. If we return APR_NOTFOUND, there was no lock to wait
+ * for (or CacheLockWait is not set), and APR_TIMEUP if the lock was still
+ * held after CacheLockWait.
+ */
+apr_status_t cache_wait_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r);
+
+/**
+ * Set up the wait for the cache locks taken by the threads of this child.
+ */
+void cache_lock_child_init(apr_pool_t *p);
+
+/**
+ * Draw the key ap_cache_hash() uses when given none, once for the
+ * lifetime of the server, restarts included.
+ */
+apr_status_t cache_hash_key_init(void);
+
 cache_provider_list *cache_get_providers(request_rec *r,
         cache_server_conf *conf, apr_uri_t uri);
 
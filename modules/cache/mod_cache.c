@@ -21,6 +21,7 @@
 
 module AP_MODULE_DECLARE_DATA cache_module;
 APR_OPTIONAL_FN_TYPE(ap_cache_generate_key) *cache_generate_key;
+static APR_OPTIONAL_FN_TYPE(ap_cache_generate_key) *cache_generate_entity_key;
 
 /* -------------------------------------------------------------- */
 
@@ -35,6 +36,29 @@ static ap_filter_rec_t *cache_out_filter_handle;
 static ap_filter_rec_t *cache_out_subreq_filter_handle;
 static ap_filter_rec_t *cache_remove_url_filter_handle;
 static ap_filter_rec_t *cache_invalidate_filter_handle;
+static ap_filter_rec_t *cache_discard_filter_handle;
+static ap_filter_rec_t *cache_slice_filter_handle;
+static ap_filter_rec_t *cache_deflate_filter_handle;
+
+/* A range of an entity served from slices, see cache_slice() */
+typedef struct cache_slice_ctx {
+    request_rec *r;             /* the main request */
+    request_rec *rr;            /* the subrequest for the current slice */
+    apr_bucket_brigade *bb;
+    apr_off_t size;             /* of each slice */
+    apr_off_t slice;            /* the current slice */
+    apr_off_t start;            /* first byte of the range */
+    apr_off_t end;              /* last byte of the range, or -1 */
+    apr_off_t last;             /* last byte of the current slice */
+    apr_off_t offset;           /* of the next byte of the current slice */
+    apr_off_t length;           /* of the entity, or -1 */
+    const char *etag;           /* validators of the first slice, all */
+    const char *lastmod;        /* others must be of the same entity */
+    int status;                 /* of the response, once known */
+    unsigned int seen:1;        /* the current slice has been checked */
+    unsigned int whole:1;       /* the whole entity came along */
+    unsigned int failed:1;      /* the current slice does not fit */
+} cache_slice_ctx;
 
 /**
  * Entity headers' names
@@ -52,6 +76,446 @@ static const char *MOD_CACHE_ENTITY_HEADERS[] = {
     NULL
 };
 
+/**
+ * Throw away the response of a revalidation, once the
+ * CACHE_SAVE filter has seen it.
+ */
+static apr_status_t cache_discard_filter(ap_filter_t *f, apr_bucket_brigade *in)
+{
+    apr_brigade_cleanup(in);
+    return APR_SUCCESS;
+}
+
+/**
+ * Revalidate a stale entity that was just served to the client within
+ * its RFC5861 stale-while-revalidate window.
+ *
+ * This is not done in the background: it runs synchronously on the
+ * worker of the request. The stale response is sent with keep-alive off
+ * so that no further request of the connection waits for it; only the
+ * worker is tied up until the backend has answered.
+ *
+ * Once the stale response has been flushed to the client, a GET
+ * subrequest for the same URL is run. It bypasses the freshness check
+ * and goes to the backend with the conditionals of the stale entity, so
+ * that the CACHE_SAVE filter updates or replaces the entity as for any
+ * other revalidation. Its response ends up in the CACHE_DISCARD filter
+ * rather than on the wire. The subrequest runs under the cache lock of
+ * this request, which is only given up once it is done.
+ */
+static void cache_revalidate(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r)
+{
+    request_rec *rr;
+    ap_filter_t *discard;
+    apr_bucket_brigade *bb;
+
+    if (r->unparsed_uri && r->unparsed_uri[0] == '/') {
+
+        /* don't keep the client waiting for the tail of the response */
+        bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(bb->bucket_alloc));
+        ap_pass_brigade(r->connection->output_filters, bb);
+
+        discard = apr_pcalloc(r->pool, sizeof(ap_filter_t));
+        discard->frec = cache_discard_filter_handle;
+        discard->r = r;
+        discard->c = r->connection;
+
+        apr_pool_userdata_setn(cache, CACHE_REVALIDATION_KEY, NULL, r->pool);
+
+        rr = ap_sub_req_method_uri("GET", r->unparsed_uri, r, discard);
+
+        /* the client's own conditionals are of no concern to us */
+        apr_table_unset(rr->headers_in, "If-Match");
+        apr_table_unset(rr->headers_in, "If-Modified-Since");
+        apr_table_unset(rr->headers_in, "If-None-Match");
+        apr_table_unset(rr->headers_in, "If-Range");
+        apr_table_unset(rr->headers_in, "If-Unmodified-Since");
+        apr_table_unset(rr->headers_in, "Range");
+
+        if (rr->status == HTTP_OK) {
+            ap_run_sub_req(rr);
+        }
+
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02878)
+                "cache: revalidation of %s returned %d",
+                r->uri, rr->status);
+
+        ap_destroy_sub_req(rr);
+        apr_pool_userdata_setn(NULL, CACHE_REVALIDATION_KEY, NULL, r->pool);
+    }
+
+    cache_remove_lock(conf, cache, r, NULL);
+}
+
+/**
+ * The key of a slice is the key of the entity, with the range of the
+ * slice appended: slices get cached as entities of their own.
+ */
+static apr_status_t cache_generate_slice_key(request_rec *r, apr_pool_t *p,
+        const char **key)
+{
+    cache_slice_ctx *ctx = NULL;
+    apr_status_t rv;
+
+    rv = cache_generate_entity_key(r, p, key);
+    if (rv == APR_SUCCESS && r->main) {
+        apr_pool_userdata_get((void **)&ctx, CACHE_SLICE_KEY, r->main->pool);
+        if (ctx) {
+            *key = apr_psprintf(p, "%s#bytes=%" APR_OFF_T_FMT "-%"
+                                APR_OFF_T_FMT, *key, ctx->slice * ctx->size,
+                                (ctx->slice + 1) * ctx->size - 1);
+        }
+    }
+    return rv;
+}
+
+/**
+ * Check the response for the current slice against the range asked for,
+ * and against the slices before it. The first slice that fits sets up
+ * the response of the main request.
+ */
+static void cache_slice_start(cache_slice_ctx *ctx, int status)
+{
+    request_rec *r = ctx->r, *rr = ctx->rr;
+    const char *range, *etag, *lastmod;
+    apr_off_t first, length = -1;
+    char *end;
+
+    ctx->seen = 1;
+
+    if (status == HTTP_PARTIAL_CONTENT) {
+        range = apr_table_get(rr->headers_out, "Content-Range");
+        if (!range || strncasecmp(range, "bytes ", 6)
+                || apr_strtoff(&first, range + 6, &end, 10) || *end != '-'
+                || apr_strtoff(&ctx->last, end + 1, &end, 10) || *end != '/'
+                || apr_strtoff(&length, end + 1, &end, 10) || *end
+                || first != ctx->slice * ctx->size || ctx->last >= length
+                || (ctx->last != (ctx->slice + 1) * ctx->size - 1
+                    && ctx->last != length - 1)) {
+            /* not the slice we asked for, or of unknown length */
+            ctx->failed = 1;
+            return;
+        }
+        ctx->offset = first;
+    }
+    else if (status == HTTP_OK) {
+        /* the backend ignored the Range, the whole entity is coming */
+        range = apr_table_get(rr->headers_out, "Content-Length");
+        if (range && (apr_strtoff(&length, range, &end, 10) || *end
+                      || length < 0)) {
+            ctx->failed = 1;
+            return;
+        }
+        ctx->offset = 0;
+        ctx->whole = 1;
+    }
+    else {
+        ctx->failed = 1;
+        return;
+    }
+
+    etag = apr_table_get(rr->headers_out, "ETag");
+    lastmod = apr_table_get(rr->headers_out, "Last-Modified");
+
+    if (ctx->status) {
+        /* a later slice must be of the very same entity */
+        if (length != ctx->length
+                || (ctx->etag && (!etag || strcmp(etag, ctx->etag)))
+                || (!ctx->etag && ctx->lastmod
+                    && (!lastmod || strcmp(lastmod, ctx->lastmod)))) {
+            ctx->failed = 1;
+        }
+        return;
+    }
+
+    ctx->etag = etag;
+    ctx->lastmod = lastmod;
+    ctx->length = length;
+
+    r->headers_out = apr_table_overlay(r->pool, rr->headers_out,
+                                       rr->err_headers_out);
+    apr_table_unset(r->headers_out, "Content-Range");
+    apr_table_unset(r->headers_out, "Content-Length");
+    if (rr->content_type) {
+        ap_set_content_type(r, rr->content_type);
+    }
+    r->content_encoding = rr->content_encoding;
+    r->content_languages = rr->content_languages;
+
+    if (length < 0) {
+        /* no way to tell the range, hand out the entity as it is */
+        ctx->start = 0;
+        ctx->end = -1;
+        ctx->status = r->status = HTTP_OK;
+        return;
+    }
+
+    if (ctx->end < 0 || ctx->end >= length) {
+        ctx->end = length - 1;
+    }
+    if (ctx->start > ctx->end) {
+        ctx->status = r->status = HTTP_RANGE_NOT_SATISFIABLE;
+        apr_table_setn(r->headers_out, "Content-Range",
+                       apr_psprintf(r->pool, "bytes */%" APR_OFF_T_FMT,
+                                    length));
+        ap_set_content_length(r, 0);
+        return;
+    }
+
+    ctx->status = r->status = HTTP_PARTIAL_CONTENT;
+    apr_table_setn(r->headers_out, "Content-Range",
+                   apr_psprintf(r->pool, "bytes %" APR_OFF_T_FMT "-%"
+                                APR_OFF_T_FMT "/%" APR_OFF_T_FMT,
+                                ctx->start, ctx->end, length));
+    ap_set_content_length(r, ctx->end - ctx->start + 1);
+}
+
+/**
+ * Pass the part of each slice that lies within the range asked for on
+ * to the main request. The content filters of the subrequests have been
+ * at the slices already, so they go straight to the protocol filters.
+ */
+static apr_status_t cache_slice_filter(ap_filter_t *f, apr_bucket_brigade *in)
+{
+    cache_slice_ctx *ctx = f->ctx;
+    apr_bucket *e, *next;
+    apr_off_t from, to;
+    apr_status_t rv;
+
+    if (!ctx->seen) {
+        cache_slice_start(ctx, ctx->rr->status);
+    }
+    if (ctx->failed) {
+        apr_brigade_cleanup(in);
+        return APR_SUCCESS;
+    }
+
+    for (e = APR_BRIGADE_FIRST(in); e != APR_BRIGADE_SENTINEL(in); e = next) {
+        next = APR_BUCKET_NEXT(e);
+
+        if (APR_BUCKET_IS_METADATA(e)) {
+            if (APR_BUCKET_IS_FLUSH(e)) {
+                APR_BUCKET_REMOVE(e);
+                APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+            }
+            else {
+                apr_bucket_delete(e);
+            }
+            continue;
+        }
+
+        if (e->length == (apr_size_t)-1) {
+            const char *data;
+            apr_size_t len;
+
+            rv = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                apr_brigade_cleanup(in);
+                return rv;
+            }
+            next = APR_BUCKET_NEXT(e);
+        }
+
+        from = ctx->offset;
+        to = ctx->offset + e->length;
+        ctx->offset = to;
+
+        if (to <= ctx->start || (ctx->end >= 0 && from > ctx->end)) {
+            apr_bucket_delete(e);
+            continue;
+        }
+        if (from < ctx->start) {
+            apr_bucket_split(e, ctx->start - from);
+            next = APR_BUCKET_NEXT(e);
+            apr_bucket_delete(e);
+            e = next;
+            next = APR_BUCKET_NEXT(e);
+            from = ctx->start;
+        }
+        if (ctx->end >= 0 && to > ctx->end + 1) {
+            apr_bucket_split(e, ctx->end + 1 - from);
+            apr_bucket_delete(APR_BUCKET_NEXT(e));
+            next = APR_BUCKET_NEXT(e);
+        }
+
+        /* the subrequest is destroyed before the core output filter is
+         * done with what it set aside, so nothing may point into the
+         * subrequest pool or a cache entry pinned by it: files move to
+         * the main request, anything but the heap is copied
+         */
+        if (APR_BUCKET_IS_FILE(e)) {
+            rv = apr_bucket_setaside(e, ctx->r->pool);
+        }
+        else if (!APR_BUCKET_IS_HEAP(e)) {
+            const char *data;
+            apr_size_t len;
+            apr_bucket *copy;
+
+            rv = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
+            if (rv == APR_SUCCESS) {
+                copy = apr_bucket_heap_create(data, len, NULL, e->list);
+                APR_BUCKET_INSERT_BEFORE(e, copy);
+                apr_bucket_delete(e);
+                e = copy;
+            }
+        }
+        else {
+            rv = APR_SUCCESS;
+        }
+        if (rv != APR_SUCCESS) {
+            apr_brigade_cleanup(in);
+            return rv;
+        }
+
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+    }
+
+    if (APR_BRIGADE_EMPTY(ctx->bb)) {
+        return APR_SUCCESS;
+    }
+    rv = ap_pass_brigade(ctx->r->proto_output_filters, ctx->bb);
+    apr_brigade_cleanup(ctx->bb);
+    return rv;
+}
+
+/**
+ * Serve a single range of a large entity from slices, when the entity
+ * is not cached as a whole.
+ *
+ * The range is fetched as a run of GET subrequests, one for each slice
+ * of CacheSliceSize bytes it overlaps. Each subrequest asks the backend
+ * for its slice only, and caches the 206 Partial Content response under
+ * a key of its own, so that a client asking for a few megabytes of a
+ * large video does not have the cache fetch and store all of it first,
+ * and later clients asking for other ranges find whatever slices are
+ * cached already. The CACHE_SLICE filter glues the slices together,
+ * trimmed to the range asked for.
+ *
+ * Slices are checked against each other by length and ETag or
+ * Last-Modified. Should the first slice not fit, the request takes its
+ * usual course; should a later one not fit, the response is aborted.
+ */
+static int cache_slice(cache_server_conf *conf, request_rec *r)
+{
+    cache_slice_ctx *ctx;
+    request_rec *rr;
+    ap_filter_t *slice;
+    apr_bucket_brigade *bb;
+    const char *range;
+    apr_off_t start, end = -1;
+    char *last;
+    int rv;
+
+    if (!conf->slice_size || r->main || r->header_only
+            || r->proxyreq == PROXYREQ_PROXY
+            || !r->unparsed_uri || r->unparsed_uri[0] != '/'
+            || apr_table_get(r->headers_in, "If-Match")
+            || apr_table_get(r->headers_in, "If-Modified-Since")
+            || apr_table_get(r->headers_in, "If-None-Match")
+            || apr_table_get(r->headers_in, "If-Range")
+            || apr_table_get(r->headers_in, "If-Unmodified-Since")) {
+        return DECLINED;
+    }
+
+    /* a single range with a start is all we do */
+    range = apr_table_get(r->headers_in, "Range");
+    if (!range || strncasecmp(range, "bytes=", 6) || !apr_isdigit(range[6])
+            || apr_strtoff(&start, range + 6, &last, 10) || *last++ != '-') {
+        return DECLINED;
+    }
+    if (*last && (!apr_isdigit(*last) || apr_strtoff(&end, last, &last, 10)
+                  || *last || end < start)) {
+        return DECLINED;
+    }
+
+    ctx = apr_pcalloc(r->pool, sizeof(cache_slice_ctx));
+    ctx->r = r;
+    ctx->size = conf->slice_size;
+    ctx->slice = start / conf->slice_size;
+    ctx->start = start;
+    ctx->end = end;
+    ctx->length = -1;
+    ctx->bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+
+    slice = apr_pcalloc(r->pool, sizeof(ap_filter_t));
+    slice->frec = cache_slice_filter_handle;
+    slice->ctx = ctx;
+    slice->r = r;
+    slice->c = r->connection;
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02881)
+            "cache: serving %s of %s in slices of %" APR_OFF_T_FMT " bytes",
+            range, r->uri, ctx->size);
+
+    apr_pool_userdata_setn(ctx, CACHE_SLICE_KEY, NULL, r->pool);
+
+    do {
+        ctx->seen = 0;
+        ctx->whole = 0;
+        ctx->rr = rr = ap_sub_req_method_uri("GET", r->unparsed_uri, r,
+                                             slice);
+
+        /* the client's conditionals are not for a slice */
+        apr_table_unset(rr->headers_in, "If-Match");
+        apr_table_unset(rr->headers_in, "If-Modified-Since");
+        apr_table_unset(rr->headers_in, "If-None-Match");
+        apr_table_unset(rr->headers_in, "If-Range");
+        apr_table_unset(rr->headers_in, "If-Unmodified-Since");
+        apr_table_setn(rr->headers_in, "Range",
+                       apr_psprintf(rr->pool, "bytes=%" APR_OFF_T_FMT "-%"
+                                    APR_OFF_T_FMT, ctx->slice * ctx->size,
+                                    (ctx->slice + 1) * ctx->size - 1));
+
+        rv = rr->status;
+        if (rv == HTTP_OK) {
+            rv = ap_run_sub_req(rr);
+            if (rv == OK) {
+                rv = rr->status;
+            }
+        }
+        if (!ctx->seen) {
+            cache_slice_start(ctx, rv);
+        }
+        if (!ctx->failed && !ctx->whole && ctx->offset != ctx->last + 1) {
+            /* the slice came up short */
+            ctx->failed = 1;
+        }
+
+        ap_destroy_sub_req(rr);
+        ctx->rr = NULL;
+
+        ctx->slice++;
+    } while (!ctx->failed && !ctx->whole
+             && ctx->slice * ctx->size <= ctx->end);
+
+    apr_pool_userdata_setn(NULL, CACHE_SLICE_KEY, NULL, r->pool);
+
+    if (!ctx->status) {
+        /* nothing has been sent, let the request take its usual course */
+        return DECLINED;
+    }
+
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    if (ctx->failed) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02880)
+                "cache: slice %" APR_OFF_T_FMT " of %s does not fit the "
+                "slices before it, response aborted", ctx->slice - 1,
+                r->uri);
+        r->no_cache = 1;
+        APR_BRIGADE_INSERT_TAIL(bb, ap_bucket_error_create(HTTP_BAD_GATEWAY,
+                NULL, r->pool, r->connection->bucket_alloc));
+    }
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_eos_create(bb->bucket_alloc));
+
+    if (ap_pass_brigade(r->proto_output_filters, bb) != APR_SUCCESS) {
+        return AP_FILTER_ERROR;
+    }
+    return OK;
+}
+
 /*
  * CACHE handler
  * -------------
@@ -115,6 +579,16 @@ static int cache_quick_handler(request_rec *r, int lookup)
     /* save away the possible providers */
     cache->providers = providers;
 
+    /* are we revalidating a stale entity or fetching a slice on behalf
+     * of our main request?
+     */
+    if (r->main) {
+        void *dummy;
+        apr_pool_userdata_get(&dummy, CACHE_REVALIDATION_KEY, r->main->pool);
+        cache->revalidation = (dummy != NULL);
+        cache->slice = ap_cache_is_slice(r);
+    }
+
     /*
      * Are we allowed to serve cached info at all?
      */
@@ -123,7 +597,7 @@ static int cache_quick_handler(request_rec *r, int lookup)
     }
 
     /* find certain cache controlling headers */
-    auth = apr_table_get(r->headers_in, "Authorization");
+    auth = ap_get_request_header(r, AP_HEADER_AUTHORIZATION);
 
     /* First things first - does the request allow us to return
      * cached information at all? If not, just decline the request.
@@ -177,6 +651,33 @@ static int cache_quick_handler(request_rec *r, int lookup)
      *   return OK
      */
     rv = cache_select(cache, r);
+    if (rv == DECLINED && !lookup && !cache->stale_handle) {
+        apr_status_t status;
+
+        /* a cold miss for the whole entity: serve ranges of large ones
+         * from slices cached on their own.
+         */
+        rv = cache_slice(conf, r);
+        if (rv != DECLINED) {
+            return rv;
+        }
+
+        /* if someone else is fetching it already, wait for them and look
+         * again, rather than joining the herd.
+         */
+        status = cache_wait_lock(conf, cache, r);
+        if (status == APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02865)
+                    "Cache lock released for url, looking it up "
+                    "again: %s", r->uri);
+            rv = cache_select(cache, r);
+        }
+        else if (status != APR_NOTFOUND) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, r, APLOGNO(02866)
+                    "Gave up waiting for the cache lock for url: %s",
+                    r->uri);
+        }
+    }
     if (rv != OK) {
         if (rv == DECLINED) {
             if (!lookup) {
@@ -281,6 +782,11 @@ static int cache_quick_handler(request_rec *r, int lookup)
             return DECLINED;
         }
 
+        /* Not worth revalidating for, let the next request do it */
+        if (cache->revalidate) {
+            cache_remove_lock(conf, cache, r, NULL);
+        }
+
         /* Return cached status. */
         return rv;
     }
@@ -328,14 +834,29 @@ static int cache_quick_handler(request_rec *r, int lookup)
         next = next->next;
     }
 
+    /* The revalidation will tie up this worker once the stale response
+     * is sent, so don't have further requests of the connection wait
+     * behind it.
+     */
+    if (cache->revalidate) {
+        r->connection->keepalive = AP_CONN_CLOSE;
+    }
+
     /* kick off the filter stack */
     out = apr_brigade_create(r->pool, r->connection->bucket_alloc);
     e = apr_bucket_eos_create(out->bucket_alloc);
     APR_BRIGADE_INSERT_TAIL(out, e);
 
-    return ap_pass_brigade_fchk(r, out,
-                                "cache_quick_handler(%s): ap_pass_brigade returned",
-                                cache->provider_name);
+    rv = ap_pass_brigade_fchk(r, out,
+                              "cache_quick_handler(%s): ap_pass_brigade returned",
+                              cache->provider_name);
+
+    /* A stale entity was served, now bring it up to date */
+    if (cache->revalidate) {
+        cache_revalidate(conf, cache, r);
+    }
+
+    return rv;
 }
 
 /**
@@ -384,6 +905,52 @@ static ap_filter_t *cache_get_filter(ap_filter_t *next, ap_filter_rec_t *rec) {
     return next;
 }
 
+/**
+ * With CacheEncodingVariants, move a CACHE marker that DEFLATE directly
+ * follows behind it, so that the compressed variant is saved, and served
+ * as is on a hit, rather than compressed again for every request.
+ */
+static void cache_swap_deflate(ap_filter_t *next) {
+    ap_filter_rec_t *frec;
+    void *ctx;
+
+    while (next && next->frec != cache_filter_handle) {
+        next = next->next;
+    }
+    if (next && next->next
+            && next->next->frec == cache_deflate_filter_handle) {
+        frec = next->frec;
+        ctx = next->ctx;
+        next->frec = next->next->frec;
+        next->ctx = next->next->ctx;
+        next->next->frec = frec;
+        next->next->ctx = ctx;
+    }
+}
+
+/**
+ * Is the Content-Encoding of the response one the variant it will be
+ * stored as accepts? An identity variant takes unencoded bodies only, a
+ * gzip variant gzip'ed ones too.
+ */
+static int cache_encoding_acceptable(request_rec *r)
+{
+    const char *variant, *encoding;
+
+    variant = ap_cache_vary_value(r, "Accept-Encoding",
+            cache_table_getm(r->pool, r->headers_in, "Accept-Encoding"));
+    encoding = apr_table_get(r->headers_out, "Content-Encoding");
+    if (!encoding) {
+        encoding = r->content_encoding;
+    }
+
+    if (!encoding || !strcasecmp(encoding, "identity")) {
+        return 1;
+    }
+    return !strcmp(variant, "gzip") && (!strcasecmp(encoding, "gzip")
+            || !strcasecmp(encoding, "x-gzip"));
+}
+
 /**
  * The cache handler is functionally similar to the cache_quick_hander,
  * however a number of steps that are required by the quick handler are
@@ -425,6 +992,16 @@ static int cache_handler(request_rec *r)
     /* save away the possible providers */
     cache->providers = providers;
 
+    /* are we revalidating a stale entity or fetching a slice on behalf
+     * of our main request?
+     */
+    if (r->main) {
+        void *dummy;
+        apr_pool_userdata_get(&dummy, CACHE_REVALIDATION_KEY, r->main->pool);
+        cache->revalidation = (dummy != NULL);
+        cache->slice = ap_cache_is_slice(r);
+    }
+
     /*
      * Are we allowed to serve cached info at all?
      */
@@ -477,6 +1054,33 @@ static int cache_handler(request_rec *r)
      *   return OK
      */
     rv = cache_select(cache, r);
+    if (rv == DECLINED && !cache->stale_handle) {
+        apr_status_t status;
+
+        /* a cold miss for the whole entity: serve ranges of large ones
+         * from slices cached on their own.
+         */
+        rv = cache_slice(conf, r);
+        if (rv != DECLINED) {
+            return rv;
+        }
+
+        /* if someone else is fetching it already, wait for them and look
+         * again, rather than joining the herd.
+         */
+        status = cache_wait_lock(conf, cache, r);
+        if (status == APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02867)
+                    "Cache lock released for url, looking it up "
+                    "again: %s", r->uri);
+            rv = cache_select(cache, r);
+        }
+        else if (status != APR_NOTFOUND) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, r, APLOGNO(02868)
+                    "Gave up waiting for the cache lock for url: %s",
+                    r->uri);
+        }
+    }
     if (rv != OK) {
         if (rv == DECLINED) {
 
@@ -510,6 +1114,10 @@ static int cache_handler(request_rec *r)
                 ap_add_output_filter_handle(cache_save_handle, cache, r,
                         r->connection);
 
+                if (conf->encoding_variants) {
+                    cache_swap_deflate(r->output_filters);
+                }
+
                 /*
                  * Did the user indicate the precise location of the
                  * CACHE_SAVE filter by inserting the CACHE filter as a
@@ -571,6 +1179,10 @@ static int cache_handler(request_rec *r)
 
     rv = ap_meets_conditions(r);
     if (rv != OK) {
+        /* Not worth revalidating for, let the next request do it */
+        if (cache->revalidate) {
+            cache_remove_lock(conf, cache, r, NULL);
+        }
         return rv;
     }
 
@@ -589,6 +1201,10 @@ static int cache_handler(request_rec *r)
     }
     ap_add_output_filter_handle(cache_out_handle, cache, r, r->connection);
 
+    if (conf->encoding_variants) {
+        cache_swap_deflate(r->output_filters);
+    }
+
     /*
      * Did the user indicate the precise location of the CACHE_OUT filter by
      * inserting the CACHE filter as a marker?
@@ -624,12 +1240,27 @@ static int cache_handler(request_rec *r)
         next = next->next;
     }
 
+    /* The revalidation will tie up this worker once the stale response
+     * is sent, so don't have further requests of the connection wait
+     * behind it.
+     */
+    if (cache->revalidate) {
+        r->connection->keepalive = AP_CONN_CLOSE;
+    }
+
     /* kick off the filter stack */
     out = apr_brigade_create(r->pool, r->connection->bucket_alloc);
     e = apr_bucket_eos_create(out->bucket_alloc);
     APR_BRIGADE_INSERT_TAIL(out, e);
-    return ap_pass_brigade_fchk(r, out, "cache(%s): ap_pass_brigade returned",
-                                cache->provider_name);
+    rv = ap_pass_brigade_fchk(r, out, "cache(%s): ap_pass_brigade returned",
+                              cache->provider_name);
+
+    /* A stale entity was served, now bring it up to date */
+    if (cache->revalidate) {
+        cache_revalidate(conf, cache, r);
+    }
+
+    return rv;
 }
 
 /*
@@ -1029,6 +1660,12 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
     if (reason) {
         /* noop */
     }
+    else if (cache->slice && r->status != HTTP_PARTIAL_CONTENT
+             && (r->status != HTTP_NOT_MODIFIED || !cache->stale_handle)) {
+        /* a slice key names a range of the entity, not the whole of it */
+        reason = apr_psprintf(p, "Response status %d for a slice",
+                              r->status);
+    }
     else if (exps != NULL && exp == APR_DATE_BAD) {
         /* if a broken Expires header is present, don't cache it */
         reason = apr_pstrcat(p, "Broken expires header: ", exps, NULL);
@@ -1086,7 +1723,7 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
          */
         reason = "Cache-Control: private present";
     }
-    else if (apr_table_get(r->headers_in, "Authorization")
+    else if (ap_get_request_header(r, AP_HEADER_AUTHORIZATION)
             && !(control.s_maxage || control.must_revalidate
                     || control.proxy_revalidate || control.public)) {
         /* RFC2616 14.8 Authorisation:
@@ -1101,6 +1738,12 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
     else if (ap_find_token(NULL, apr_table_get(r->headers_out, "Vary"), "*")) {
         reason = "Vary header contains '*'";
     }
+    else if (conf->encoding_variants
+            && ap_find_token(NULL, apr_table_get(r->headers_out, "Vary"),
+                    "Accept-Encoding")
+            && !cache_encoding_acceptable(r)) {
+        reason = "Content-Encoding does not match the Accept-Encoding variant";
+    }
     else if (apr_table_get(r->subprocess_env, "no-cache") != NULL) {
         reason = "environment variable 'no-cache' is set";
     }
@@ -1929,6 +2572,7 @@ static void *create_dir_config(apr_pool_t *p, char *dummy)
     dconf->x_cache_detail = DEFAULT_X_CACHE_DETAIL;
 
     dconf->stale_on_error = DEFAULT_CACHE_STALE_ON_ERROR;
+    dconf->stale_while_revalidate = DEFAULT_CACHE_STALE_WHILE_REVALIDATE;
 
     /* array of providers for this URL space */
     dconf->cacheenable = apr_array_make(p, 10, sizeof(struct cache_enable));
@@ -1977,6 +2621,11 @@ static void *merge_dir_config(apr_pool_t *p, void *basev, void *addv) {
     new->stale_on_error_set = add->stale_on_error_set
             || base->stale_on_error_set;
 
+    new->stale_while_revalidate = (add->stale_while_revalidate_set == 0)
+            ? base->stale_while_revalidate : add->stale_while_revalidate;
+    new->stale_while_revalidate_set = add->stale_while_revalidate_set
+            || base->stale_while_revalidate_set;
+
     new->cacheenable = add->enable_set ? apr_array_append(p, base->cacheenable,
             add->cacheenable) : base->cacheenable;
     new->enable_set = add->enable_set || base->enable_set;
@@ -2012,8 +2661,11 @@ static void * create_cache_config(apr_pool_t *p, server_rec *s)
     ps->lock_set = 0;
     ps->lockpath = ap_runtime_dir_relative(p, DEFAULT_CACHE_LOCKPATH);
     ps->lockmaxage = apr_time_from_sec(DEFAULT_CACHE_MAXAGE);
+    ps->lockwait = 0; /* cold misses don't wait for the lock by default */
     ps->x_cache = DEFAULT_X_CACHE;
     ps->x_cache_detail = DEFAULT_X_CACHE_DETAIL;
+    ps->slice_size = 0; /* ranges are not sliced by default */
+    ps->encoding_variants = 0; /* raw Accept-Encoding keys by default */
     return ps;
 }
 
@@ -2060,6 +2712,10 @@ static void * merge_cache_config(apr_pool_t *p, void *basev, void *overridesv)
         (overrides->lockmaxage_set == 0)
         ? base->lockmaxage
         : overrides->lockmaxage;
+    ps->lockwait =
+        (overrides->lockwait_set == 0)
+        ? base->lockwait
+        : overrides->lockwait;
     ps->quick =
         (overrides->quick_set == 0)
         ? base->quick
@@ -2076,6 +2732,14 @@ static void * merge_cache_config(apr_pool_t *p, void *basev, void *overridesv)
         (overrides->base_uri_set == 0)
         ? base->base_uri
         : overrides->base_uri;
+    ps->slice_size =
+        (overrides->slice_size_set == 0)
+        ? base->slice_size
+        : overrides->slice_size;
+    ps->encoding_variants =
+        (overrides->encoding_variants_set == 0)
+        ? base->encoding_variants
+        : overrides->encoding_variants;
     return ps;
 }
 
@@ -2411,6 +3075,54 @@ static const char *set_cache_lock_maxage(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *set_cache_lock_wait(cmd_parms *parms, void *dummy,
+                                    const char *arg)
+{
+    cache_server_conf *conf;
+    apr_int64_t milliseconds;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    milliseconds = apr_atoi64(arg);
+    if (milliseconds < 0) {
+        return "CacheLockWait value must be a positive integer";
+    }
+    conf->lockwait = apr_time_from_msec(milliseconds);
+    conf->lockwait_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_slice_size(cmd_parms *parms, void *dummy,
+                                        const char *arg)
+{
+    cache_server_conf *conf;
+    apr_off_t size;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS || size < 0) {
+        return "CacheSliceSize value must be zero or a positive integer";
+    }
+    conf->slice_size = size;
+    conf->slice_size_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_encoding_variants(cmd_parms *parms, void *dummy,
+                                               int flag)
+{
+    cache_server_conf *conf;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    conf->encoding_variants = flag;
+    conf->encoding_variants_set = 1;
+    return NULL;
+}
+
 static const char *set_cache_x_cache(cmd_parms *parms, void *dummy, int flag)
 {
 
@@ -2489,19 +3201,44 @@ static const char *set_cache_stale_on_error(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *set_cache_stale_while_revalidate(cmd_parms *parms,
+        void *dummy, int flag)
+{
+    cache_dir_conf *dconf = (cache_dir_conf *)dummy;
+
+    dconf->stale_while_revalidate = flag;
+    dconf->stale_while_revalidate_set = 1;
+    return NULL;
+}
+
 static int cache_post_config(apr_pool_t *p, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *s)
 {
+    apr_status_t rv;
+
+    rv = cache_hash_key_init();
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02903)
+                "error generating the key of the cache hash");
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
     /* This is the means by which unusual (non-unix) os's may find alternate
      * means to run a given command (e.g. shebang/registry parsing on Win32)
      */
-    cache_generate_key = APR_RETRIEVE_OPTIONAL_FN(ap_cache_generate_key);
-    if (!cache_generate_key) {
-        cache_generate_key = cache_generate_key_default;
+    cache_generate_entity_key = APR_RETRIEVE_OPTIONAL_FN(ap_cache_generate_key);
+    if (!cache_generate_entity_key) {
+        cache_generate_entity_key = cache_generate_key_default;
     }
+    cache_generate_key = cache_generate_slice_key;
+    cache_deflate_filter_handle = ap_get_output_filter_handle("DEFLATE");
     return OK;
 }
 
+static void cache_child_init(apr_pool_t *p, server_rec *s)
+{
+    cache_lock_child_init(p);
+}
 
 static const command_rec cache_cmds[] =
 {
@@ -2566,6 +3303,16 @@ static const command_rec cache_cmds[] =
                   "DefaultRuntimeDir setting."),
     AP_INIT_TAKE1("CacheLockMaxAge", set_cache_lock_maxage, NULL, RSRC_CONF,
                   "Maximum age of any thundering herd lock."),
+    AP_INIT_TAKE1("CacheLockWait", set_cache_lock_wait, NULL, RSRC_CONF,
+                  "Maximum time in milliseconds a cache miss waits for "
+                  "the request holding the thundering herd lock."),
+    AP_INIT_TAKE1("CacheSliceSize", set_cache_slice_size, NULL, RSRC_CONF,
+                  "The size in bytes of the slices in which ranges of large "
+                  "entities are fetched and cached, 0 to disable."),
+    AP_INIT_FLAG("CacheEncodingVariants", set_cache_encoding_variants, NULL,
+                 RSRC_CONF,
+                 "Cache one gzip and one identity variant of responses that "
+                 "vary on Accept-Encoding. Default is off."),
     AP_INIT_FLAG("CacheHeader", set_cache_x_cache, NULL, RSRC_CONF | ACCESS_CONF,
                  "Add a X-Cache header to responses. Default is off."),
     AP_INIT_FLAG("CacheDetailHeader", set_cache_x_cache_detail, NULL,
@@ -2576,6 +3323,10 @@ static const command_rec cache_cmds[] =
     AP_INIT_FLAG("CacheStaleOnError", set_cache_stale_on_error,
                  NULL, RSRC_CONF|ACCESS_CONF,
                  "Serve stale content on 5xx errors if present. Defaults to on."),
+    AP_INIT_FLAG("CacheStaleWhileRevalidate", set_cache_stale_while_revalidate,
+                 NULL, RSRC_CONF|ACCESS_CONF,
+                 "Honour stale-while-revalidate by serving stale content and "
+                 "revalidating it after the response. Defaults to on."),
     {NULL}
 };
 
@@ -2669,7 +3420,25 @@ static void register_hooks(apr_pool_t *p)
                                   cache_invalidate_filter,
                                   NULL,
                                   AP_FTYPE_PROTOCOL);
+    /* CACHE_DISCARD is the sink at the end of a stale-while-revalidate
+     * revalidation, it never appears in a regular filter chain.
+     */
+    cache_discard_filter_handle =
+        ap_register_output_filter("CACHE_DISCARD",
+                                  cache_discard_filter,
+                                  NULL,
+                                  AP_FTYPE_NETWORK);
+    /* CACHE_SLICE sits between the subrequests for the slices of an
+     * entity and the main request, it never appears in a regular filter
+     * chain either.
+     */
+    cache_slice_filter_handle =
+        ap_register_output_filter("CACHE_SLICE",
+                                  cache_slice_filter,
+                                  NULL,
+                                  AP_FTYPE_NETWORK);
     ap_hook_post_config(cache_post_config, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_hook_child_init(cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(cache) =
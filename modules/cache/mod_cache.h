@@ -133,9 +133,26 @@ CACHE_DECLARE(apr_time_t) ap_cache_current_age(cache_info *info, const apr_time_
 
 CACHE_DECLARE(apr_time_t) ap_cache_hex2usec(const char *x);
 CACHE_DECLARE(void) ap_cache_usec2hex(apr_time_t j, char *y);
+
+/* The 128 bit hash of a cache key, from which the generate_name functions
+ * derive file names: SipHash-2-4 with 128 bits of output, keyed with the
+ * CACHE_HASH_KEY_LEN bytes of hkey, with the two 64 bit halves stored
+ * little endian on all platforms. A NULL hkey stands for a random key
+ * drawn at startup, kept across restarts but not stored anywhere: names
+ * meant to outlive the server need a key of their own.
+ */
+#define CACHE_HASH_LEN 16
+CACHE_DECLARE(void) ap_cache_hash(const unsigned char *hkey,
+                                  const char *key, apr_size_t len,
+                                  unsigned char *hash);
 CACHE_DECLARE(char *) ap_cache_generate_name(apr_pool_t *p, int dirlevels,
                                              int dirlength,
                                              const char *name);
+CACHE_DECLARE(char *) ap_cache_generate_keyed_name(apr_pool_t *p,
+                                                   const unsigned char *hkey,
+                                                   int dirlevels,
+                                                   int dirlength,
+                                                   const char *name);
 CACHE_DECLARE(const char *)ap_cache_tokstr(apr_pool_t *p, const char *list, const char **str);
 
 /* Create a new table consisting of those elements from an
@@ -156,6 +173,21 @@ CACHE_DECLARE(apr_table_t *)ap_cache_cacheable_headers_in(request_rec *r);
  */
 CACHE_DECLARE(apr_table_t *)ap_cache_cacheable_headers_out(request_rec *r);
 
+/* Is this subrequest fetching a slice of a large entity for its main
+ * request? The 206 Partial Content response to it is all there is to
+ * the entity cached under its key, so providers may store it.
+ */
+CACHE_DECLARE(int) ap_cache_is_slice(request_rec *r);
+
+/* The value of the request header name that variants of an entity
+ * varying on it are keyed on: value itself, or for Accept-Encoding
+ * under CacheEncodingVariants "gzip" or "identity". Providers regenerate
+ * the keys of their variants with it.
+ */
+CACHE_DECLARE(const char *) ap_cache_vary_value(request_rec *r,
+                                                const char *name,
+                                                const char *value);
+
 /**
  * Parse the Cache-Control and Pragma headers in one go, marking
  * which tokens appear within the header. Populate the structure
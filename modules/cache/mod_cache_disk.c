@@ -26,6 +26,8 @@
 #include "util_filter.h"
 #include "util_script.h"
 #include "util_charset.h"
+#include "util_mutex.h"
+#include "ap_socache.h"
 
 /*
  * mod_cache_disk: Disk Based HTTP 1.1 Cache.
@@ -53,6 +55,23 @@
  *   CRLF
  *   r->headers_in (delimited by CRLF)
  *   CRLF
+ *
+ * Header index:
+ *   If CacheDiskIndex is configured, the contents of each header file
+ *   are also kept in a shared object cache, keyed by the name of the
+ *   header file, so that a cache hit only needs to stat the header file
+ *   rather than to open and read it.  The files on disk remain
+ *   authoritative: an entry holds the inode, device, mtime and size of
+ *   the file it was read from (disk_index_ident_t), and is only used
+ *   while the file still matches them, so that a reader storing what it
+ *   read just before the entity was replaced can't have it served.
+ *   Entries are also removed when an entity is committed or removed.
+ *
+ * Journal:
+ *   If CacheDiskJournal is on, each entity committed or removed is
+ *   appended to CACHE_JOURNAL_FILE in the cache root, from which
+ *   htcacheclean -j keeps track of the size of the cache without
+ *   walking the cache directory tree.
  */
 
 module AP_MODULE_DECLARE_DATA cache_disk_module;
@@ -65,7 +84,21 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r, apr_bucket_bri
 static apr_status_t recall_headers(cache_handle_t *h, request_rec *r);
 static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_brigade *bb);
 static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
-                               apr_file_t *file);
+                               const char *buffer, apr_size_t buffer_len,
+                               apr_size_t *slider);
+
+/* The shared object cache holding the header index, and its mutex */
+static const char * const cache_disk_index_id = "cache-disk-index";
+static ap_socache_provider_t *index_provider = NULL;
+static const char *index_args = NULL;
+static ap_socache_instance_t *index_instance = NULL;
+static apr_global_mutex_t *index_mutex = NULL;
+
+/* Whether stores and removes are journaled, in every cache root: one
+ * server not journaling a root shared with others would leave holes in
+ * its journal
+ */
+static int journal = 0;
 
 /*
  * Local static functions
@@ -75,8 +108,9 @@ static char *header_file(apr_pool_t *p, disk_cache_conf *conf,
                          disk_cache_object_t *dobj, const char *name)
 {
     if (!dobj->hashfile) {
-        dobj->hashfile = ap_cache_generate_name(p, conf->dirlevels,
-                                                conf->dirlength, name);
+        dobj->hashfile = ap_cache_generate_keyed_name(p, conf->hash_key,
+                                                      conf->dirlevels,
+                                                      conf->dirlength, name);
     }
 
     if (dobj->prefix) {
@@ -93,8 +127,9 @@ static char *data_file(apr_pool_t *p, disk_cache_conf *conf,
                        disk_cache_object_t *dobj, const char *name)
 {
     if (!dobj->hashfile) {
-        dobj->hashfile = ap_cache_generate_name(p, conf->dirlevels,
-                                                conf->dirlength, name);
+        dobj->hashfile = ap_cache_generate_keyed_name(p, conf->hash_key,
+                                                      conf->dirlevels,
+                                                      conf->dirlength, name);
     }
 
     if (dobj->prefix) {
@@ -210,23 +245,323 @@ static apr_status_t file_cache_create(disk_cache_conf *conf, disk_cache_file_t *
     return APR_SUCCESS;
 }
 
+/*
+ * The name under which an entity appears in the journal: the path of
+ * its header or data file relative to the cache root, without suffix.
+ */
+static const char *journal_name(apr_pool_t *p, disk_cache_conf *conf,
+                                const char *file)
+{
+    apr_size_t len;
+
+    if (!file || strncmp(file, conf->cache_root, conf->cache_root_len)
+            || file[conf->cache_root_len] != '/') {
+        return NULL;
+    }
+    file += conf->cache_root_len + 1;
+    len = strlen(file);
+
+    if (len > sizeof(CACHE_HEADER_SUFFIX) - 1 && !strcmp(file + len
+            - (sizeof(CACHE_HEADER_SUFFIX) - 1), CACHE_HEADER_SUFFIX)) {
+        return apr_pstrmemdup(p, file, len - (sizeof(CACHE_HEADER_SUFFIX) - 1));
+    }
+    if (len > sizeof(CACHE_DATA_SUFFIX) - 1 && !strcmp(file + len
+            - (sizeof(CACHE_DATA_SUFFIX) - 1), CACHE_DATA_SUFFIX)) {
+        return apr_pstrmemdup(p, file, len - (sizeof(CACHE_DATA_SUFFIX) - 1));
+    }
+    return NULL;
+}
+
+/*
+ * Append a record to the journal. The journal is opened for each record,
+ * so that htcacheclean can move it aside at any time, and each record is
+ * written in one go, so that records of concurrent writers do not
+ * interleave.
+ */
+static void journal_append(request_rec *r, disk_cache_conf *conf,
+                           const char *record)
+{
+    apr_file_t *fd;
+    apr_status_t rv;
+    const char *file = apr_pstrcat(r->pool, conf->cache_root, "/",
+                                   CACHE_JOURNAL_FILE, NULL);
+
+    rv = apr_file_open(&fd, file,
+                       APR_FOPEN_WRITE | APR_FOPEN_CREATE | APR_FOPEN_APPEND
+                       | APR_FOPEN_BINARY,
+                       APR_FPROT_UREAD | APR_FPROT_UWRITE, r->pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(fd, record, strlen(record), NULL);
+        apr_file_close(fd);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(02879)
+                "could not append to the cache journal %s", file);
+
+        /* have htcacheclean walk the cache rather than trust the journal */
+        rv = apr_file_open(&fd, apr_pstrcat(r->pool, conf->cache_root, "/",
+                                            CACHE_JOURNAL_GAP, NULL),
+                           APR_FOPEN_WRITE | APR_FOPEN_CREATE,
+                           APR_FPROT_UREAD | APR_FPROT_UWRITE, r->pool);
+        if (rv == APR_SUCCESS) {
+            apr_file_close(fd);
+        }
+    }
+}
+
+static void journal_store(request_rec *r, disk_cache_conf *conf,
+                          cache_object_t *obj)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t *) obj->vobj;
+    apr_finfo_t finfo;
+    const char *name;
+
+    if (!journal) {
+        return;
+    }
+    name = journal_name(r->pool, conf, dobj->hdrs.file);
+    if (!name || apr_stat(&finfo, dobj->hdrs.file, APR_FINFO_SIZE,
+                          r->pool) != APR_SUCCESS) {
+        return;
+    }
+
+    journal_append(r, conf, apr_psprintf(r->pool,
+            "%c %" APR_TIME_T_FMT " %" APR_TIME_T_FMT " %" APR_TIME_T_FMT
+            " %" APR_OFF_T_FMT " %" APR_OFF_T_FMT " %s\n",
+            CACHE_JOURNAL_STORE, obj->info.expire,
+            obj->info.response_time, apr_time_now(), finfo.size,
+            dobj->disk_info.header_only ? (apr_off_t)0 : dobj->file_size,
+            name));
+}
+
+static void journal_vary(request_rec *r, disk_cache_conf *conf,
+                         cache_object_t *obj)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t *) obj->vobj;
+    apr_finfo_t finfo;
+    const char *name;
+
+    if (!journal) {
+        return;
+    }
+    name = journal_name(r->pool, conf, dobj->vary.file);
+    if (!name || apr_stat(&finfo, dobj->vary.file, APR_FINFO_SIZE,
+                          r->pool) != APR_SUCCESS) {
+        return;
+    }
+
+    journal_append(r, conf, apr_psprintf(r->pool,
+            "%c %" APR_TIME_T_FMT " %" APR_TIME_T_FMT " %" APR_OFF_T_FMT
+            " %s\n", CACHE_JOURNAL_VARY, obj->info.expire,
+            apr_time_now(), finfo.size, name));
+}
+
+static void journal_remove(request_rec *r, disk_cache_conf *conf,
+                           disk_cache_object_t *dobj)
+{
+    const char *name;
+
+    if (!journal) {
+        return;
+    }
+    name = journal_name(r->pool, conf,
+                        dobj->hdrs.file ? dobj->hdrs.file : dobj->data.file);
+    if (!name) {
+        return;
+    }
+
+    journal_append(r, conf, apr_psprintf(r->pool,
+            "%c %" APR_TIME_T_FMT " %s\n",
+            CACHE_JOURNAL_REMOVE, apr_time_now(), name));
+}
+
+static apr_status_t index_lock(request_rec *r)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if (index_mutex) {
+        rv = apr_global_mutex_lock(index_mutex);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02869)
+                    "could not acquire lock, ignoring header index");
+        }
+    }
+    return rv;
+}
+
+static void index_unlock(request_rec *r)
+{
+    apr_status_t rv;
+
+    if (index_mutex) {
+        rv = apr_global_mutex_unlock(index_mutex);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02870)
+                    "could not release lock on header index");
+        }
+    }
+}
+
+static void index_ident(disk_index_ident_t *ident, const apr_finfo_t *finfo)
+{
+    memset(ident, 0, sizeof(*ident));
+    ident->inode = finfo->inode;
+    ident->device = finfo->device;
+    ident->mtime = finfo->mtime;
+    ident->size = finfo->size;
+}
+
+/*
+ * Look up the contents of a header file in the index, as long as the
+ * file is still the one they were read from. Returns APR_NOTFOUND if
+ * the index knows nothing about it, or something else.
+ */
+static apr_status_t index_lookup(request_rec *r, const char *file,
+                                 const apr_finfo_t *finfo,
+                                 const char **buf, apr_size_t *len)
+{
+    unsigned char *buffer;
+    unsigned int buffer_len = sizeof(disk_index_ident_t)
+                              + DISK_INDEX_MAX_HEADER;
+    disk_index_ident_t ident;
+    apr_status_t rv;
+
+    if (index_lock(r) != APR_SUCCESS) {
+        return APR_NOTFOUND;
+    }
+    buffer = apr_palloc(r->pool, buffer_len);
+    rv = index_provider->retrieve(index_instance, r->server,
+                                  (unsigned char *) file, strlen(file),
+                                  buffer, &buffer_len, r->pool);
+    index_unlock(r);
+
+    if (rv != APR_SUCCESS || buffer_len < sizeof(ident)) {
+        return APR_NOTFOUND;
+    }
+
+    index_ident(&ident, finfo);
+    if (memcmp(&ident, buffer, sizeof(ident))) {
+        return APR_NOTFOUND;
+    }
+
+    *buf = (const char *) buffer + sizeof(ident);
+    *len = buffer_len - sizeof(ident);
+    return APR_SUCCESS;
+}
+
+static void index_store(request_rec *r, const char *file,
+                        const apr_finfo_t *finfo, const char *buf,
+                        apr_size_t len)
+{
+    disk_index_ident_t ident;
+    unsigned char *entry;
+    apr_status_t rv;
+
+    if (len > DISK_INDEX_MAX_HEADER) {
+        return;
+    }
+    index_ident(&ident, finfo);
+    entry = apr_palloc(r->pool, sizeof(ident) + len);
+    memcpy(entry, &ident, sizeof(ident));
+    memcpy(entry + sizeof(ident), buf, len);
+
+    if (index_lock(r) != APR_SUCCESS) {
+        return;
+    }
+    rv = index_provider->store(index_instance, r->server,
+                               (unsigned char *) file, strlen(file),
+                               apr_time_now() + DISK_INDEX_TIMEOUT,
+                               entry, sizeof(ident) + len, r->pool);
+    index_unlock(r);
+
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02871)
+                "could not add %s to header index", file);
+    }
+}
+
+static void index_remove(request_rec *r, const char *file)
+{
+    if (!index_instance || !file || index_lock(r) != APR_SUCCESS) {
+        return;
+    }
+    index_provider->remove(index_instance, r->server,
+                           (unsigned char *) file, strlen(file), r->pool);
+    index_unlock(r);
+}
+
+#define DISK_INDEX_FINFO (APR_FINFO_SIZE | APR_FINFO_MTIME | APR_FINFO_IDENT)
+
+static apr_status_t read_header_file(request_rec *r, const char *file,
+                                     apr_finfo_t *finfo,
+                                     const char **buf, apr_size_t *len)
+{
+    apr_file_t *fd;
+    char *buffer;
+    apr_status_t rv;
+
+    rv = apr_file_open(&fd, file, APR_READ | APR_BINARY, 0, r->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = apr_file_info_get(finfo, DISK_INDEX_FINFO, fd);
+    if (rv == APR_SUCCESS) {
+        buffer = apr_palloc(r->pool, (apr_size_t) finfo->size);
+        rv = apr_file_read_full(fd, buffer, (apr_size_t) finfo->size, len);
+        *buf = buffer;
+    }
+    apr_file_close(fd);
+
+    return rv;
+}
+
+/*
+ * Fetch the contents of a header file with a single read, consulting
+ * the header index first where one is configured.
+ */
+static apr_status_t load_header(request_rec *r, const char *file,
+                                const char **buf, apr_size_t *len)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    if (index_instance) {
+        rv = apr_stat(&finfo, file, DISK_INDEX_FINFO, r->pool);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (index_lookup(r, file, &finfo, buf, len) == APR_SUCCESS) {
+            return APR_SUCCESS;
+        }
+    }
+
+    /* indexed along with the file it was read from, checked on hits */
+    rv = read_header_file(r, file, &finfo, buf, len);
+    if (rv == APR_SUCCESS && index_instance) {
+        index_store(r, file, &finfo, *buf, *len);
+    }
+
+    return rv;
+}
+
 /* These two functions get and put state information into the data
  * file for an ap_cache_el, this state information will be read
  * and written transparent to clients of this module
  */
-static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
+static int file_cache_recall_mydata(cache_info *info,
                                     disk_cache_object_t *dobj, request_rec *r)
 {
-    apr_status_t rv;
-    char *urlbuff;
+    const char *urlbuff;
     apr_size_t len;
 
-    /* read the data from the cache file */
+    /* read the data from the header file contents */
     len = sizeof(disk_cache_info_t);
-    rv = apr_file_read_full(fd, &dobj->disk_info, len, &len);
-    if (rv != APR_SUCCESS) {
-        return rv;
+    if (dobj->header_len < len) {
+        return APR_EOF;
     }
+    memcpy(&dobj->disk_info, dobj->header_buf, len);
+    dobj->header_pos = len;
 
     /* Store it away so we can get it later. */
     info->status = dobj->disk_info.status;
@@ -237,26 +572,22 @@ static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
 
     memcpy(&info->control, &dobj->disk_info.control, sizeof(cache_control_t));
 
-    /* Note that we could optimize this by conditionally doing the palloc
-     * depending upon the size. */
-    urlbuff = apr_palloc(r->pool, dobj->disk_info.name_len + 1);
     len = dobj->disk_info.name_len;
-    rv = apr_file_read_full(fd, urlbuff, len, &len);
-    if (rv != APR_SUCCESS) {
-        return rv;
+    if (len > dobj->header_len - dobj->header_pos) {
+        return APR_EOF;
     }
-    urlbuff[dobj->disk_info.name_len] = '\0';
+    urlbuff = dobj->header_buf + dobj->header_pos;
+    dobj->header_pos += len;
 
     /* check that we have the same URL */
-    /* Would strncmp be correct? */
-    if (strcmp(urlbuff, dobj->name) != 0) {
+    if (len != strlen(dobj->name) || memcmp(urlbuff, dobj->name, len)) {
         return APR_EGENERAL;
     }
 
     return APR_SUCCESS;
 }
 
-static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
+static const char* regen_key(request_rec *r, apr_table_t *headers,
                              apr_array_header_t *varray, const char *oldkey)
 {
     struct iovec *iov;
@@ -266,7 +597,7 @@ static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
     const char **elts;
 
     nvec = (varray->nelts * 2) + 1;
-    iov = apr_palloc(p, sizeof(struct iovec) * nvec);
+    iov = apr_palloc(r->pool, sizeof(struct iovec) * nvec);
     elts = (const char **) varray->elts;
 
     /* TODO:
@@ -294,7 +625,8 @@ static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
      */
 
     for(i=0, k=0; i < varray->nelts; i++) {
-        header = apr_table_get(headers, elts[i]);
+        header = ap_cache_vary_value(r, elts[i],
+                                     apr_table_get(headers, elts[i]));
         if (!header) {
             header = "";
         }
@@ -309,7 +641,7 @@ static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
     iov[k].iov_len = strlen(oldkey);
     k++;
 
-    return apr_pstrcatv(p, iov, k, NULL);
+    return apr_pstrcatv(r->pool, iov, k, NULL);
 }
 
 static int array_alphasort(const void *fn1, const void *fn2)
@@ -348,8 +680,10 @@ static int create_entity(cache_handle_t *h, request_rec *r, const char *key, apr
         return DECLINED;
     }
 
-    /* we don't support caching of range requests (yet) */
-    if (r->status == HTTP_PARTIAL_CONTENT) {
+    /* we don't support caching of range requests (yet), other than the
+     * slices of large entities mod_cache asks for on its own
+     */
+    if (r->status == HTTP_PARTIAL_CONTENT && !ap_cache_is_slice(r)) {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00700)
                 "URL %s partial content response not cached",
                 key);
@@ -445,42 +779,46 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     dobj->root_len = conf->cache_root_len;
 
     dobj->vary.file = header_file(r->pool, conf, dobj, key);
-    flags = APR_READ|APR_BINARY|APR_BUFFERED;
-    rc = apr_file_open(&dobj->vary.fd, dobj->vary.file, flags, 0, r->pool);
+    rc = load_header(r, dobj->vary.file, &dobj->header_buf, &dobj->header_len);
     if (rc != APR_SUCCESS) {
         return DECLINED;
     }
 
     /* read the format from the cache file */
     len = sizeof(format);
-    apr_file_read_full(dobj->vary.fd, &format, len, &len);
+    if (dobj->header_len < len) {
+        format = 0;
+    }
+    else {
+        memcpy(&format, dobj->header_buf, len);
+    }
 
     if (format == VARY_FORMAT_VERSION) {
         apr_array_header_t* varray;
-        apr_time_t expire;
+        apr_size_t slider;
 
-        len = sizeof(expire);
-        apr_file_read_full(dobj->vary.fd, &expire, len, &len);
+        /* skip the expiry time, it is not used here */
+        slider = len + sizeof(apr_time_t);
 
         varray = apr_array_make(r->pool, 5, sizeof(char*));
-        rc = read_array(r, varray, dobj->vary.fd);
+        rc = read_array(r, varray, dobj->header_buf, dobj->header_len,
+                        &slider);
         if (rc != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(00704)
                     "Cannot parse vary header file: %s",
                     dobj->vary.file);
-            apr_file_close(dobj->vary.fd);
+            index_remove(r, dobj->vary.file);
             return DECLINED;
         }
-        apr_file_close(dobj->vary.fd);
 
-        nkey = regen_key(r->pool, r->headers_in, varray, key);
+        nkey = regen_key(r, r->headers_in, varray, key);
 
         dobj->hashfile = NULL;
         dobj->prefix = dobj->vary.file;
         dobj->hdrs.file = header_file(r->pool, conf, dobj, nkey);
 
-        flags = APR_READ|APR_BINARY|APR_BUFFERED;
-        rc = apr_file_open(&dobj->hdrs.fd, dobj->hdrs.file, flags, 0, r->pool);
+        rc = load_header(r, dobj->hdrs.file, &dobj->header_buf,
+                         &dobj->header_len);
         if (rc != APR_SUCCESS) {
             return DECLINED;
         }
@@ -489,21 +827,12 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00705)
                 "File '%s' has a version mismatch. File had version: %d.",
                 dobj->vary.file, format);
-        apr_file_close(dobj->vary.fd);
+        index_remove(r, dobj->vary.file);
         return DECLINED;
     }
     else {
-        apr_off_t offset = 0;
-
         /* oops, not vary as it turns out */
-        dobj->hdrs.fd = dobj->vary.fd;
-        dobj->vary.fd = NULL;
         dobj->hdrs.file = dobj->vary.file;
-
-        /* This wasn't a Vary Format file, so we must seek to the
-         * start of the file again, so that later reads work.
-         */
-        apr_file_seek(dobj->hdrs.fd, APR_SET, &offset);
         nkey = key;
     }
 
@@ -521,11 +850,11 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     dobj->data.file = data_file(r->pool, conf, dobj, nkey);
 
     /* Read the bytes to setup the cache_info fields */
-    rc = file_cache_recall_mydata(dobj->hdrs.fd, info, dobj, r);
+    rc = file_cache_recall_mydata(info, dobj, r);
     if (rc != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(00706)
                 "Cannot read header file %s", dobj->hdrs.file);
-        apr_file_close(dobj->hdrs.fd);
+        index_remove(r, dobj->hdrs.file);
         return DECLINED;
     }
 
@@ -535,7 +864,6 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r, APLOGNO(00707)
                 "HEAD request cached, non-HEAD requested, ignoring: %s",
                 dobj->hdrs.file);
-        apr_file_close(dobj->hdrs.fd);
         return DECLINED;
     }
 
@@ -553,7 +881,7 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         if (rc != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(00708)
                     "Cannot open data file %s", dobj->data.file);
-            apr_file_close(dobj->hdrs.fd);
+            index_remove(r, dobj->hdrs.file);
             return DECLINED;
         }
 
@@ -593,7 +921,7 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
             "Cached URL info header '%s' didn't match body, ignoring this entry",
             dobj->name);
 
-    apr_file_close(dobj->hdrs.fd);
+    index_remove(r, dobj->hdrs.file);
     return DECLINED;
 }
 
@@ -624,6 +952,8 @@ static int remove_entity(cache_handle_t *h)
 
 static int remove_url(cache_handle_t *h, request_rec *r)
 {
+    disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                 &cache_disk_module);
     apr_status_t rc;
     disk_cache_object_t *dobj;
 
@@ -633,6 +963,9 @@ static int remove_url(cache_handle_t *h, request_rec *r)
         return DECLINED;
     }
 
+    /* Forget about the headers file in the index */
+    index_remove(r, dobj->hdrs.file);
+
     /* Delete headers file */
     if (dobj->hdrs.file) {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00711)
@@ -667,6 +1000,8 @@ static int remove_url(cache_handle_t *h, request_rec *r)
         }
     }
 
+    journal_remove(r, conf, dobj);
+
     /* now delete directories as far as possible up to our cache root */
     if (dobj->root) {
         const char *str_to_copy;
@@ -708,15 +1043,40 @@ static int remove_url(cache_handle_t *h, request_rec *r)
     return OK;
 }
 
+/*
+ * Like apr_file_gets(), but reading from the header file contents in
+ * memory.
+ */
+static apr_status_t buffer_gets(char *w, apr_size_t n, const char *buffer,
+                                apr_size_t buffer_len, apr_size_t *slider)
+{
+    apr_size_t i = 0;
+
+    if (*slider >= buffer_len) {
+        return APR_EOF;
+    }
+
+    while (i + 1 < n && *slider < buffer_len) {
+        w[i] = buffer[(*slider)++];
+        if (w[i++] == '\n') {
+            break;
+        }
+    }
+    w[i] = '\0';
+
+    return APR_SUCCESS;
+}
+
 static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
-                               apr_file_t *file)
+                               const char *buffer, apr_size_t buffer_len,
+                               apr_size_t *slider)
 {
     char w[MAX_STRING_LEN];
     int p;
     apr_status_t rv;
 
     while (1) {
-        rv = apr_file_gets(w, MAX_STRING_LEN - 1, file);
+        rv = buffer_gets(w, MAX_STRING_LEN - 1, buffer, buffer_len, slider);
         if (rv != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00716)
                           "Premature end of vary array.");
@@ -773,7 +1133,8 @@ static apr_status_t store_array(apr_file_t *fd, apr_array_header_t* arr)
 }
 
 static apr_status_t read_table(cache_handle_t *handle, request_rec *r,
-                               apr_table_t *table, apr_file_t *file)
+                               apr_table_t *table, const char *buffer,
+                               apr_size_t buffer_len, apr_size_t *slider)
 {
     char w[MAX_STRING_LEN];
     char *l;
@@ -783,7 +1144,7 @@ static apr_status_t read_table(cache_handle_t *handle, request_rec *r,
     while (1) {
 
         /* ### What about APR_EOF? */
-        rv = apr_file_gets(w, MAX_STRING_LEN - 1, file);
+        rv = buffer_gets(w, MAX_STRING_LEN - 1, buffer, buffer_len, slider);
         if (rv != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00717)
                           "Premature end of cache headers.");
@@ -866,9 +1227,9 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
 
     /* This case should not happen... */
-    if (!dobj->hdrs.fd) {
+    if (!dobj->header_buf) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00719)
-                "recalling headers; but no header fd for %s", dobj->name);
+                "recalling headers; but no header data for %s", dobj->name);
         return APR_NOTFOUND;
     }
 
@@ -876,10 +1237,12 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
     h->resp_hdrs = apr_table_make(r->pool, 20);
 
     /* Call routine to read the header lines/status line */
-    read_table(h, r, h->resp_hdrs, dobj->hdrs.fd);
-    read_table(h, r, h->req_hdrs, dobj->hdrs.fd);
+    read_table(h, r, h->resp_hdrs, dobj->header_buf, dobj->header_len,
+               &dobj->header_pos);
+    read_table(h, r, h->req_hdrs, dobj->header_buf, dobj->header_len,
+               &dobj->header_pos);
 
-    apr_file_close(dobj->hdrs.fd);
+    dobj->header_buf = NULL;
 
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00720)
             "Recalled headers for URL %s", dobj->name);
@@ -1031,7 +1394,7 @@ static apr_status_t write_headers(cache_handle_t *h, request_rec *r)
                 return rv;
             }
 
-            tmp = regen_key(r->pool, dobj->headers_in, varray, dobj->name);
+            tmp = regen_key(r, dobj->headers_in, varray, dobj->name);
             dobj->prefix = dobj->hdrs.file;
             dobj->hashfile = NULL;
             dobj->data.file = data_file(r->pool, conf, dobj, tmp);
@@ -1317,9 +1680,11 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
                                                  &cache_disk_module);
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
     apr_status_t rv;
+    int vary;
 
     /* write the headers to disk at the last possible moment */
     rv = write_headers(h, r);
+    vary = dobj->vary.tempfd != NULL;
 
     /* move header and data tempfiles to the final destination */
     if (APR_SUCCESS == rv) {
@@ -1337,6 +1702,13 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
         }
     }
 
+    /* the index may describe the files we just replaced */
+    index_remove(r, dobj->hdrs.file);
+    if (dobj->vary.file && dobj->hdrs.file
+            && strcmp(dobj->vary.file, dobj->hdrs.file)) {
+        index_remove(r, dobj->vary.file);
+    }
+
     /* remove the cached items completely on any failure */
     if (APR_SUCCESS != rv) {
         remove_url(h, r);
@@ -1345,6 +1717,10 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
                 dobj->name);
     }
     else {
+        if (vary) {
+            journal_vary(r, conf, h->cache_obj);
+        }
+        journal_store(r, conf, h->cache_obj);
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00737)
                 "commit_entity: Headers and body for URL %s cached.",
                 dobj->name);
@@ -1520,6 +1896,50 @@ static const char
     return NULL;
 }
 
+static const char
+*set_cache_index(cmd_parms *parms, void *in_struct_ptr, const char *arg)
+{
+    const char *err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    const char *sep, *name;
+
+    if (err) {
+        return err;
+    }
+
+    /* Argument is of form 'name:args' or just 'name'. */
+    sep = ap_strchr_c(arg, ':');
+    if (sep) {
+        name = apr_pstrmemdup(parms->pool, arg, sep - arg);
+        index_args = sep + 1;
+    }
+    else {
+        name = arg;
+        index_args = NULL;
+    }
+
+    index_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, name,
+                                        AP_SOCACHE_PROVIDER_VERSION);
+    if (index_provider == NULL) {
+        return apr_psprintf(parms->pool,
+                            "Unknown socache provider '%s'. Maybe you need "
+                            "to load the appropriate socache module "
+                            "(mod_socache_%s?)", name, name);
+    }
+    return NULL;
+}
+
+static const char
+*set_cache_journal(cmd_parms *parms, void *in_struct_ptr, int flag)
+{
+    const char *err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+
+    if (err) {
+        return err;
+    }
+    journal = flag;
+    return NULL;
+}
+
 static const command_rec disk_cache_cmds[] =
 {
     AP_INIT_TAKE1("CacheRoot", set_cache_root, NULL, RSRC_CONF,
@@ -1536,6 +1956,11 @@ static const command_rec disk_cache_cmds[] =
                   "The maximum quantity of data to attempt to read and cache in one go"),
     AP_INIT_TAKE1("CacheReadTime", set_cache_readtime, NULL, RSRC_CONF | ACCESS_CONF,
                   "The maximum time taken to attempt to read and cache in go"),
+    AP_INIT_TAKE1("CacheDiskIndex", set_cache_index, NULL, RSRC_CONF,
+                  "The shared object cache used to index cached headers"),
+    AP_INIT_FLAG("CacheDiskJournal", set_cache_journal, NULL, RSRC_CONF,
+                 "Append the entities stored and removed to a journal in the "
+                 "cache root, for use by htcacheclean -j"),
     {NULL}
 };
 
@@ -1553,11 +1978,194 @@ static const cache_provider cache_disk_provider =
     &invalidate_entity
 };
 
+static apr_status_t remove_index_lock(void *data)
+{
+    if (index_mutex) {
+        apr_global_mutex_destroy(index_mutex);
+        index_mutex = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t destroy_index(void *data)
+{
+    server_rec *s = data;
+
+    if (index_instance) {
+        index_provider->destroy(index_instance, s);
+        index_instance = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+static int disk_cache_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                 apr_pool_t *ptmp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, cache_disk_index_id, NULL,
+                                        APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02872)
+                "failed to register %s mutex", cache_disk_index_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    /* forget the index of the previous generation */
+    index_provider = NULL;
+    index_args = NULL;
+    journal = 0;
+
+    return OK;
+}
+
+/*
+ * Read the key of the hash naming the files of the cache root, or create
+ * it if the root has none yet. It has to outlive the server for cached
+ * entities to be found again after a restart, and be the same for all
+ * servers sharing the root.
+ */
+static apr_status_t load_hash_key(apr_pool_t *p, disk_cache_conf *conf)
+{
+    const char *file = apr_pstrcat(p, conf->cache_root, "/",
+                                   CACHE_HASH_KEY_FILE, NULL);
+    apr_file_t *fd;
+    apr_status_t rv;
+
+    rv = apr_file_open(&fd, file, APR_FOPEN_READ | APR_FOPEN_BINARY, 0, p);
+    if (APR_STATUS_IS_ENOENT(rv)) {
+#if APR_HAS_RANDOM
+        rv = apr_generate_random_bytes(conf->hash_key, CACHE_HASH_KEY_LEN);
+#else
+#error APR random number support is missing
+#endif
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        rv = apr_file_open(&fd, file, APR_FOPEN_WRITE | APR_FOPEN_CREATE
+                           | APR_FOPEN_EXCL | APR_FOPEN_BINARY,
+                           APR_FPROT_UREAD | APR_FPROT_UWRITE
+                           | APR_FPROT_GREAD | APR_FPROT_WREAD, p);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_write_full(fd, conf->hash_key, CACHE_HASH_KEY_LEN,
+                                     NULL);
+            apr_file_close(fd);
+            if (rv != APR_SUCCESS) {
+                apr_file_remove(file, p);
+            }
+            return rv;
+        }
+        if (!APR_STATUS_IS_EEXIST(rv)) {
+            return rv;
+        }
+        /* another server sharing the root got there first */
+        rv = apr_file_open(&fd, file, APR_FOPEN_READ | APR_FOPEN_BINARY, 0, p);
+    }
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_file_read_full(fd, conf->hash_key, CACHE_HASH_KEY_LEN, NULL);
+    apr_file_close(fd);
+
+    return rv;
+}
+
+static int disk_cache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                  apr_pool_t *ptmp, server_rec *s)
+{
+    apr_status_t rv;
+    const char *errmsg;
+    static struct ap_socache_hints index_hints = { 64, 1024, 60000000 };
+    server_rec *vs;
+
+    /* don't create the keys for the configuration check pass */
+    for (vs = s; vs; vs = vs->next) {
+        disk_cache_conf *conf = ap_get_module_config(vs->module_config,
+                                                     &cache_disk_module);
+        if (!conf->cache_root
+            || ap_state_query(AP_SQ_MAIN_STATE)
+               == AP_SQ_MS_CREATE_PRE_CONFIG) {
+            continue;
+        }
+        rv = load_hash_key(ptmp, conf);
+        if (rv != APR_SUCCESS) {
+            /* names from a key of our own still can't be guessed */
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, vs, APLOGNO(02904)
+                    "could not read or create %s/%s, the entities cached "
+                    "under this root will not be found again after a "
+                    "restart nor by htcacheclean", conf->cache_root,
+                    CACHE_HASH_KEY_FILE);
+#if APR_HAS_RANDOM
+            rv = apr_generate_random_bytes(conf->hash_key,
+                                           CACHE_HASH_KEY_LEN);
+#endif
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, vs, APLOGNO(02905)
+                        "error generating the key of the cache hash");
+                return 500; /* An HTTP status would be a misnomer! */
+            }
+        }
+    }
+
+    if (!index_provider) {
+        return OK;
+    }
+
+    if (index_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&index_mutex, NULL, cache_disk_index_id,
+                                    NULL, s, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02873)
+                    "failed to create %s mutex", cache_disk_index_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+        apr_pool_cleanup_register(pconf, NULL, remove_index_lock,
+                                  apr_pool_cleanup_null);
+    }
+
+    errmsg = index_provider->create(&index_instance, index_args, ptmp, pconf);
+    if (errmsg) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, 0, plog, APLOGNO(02874)
+                "%s", errmsg);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    rv = index_provider->init(index_instance, cache_disk_index_id,
+                              &index_hints, s, pconf);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02875)
+                "failed to initialise %s cache", cache_disk_index_id);
+        index_instance = NULL;
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    apr_pool_cleanup_register(pconf, (void *) s, destroy_index,
+                              apr_pool_cleanup_null);
+
+    return OK;
+}
+
+static void disk_cache_child_init(apr_pool_t *p, server_rec *s)
+{
+    const char *lock;
+    apr_status_t rv;
+
+    if (!index_mutex) {
+        return;
+    }
+    lock = apr_global_mutex_lockfile(index_mutex);
+    rv = apr_global_mutex_child_init(&index_mutex, lock, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(02876)
+                "failed to initialise mutex in child_init");
+    }
+}
+
 static void disk_cache_register_hook(apr_pool_t *p)
 {
     /* cache initializer */
     ap_register_provider(p, CACHE_PROVIDER_GROUP, "disk", "0",
                          &cache_disk_provider);
+    ap_hook_pre_config(disk_cache_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(disk_cache_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(disk_cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(cache_disk) = {
@@ -49,6 +49,9 @@ typedef struct disk_cache_object {
     const char *key;             /* On-disk prefix; URI with Vary bits (if present) */
     apr_off_t file_size;         /*  File size of the cached data file  */
     disk_cache_info_t disk_info; /* Header information. */
+    const char *header_buf;      /* Contents of the header file */
+    apr_size_t header_len;
+    apr_size_t header_pos;       /* Parse position within header_buf */
     apr_table_t *headers_in;     /* Input headers to save */
     apr_table_t *headers_out;    /* Output headers to save */
     apr_off_t offset;            /* Max size to set aside */
@@ -69,11 +72,24 @@ typedef struct disk_cache_object {
 #define DEFAULT_READSIZE 0
 #define DEFAULT_READTIME 0
 
+/* The header index */
+#define DISK_INDEX_MAX_HEADER 16384
+#define DISK_INDEX_TIMEOUT apr_time_from_sec(3600)
+
+/* The header file an index entry was read from, preceding its contents */
+typedef struct {
+    apr_ino_t inode;
+    apr_dev_t device;
+    apr_time_t mtime;
+    apr_off_t size;
+} disk_index_ident_t;
+
 typedef struct {
     const char* cache_root;
     apr_size_t cache_root_len;
     int dirlevels;               /* Number of levels of subdirectories */
     int dirlength;               /* Length of subdirectory names */
+    unsigned char hash_key[CACHE_HASH_KEY_LEN]; /* see CACHE_HASH_KEY_FILE */
 } disk_cache_conf;
 
 typedef struct {
@@ -0,0 +1,2103 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "apr_lib.h"
+#include "apr_strings.h"
+#include "apr_buckets.h"
+#include "apr_shm.h"
+#include "apr_global_mutex.h"
+#include "httpd.h"
+#include "http_config.h"
+#include "http_log.h"
+#include "http_core.h"
+#include "http_protocol.h"
+#include "ap_provider.h"
+#include "util_mutex.h"
+
+#include "mod_cache.h"
+#include "mod_status.h"
+
+#include "cache_common.h"
+
+/*
+ * mod_cache_shm: Shared Memory Based HTTP 1.1 Cache.
+ *
+ * The cache is one shared memory segment, created at startup and shared
+ * by all the children, split into partitions which each have their own
+ * lock.  A partition is made of fixed size chunks, an entry being stored
+ * in a chain of chunks as:
+ *
+ *   key
+ *   cache_shm_info_t
+ *   entity name [length is in cache_shm_info_t->name_len]
+ *   r->headers_out (delimited by CRLF)
+ *   CRLF
+ *   r->headers_in (delimited by CRLF)
+ *   CRLF
+ *   body
+ *
+ * or, for a URL with a Vary header:
+ *
+ *   key
+ *   cache_shm_info_t (format is CACHE_SHM_VARY_FORMAT)
+ *   vary headers (delimited by CRLF)
+ *   CRLF
+ *
+ * where the key of the entity is then regenerated from the request
+ * headers listed, like mod_cache_socache does.
+ *
+ * Entries are found through a hash index and kept in a segmented LRU: new
+ * entries go to the probation segment, those hit again move up to the
+ * protected one, which is capped to 80% of the partition and demotes its
+ * least recently used entries back to probation.  When a partition is
+ * full, the victims are taken from the tail of probation first, and a new
+ * entry is only admitted if the key was requested more often than each of
+ * the victims recently (TinyLFU), as estimated by a count-min sketch
+ * which is halved periodically.  This keeps one-hit wonders from
+ * flushing the hot set.
+ *
+ * Hits are served with buckets pointing right into the shared memory,
+ * the entry being pinned until the last of them is destroyed: it can
+ * still be replaced or removed meanwhile, but its chunks are only freed
+ * once the last reader is done with them.  Buckets set aside, which may
+ * outlive the request, are copied out of the shared memory.
+ */
+
+module AP_MODULE_DECLARE_DATA cache_shm_module;
+
+#define CACHE_SHM_VARY_FORMAT   1
+#define CACHE_SHM_ENTITY_FORMAT 2
+
+typedef struct {
+    /* Indicates the format of the header struct stored in the cache. */
+    apr_uint32_t format;
+    /* The HTTP status code returned for this response.  */
+    int status;
+    /* The size of the entity name that follows. */
+    apr_size_t name_len;
+    /* Miscellaneous time values. */
+    apr_time_t date;
+    apr_time_t expire;
+    apr_time_t request_time;
+    apr_time_t response_time;
+    /* Does this cached request have a body? */
+    unsigned int header_only:1;
+    /* The parsed cache control header */
+    cache_control_t control;
+} cache_shm_info_t;
+
+/* No chunk or entry */
+#define CACHE_SHM_NONE          APR_UINT32_MAX
+
+/* The segments of the LRU, and the other states of an entry */
+#define CACHE_SHM_PROBATION     0
+#define CACHE_SHM_PROTECTED     1
+#define CACHE_SHM_FREE          2
+#define CACHE_SHM_WRITING       3   /* chunks reserved, not indexed yet */
+#define CACHE_SHM_DEAD          4   /* removed but still pinned */
+
+/* The protected segment may use that part of the chunks (in percent) */
+#define CACHE_SHM_PROTECTED_SHARE 80
+
+/* The count-min sketch: rows of 4 bit counters (stored in bytes), halved
+ * every SKETCH_SAMPLE * width increments.
+ */
+#define SKETCH_DEPTH    4
+#define SKETCH_MAX      15
+#define SKETCH_SAMPLE   10
+
+/* An entry may not use more than this part of its partition's chunks */
+#define CACHE_SHM_MAX_SHARE 2
+
+typedef struct {
+    apr_uint64_t hash;          /* of the key */
+    apr_time_t expire;          /* when to drop the entry */
+    apr_size_t key_len;
+    apr_size_t meta_len;        /* key, info and headers: where the body starts */
+    apr_size_t data_len;        /* all of it */
+    apr_uint32_t hnext;         /* next entry in the hash bucket/free list */
+    apr_uint32_t prev, next;    /* neighbours in the LRU segment */
+    apr_uint32_t first;         /* first chunk of the chain */
+    apr_uint32_t nchunks;
+    apr_uint32_t refs;          /* requests serving it */
+    apr_uint32_t state;
+} cache_shm_entry_t;
+
+/* The head of a partition in the shared memory, the tables and the
+ * chunks follow at the given offsets.
+ */
+typedef struct {
+    apr_uint32_t nchunks;       /* also the number of entries, hash buckets
+                                 * and sketch counters per row */
+    apr_uint32_t free_chunk;
+    apr_uint32_t free_chunks;
+    apr_uint32_t free_entry;
+    apr_uint32_t head[2], tail[2];  /* of the LRU segments, MRU first */
+    apr_uint32_t used[2];       /* chunks in each segment */
+    apr_uint32_t protected_max;
+    apr_uint32_t sketch_ops;
+    apr_uint32_t entries;
+    apr_uint64_t hits, misses, stores, rejected, evictions;
+    apr_size_t buckets_off, entries_off, chain_off, sketch_off, chunks_off;
+} cache_shm_header_t;
+
+/* A partition, as seen by this process */
+typedef struct {
+    cache_shm_header_t *header;
+    apr_uint32_t *buckets;
+    cache_shm_entry_t *entries;
+    apr_uint32_t *chain;        /* next chunk of each chunk */
+    unsigned char *sketch;
+    char *chunks;
+    apr_global_mutex_t *mutex;
+} cache_shm_part_t;
+
+/* An entry being served by this request */
+typedef struct {
+    cache_shm_part_t *part;
+    apr_uint32_t entry;
+} cache_shm_pin_t;
+
+/* The body of an entry, pinned by its buckets */
+typedef struct {
+    cache_shm_pin_t pin;
+    apr_uint32_t refs;          /* chunk buckets */
+} cache_shm_body_t;
+
+/* A CACHE_SHM bucket, some data of a chunk */
+typedef struct {
+    apr_bucket_refcount refcount;
+    cache_shm_body_t *body;
+    const char *base;           /* the chunk */
+} cache_shm_bucket_t;
+
+/*
+ * cache_shm_object_t
+ * Pointed to by cache_object_t::vobj
+ */
+typedef struct cache_shm_object_t
+{
+    apr_pool_t *pool; /* pool */
+    unsigned char *buffer; /* the headers buffer */
+    apr_size_t buffer_len; /* size of the buffer */
+    apr_size_t meta_len; /* size of the headers in the buffer */
+    apr_bucket_brigade *body; /* brigade containing the body, if any */
+    apr_table_t *headers_in; /* Input headers to save */
+    apr_table_t *headers_out; /* Output headers to save */
+    cache_shm_info_t shm_info; /* Header information. */
+    unsigned int newbody :1; /* whether a new body is present */
+    apr_time_t expire; /* when to expire the entry */
+
+    const char *name; /* Requested URI without vary bits - suitable for mortals. */
+    const char *key; /* URI with Vary bits (if present) */
+    apr_off_t file_size; /* Size of the cached body */
+    apr_off_t offset; /* Max size to set aside */
+    apr_time_t timeout; /* Max time to set aside */
+    unsigned int done :1; /* Is the attempt to cache complete? */
+} cache_shm_object_t;
+
+/*
+ * mod_cache_shm configuration
+ */
+#define DEFAULT_SHM_SIZE (64*1024*1024)
+#define DEFAULT_CHUNK_SIZE 4096
+#define DEFAULT_PARTITIONS 16
+#define DEFAULT_MAX_FILE_SIZE 1024*1024
+#define DEFAULT_MAXTIME 86400
+#define DEFAULT_MINTIME 600
+#define DEFAULT_READSIZE 0
+#define DEFAULT_READTIME 0
+
+typedef struct cache_shm_dir_conf
+{
+    apr_off_t max; /* maximum file size for cached files */
+    apr_time_t maxtime; /* maximum expiry time */
+    apr_time_t mintime; /* minimum expiry time */
+    apr_off_t readsize; /* maximum data to attempt to cache in one go */
+    apr_time_t readtime; /* maximum time taken to cache in one go */
+    unsigned int max_set :1;
+    unsigned int maxtime_set :1;
+    unsigned int mintime_set :1;
+    unsigned int readsize_set :1;
+    unsigned int readtime_set :1;
+} cache_shm_dir_conf;
+
+/* The shared memory is global to the server, so is its configuration */
+static apr_off_t shm_size = DEFAULT_SHM_SIZE;
+static apr_size_t chunk_size = DEFAULT_CHUNK_SIZE;
+static int num_parts = DEFAULT_PARTITIONS;
+
+static const char * const cache_shm_id = "cache-shm";
+static apr_shm_t *cache_shm = NULL;
+static cache_shm_part_t *parts = NULL;
+
+/*
+ * Local static functions
+ */
+
+/* the first half of the hash of the key, with the key of this server */
+static apr_uint64_t hash_key(const char *key, apr_size_t len)
+{
+    unsigned char hash[CACHE_HASH_LEN];
+    apr_uint64_t h = 0;
+    int i;
+
+    ap_cache_hash(NULL, key, len, hash);
+    for (i = 7; i >= 0; i--) {
+        h = (h << 8) | hash[i];
+    }
+    return h;
+}
+
+static cache_shm_part_t *part_of(apr_uint64_t hash)
+{
+    return &parts[(hash >> 48) % num_parts];
+}
+
+static APR_INLINE char *chunk_at(cache_shm_part_t *part, apr_uint32_t chunk)
+{
+    return part->chunks + (apr_size_t)chunk * chunk_size;
+}
+
+/* Copy len bytes of the entry from offset (walking the chain from the
+ * start, offsets are small here: the key and the headers).
+ */
+static void chain_read(cache_shm_part_t *part, cache_shm_entry_t *e,
+                       apr_size_t offset, char *buf, apr_size_t len)
+{
+    apr_uint32_t chunk = e->first;
+
+    while (offset >= chunk_size) {
+        chunk = part->chain[chunk];
+        offset -= chunk_size;
+    }
+    while (len) {
+        apr_size_t n = chunk_size - offset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(buf, chunk_at(part, chunk) + offset, n);
+        buf += n;
+        len -= n;
+        offset = 0;
+        chunk = part->chain[chunk];
+    }
+}
+
+typedef struct {
+    cache_shm_part_t *part;
+    apr_uint32_t chunk;
+    apr_size_t offset;
+} chain_cursor_t;
+
+static void chain_write(chain_cursor_t *cur, const char *data,
+                        apr_size_t len)
+{
+    while (len) {
+        apr_size_t n;
+        if (cur->offset == chunk_size) {
+            cur->chunk = cur->part->chain[cur->chunk];
+            cur->offset = 0;
+        }
+        n = chunk_size - cur->offset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(chunk_at(cur->part, cur->chunk) + cur->offset, data, n);
+        cur->offset += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static int key_matches(cache_shm_part_t *part, cache_shm_entry_t *e,
+                       const char *key, apr_size_t len)
+{
+    apr_uint32_t chunk = e->first;
+
+    while (len) {
+        apr_size_t n = len < chunk_size ? len : chunk_size;
+        if (memcmp(chunk_at(part, chunk), key, n)) {
+            return 0;
+        }
+        key += n;
+        len -= n;
+        chunk = part->chain[chunk];
+    }
+    return 1;
+}
+
+/*
+ * TinyLFU frequency sketch, the partition must be locked
+ */
+static void sketch_add(cache_shm_part_t *part, apr_uint64_t hash)
+{
+    cache_shm_header_t *h = part->header;
+    apr_uint32_t h1 = (apr_uint32_t)hash, h2 = (apr_uint32_t)(hash >> 32) | 1;
+    int i;
+
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        unsigned char *c = &part->sketch[(apr_size_t)i * h->nchunks
+                                         + (h1 + i * h2) % h->nchunks];
+        if (*c < SKETCH_MAX) {
+            (*c)++;
+        }
+    }
+
+    /* age the counts so that the sketch follows the popularity changes */
+    if (++h->sketch_ops >= (apr_uint64_t)SKETCH_SAMPLE * h->nchunks) {
+        apr_size_t n = (apr_size_t)SKETCH_DEPTH * h->nchunks, j;
+        for (j = 0; j < n; j++) {
+            part->sketch[j] >>= 1;
+        }
+        h->sketch_ops = 0;
+    }
+}
+
+static int sketch_count(cache_shm_part_t *part, apr_uint64_t hash)
+{
+    cache_shm_header_t *h = part->header;
+    apr_uint32_t h1 = (apr_uint32_t)hash, h2 = (apr_uint32_t)(hash >> 32) | 1;
+    int i, count = SKETCH_MAX;
+
+    for (i = 0; i < SKETCH_DEPTH; i++) {
+        unsigned char c = part->sketch[(apr_size_t)i * h->nchunks
+                                       + (h1 + i * h2) % h->nchunks];
+        if (c < count) {
+            count = c;
+        }
+    }
+    return count;
+}
+
+/*
+ * Segmented LRU and entries, the partition must be locked
+ */
+static void lru_unlink(cache_shm_part_t *part, apr_uint32_t idx)
+{
+    cache_shm_header_t *h = part->header;
+    cache_shm_entry_t *e = &part->entries[idx];
+    apr_uint32_t seg = e->state;
+
+    if (e->prev != CACHE_SHM_NONE) {
+        part->entries[e->prev].next = e->next;
+    }
+    else {
+        h->head[seg] = e->next;
+    }
+    if (e->next != CACHE_SHM_NONE) {
+        part->entries[e->next].prev = e->prev;
+    }
+    else {
+        h->tail[seg] = e->prev;
+    }
+    h->used[seg] -= e->nchunks;
+}
+
+static void lru_push(cache_shm_part_t *part, apr_uint32_t idx,
+                     apr_uint32_t seg)
+{
+    cache_shm_header_t *h = part->header;
+    cache_shm_entry_t *e = &part->entries[idx];
+
+    e->state = seg;
+    e->prev = CACHE_SHM_NONE;
+    e->next = h->head[seg];
+    if (h->head[seg] != CACHE_SHM_NONE) {
+        part->entries[h->head[seg]].prev = idx;
+    }
+    else {
+        h->tail[seg] = idx;
+    }
+    h->head[seg] = idx;
+    h->used[seg] += e->nchunks;
+}
+
+/* A hit: move the entry up, to the protected segment if it was on
+ * probation, demoting the protected segment's LRU entries if needed.
+ */
+static void lru_touch(cache_shm_part_t *part, apr_uint32_t idx)
+{
+    cache_shm_header_t *h = part->header;
+
+    lru_unlink(part, idx);
+    lru_push(part, idx, CACHE_SHM_PROTECTED);
+    while (h->used[CACHE_SHM_PROTECTED] > h->protected_max
+           && h->tail[CACHE_SHM_PROTECTED] != idx) {
+        apr_uint32_t demoted = h->tail[CACHE_SHM_PROTECTED];
+        lru_unlink(part, demoted);
+        lru_push(part, demoted, CACHE_SHM_PROBATION);
+    }
+}
+
+static void entry_free(cache_shm_part_t *part, apr_uint32_t idx)
+{
+    cache_shm_header_t *h = part->header;
+    cache_shm_entry_t *e = &part->entries[idx];
+    apr_uint32_t chunk = e->first, n;
+
+    for (n = 0; n < e->nchunks; n++) {
+        apr_uint32_t next = part->chain[chunk];
+        part->chain[chunk] = h->free_chunk;
+        h->free_chunk = chunk;
+        chunk = next;
+    }
+    h->free_chunks += e->nchunks;
+
+    e->state = CACHE_SHM_FREE;
+    e->nchunks = 0;
+    e->hnext = h->free_entry;
+    h->free_entry = idx;
+}
+
+static apr_uint32_t entry_lookup(cache_shm_part_t *part, apr_uint64_t hash,
+                                 const char *key, apr_size_t len)
+{
+    apr_uint32_t idx = part->buckets[hash % part->header->nchunks];
+
+    while (idx != CACHE_SHM_NONE) {
+        cache_shm_entry_t *e = &part->entries[idx];
+        if (e->hash == hash && e->key_len == len
+                && key_matches(part, e, key, len)) {
+            break;
+        }
+        idx = e->hnext;
+    }
+    return idx;
+}
+
+/* Take an indexed entry out, its chunks are freed once it is not
+ * pinned anymore.
+ */
+static void entry_remove(cache_shm_part_t *part, apr_uint32_t idx)
+{
+    cache_shm_entry_t *e = &part->entries[idx];
+    apr_uint32_t *link = &part->buckets[e->hash % part->header->nchunks];
+
+    while (*link != idx) {
+        link = &part->entries[*link].hnext;
+    }
+    *link = e->hnext;
+    lru_unlink(part, idx);
+    part->header->entries--;
+
+    if (e->refs) {
+        e->state = CACHE_SHM_DEAD;
+    }
+    else {
+        entry_free(part, idx);
+    }
+}
+
+/* Make room for need chunks, evicting the LRU entries which are not
+ * pinned, if the new entry is more popular than each of them.
+ * Returns whether there is room now.
+ */
+static int make_room(cache_shm_part_t *part, apr_uint32_t need,
+                     apr_uint64_t hash)
+{
+    cache_shm_header_t *h = part->header;
+    apr_uint32_t found = h->free_chunks, idx;
+    int seg, count;
+
+    if (found >= need) {
+        return 1;
+    }
+
+    /* first check that enough victims would be admitted against */
+    count = sketch_count(part, hash);
+    for (seg = CACHE_SHM_PROBATION; seg <= CACHE_SHM_PROTECTED; seg++) {
+        for (idx = h->tail[seg]; idx != CACHE_SHM_NONE && found < need;
+             idx = part->entries[idx].prev) {
+            cache_shm_entry_t *e = &part->entries[idx];
+            if (e->refs) {
+                continue;
+            }
+            if (sketch_count(part, e->hash) >= count) {
+                h->rejected++;
+                return 0;
+            }
+            found += e->nchunks;
+        }
+    }
+    if (found < need) {
+        /* too much is being served right now */
+        h->rejected++;
+        return 0;
+    }
+
+    /* then evict them */
+    for (seg = CACHE_SHM_PROBATION;
+         h->free_chunks < need && seg <= CACHE_SHM_PROTECTED; ) {
+        idx = h->tail[seg];
+        while (idx != CACHE_SHM_NONE && part->entries[idx].refs) {
+            idx = part->entries[idx].prev;
+        }
+        if (idx == CACHE_SHM_NONE) {
+            seg++;
+            continue;
+        }
+        entry_remove(part, idx);
+        h->evictions++;
+    }
+    return 1;
+}
+
+/*
+ * Locking
+ */
+static apr_status_t part_lock(cache_shm_part_t *part, request_rec *r)
+{
+    apr_status_t rv = apr_global_mutex_lock(part->mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02832)
+                "could not acquire lock, ignoring");
+    }
+    return rv;
+}
+
+static void part_unlock(cache_shm_part_t *part, request_rec *r)
+{
+    apr_status_t rv = apr_global_mutex_unlock(part->mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02833)
+                "could not release lock");
+    }
+}
+
+static void entry_unpin(cache_shm_pin_t *pin)
+{
+    cache_shm_part_t *part = pin->part;
+    cache_shm_entry_t *e = &part->entries[pin->entry];
+
+    if (apr_global_mutex_lock(part->mutex) != APR_SUCCESS) {
+        /* better leaked than freed while in use */
+        return;
+    }
+    if (!--e->refs && e->state == CACHE_SHM_DEAD) {
+        entry_free(part, pin->entry);
+    }
+    apr_global_mutex_unlock(part->mutex);
+}
+
+static apr_status_t unpin_entry(void *data)
+{
+    entry_unpin(data);
+    return APR_SUCCESS;
+}
+
+/*
+ * The CACHE_SHM bucket type: the data is read in place, the last bucket
+ * of a body destroyed unpins its entry.  Setting aside copies the data to
+ * the heap, since it could then outlive both the request and the pin.
+ */
+static void shm_bucket_destroy(void *data)
+{
+    cache_shm_bucket_t *s = data;
+
+    if (apr_bucket_shared_destroy(s)) {
+        cache_shm_body_t *body = s->body;
+
+        if (!--body->refs) {
+            entry_unpin(&body->pin);
+            apr_bucket_free(body);
+        }
+        apr_bucket_free(s);
+    }
+}
+
+static apr_status_t shm_bucket_read(apr_bucket *b, const char **str,
+                                    apr_size_t *len, apr_read_type_e block)
+{
+    cache_shm_bucket_t *s = b->data;
+
+    *str = s->base + b->start;
+    *len = b->length;
+    return APR_SUCCESS;
+}
+
+static apr_status_t shm_bucket_setaside(apr_bucket *b, apr_pool_t *p)
+{
+    cache_shm_bucket_t *s = b->data;
+
+    /* copies the data, before the pin is released */
+    apr_bucket_heap_make(b, s->base + b->start, b->length, NULL);
+    shm_bucket_destroy(s);
+
+    return APR_SUCCESS;
+}
+
+static const apr_bucket_type_t bucket_type_cache_shm = {
+    "CACHE_SHM", 5, APR_BUCKET_DATA,
+    shm_bucket_destroy,
+    shm_bucket_read,
+    shm_bucket_setaside,
+    apr_bucket_shared_split,
+    apr_bucket_shared_copy
+};
+
+static apr_bucket *shm_bucket_create(cache_shm_body_t *body,
+                                     const char *base, apr_size_t len,
+                                     apr_bucket_alloc_t *list)
+{
+    apr_bucket *b = apr_bucket_alloc(sizeof(*b), list);
+    cache_shm_bucket_t *s = apr_bucket_alloc(sizeof(*s), list);
+
+    APR_BUCKET_INIT(b);
+    b->free = apr_bucket_free;
+    b->list = list;
+    s->body = body;
+    s->base = base;
+    body->refs++;
+    b = apr_bucket_shared_make(b, s, 0, len);
+    b->type = &bucket_type_cache_shm;
+
+    return b;
+}
+
+/*
+ * Find an entry and pin it for the lifetime of the request, returning a
+ * copy of its headers.  Finding a Vary entry is not a hit yet.
+ */
+static cache_shm_pin_t *cache_shm_get(request_rec *r, const char *key,
+                                      char **meta, apr_size_t *meta_len)
+{
+    apr_size_t len = strlen(key);
+    apr_uint64_t hash = hash_key(key, len);
+    cache_shm_part_t *part = part_of(hash);
+    cache_shm_entry_t *e = NULL;
+    cache_shm_pin_t *pin;
+    apr_uint32_t idx, format = 0;
+
+    if (part_lock(part, r) != APR_SUCCESS) {
+        return NULL;
+    }
+    sketch_add(part, hash);
+    idx = entry_lookup(part, hash, key, len);
+    if (idx != CACHE_SHM_NONE) {
+        e = &part->entries[idx];
+        if (e->expire < r->request_time) {
+            entry_remove(part, idx);
+            e = NULL;
+        }
+    }
+    if (!e) {
+        part->header->misses++;
+        part_unlock(part, r);
+        return NULL;
+    }
+    if (e->meta_len - e->key_len >= sizeof(cache_shm_info_t)) {
+        chain_read(part, e, e->key_len, (char *)&format, sizeof(format));
+    }
+    if (format != CACHE_SHM_VARY_FORMAT) {
+        part->header->hits++;
+    }
+    lru_touch(part, idx);
+    e->refs++;
+    part_unlock(part, r);
+
+    pin = apr_palloc(r->pool, sizeof(*pin));
+    pin->part = part;
+    pin->entry = idx;
+    apr_pool_cleanup_register(r->pool, pin, unpin_entry,
+                              apr_pool_cleanup_null);
+
+    /* pinned, the chunks won't change under us */
+    *meta_len = e->meta_len - e->key_len;
+    *meta = apr_palloc(r->pool, *meta_len + 1);
+    chain_read(part, e, e->key_len, *meta, *meta_len);
+    (*meta)[*meta_len] = '\0';
+
+    return pin;
+}
+
+/*
+ * Add buckets pointing to the body of a pinned entry, handing the pin of
+ * the request over to them.
+ */
+static void cache_shm_body(request_rec *r, cache_shm_pin_t *pin,
+                           apr_bucket_brigade *bb)
+{
+    cache_shm_part_t *part = pin->part;
+    cache_shm_entry_t *e = &part->entries[pin->entry];
+    apr_size_t offset = e->meta_len, len = e->data_len - e->meta_len;
+    apr_uint32_t chunk = e->first;
+    cache_shm_body_t *body;
+
+    if (!len) {
+        return;
+    }
+    body = apr_bucket_alloc(sizeof(*body), bb->bucket_alloc);
+    body->pin = *pin;
+    body->refs = 0;
+    apr_pool_cleanup_kill(r->pool, pin, unpin_entry);
+
+    while (offset >= chunk_size) {
+        chunk = part->chain[chunk];
+        offset -= chunk_size;
+    }
+    while (len) {
+        apr_size_t n = chunk_size - offset;
+        apr_bucket *b;
+        if (n > len) {
+            n = len;
+        }
+        b = shm_bucket_create(body, chunk_at(part, chunk) + offset, n,
+                              bb->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, b);
+        len -= n;
+        offset = 0;
+        chunk = part->chain[chunk];
+    }
+}
+
+/*
+ * Store (or replace) an entry: reserve its chunks, then fill them
+ * unlocked, then index it.
+ */
+static apr_status_t cache_shm_put(request_rec *r, const char *key,
+                                  apr_time_t expire,
+                                  const unsigned char *meta,
+                                  apr_size_t meta_len,
+                                  apr_bucket_brigade *body)
+{
+    apr_size_t len = strlen(key), data_len;
+    apr_uint64_t hash = hash_key(key, len);
+    cache_shm_part_t *part = part_of(hash);
+    cache_shm_header_t *h = part->header;
+    cache_shm_entry_t *e;
+    chain_cursor_t cur;
+    apr_uint32_t idx, need, n;
+    apr_off_t body_len = 0;
+    apr_status_t rv = APR_SUCCESS;
+
+    if (body) {
+        apr_brigade_length(body, 1, &body_len);
+    }
+    data_len = len + meta_len + body_len;
+    need = (apr_uint32_t)((data_len + chunk_size - 1) / chunk_size);
+    if (need > h->nchunks / CACHE_SHM_MAX_SHARE) {
+        return APR_ENOSPC;
+    }
+
+    if ((rv = part_lock(part, r)) != APR_SUCCESS) {
+        return rv;
+    }
+    if (!make_room(part, need, hash)) {
+        part_unlock(part, r);
+        return APR_ENOSPC;
+    }
+    /* each used entry has a chunk at least, so one is free */
+    idx = h->free_entry;
+    e = &part->entries[idx];
+    h->free_entry = e->hnext;
+    e->state = CACHE_SHM_WRITING;
+    e->refs = 0;
+    e->first = h->free_chunk;
+    for (n = 1; n < need; n++) {
+        h->free_chunk = part->chain[h->free_chunk];
+    }
+    e->nchunks = need;
+    h->free_chunks -= need;
+    {
+        apr_uint32_t last = h->free_chunk;
+        h->free_chunk = part->chain[last];
+        part->chain[last] = CACHE_SHM_NONE;
+    }
+    part_unlock(part, r);
+
+    /* nobody else sees these chunks until indexed (should the process
+     * die meanwhile, they would only be lost until the next restart)
+     */
+    cur.part = part;
+    cur.chunk = e->first;
+    cur.offset = 0;
+    chain_write(&cur, key, len);
+    chain_write(&cur, (const char *)meta, meta_len);
+    if (body) {
+        apr_bucket *b;
+        for (b = APR_BRIGADE_FIRST(body);
+             b != APR_BRIGADE_SENTINEL(body);
+             b = APR_BUCKET_NEXT(b)) {
+            const char *str;
+            apr_size_t slen;
+            rv = apr_bucket_read(b, &str, &slen, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                break;
+            }
+            chain_write(&cur, str, slen);
+        }
+    }
+
+    if (part_lock(part, r) != APR_SUCCESS) {
+        /* leak rather than risk corrupting the partition */
+        return APR_EGENERAL;
+    }
+    if (rv != APR_SUCCESS) {
+        entry_free(part, idx);
+        part_unlock(part, r);
+        return rv;
+    }
+    n = entry_lookup(part, hash, key, len);
+    if (n != CACHE_SHM_NONE) {
+        entry_remove(part, n);
+    }
+    e->hash = hash;
+    e->expire = expire;
+    e->key_len = len;
+    e->meta_len = len + meta_len;
+    e->data_len = data_len;
+    e->hnext = part->buckets[hash % h->nchunks];
+    part->buckets[hash % h->nchunks] = idx;
+    lru_push(part, idx, CACHE_SHM_PROBATION);
+    h->entries++;
+    h->stores++;
+    part_unlock(part, r);
+
+    return APR_SUCCESS;
+}
+
+static void cache_shm_remove(request_rec *r, const char *key)
+{
+    apr_size_t len = strlen(key);
+    apr_uint64_t hash = hash_key(key, len);
+    cache_shm_part_t *part = part_of(hash);
+    apr_uint32_t idx;
+
+    if (part_lock(part, r) != APR_SUCCESS) {
+        return;
+    }
+    idx = entry_lookup(part, hash, key, len);
+    if (idx != CACHE_SHM_NONE) {
+        entry_remove(part, idx);
+    }
+    part_unlock(part, r);
+}
+
+/*
+ * Headers (de)serialization
+ */
+static apr_status_t read_array(request_rec *r, apr_array_header_t *arr,
+        const char *buffer, apr_size_t buffer_len, apr_size_t *slider)
+{
+    apr_size_t val = *slider;
+
+    while (*slider < buffer_len) {
+        if (buffer[*slider] == '\r') {
+            if (val == *slider) {
+                (*slider)++;
+                if (*slider < buffer_len && buffer[*slider] == '\n') {
+                    (*slider)++;
+                }
+                return APR_SUCCESS;
+            }
+            *((const char **) apr_array_push(arr)) = apr_pstrmemdup(r->pool,
+                    buffer + val, *slider - val);
+            (*slider)++;
+            if (*slider < buffer_len && buffer[*slider] == '\n') {
+                (*slider)++;
+            }
+            val = *slider;
+        }
+        else {
+            (*slider)++;
+        }
+    }
+
+    return APR_EOF;
+}
+
+static apr_status_t read_table(request_rec *r, apr_table_t *table,
+        char *buffer, apr_size_t buffer_len, apr_size_t *slider)
+{
+    apr_size_t key = *slider, colon = 0;
+
+    while (*slider < buffer_len) {
+        if (buffer[*slider] == ':') {
+            if (!colon) {
+                colon = *slider;
+            }
+            (*slider)++;
+        }
+        else if (buffer[*slider] == '\r') {
+            if (key == *slider) {
+                (*slider)++;
+                if (*slider < buffer_len && buffer[*slider] == '\n') {
+                    (*slider)++;
+                }
+                return APR_SUCCESS;
+            }
+            if (!colon) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02834)
+                        "Premature end of cache headers.");
+                return APR_EGENERAL;
+            }
+            /* the copy of the headers is ours, terminate in place */
+            buffer[colon++] = '\0';
+            while (apr_isspace(buffer[colon])) {
+                colon++;
+            }
+            buffer[*slider] = '\0';
+            apr_table_addn(table, buffer + key, buffer + colon);
+            (*slider)++;
+            if (*slider < buffer_len && buffer[*slider] == '\n') {
+                (*slider)++;
+            }
+            key = *slider;
+            colon = 0;
+        }
+        else {
+            (*slider)++;
+        }
+    }
+
+    return APR_EOF;
+}
+
+static apr_status_t store_array(apr_array_header_t *arr, unsigned char *buffer,
+        apr_size_t buffer_len, apr_size_t *slider)
+{
+    int i;
+    const char **elts = (const char **) arr->elts;
+
+    for (i = 0; i < arr->nelts; i++) {
+        apr_size_t e_len = strlen(elts[i]);
+        if (e_len + 3 >= buffer_len - *slider) {
+            return APR_EOF;
+        }
+        memcpy(buffer + *slider, elts[i], e_len);
+        *slider += e_len;
+        memcpy(buffer + *slider, CRLF, sizeof(CRLF) - 1);
+        *slider += sizeof(CRLF) - 1;
+    }
+    if (3 >= buffer_len - *slider) {
+        return APR_EOF;
+    }
+    memcpy(buffer + *slider, CRLF, sizeof(CRLF) - 1);
+    *slider += sizeof(CRLF) - 1;
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_table(apr_table_t *table, unsigned char *buffer,
+        apr_size_t buffer_len, apr_size_t *slider)
+{
+    int i;
+    apr_table_entry_t *elts;
+
+    elts = (apr_table_entry_t *) apr_table_elts(table)->elts;
+    for (i = 0; i < apr_table_elts(table)->nelts; ++i) {
+        if (elts[i].key != NULL) {
+            apr_size_t key_len = strlen(elts[i].key);
+            apr_size_t val_len = strlen(elts[i].val);
+            if (key_len + val_len + 5 >= buffer_len - *slider) {
+                return APR_EOF;
+            }
+            if (buffer) {
+                memcpy(buffer + *slider, elts[i].key, key_len);
+                memcpy(buffer + *slider + key_len, ": ", 2);
+                memcpy(buffer + *slider + key_len + 2, elts[i].val, val_len);
+                memcpy(buffer + *slider + key_len + 2 + val_len, CRLF,
+                       sizeof(CRLF) - 1);
+            }
+            *slider += key_len + val_len + 4;
+        }
+    }
+    if (3 >= buffer_len - *slider) {
+        return APR_EOF;
+    }
+    if (buffer) {
+        memcpy(buffer + *slider, CRLF, sizeof(CRLF) - 1);
+    }
+    *slider += sizeof(CRLF) - 1;
+
+    return APR_SUCCESS;
+}
+
+static const char* regen_key(request_rec *r, apr_table_t *headers,
+        apr_array_header_t *varray, const char *oldkey)
+{
+    struct iovec *iov;
+    int i, k;
+    int nvec;
+    const char *header;
+    const char **elts;
+
+    nvec = (varray->nelts * 2) + 1;
+    iov = apr_palloc(r->pool, sizeof(struct iovec) * nvec);
+    elts = (const char **) varray->elts;
+
+    for (i = 0, k = 0; i < varray->nelts; i++) {
+        header = ap_cache_vary_value(r, elts[i],
+                                     apr_table_get(headers, elts[i]));
+        if (!header) {
+            header = "";
+        }
+        iov[k].iov_base = (char*) elts[i];
+        iov[k].iov_len = strlen(elts[i]);
+        k++;
+        iov[k].iov_base = (char*) header;
+        iov[k].iov_len = strlen(header);
+        k++;
+    }
+    iov[k].iov_base = (char*) oldkey;
+    iov[k].iov_len = strlen(oldkey);
+    k++;
+
+    return apr_pstrcatv(r->pool, iov, k, NULL);
+}
+
+static int array_alphasort(const void *fn1, const void *fn2)
+{
+    return strcmp(*(char**) fn1, *(char**) fn2);
+}
+
+static void tokens_to_array(apr_pool_t *p, const char *data,
+        apr_array_header_t *arr)
+{
+    char *token;
+
+    while ((token = ap_get_list_item(p, &data)) != NULL) {
+        *((const char **) apr_array_push(arr)) = token;
+    }
+
+    /* Sort it so that "Vary: A, B" and "Vary: B, A" are stored the same. */
+    qsort((void *) arr->elts, arr->nelts, sizeof(char *), array_alphasort);
+}
+
+/*
+ * Hook and mod_cache callback functions
+ */
+static int create_entity(cache_handle_t *h, request_rec *r, const char *key,
+        apr_off_t len, apr_bucket_brigade *bb)
+{
+    cache_shm_dir_conf *dconf =
+            ap_get_module_config(r->per_dir_config, &cache_shm_module);
+    cache_object_t *obj;
+    cache_shm_object_t *sobj;
+
+    if (!parts) {
+        return DECLINED;
+    }
+
+    /* we don't support caching of range requests (yet), other than the
+     * slices of large entities mod_cache asks for on its own
+     */
+    if (r->status == HTTP_PARTIAL_CONTENT && !ap_cache_is_slice(r)) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02835)
+                "URL %s partial content response not cached",
+                key);
+        return DECLINED;
+    }
+
+    if (len < 0) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02836)
+                "URL '%s' had no explicit size, ignoring", key);
+        return DECLINED;
+    }
+    if (len > dconf->max) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02837)
+                "URL '%s' body larger than limit, ignoring "
+                "(%" APR_OFF_T_FMT " > %" APR_OFF_T_FMT ")",
+                key, len, dconf->max);
+        return DECLINED;
+    }
+
+    /* Allocate and initialize cache_object_t and cache_shm_object_t */
+    h->cache_obj = obj = apr_pcalloc(r->pool, sizeof(*obj));
+    obj->vobj = sobj = apr_pcalloc(r->pool, sizeof(*sobj));
+
+    obj->key = apr_pstrdup(r->pool, key);
+    sobj->key = obj->key;
+    sobj->name = obj->key;
+
+    return OK;
+}
+
+static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
+{
+    cache_object_t *obj;
+    cache_info *info;
+    cache_shm_object_t *sobj;
+    cache_shm_pin_t *pin;
+    const char *nkey;
+    char *meta;
+    apr_size_t meta_len, slider;
+
+    h->cache_obj = NULL;
+
+    if (!parts) {
+        return DECLINED;
+    }
+
+    pin = cache_shm_get(r, key, &meta, &meta_len);
+    if (!pin) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02838)
+                "Key not found in cache: %s", key);
+        return DECLINED;
+    }
+    if (meta_len < sizeof(cache_shm_info_t)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02839)
+                "Cache entry for key '%s' too short, removing", key);
+        cache_shm_remove(r, key);
+        return DECLINED;
+    }
+
+    obj = apr_pcalloc(r->pool, sizeof(cache_object_t));
+    sobj = apr_pcalloc(r->pool, sizeof(cache_shm_object_t));
+    info = &(obj->info);
+    memcpy(&sobj->shm_info, meta, sizeof(cache_shm_info_t));
+
+    if (sobj->shm_info.format == CACHE_SHM_VARY_FORMAT) {
+        apr_array_header_t *varray;
+
+        varray = apr_array_make(r->pool, 5, sizeof(char*));
+        slider = sizeof(cache_shm_info_t);
+        if (read_array(r, varray, meta, meta_len, &slider) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02840)
+                    "Cannot parse vary entry for key: %s", key);
+            cache_shm_remove(r, key);
+            return DECLINED;
+        }
+        nkey = regen_key(r, r->headers_in, varray, key);
+
+        pin = cache_shm_get(r, nkey, &meta, &meta_len);
+        if (!pin) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02841)
+                    "Key not found in cache: %s", nkey);
+            return DECLINED;
+        }
+        if (meta_len < sizeof(cache_shm_info_t)) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02842)
+                    "Cache entry for key '%s' too short, removing", nkey);
+            cache_shm_remove(r, nkey);
+            return DECLINED;
+        }
+        memcpy(&sobj->shm_info, meta, sizeof(cache_shm_info_t));
+    }
+    else {
+        nkey = key;
+    }
+    if (sobj->shm_info.format != CACHE_SHM_ENTITY_FORMAT) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02843)
+                "Key '%s' found in cache has version %d, expected %d, ignoring",
+                nkey, sobj->shm_info.format, CACHE_SHM_ENTITY_FORMAT);
+        cache_shm_remove(r, nkey);
+        return DECLINED;
+    }
+
+    obj->key = nkey;
+    sobj->key = nkey;
+    sobj->name = key;
+
+    /* Store it away so we can get it later. */
+    info->status = sobj->shm_info.status;
+    info->date = sobj->shm_info.date;
+    info->expire = sobj->shm_info.expire;
+    info->request_time = sobj->shm_info.request_time;
+    info->response_time = sobj->shm_info.response_time;
+
+    memcpy(&info->control, &sobj->shm_info.control, sizeof(cache_control_t));
+
+    slider = sizeof(cache_shm_info_t);
+    if (sobj->shm_info.name_len > meta_len - slider
+            || strncmp(meta + slider, sobj->name, sobj->shm_info.name_len)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02844)
+                "Cache entry for key '%s' URL mismatch, ignoring", nkey);
+        return DECLINED;
+    }
+    slider += sobj->shm_info.name_len;
+
+    /* Is this a cached HEAD request? */
+    if (sobj->shm_info.header_only && !r->header_only) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r, APLOGNO(02845)
+                "HEAD request cached, non-HEAD requested, ignoring: %s",
+                sobj->key);
+        return DECLINED;
+    }
+
+    h->req_hdrs = apr_table_make(r->pool, 20);
+    h->resp_hdrs = apr_table_make(r->pool, 20);
+
+    /* Call routine to read the header lines/status line */
+    if (read_table(r, h->resp_hdrs, meta, meta_len, &slider) != APR_SUCCESS
+            || read_table(r, h->req_hdrs, meta, meta_len, &slider)
+               != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02846)
+                "Cache entry for key '%s' headers unreadable, removing", nkey);
+        cache_shm_remove(r, nkey);
+        return DECLINED;
+    }
+
+    /* The body stays where it is, pinned by its buckets */
+    sobj->body = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    cache_shm_body(r, pin, sobj->body);
+
+    /* make the configuration stick */
+    h->cache_obj = obj;
+    obj->vobj = sobj;
+
+    return OK;
+}
+
+static int remove_entity(cache_handle_t *h)
+{
+    /* Null out the cache object pointer so next time we start from scratch  */
+    h->cache_obj = NULL;
+    return OK;
+}
+
+static int remove_url(cache_handle_t *h, request_rec *r)
+{
+    cache_shm_object_t *sobj;
+
+    sobj = (cache_shm_object_t *) h->cache_obj->vobj;
+    if (!sobj) {
+        return DECLINED;
+    }
+
+    cache_shm_remove(r, sobj->key);
+
+    return OK;
+}
+
+static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
+{
+    /* we recalled the headers during open_entity, so do nothing */
+    return APR_SUCCESS;
+}
+
+static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p,
+        apr_bucket_brigade *bb)
+{
+    cache_shm_object_t *sobj = (cache_shm_object_t*) h->cache_obj->vobj;
+
+    APR_BRIGADE_CONCAT(bb, sobj->body);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_headers(cache_handle_t *h, request_rec *r,
+        cache_info *info)
+{
+    cache_shm_dir_conf *dconf =
+            ap_get_module_config(r->per_dir_config, &cache_shm_module);
+    apr_size_t slider;
+    apr_status_t rv;
+    cache_object_t *obj = h->cache_obj;
+    cache_shm_object_t *sobj = (cache_shm_object_t*) obj->vobj;
+    cache_shm_info_t *shm_info;
+
+    memcpy(&h->cache_obj->info, info, sizeof(cache_info));
+
+    if (r->headers_out) {
+        sobj->headers_out = ap_cache_cacheable_headers_out(r);
+    }
+
+    if (r->headers_in) {
+        sobj->headers_in = ap_cache_cacheable_headers_in(r);
+    }
+
+    sobj->expire
+            = obj->info.expire > r->request_time + dconf->maxtime ? r->request_time
+                    + dconf->maxtime
+                    : obj->info.expire + dconf->mintime;
+
+    apr_pool_create(&sobj->pool, r->pool);
+
+    /* the headers only, the body won't be copied to this buffer */
+    sobj->buffer_len = sizeof(cache_shm_info_t) + strlen(sobj->name) + 3;
+    if (sobj->headers_out) {
+        store_table(sobj->headers_out, NULL, APR_SIZE_MAX, &sobj->buffer_len);
+    }
+    if (sobj->headers_in) {
+        store_table(sobj->headers_in, NULL, APR_SIZE_MAX, &sobj->buffer_len);
+    }
+    sobj->buffer = apr_palloc(sobj->pool, sobj->buffer_len);
+    shm_info = (cache_shm_info_t *) sobj->buffer;
+
+    if (sobj->headers_out) {
+        const char *vary;
+
+        vary = apr_table_get(sobj->headers_out, "Vary");
+
+        if (vary) {
+            apr_array_header_t* varray;
+            cache_shm_info_t vary_info;
+            unsigned char *vbuf;
+            apr_size_t vlen = sizeof(vary_info) + strlen(vary) + 8;
+
+            memset(&vary_info, 0, sizeof(vary_info));
+            vary_info.format = CACHE_SHM_VARY_FORMAT;
+            vary_info.expire = obj->info.expire;
+
+            varray = apr_array_make(r->pool, 6, sizeof(char*));
+            tokens_to_array(r->pool, vary, varray);
+
+            vlen += 2 * varray->nelts;
+            vbuf = apr_palloc(sobj->pool, vlen);
+            memcpy(vbuf, &vary_info, sizeof(vary_info));
+            slider = sizeof(vary_info);
+            if (APR_SUCCESS != (rv = store_array(varray, vbuf, vlen,
+                                                 &slider))) {
+                ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02847)
+                        "buffer too small for Vary array, caching aborted: %s",
+                        obj->key);
+                apr_pool_destroy(sobj->pool);
+                sobj->pool = NULL;
+                return rv;
+            }
+
+            rv = cache_shm_put(r, obj->key, sobj->expire, vbuf, slider, NULL);
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02848)
+                        "Vary not written to cache, ignoring: %s", obj->key);
+                apr_pool_destroy(sobj->pool);
+                sobj->pool = NULL;
+                return rv;
+            }
+
+            obj->key = sobj->key = regen_key(r, sobj->headers_in, varray,
+                    sobj->name);
+        }
+    }
+
+    memset(shm_info, 0, sizeof(*shm_info));
+    shm_info->format = CACHE_SHM_ENTITY_FORMAT;
+    shm_info->date = obj->info.date;
+    shm_info->expire = obj->info.expire;
+    shm_info->request_time = obj->info.request_time;
+    shm_info->response_time = obj->info.response_time;
+    shm_info->status = obj->info.status;
+
+    if (r->header_only && r->status != HTTP_NOT_MODIFIED) {
+        shm_info->header_only = 1;
+    }
+    else {
+        shm_info->header_only = sobj->shm_info.header_only;
+    }
+
+    shm_info->name_len = strlen(sobj->name);
+
+    memcpy(&shm_info->control, &obj->info.control, sizeof(cache_control_t));
+    slider = sizeof(cache_shm_info_t);
+
+    memcpy(sobj->buffer + slider, sobj->name, shm_info->name_len);
+    slider += shm_info->name_len;
+
+    if (sobj->headers_out) {
+        if (APR_SUCCESS != store_table(sobj->headers_out, sobj->buffer,
+                sobj->buffer_len, &slider)) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02849)
+                    "out-headers didn't fit in buffer: %s", sobj->name);
+            apr_pool_destroy(sobj->pool);
+            sobj->pool = NULL;
+            return APR_EGENERAL;
+        }
+    }
+
+    if (sobj->headers_in) {
+        if (APR_SUCCESS != store_table(sobj->headers_in, sobj->buffer,
+                sobj->buffer_len, &slider)) {
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02850)
+                    "in-headers didn't fit in buffer %s",
+                    sobj->key);
+            apr_pool_destroy(sobj->pool);
+            sobj->pool = NULL;
+            return APR_EGENERAL;
+        }
+    }
+
+    sobj->meta_len = slider;
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t store_body(cache_handle_t *h, request_rec *r,
+        apr_bucket_brigade *in, apr_bucket_brigade *out)
+{
+    apr_bucket *e;
+    apr_status_t rv = APR_SUCCESS;
+    cache_shm_object_t *sobj =
+            (cache_shm_object_t *) h->cache_obj->vobj;
+    cache_shm_dir_conf *dconf =
+            ap_get_module_config(r->per_dir_config, &cache_shm_module);
+    int seen_eos = 0;
+
+    if (!sobj->offset) {
+        sobj->offset = dconf->readsize;
+    }
+    if (!sobj->timeout && dconf->readtime) {
+        sobj->timeout = apr_time_now() + dconf->readtime;
+    }
+
+    if (!sobj->newbody) {
+        if (sobj->body) {
+            apr_brigade_cleanup(sobj->body);
+        }
+        else {
+            sobj->body = apr_brigade_create(r->pool,
+                    r->connection->bucket_alloc);
+        }
+        sobj->newbody = 1;
+    }
+    if (sobj->offset) {
+        apr_brigade_partition(in, sobj->offset, &e);
+    }
+
+    while (APR_SUCCESS == rv && !APR_BRIGADE_EMPTY(in)) {
+        const char *str;
+        apr_size_t length;
+
+        e = APR_BRIGADE_FIRST(in);
+
+        /* are we done completely? if so, pass any trailing buckets right through */
+        if (sobj->done || !sobj->pool) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            continue;
+        }
+
+        /* have we seen eos yet? */
+        if (APR_BUCKET_IS_EOS(e)) {
+            seen_eos = 1;
+            sobj->done = 1;
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            break;
+        }
+
+        /* honour flush buckets, we'll get called again */
+        if (APR_BUCKET_IS_FLUSH(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            break;
+        }
+
+        /* metadata buckets are preserved as is */
+        if (APR_BUCKET_IS_METADATA(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(out, e);
+            continue;
+        }
+
+        /* read the bucket, keep a copy for the cache */
+        rv = apr_bucket_read(e, &str, &length, APR_BLOCK_READ);
+        APR_BUCKET_REMOVE(e);
+        APR_BRIGADE_INSERT_TAIL(out, e);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02851)
+                    "Error when reading bucket for URL %s",
+                    h->cache_obj->key);
+            apr_pool_destroy(sobj->pool);
+            sobj->pool = NULL;
+            return rv;
+        }
+
+        /* don't write empty buckets to the cache */
+        if (!length) {
+            continue;
+        }
+
+        sobj->file_size += length;
+        if (sobj->file_size > dconf->max) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02852)
+                    "URL %s failed the size check "
+                    "(%" APR_OFF_T_FMT " > %" APR_OFF_T_FMT ")",
+                    h->cache_obj->key, sobj->file_size, dconf->max);
+            apr_pool_destroy(sobj->pool);
+            sobj->pool = NULL;
+            return APR_EGENERAL;
+        }
+
+        /* the copy is only read at commit time, until then it must not
+         * depend on the caller's (transient) memory
+         */
+        rv = apr_bucket_copy(e, &e);
+        if (rv == APR_SUCCESS) {
+            rv = apr_bucket_setaside(e, sobj->pool);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02853)
+                    "Error when copying bucket for URL %s",
+                    h->cache_obj->key);
+            apr_pool_destroy(sobj->pool);
+            sobj->pool = NULL;
+            return rv;
+        }
+        APR_BRIGADE_INSERT_TAIL(sobj->body, e);
+
+        /* have we reached the limit of how much we're prepared to write in one
+         * go? If so, leave, we'll get called again. This prevents us from trying
+         * to swallow too much data at once, or taking so long to write the data
+         * the client times out.
+         */
+        sobj->offset -= length;
+        if (sobj->offset <= 0) {
+            sobj->offset = 0;
+            break;
+        }
+        if ((dconf->readtime && apr_time_now() > sobj->timeout)) {
+            sobj->timeout = 0;
+            break;
+        }
+
+    }
+
+    /* Was this the final bucket? If yes, perform sanity checks.
+     */
+    if (seen_eos) {
+        const char *cl_header = apr_table_get(r->headers_out, "Content-Length");
+
+        if (r->connection->aborted || r->no_cache) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(02854)
+                    "Discarding body for URL %s "
+                    "because connection has been aborted.",
+                    h->cache_obj->key);
+            apr_pool_destroy(sobj->pool);
+            sobj->pool = NULL;
+            return APR_EGENERAL;
+        }
+        if (cl_header) {
+            apr_int64_t cl = apr_atoi64(cl_header);
+            if ((errno == 0) && (sobj->file_size != cl)) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02855)
+                        "URL %s didn't receive complete response, not caching",
+                        h->cache_obj->key);
+                apr_pool_destroy(sobj->pool);
+                sobj->pool = NULL;
+                return APR_EGENERAL;
+            }
+        }
+
+        /* All checks were fine, we're good to go when the commit comes */
+
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
+{
+    cache_object_t *obj = h->cache_obj;
+    cache_shm_object_t *sobj = (cache_shm_object_t *) obj->vobj;
+    apr_status_t rv;
+
+    if (!sobj->pool) {
+        /* store_headers() or store_body() gave up already */
+        cache_shm_remove(r, sobj->key);
+        return APR_EGENERAL;
+    }
+
+    /* The body is copied straight from the brigade (the buckets of the
+     * cached entity when only the headers are updated, the copies made
+     * by store_body() otherwise), not flattened first.
+     */
+    rv = cache_shm_put(r, sobj->key, sobj->expire, sobj->buffer,
+                       sobj->meta_len, sobj->body);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02856)
+                "could not write to cache, ignoring: %s", sobj->key);
+
+        /* For safety, remove any existing entry on failure, just in case
+         * it could not be revalidated successfully.
+         */
+        cache_shm_remove(r, sobj->key);
+    }
+    else {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02857)
+                "commit_entity: Headers and body for URL %s cached for maximum of %d seconds.",
+                sobj->name, (apr_uint32_t)apr_time_sec(sobj->expire - r->request_time));
+    }
+
+    apr_pool_destroy(sobj->pool);
+    sobj->pool = NULL;
+
+    return rv;
+}
+
+static apr_status_t invalidate_entity(cache_handle_t *h, request_rec *r)
+{
+    cache_shm_object_t *sobj = (cache_shm_object_t *) h->cache_obj->vobj;
+
+    /* The entry is shared and may be being served, rather than marking it
+     * invalidated in place drop it, the next request will fetch it again.
+     */
+    cache_shm_remove(r, sobj->key);
+
+    return APR_SUCCESS;
+}
+
+static void *create_dir_config(apr_pool_t *p, char *dummy)
+{
+    cache_shm_dir_conf *dconf = apr_pcalloc(p, sizeof(cache_shm_dir_conf));
+
+    dconf->max = DEFAULT_MAX_FILE_SIZE;
+    dconf->maxtime = apr_time_from_sec(DEFAULT_MAXTIME);
+    dconf->mintime = apr_time_from_sec(DEFAULT_MINTIME);
+    dconf->readsize = DEFAULT_READSIZE;
+    dconf->readtime = DEFAULT_READTIME;
+
+    return dconf;
+}
+
+static void *merge_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    cache_shm_dir_conf *new = apr_pcalloc(p, sizeof(cache_shm_dir_conf));
+    cache_shm_dir_conf *add = (cache_shm_dir_conf *) addv;
+    cache_shm_dir_conf *base = (cache_shm_dir_conf *) basev;
+
+    new->max = (add->max_set == 0) ? base->max : add->max;
+    new->max_set = add->max_set || base->max_set;
+    new->maxtime = (add->maxtime_set == 0) ? base->maxtime : add->maxtime;
+    new->maxtime_set = add->maxtime_set || base->maxtime_set;
+    new->mintime = (add->mintime_set == 0) ? base->mintime : add->mintime;
+    new->mintime_set = add->mintime_set || base->mintime_set;
+    new->readsize = (add->readsize_set == 0) ? base->readsize : add->readsize;
+    new->readsize_set = add->readsize_set || base->readsize_set;
+    new->readtime = (add->readtime_set == 0) ? base->readtime : add->readtime;
+    new->readtime_set = add->readtime_set || base->readtime_set;
+
+    return new;
+}
+
+/*
+ * mod_cache_shm configuration directives handlers.
+ */
+static const char *set_cache_shm_size(cmd_parms *cmd, void *dummy,
+        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    char *end;
+
+    if (err != NULL) {
+        return err;
+    }
+    if (apr_strtoff(&shm_size, arg, &end, 10) != APR_SUCCESS
+            || shm_size <= 0) {
+        return "CacheShmSize argument must be a size in bytes, "
+               "optionally followed by K, M or G";
+    }
+    switch (apr_tolower(*end)) {
+    case 'g':
+        shm_size *= 1024;
+        /* fall through */
+    case 'm':
+        shm_size *= 1024;
+        /* fall through */
+    case 'k':
+        shm_size *= 1024;
+        end++;
+        break;
+    }
+    if (*end) {
+        return "CacheShmSize argument must be a size in bytes, "
+               "optionally followed by K, M or G";
+    }
+    return NULL;
+}
+
+static const char *set_cache_shm_chunk(cmd_parms *cmd, void *dummy,
+        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_off_t size;
+
+    if (err != NULL) {
+        return err;
+    }
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS
+            || size < 256 || size > 1024*1024 || size % 64) {
+        return "CacheShmChunkSize argument must be a multiple of 64 bytes "
+               "between 256 and 1048576";
+    }
+    chunk_size = (apr_size_t)size;
+    return NULL;
+}
+
+static const char *set_cache_shm_partitions(cmd_parms *cmd, void *dummy,
+        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+    num_parts = atoi(arg);
+    if (num_parts < 1 || num_parts > 256) {
+        return "CacheShmPartitions argument must be between 1 and 256";
+    }
+    return NULL;
+}
+
+static const char *set_cache_max(cmd_parms *parms, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_dir_conf *dconf = (cache_shm_dir_conf *) in_struct_ptr;
+
+    if (apr_strtoff(&dconf->max, arg, NULL, 10) != APR_SUCCESS || dconf->max
+            < 0) {
+        return "CacheShmMaxSize argument must be a non-negative integer representing the max size of a cached body";
+    }
+    dconf->max_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_maxtime(cmd_parms *parms, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_dir_conf *dconf = (cache_shm_dir_conf *) in_struct_ptr;
+    apr_off_t seconds;
+
+    if (apr_strtoff(&seconds, arg, NULL, 10) != APR_SUCCESS || seconds < 0) {
+        return "CacheShmMaxTime argument must be the maximum amount of time in seconds to cache an entry.";
+    }
+    dconf->maxtime = apr_time_from_sec(seconds);
+    dconf->maxtime_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_mintime(cmd_parms *parms, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_dir_conf *dconf = (cache_shm_dir_conf *) in_struct_ptr;
+    apr_off_t seconds;
+
+    if (apr_strtoff(&seconds, arg, NULL, 10) != APR_SUCCESS || seconds < 0) {
+        return "CacheShmMinTime argument must be the minimum amount of time in seconds to cache an entry.";
+    }
+    dconf->mintime = apr_time_from_sec(seconds);
+    dconf->mintime_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_readsize(cmd_parms *parms, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_dir_conf *dconf = (cache_shm_dir_conf *) in_struct_ptr;
+
+    if (apr_strtoff(&dconf->readsize, arg, NULL, 10) != APR_SUCCESS
+            || dconf->readsize < 0) {
+        return "CacheShmReadSize argument must be a non-negative integer representing the max amount of data to cache in go.";
+    }
+    dconf->readsize_set = 1;
+    return NULL;
+}
+
+static const char *set_cache_readtime(cmd_parms *parms, void *in_struct_ptr,
+        const char *arg)
+{
+    cache_shm_dir_conf *dconf = (cache_shm_dir_conf *) in_struct_ptr;
+    apr_off_t milliseconds;
+
+    if (apr_strtoff(&milliseconds, arg, NULL, 10) != APR_SUCCESS
+            || milliseconds < 0) {
+        return "CacheShmReadTime argument must be a non-negative integer representing the max amount of time taken to cache in go.";
+    }
+    dconf->readtime = apr_time_from_msec(milliseconds);
+    dconf->readtime_set = 1;
+    return NULL;
+}
+
+static int cache_shm_status_hook(request_rec *r, int flags)
+{
+    apr_uint64_t hits = 0, misses = 0, stores = 0, rejected = 0,
+                 evictions = 0;
+    apr_uint64_t chunks = 0, free_chunks = 0, entries = 0;
+    int i;
+
+    if (!parts) {
+        return DECLINED;
+    }
+
+    /* unlocked, these are only statistics */
+    for (i = 0; i < num_parts; i++) {
+        cache_shm_header_t *h = parts[i].header;
+        hits += h->hits;
+        misses += h->misses;
+        stores += h->stores;
+        rejected += h->rejected;
+        evictions += h->evictions;
+        chunks += h->nchunks;
+        free_chunks += h->free_chunks;
+        entries += h->entries;
+    }
+
+    if (flags & AP_STATUS_SHORT) {
+        ap_rprintf(r, "CacheShmEntries: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmChunks: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmFreeChunks: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmHits: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmMisses: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmStores: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmRejected: %" APR_UINT64_T_FMT "\n"
+                      "CacheShmEvictions: %" APR_UINT64_T_FMT "\n",
+                   entries, chunks, free_chunks, hits, misses, stores,
+                   rejected, evictions);
+        return OK;
+    }
+
+    ap_rputs("<hr>\n"
+             "<table cellspacing=0 cellpadding=0>\n"
+             "<tr><td bgcolor=\"#000000\">\n"
+             "<b><font color=\"#ffffff\" face=\"Arial,Helvetica\">"
+             "mod_cache_shm Status:</font></b>\n"
+             "</td></tr>\n"
+             "<tr><td bgcolor=\"#ffffff\">\n", r);
+    ap_rprintf(r, "entries: <b>%" APR_UINT64_T_FMT "</b> in <b>%d</b> "
+                  "partitions, using <b>%" APR_UINT64_T_FMT "</b> of <b>%"
+                  APR_UINT64_T_FMT "</b> chunks of <b>%" APR_SIZE_T_FMT
+                  "</b> bytes<br>",
+               entries, num_parts, chunks - free_chunks, chunks, chunk_size);
+    ap_rprintf(r, "hits: <b>%" APR_UINT64_T_FMT "</b>, misses: <b>%"
+                  APR_UINT64_T_FMT "</b>", hits, misses);
+    if (hits + misses) {
+        ap_rprintf(r, " (<b>%.1f%%</b> hit ratio)",
+                   hits * 100.0 / (hits + misses));
+    }
+    ap_rprintf(r, "<br>stores: <b>%" APR_UINT64_T_FMT "</b>, rejected by "
+                  "admission: <b>%" APR_UINT64_T_FMT "</b>, evictions: <b>%"
+                  APR_UINT64_T_FMT "</b><br>", stores, rejected, evictions);
+    ap_rputs("</td></tr>\n</table>\n", r);
+
+    return OK;
+}
+
+static int cache_shm_precfg(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptmp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, cache_shm_id, NULL,
+            APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02858)
+        "failed to register %s mutex", cache_shm_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    /* Register to handle mod_status status page generation */
+    APR_OPTIONAL_HOOK(ap, status_hook, cache_shm_status_hook, NULL, NULL,
+                      APR_HOOK_MIDDLE);
+
+    shm_size = DEFAULT_SHM_SIZE;
+    chunk_size = DEFAULT_CHUNK_SIZE;
+    num_parts = DEFAULT_PARTITIONS;
+    cache_shm = NULL;
+    parts = NULL;
+
+    return OK;
+}
+
+/* Lay out a partition of size bytes at base and initialize it */
+static apr_status_t part_init(cache_shm_part_t *part, char *base,
+                              apr_size_t size)
+{
+    cache_shm_header_t *h = (cache_shm_header_t *)base;
+    apr_size_t per_chunk, off;
+    apr_uint32_t n, i;
+
+    /* a chunk, its chain link, entry, hash bucket and sketch counters */
+    per_chunk = chunk_size + sizeof(apr_uint32_t) + sizeof(cache_shm_entry_t)
+                + sizeof(apr_uint32_t) + SKETCH_DEPTH;
+    off = APR_ALIGN(sizeof(*h), 64);
+    if (size < off + 256 + 16 * per_chunk) {
+        return APR_ENOSPC;
+    }
+    n = (apr_uint32_t)((size - off - 256) / per_chunk);
+
+    memset(h, 0, sizeof(*h));
+    h->nchunks = n;
+    h->buckets_off = off;
+    off = APR_ALIGN(off + (apr_size_t)n * sizeof(apr_uint32_t), 8);
+    h->entries_off = off;
+    off = APR_ALIGN(off + (apr_size_t)n * sizeof(cache_shm_entry_t), 8);
+    h->chain_off = off;
+    off = APR_ALIGN(off + (apr_size_t)n * sizeof(apr_uint32_t), 8);
+    h->sketch_off = off;
+    off = APR_ALIGN(off + (apr_size_t)n * SKETCH_DEPTH, 64);
+    h->chunks_off = off;
+
+    part->header = h;
+    part->buckets = (apr_uint32_t *)(base + h->buckets_off);
+    part->entries = (cache_shm_entry_t *)(base + h->entries_off);
+    part->chain = (apr_uint32_t *)(base + h->chain_off);
+    part->sketch = (unsigned char *)(base + h->sketch_off);
+    part->chunks = base + h->chunks_off;
+
+    for (i = 0; i < n; i++) {
+        part->buckets[i] = CACHE_SHM_NONE;
+        part->chain[i] = i + 1;
+        part->entries[i].state = CACHE_SHM_FREE;
+        part->entries[i].hnext = i + 1;
+    }
+    part->chain[n - 1] = CACHE_SHM_NONE;
+    part->entries[n - 1].hnext = CACHE_SHM_NONE;
+    memset(part->sketch, 0, (apr_size_t)n * SKETCH_DEPTH);
+
+    h->free_chunk = 0;
+    h->free_chunks = n;
+    h->free_entry = 0;
+    h->head[CACHE_SHM_PROBATION] = h->tail[CACHE_SHM_PROBATION] =
+        CACHE_SHM_NONE;
+    h->head[CACHE_SHM_PROTECTED] = h->tail[CACHE_SHM_PROTECTED] =
+        CACHE_SHM_NONE;
+    h->protected_max = (apr_uint32_t)((apr_uint64_t)n
+                                      * CACHE_SHM_PROTECTED_SHARE / 100);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t remove_shm(void *data)
+{
+    if (cache_shm) {
+        apr_shm_destroy(cache_shm);
+        cache_shm = NULL;
+    }
+    parts = NULL;
+    return APR_SUCCESS;
+}
+
+static int cache_shm_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptmp, server_rec *s)
+{
+    apr_status_t rv;
+    apr_size_t size, part_size;
+    char *base;
+    int i;
+
+    /* don't map the memory for the configuration check pass */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    size = (apr_size_t)shm_size;
+    if ((apr_off_t)size != shm_size) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, 0, plog, APLOGNO(02859)
+                "CacheShmSize %" APR_OFF_T_FMT " is too large for this "
+                "platform", shm_size);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    /* anonymous if possible, else in a file of the runtime directory */
+    rv = apr_shm_create(&cache_shm, size, NULL, pconf);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        const char *fname = ap_runtime_dir_relative(pconf, cache_shm_id);
+        apr_shm_remove(fname, pconf);
+        rv = apr_shm_create(&cache_shm, size, fname, pconf);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02860)
+                "failed to create %s shared memory segment of %"
+                APR_SIZE_T_FMT " bytes", cache_shm_id, size);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    apr_pool_cleanup_register(pconf, NULL, remove_shm, apr_pool_cleanup_null);
+
+    base = apr_shm_baseaddr_get(cache_shm);
+    size = apr_shm_size_get(cache_shm);
+    part_size = (size / num_parts) & ~(apr_size_t)63;
+
+    parts = apr_pcalloc(pconf, num_parts * sizeof(*parts));
+    for (i = 0; i < num_parts; i++) {
+        rv = part_init(&parts[i], base + i * part_size, part_size);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, 0, plog, APLOGNO(02861)
+                    "CacheShmSize is too small for %d partitions of "
+                    "chunks of %" APR_SIZE_T_FMT " bytes",
+                    num_parts, chunk_size);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+        rv = ap_global_mutex_create(&parts[i].mutex, NULL, cache_shm_id,
+                                    apr_itoa(ptmp, i), s, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02862)
+                    "failed to create %s mutex", cache_shm_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02863)
+            "shared memory cache of %" APR_SIZE_T_FMT " bytes in %d "
+            "partitions of %u chunks", size, num_parts,
+            parts[0].header->nchunks);
+
+    return OK;
+}
+
+static void cache_shm_child_init(apr_pool_t *p, server_rec *s)
+{
+    int i;
+
+    if (!parts) {
+        return;
+    }
+    for (i = 0; i < num_parts; i++) {
+        const char *lock = apr_global_mutex_lockfile(parts[i].mutex);
+        apr_status_t rv = apr_global_mutex_child_init(&parts[i].mutex,
+                                                      lock, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(02864)
+                    "failed to initialise mutex in child_init");
+        }
+    }
+}
+
+static const command_rec cache_shm_cmds[] =
+{
+    AP_INIT_TAKE1("CacheShmSize", set_cache_shm_size, NULL, RSRC_CONF,
+            "The size of the shared memory holding the cache"),
+    AP_INIT_TAKE1("CacheShmChunkSize", set_cache_shm_chunk, NULL, RSRC_CONF,
+            "The size of the chunks the cached entries are stored in"),
+    AP_INIT_TAKE1("CacheShmPartitions", set_cache_shm_partitions, NULL,
+            RSRC_CONF, "The number of independently locked partitions "
+            "of the cache"),
+    AP_INIT_TAKE1("CacheShmMaxTime", set_cache_maxtime, NULL, RSRC_CONF | ACCESS_CONF,
+            "The maximum cache expiry age to cache a document in seconds"),
+    AP_INIT_TAKE1("CacheShmMinTime", set_cache_mintime, NULL, RSRC_CONF | ACCESS_CONF,
+            "The minimum cache expiry age to cache a document in seconds"),
+    AP_INIT_TAKE1("CacheShmMaxSize", set_cache_max, NULL, RSRC_CONF | ACCESS_CONF,
+            "The maximum body size to cache a document"),
+    AP_INIT_TAKE1("CacheShmReadSize", set_cache_readsize, NULL, RSRC_CONF | ACCESS_CONF,
+            "The maximum quantity of data to attempt to read and cache in one go"),
+    AP_INIT_TAKE1("CacheShmReadTime", set_cache_readtime, NULL, RSRC_CONF | ACCESS_CONF,
+            "The maximum time taken to attempt to read and cache in go"),
+    { NULL }
+};
+
+static const cache_provider cache_shm_provider =
+{
+    &remove_entity, &store_headers, &store_body, &recall_headers, &recall_body,
+    &create_entity, &open_entity, &remove_url, &commit_entity,
+    &invalidate_entity
+};
+
+static void cache_shm_register_hook(apr_pool_t *p)
+{
+    /* cache initializer */
+    ap_register_provider(p, CACHE_PROVIDER_GROUP, "shm", "0",
+            &cache_shm_provider);
+    ap_hook_pre_config(cache_shm_precfg, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(cache_shm_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(cache_shm_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(cache_shm) = { STANDARD20_MODULE_STUFF,
+    create_dir_config,  /* create per-directory config structure */
+    merge_dir_config, /* merge per-directory config structures */
+    NULL, /* create per-server config structure */
+    NULL, /* merge per-server config structures */
+    cache_shm_cmds, /* command apr_table_t */
+    cache_shm_register_hook /* register hooks */
+};
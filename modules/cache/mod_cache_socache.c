@@ -270,7 +270,7 @@ static apr_status_t store_table(apr_table_t *table, unsigned char *buffer,
     return APR_SUCCESS;
 }
 
-static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
+static const char* regen_key(request_rec *r, apr_table_t *headers,
         apr_array_header_t *varray, const char *oldkey)
 {
     struct iovec *iov;
@@ -280,7 +280,7 @@ static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
     const char **elts;
 
     nvec = (varray->nelts * 2) + 1;
-    iov = apr_palloc(p, sizeof(struct iovec) * nvec);
+    iov = apr_palloc(r->pool, sizeof(struct iovec) * nvec);
     elts = (const char **) varray->elts;
 
     /* TODO:
@@ -308,7 +308,8 @@ static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
      */
 
     for (i = 0, k = 0; i < varray->nelts; i++) {
-        header = apr_table_get(headers, elts[i]);
+        header = ap_cache_vary_value(r, elts[i],
+                                     apr_table_get(headers, elts[i]));
         if (!header) {
             header = "";
         }
@@ -323,7 +324,7 @@ static const char* regen_key(apr_pool_t *p, apr_table_t *headers,
     iov[k].iov_len = strlen(oldkey);
     k++;
 
-    return apr_pstrcatv(p, iov, k, NULL);
+    return apr_pstrcatv(r->pool, iov, k, NULL);
 }
 
 static int array_alphasort(const void *fn1, const void *fn2)
@@ -362,9 +363,10 @@ static int create_entity(cache_handle_t *h, request_rec *r, const char *key,
         return DECLINED;
     }
 
-    /* we don't support caching of range requests (yet) */
-    /* TODO: but we could */
-    if (r->status == HTTP_PARTIAL_CONTENT) {
+    /* we don't support caching of range requests (yet), other than the
+     * slices of large entities mod_cache asks for on its own
+     */
+    if (r->status == HTTP_PARTIAL_CONTENT && !ap_cache_is_slice(r)) {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02345)
                 "URL %s partial content response not cached",
                 key);
@@ -527,7 +529,7 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
             return DECLINED;
         }
 
-        nkey = regen_key(r->pool, r->headers_in, varray, key);
+        nkey = regen_key(r, r->headers_in, varray, key);
 
         /* attempt to retrieve the cached entry */
         if (socache_mutex) {
@@ -869,7 +871,7 @@ static apr_status_t store_headers(cache_handle_t *h, request_rec *r,
                 return rv;
             }
 
-            obj->key = sobj->key = regen_key(r->pool, sobj->headers_in, varray,
+            obj->key = sobj->key = regen_key(r, sobj->headers_in, varray,
                     sobj->name);
         }
     }
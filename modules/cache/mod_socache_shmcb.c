@@ -24,11 +24,13 @@
 #include "apr_strings.h"
 #include "apr_time.h"
 #include "apr_shm.h"
+#include "apr_global_mutex.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 #include "apr_general.h"
 
 #include "ap_socache.h"
+#include "util_mutex.h"
 
 /* XXX Unfortunately, there are still many unsigned ints in use here, so we
  * XXX cannot allow more than UINT_MAX. Since some of the ints are exposed in
@@ -47,19 +49,15 @@
 #define ALIGNED_SUBCACHE_SIZE APR_ALIGN_DEFAULT(sizeof(SHMCBSubcache))
 #define ALIGNED_INDEX_SIZE APR_ALIGN_DEFAULT(sizeof(SHMCBIndex))
 
+/* At most this many mutexes per cache, shared by the subcaches beyond */
+#define SHMCB_MAX_MUTEXES 32
+
+static const char * const shmcb_mutex_type = "socache-shmcb";
+
 /*
  * Header structure - the start of the shared-mem segment
  */
 typedef struct {
-    /* Stats for cache operations */
-    unsigned long stat_stores;
-    unsigned long stat_replaced;
-    unsigned long stat_expiries;
-    unsigned long stat_scrolled;
-    unsigned long stat_retrieves_hit;
-    unsigned long stat_retrieves_miss;
-    unsigned long stat_removes_hit;
-    unsigned long stat_removes_miss;
     /* Number of subcaches */
     unsigned int subcache_num;
     /* How many indexes each subcache's queue has */
@@ -81,6 +79,15 @@ typedef struct {
     unsigned int idx_pos, idx_used;
     /* Same for the data area */
     unsigned int data_pos, data_used;
+    /* Stats for cache operations */
+    unsigned long stat_stores;
+    unsigned long stat_replaced;
+    unsigned long stat_expiries;
+    unsigned long stat_scrolled;
+    unsigned long stat_retrieves_hit;
+    unsigned long stat_retrieves_miss;
+    unsigned long stat_removes_hit;
+    unsigned long stat_removes_miss;
 } SHMCBSubcache;
 
 /*
@@ -104,8 +111,15 @@ struct ap_socache_instance_t {
     apr_size_t shm_size;
     apr_shm_t *shm;
     SHMCBHeader *header;
+    /* The subcache locks, subcache n using mutexes[n % num_mutexes] */
+    apr_global_mutex_t **mutexes;
+    unsigned int num_mutexes;
 };
 
+/* The instances initialised, for their mutexes to be reopened by the
+ * children */
+static apr_array_header_t *shmcb_instances = NULL;
+
 /* The SHM data segment is of fixed size and stores data as follows.
  *
  *   [ SHMCBHeader | Subcaches ]
@@ -122,6 +136,13 @@ struct ap_socache_instance_t {
  *
  * Each subcache is prefixed by the SHMCBSubcache structure.
  *
+ * Every subcache has its own global mutex (up to SHMCB_MAX_MUTEXES of
+ * them, then shared), taken for the duration of any operation on it, so
+ * that consumers need not serialize access to the whole cache behind a
+ * global mutex and operations on different subcaches run in parallel.
+ * The same holds for the statistics, which are kept per subcache and
+ * summed up for display.
+ *
  * The subcache's "Data" segment is a single cyclic data buffer, of
  * total size header->subcache_data_size; data inside is referenced
  * using byte offsets. The offset marking the beginning of the cyclic
@@ -247,6 +268,45 @@ static int shmcb_cyclic_memcmp(unsigned int buf_size, unsigned char *data,
 }
 
 
+/* Subcache locking, with the global mutexes of the instance which the
+ * APR mechanisms release when their holder dies. */
+static apr_global_mutex_t *shmcb_subcache_mutex(ap_socache_instance_t *ctx,
+                                                SHMCBSubcache *subcache)
+{
+    SHMCBHeader *header = ctx->header;
+    apr_size_t n = ((unsigned char *)subcache - (unsigned char *)header
+                    - ALIGNED_HEADER_SIZE) / header->subcache_size;
+
+    return ctx->mutexes[n % ctx->num_mutexes];
+}
+
+static apr_status_t shmcb_subcache_lock(ap_socache_instance_t *ctx,
+                                        server_rec *s,
+                                        SHMCBSubcache *subcache)
+{
+    apr_status_t rv;
+
+    rv = apr_global_mutex_lock(shmcb_subcache_mutex(ctx, subcache));
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02897)
+                     "could not acquire the shmcb subcache lock");
+    }
+    return rv;
+}
+
+static void shmcb_subcache_unlock(ap_socache_instance_t *ctx,
+                                  server_rec *s,
+                                  SHMCBSubcache *subcache)
+{
+    apr_status_t rv;
+
+    rv = apr_global_mutex_unlock(shmcb_subcache_mutex(ctx, subcache));
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02898)
+                     "could not release the shmcb subcache lock");
+    }
+}
+
 /* Prototypes for low-level subcache operations */
 static void shmcb_subcache_expire(server_rec *, SHMCBHeader *, SHMCBSubcache *,
                                   apr_time_t);
@@ -271,8 +331,7 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
                                            SHMCBHeader *header,
                                            SHMCBSubcache *subcache,
                                            ap_socache_iterator_t *iterator,
-                                           unsigned char **buf,
-                                           apr_size_t *buf_len,
+                                           apr_pool_t *ptemp,
                                            apr_pool_t *pool,
                                            apr_time_t now);
 
@@ -418,14 +477,6 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
     }
     /* OK, we're sorted */
     ctx->header = header = shm_segment;
-    header->stat_stores = 0;
-    header->stat_replaced = 0;
-    header->stat_expiries = 0;
-    header->stat_scrolled = 0;
-    header->stat_retrieves_hit = 0;
-    header->stat_retrieves_miss = 0;
-    header->stat_removes_hit = 0;
-    header->stat_removes_miss = 0;
     header->subcache_num = num_subcache;
     /* Convert the subcache size (in bytes) to a value that is suitable for
      * structure alignment on the host platform, by rounding down if necessary. */
@@ -456,8 +507,25 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
     /* The header is done, make the caches empty */
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
-        subcache->idx_pos = subcache->idx_used = 0;
-        subcache->data_pos = subcache->data_used = 0;
+        memset(subcache, 0, sizeof(*subcache));
+    }
+    /* and their locks */
+    ctx->num_mutexes = num_subcache < SHMCB_MAX_MUTEXES ? num_subcache
+                                                        : SHMCB_MAX_MUTEXES;
+    ctx->mutexes = apr_pcalloc(p, ctx->num_mutexes * sizeof(*ctx->mutexes));
+    for (loop = 0; loop < ctx->num_mutexes; loop++) {
+        rv = ap_global_mutex_create(&ctx->mutexes[loop], NULL,
+                                    shmcb_mutex_type,
+                                    apr_psprintf(p, "%s-%u", namespace, loop),
+                                    s, p, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02899)
+                         "could not create the shmcb subcache locks");
+            return rv;
+        }
+    }
+    if (shmcb_instances) {
+        APR_ARRAY_PUSH(shmcb_instances, ap_socache_instance_t *) = ctx;
     }
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(00830)
                  "Shared memory socache initialised");
@@ -484,6 +552,7 @@ static apr_status_t socache_shmcb_store(ap_socache_instance_t *ctx,
     SHMCBHeader *header = ctx->header;
     SHMCBSubcache *subcache = SHMCB_MASK(header, id);
     int tryreplace;
+    apr_status_t rv;
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00831)
                  "socache_shmcb_store (0x%02x -> subcache %d)",
@@ -494,19 +563,25 @@ static apr_status_t socache_shmcb_store(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    rv = shmcb_subcache_lock(ctx, s, subcache);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
     tryreplace = shmcb_subcache_remove(s, header, subcache, id, idlen);
     if (shmcb_subcache_store(s, header, subcache, encoded,
                              len_encoded, id, idlen, expiry)) {
+        shmcb_subcache_unlock(ctx, s, subcache);
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00833)
                      "can't store an socache entry!");
         return APR_ENOSPC;
     }
     if (tryreplace == 0) {
-        header->stat_replaced++;
+        subcache->stat_replaced++;
     }
     else {
-        header->stat_stores++;
+        subcache->stat_stores++;
     }
+    shmcb_subcache_unlock(ctx, s, subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00834)
                  "leaving socache_shmcb_store successfully");
     return APR_SUCCESS;
@@ -527,12 +602,16 @@ static apr_status_t socache_shmcb_retrieve(ap_socache_instance_t *ctx,
                  SHMCB_MASK_DBG(header, id));
 
     /* Get the entry corresponding to the id, if it exists. */
+    if (shmcb_subcache_lock(ctx, s, subcache) != APR_SUCCESS) {
+        return APR_NOTFOUND;
+    }
     rv = shmcb_subcache_retrieve(s, header, subcache, id, idlen,
                                  dest, destlen);
     if (rv == 0)
-        header->stat_retrieves_hit++;
+        subcache->stat_retrieves_hit++;
     else
-        header->stat_retrieves_miss++;
+        subcache->stat_retrieves_miss++;
+    shmcb_subcache_unlock(ctx, s, subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00836)
                  "leaving socache_shmcb_retrieve successfully");
 
@@ -555,13 +634,18 @@ static apr_status_t socache_shmcb_remove(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    rv = shmcb_subcache_lock(ctx, s, subcache);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
     if (shmcb_subcache_remove(s, header, subcache, id, idlen) == 0) {
-        header->stat_removes_hit++;
+        subcache->stat_removes_hit++;
         rv = APR_SUCCESS;
     } else {
-        header->stat_removes_miss++;
+        subcache->stat_removes_miss++;
         rv = APR_NOTFOUND;
     }
+    shmcb_subcache_unlock(ctx, s, subcache);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00839)
                  "leaving socache_shmcb_remove successfully");
 
@@ -578,15 +662,21 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
     apr_time_t now = apr_time_now();
     double expiry_total = 0;
     int index_pct, cache_pct;
+    unsigned long stores = 0, replaced = 0, expiries = 0, scrolled = 0;
+    unsigned long retrieves_hit = 0, retrieves_miss = 0;
+    unsigned long removes_hit = 0, removes_miss = 0;
 
     AP_DEBUG_ASSERT(header->subcache_num > 0);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00840) "inside shmcb_status");
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
+    /* Look at each subcache under its lock to avoid corruption or invalid
      * pointer arithmetic. The rest of our logic uses read-only header data so
      * doesn't need the lock. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        if (shmcb_subcache_lock(ctx, s, subcache) != APR_SUCCESS) {
+            continue;
+        }
         shmcb_subcache_expire(s, header, subcache, now);
         total += subcache->idx_used;
         cache_total += subcache->data_used;
@@ -601,6 +691,15 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
             else
                 min_expiry = ((idx_expiry < min_expiry) ? idx_expiry : min_expiry);
         }
+        stores += subcache->stat_stores;
+        replaced += subcache->stat_replaced;
+        expiries += subcache->stat_expiries;
+        scrolled += subcache->stat_scrolled;
+        retrieves_hit += subcache->stat_retrieves_hit;
+        retrieves_miss += subcache->stat_retrieves_miss;
+        removes_hit += subcache->stat_removes_hit;
+        removes_miss += subcache->stat_removes_miss;
+        shmcb_subcache_unlock(ctx, s, subcache);
     }
     index_pct = (100 * total) / (header->index_num *
                                  header->subcache_num);
@@ -627,19 +726,17 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
     ap_rprintf(r, "index usage: <b>%d%%</b>, cache usage: <b>%d%%</b><br>",
                index_pct, cache_pct);
     ap_rprintf(r, "total entries stored since starting: <b>%lu</b><br>",
-               header->stat_stores);
+               stores);
     ap_rprintf(r, "total entries replaced since starting: <b>%lu</b><br>",
-               header->stat_replaced);
+               replaced);
     ap_rprintf(r, "total entries expired since starting: <b>%lu</b><br>",
-               header->stat_expiries);
+               expiries);
     ap_rprintf(r, "total (pre-expiry) entries scrolled out of the cache: "
-               "<b>%lu</b><br>", header->stat_scrolled);
+               "<b>%lu</b><br>", scrolled);
     ap_rprintf(r, "total retrieves since starting: <b>%lu</b> hit, "
-               "<b>%lu</b> miss<br>", header->stat_retrieves_hit,
-               header->stat_retrieves_miss);
+               "<b>%lu</b> miss<br>", retrieves_hit, retrieves_miss);
     ap_rprintf(r, "total removes since starting: <b>%lu</b> hit, "
-               "<b>%lu</b> miss<br>", header->stat_removes_hit,
-               header->stat_removes_miss);
+               "<b>%lu</b> miss<br>", removes_hit, removes_miss);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00841) "leaving shmcb_status");
 }
 
@@ -652,18 +749,19 @@ static apr_status_t socache_shmcb_iterate(ap_socache_instance_t *instance,
     unsigned int loop;
     apr_time_t now = apr_time_now();
     apr_status_t rv = APR_SUCCESS;
-    apr_size_t buflen = 0;
-    unsigned char *buf = NULL;
+    apr_pool_t *ptemp;
+
+    apr_pool_create(&ptemp, pool);
+    apr_pool_tag(ptemp, "shmcb_iterate");
 
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
-     * doesn't need the lock. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num && rv == APR_SUCCESS; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
         rv = shmcb_subcache_iterate(instance, s, userctx, header, subcache,
-                                    iterator, &buf, &buflen, pool, now);
+                                    iterator, ptemp, pool, now);
+        apr_pool_clear(ptemp);
     }
+    apr_pool_destroy(ptemp);
     return rv;
 }
 
@@ -712,7 +810,7 @@ static void shmcb_subcache_expire(server_rec *s, SHMCBHeader *header,
         subcache->data_used -= diff;
         subcache->data_pos = idx->data_pos;
     }
-    header->stat_expiries += expired;
+    subcache->stat_expiries += expired;
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00843)
                  "we now have %u socache entries", subcache->idx_used);
 }
@@ -768,7 +866,7 @@ static int shmcb_subcache_store(server_rec *s, SHMCBHeader *header,
                                                       header->subcache_data_size);
             subcache->data_pos = idx2->data_pos;
             /* Stats */
-            header->stat_scrolled++;
+            subcache->stat_scrolled++;
             /* Loop admin */
             idx = idx2;
             loop++;
@@ -868,7 +966,7 @@ static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
             else {
                 /* Already stale, quietly remove and treat as not-found */
                 idx->removed = 1;
-                header->stat_expiries++;
+                subcache->stat_expiries++;
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00850)
                              "shmcb_subcache_retrieve discarding expired entry");
                 return -1;
@@ -920,21 +1018,39 @@ static int shmcb_subcache_remove(server_rec *s, SHMCBHeader *header,
 }
 
 
+/* An entry copied out of a subcache by shmcb_subcache_iterate() */
+typedef struct {
+    unsigned char *id;
+    unsigned int id_len;
+    unsigned char *data;
+    unsigned int data_len;
+} SHMCBEntry;
+
 static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
                                            server_rec *s,
                                            void *userctx,
                                            SHMCBHeader *header,
                                            SHMCBSubcache *subcache,
                                            ap_socache_iterator_t *iterator,
-                                           unsigned char **buf,
-                                           apr_size_t *buf_len,
+                                           apr_pool_t *ptemp,
                                            apr_pool_t *pool,
                                            apr_time_t now)
 {
+    apr_array_header_t *entries;
+    SHMCBEntry *entry;
     unsigned int pos;
     unsigned int loop = 0;
     apr_status_t rv;
+    int i;
+
+    /* Copy the live entries out under the lock, and only then hand them
+     * to the iterator, which is thus free to call back into the cache. */
+    entries = apr_array_make(ptemp, 16, sizeof(SHMCBEntry));
 
+    rv = shmcb_subcache_lock(instance, s, subcache);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
     pos = subcache->idx_pos;
     while (loop < subcache->idx_used) {
         SHMCBIndex *idx = SHMCB_INDEX(subcache, pos);
@@ -945,54 +1061,35 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00854)
                          "iterating idx=%d, data=%d", pos, idx->data_pos);
             if (idx->expires > now) {
-                unsigned char *id = *buf;
-                unsigned char *dest;
-                unsigned int data_offset, dest_len;
-                apr_size_t buf_req;
+                unsigned int data_offset;
 
                 /* Find the offset of the data segment, after the id */
                 data_offset = SHMCB_CYCLIC_INCREMENT(idx->data_pos,
                                                      idx->id_len,
                                                      header->subcache_data_size);
 
-                dest_len = idx->data_used - idx->id_len;
-
-                buf_req = APR_ALIGN_DEFAULT(idx->id_len + 1)
-                        + APR_ALIGN_DEFAULT(dest_len + 1);
-
-                if (buf_req > *buf_len) {
-                     /* Grow to ~150% of this buffer requirement on resize
-                      * always using APR_ALIGN_DEFAULT sized pages
-                      */
-                     *buf_len = buf_req + APR_ALIGN_DEFAULT(buf_req / 2);
-                     *buf = apr_palloc(pool, *buf_len);
-                     id = *buf;
-                }
-
-                dest = *buf + APR_ALIGN_DEFAULT(idx->id_len + 1);
+                entry = apr_array_push(entries);
+                entry->id_len = idx->id_len;
+                entry->data_len = idx->data_used - idx->id_len;
+                entry->id = apr_palloc(ptemp, entry->id_len + 1);
+                entry->data = apr_palloc(ptemp, entry->data_len + 1);
 
                 /* Copy out the data, because it's potentially cyclic */
-                shmcb_cyclic_cton_memcpy(header->subcache_data_size, id,
+                shmcb_cyclic_cton_memcpy(header->subcache_data_size, entry->id,
                                          SHMCB_DATA(header, subcache),
-                                         idx->data_pos, idx->id_len);
-                id[idx->id_len] = '\0';
+                                         idx->data_pos, entry->id_len);
+                entry->id[entry->id_len] = '\0';
 
-                shmcb_cyclic_cton_memcpy(header->subcache_data_size, dest,
+                shmcb_cyclic_cton_memcpy(header->subcache_data_size,
+                                         entry->data,
                                          SHMCB_DATA(header, subcache),
-                                         data_offset, dest_len);
-                dest[dest_len] = '\0';
-
-                rv = iterator(instance, s, userctx, id, idx->id_len,
-                              dest, dest_len, pool);
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(00855)
-                             "shmcb entry iterated");
-                if (rv != APR_SUCCESS)
-                    return rv;
+                                         data_offset, entry->data_len);
+                entry->data[entry->data_len] = '\0';
             }
             else {
                 /* Already stale, quietly remove and treat as not-found */
                 idx->removed = 1;
-                header->stat_expiries++;
+                subcache->stat_expiries++;
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00856)
                              "shmcb_subcache_iterate discarding expired entry");
             }
@@ -1001,13 +1098,24 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
         loop++;
         pos = SHMCB_CYCLIC_INCREMENT(pos, 1, header->index_num);
     }
+    shmcb_subcache_unlock(instance, s, subcache);
+
+    entry = (SHMCBEntry *) entries->elts;
+    for (i = 0; i < entries->nelts; i++, entry++) {
+        rv = iterator(instance, s, userctx, entry->id, entry->id_len,
+                      entry->data, entry->data_len, pool);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(00855)
+                     "shmcb entry iterated");
+        if (rv != APR_SUCCESS)
+            return rv;
+    }
 
     return APR_SUCCESS;
 }
 
 static const ap_socache_provider_t socache_shmcb = {
     "shmcb",
-    AP_SOCACHE_FLAG_NOTMPSAFE,
+    0,
     socache_shmcb_create,
     socache_shmcb_init,
     socache_shmcb_destroy,
@@ -1018,8 +1126,52 @@ static const ap_socache_provider_t socache_shmcb = {
     socache_shmcb_iterate
 };
 
+static int socache_shmcb_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                    apr_pool_t *ptemp)
+{
+    apr_status_t rv;
+
+    rv = ap_mutex_register(pconf, shmcb_mutex_type, NULL,
+                           APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(02900)
+                      "failed to register %s mutex", shmcb_mutex_type);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    shmcb_instances = apr_array_make(pconf, 4,
+                                     sizeof(ap_socache_instance_t *));
+
+    return OK;
+}
+
+static void socache_shmcb_child_init(apr_pool_t *p, server_rec *s)
+{
+    int i;
+    unsigned int loop;
+
+    for (i = 0; shmcb_instances && i < shmcb_instances->nelts; i++) {
+        ap_socache_instance_t *ctx = APR_ARRAY_IDX(shmcb_instances, i,
+                                                   ap_socache_instance_t *);
+
+        for (loop = 0; loop < ctx->num_mutexes; loop++) {
+            const char *lock = apr_global_mutex_lockfile(ctx->mutexes[loop]);
+            apr_status_t rv = apr_global_mutex_child_init(&ctx->mutexes[loop],
+                                                          lock, p);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(02901)
+                             "failed to initialise shmcb mutex in child_init");
+            }
+        }
+    }
+}
+
 static void register_hooks(apr_pool_t *p)
 {
+    ap_hook_pre_config(socache_shmcb_pre_config, NULL, NULL,
+                       APR_HOOK_MIDDLE);
+    ap_hook_child_init(socache_shmcb_child_init, NULL, NULL,
+                       APR_HOOK_REALLY_FIRST);
+
     ap_register_provider(p, AP_SOCACHE_PROVIDER_GROUP, "shmcb",
                          AP_SOCACHE_PROVIDER_VERSION,
                          &socache_shmcb);
@@ -737,7 +737,7 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         if (!apr_table_get(r->subprocess_env, "force-gzip")) {
             const char *accepts;
             /* if they don't have the line, then they can't play */
-            accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+            accepts = ap_get_request_header(r, AP_HEADER_ACCEPT_ENCODING);
             if (accepts == NULL) {
                 ap_remove_output_filter(f);
                 return ap_pass_brigade(f->next, bb);
@@ -1141,7 +1141,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
             }
 
             /* We can't operate on Content-Ranges */
-            if (apr_table_get(r->headers_in, "Content-Range") != NULL) {
+            if (ap_get_request_header(r, AP_HEADER_CONTENT_RANGE) != NULL) {
                 ap_remove_input_filter(f);
                 return ap_get_brigade(f->next, bb, mode, block, readbytes);
             }
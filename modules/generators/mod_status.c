@@ -187,7 +187,7 @@ static int status_handler(request_rec *r)
     int j, i, res, written;
     int ready;
     int busy;
-    unsigned long count;
+    unsigned long count, wcount, pcount, prcount;
     unsigned long lres, my_lres, conn_lres;
     apr_off_t bytes, my_bytes, conn_bytes;
     apr_off_t bcount, kbcount;
@@ -229,6 +229,9 @@ static int status_handler(request_rec *r)
     ready = 0;
     busy = 0;
     count = 0;
+    wcount = 0;
+    pcount = 0;
+    prcount = 0;
     bcount = 0;
     kbcount = 0;
     short_report = 0;
@@ -370,6 +373,9 @@ static int status_handler(request_rec *r)
 #endif /* HAVE_TIMES */
 
                     count += lres;
+                    wcount += ws_record->write_count;
+                    pcount += ws_record->pool_count;
+                    prcount += ws_record->pool_reuse_count;
                     bcount += bytes;
 
                     if (bcount >= KBYTE) {
@@ -453,6 +459,14 @@ static int status_handler(request_rec *r)
             if (count > 0)
                 ap_rprintf(r, "BytesPerReq: %g\n",
                            KBYTE * (float) kbcount / (float) count);
+
+            ap_rprintf(r, "Total Writes: %lu\n", wcount);
+            if (count > 0)
+                ap_rprintf(r, "WritesPerReq: %g\n",
+                           (float) wcount / (float) count);
+
+            ap_rprintf(r, "RequestPools: %lu\nRequestPoolsReused: %lu\n",
+                       pcount, prcount);
         }
         else { /* !short_report */
             ap_rprintf(r, "<dt>Total accesses: %lu - Total Traffic: ", count);
@@ -485,6 +499,20 @@ static int status_handler(request_rec *r)
             }
 
             ap_rputs("</dt>\n", r);
+
+            ap_rprintf(r, "<dt>Total network writes: %lu", wcount);
+            if (count > 0) {
+                ap_rprintf(r, " - %.3g writes/request",
+                           (float) wcount / (float) count);
+            }
+            ap_rputs("</dt>\n", r);
+
+            ap_rprintf(r, "<dt>Request pools: %lu", pcount);
+            if (pcount > 0) {
+                ap_rprintf(r, " - %.3g%% recycled",
+                           (float) prcount * 100 / (float) pcount);
+            }
+            ap_rputs("</dt>\n", r);
         } /* short_report */
     } /* ap_extended_status */
 
@@ -494,6 +522,33 @@ static int status_handler(request_rec *r)
     else
         ap_rprintf(r, "BusyWorkers: %d\nIdleWorkers: %d\n", busy, ready);
 
+    /* transaction pools the children had to create for the connections
+     * they accepted, the others were recycled
+     */
+    {
+        apr_uint32_t accepts = 0, pools = 0;
+
+        for (i = 0; i < server_limit; ++i) {
+            ps_record = ap_get_scoreboard_process(i);
+            if (ps_record->pid) {
+                accepts += ps_record->accept_count;
+                pools += ps_record->pool_count;
+            }
+        }
+        if (!short_report) {
+            ap_rprintf(r, "<dt>%u transaction pools created for %u "
+                          "connections", pools, accepts);
+            if (accepts > pools) {
+                ap_rprintf(r, " - %.3g%% recycled",
+                           (float) (accepts - pools) * 100 / (float) accepts);
+            }
+            ap_rputs("</dt>\n", r);
+        }
+        else
+            ap_rprintf(r, "ConnsAccepted: %u\nTransactionPools: %u\n",
+                       accepts, pools);
+    }
+
     if (!short_report)
         ap_rputs("</dl>", r);
 
@@ -554,6 +609,45 @@ static int status_handler(request_rec *r)
         }
     }
 
+    /* connections accepted per listeners bucket, to check the balance */
+    {
+        apr_uint32_t *bucket_accepts;
+        int *bucket_children, num_buckets = 0;
+
+        bucket_accepts = apr_pcalloc(r->pool,
+                                     server_limit * sizeof(*bucket_accepts));
+        bucket_children = apr_pcalloc(r->pool,
+                                      server_limit * sizeof(*bucket_children));
+        for (i = 0; i < server_limit; ++i) {
+            ps_record = ap_get_scoreboard_process(i);
+            if (ps_record->pid && ps_record->bucket >= 0
+                && ps_record->bucket < server_limit) {
+                bucket_accepts[ps_record->bucket] += ps_record->accept_count;
+                bucket_children[ps_record->bucket]++;
+                if (ps_record->bucket >= num_buckets) {
+                    num_buckets = ps_record->bucket + 1;
+                }
+            }
+        }
+        if (num_buckets > 1) {
+            if (!short_report)
+                ap_rputs("\n\n<table rules=\"all\" cellpadding=\"1%\">\n"
+                         "<tr><th>Listeners bucket</th><th>Children</th>"
+                         "<th>Accepted connections</th></tr>\n", r);
+            for (i = 0; i < num_buckets; ++i) {
+                if (!short_report)
+                    ap_rprintf(r, "<tr><td>%d</td><td>%d</td><td>%u</td>"
+                                  "</tr>\n",
+                               i, bucket_children[i], bucket_accepts[i]);
+                else
+                    ap_rprintf(r, "Bucket%dAccepts: %u\n",
+                               i, bucket_accepts[i]);
+            }
+            if (!short_report)
+                ap_rputs("</table>\n", r);
+        }
+    }
+
     /* send the scoreboard 'table' out */
     if (!short_report)
         ap_rputs("<pre>", r);
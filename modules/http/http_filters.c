@@ -1502,8 +1502,8 @@ AP_DECLARE(int) ap_discard_request_body(request_rec *r)
 
 AP_DECLARE(int) ap_setup_client_block(request_rec *r, int read_policy)
 {
-    const char *tenc = apr_table_get(r->headers_in, "Transfer-Encoding");
-    const char *lenp = apr_table_get(r->headers_in, "Content-Length");
+    const char *tenc = ap_get_request_header(r, AP_HEADER_TRANSFER_ENCODING);
+    const char *lenp = ap_get_request_header(r, AP_HEADER_CONTENT_LENGTH);
 
     r->read_body = read_policy;
     r->read_chunked = 0;
@@ -0,0 +1,458 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Consistent hashing: the request goes to the member given by the hash of
+ * a key (BalancerHashKey, the URL path by default), so that the same key
+ * keeps hitting the same backend, e.g. the shard of a cache holding it.
+ *
+ * Each child keeps a Maglev lookup table per balancer: a prime number of
+ * slots, filled in turns by the enabled members along a permutation of
+ * the slots derived from their name, lbfactor slots per turn.  Selection
+ * is a single lookup, and adding or taking a member out of the table only
+ * moves the keys of about its share of the slots.  The table is rebuilt
+ * when the members are changed (balancer-manager, new members), while a
+ * member in error only has its keys sent to the members following it in
+ * the table until it recovers.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "ap_hooks.h"
+#include "ap_expr.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_byhash_module;
+
+static int (*ap_proxy_retry_worker_fn)(const char *proxy_function,
+        proxy_worker *worker, server_rec *s) = NULL;
+
+/* Members out of the table, by choice rather than by failure */
+#define BYHASH_NOT_ENABLED (PROXY_WORKER_IN_SHUTDOWN | PROXY_WORKER_DISABLED | \
+                            PROXY_WORKER_STOPPED | PROXY_WORKER_DRAIN | \
+                            PROXY_WORKER_HOT_STANDBY | PROXY_WORKER_FREE)
+
+/* Slots per member at least, for an even spread of the keys */
+#define BYHASH_SLOTS_PER_MEMBER 100
+
+#define BYHASH_EMPTY 0xFFFF
+
+/* Table sizes, the largest one fits the apr_uint16_t slots */
+static const apr_uint32_t byhash_sizes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521
+};
+
+typedef struct {
+    ap_expr_info_t *key;
+} byhash_dir_conf;
+
+/* A member of the table being filled */
+typedef struct {
+    int index;                  /* in balancer->workers */
+    apr_uint32_t offset;
+    apr_uint32_t skip;
+    apr_uint32_t next;          /* position in its permutation */
+    int weight;
+} byhash_member_t;
+
+/* The table of a balancer in this child, in balancer->context */
+typedef struct {
+    apr_uint32_t size;
+    apr_time_t wupdated;        /* balancer->wupdated it was built from */
+    int nmembers;
+    byhash_member_t *members;   /* max_workers */
+    apr_uint16_t *lookup;       /* size slots */
+} byhash_table_t;
+
+/* murmur3 finalizer, FNV alone spreads similar keys poorly */
+static apr_uint32_t byhash_mix(apr_uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static int byhash_member_cmp(const void *a, const void *b)
+{
+    const byhash_member_t *ma = a, *mb = b;
+
+    if (ma->offset != mb->offset) {
+        return ma->offset < mb->offset ? -1 : 1;
+    }
+    return ma->skip < mb->skip ? -1 : ma->skip > mb->skip;
+}
+
+static byhash_table_t *byhash_table(proxy_balancer *balancer)
+{
+    byhash_table_t *t = balancer->context;
+    int i;
+
+    if (!t) {
+        /*
+         * Sized once from max_workers, so that members coming and going
+         * keep the slots of the others.  It lives as long as the child.
+         */
+        t = ap_calloc(1, sizeof(byhash_table_t));
+        t->size = byhash_sizes[sizeof(byhash_sizes) / sizeof(byhash_sizes[0]) - 1];
+        for (i = 0; i < sizeof(byhash_sizes) / sizeof(byhash_sizes[0]); i++) {
+            if (byhash_sizes[i] >=
+                    (apr_uint32_t)balancer->max_workers * BYHASH_SLOTS_PER_MEMBER) {
+                t->size = byhash_sizes[i];
+                break;
+            }
+        }
+        t->members = ap_calloc(balancer->max_workers > 0 ? balancer->max_workers
+                                                         : 1,
+                               sizeof(byhash_member_t));
+        t->lookup = ap_malloc(t->size * sizeof(apr_uint16_t));
+        t->wupdated = -1;
+        balancer->context = t;
+    }
+    return t;
+}
+
+/*
+ * Fill the table with the enabled members of the lowest lbset having any,
+ * each one taking the next free slot of its permutation in turn.
+ */
+static void byhash_build(proxy_balancer *balancer, byhash_table_t *t,
+                         server_rec *s)
+{
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    int nelts = balancer->workers->nelts;
+    int i, k, lbset = -1;
+    apr_uint32_t filled, c;
+
+    if (nelts > balancer->max_workers) {
+        nelts = balancer->max_workers;
+    }
+    if (nelts > BYHASH_EMPTY) {
+        nelts = BYHASH_EMPTY;
+    }
+    for (i = 0; i < nelts; i++) {
+        if (!(workers[i]->s->status & BYHASH_NOT_ENABLED)
+            && (lbset < 0 || workers[i]->s->lbset < lbset)) {
+            lbset = workers[i]->s->lbset;
+        }
+    }
+
+    t->nmembers = 0;
+    for (i = 0; i < nelts; i++) {
+        byhash_member_t *m;
+
+        if ((workers[i]->s->status & BYHASH_NOT_ENABLED)
+            || workers[i]->s->lbset != lbset) {
+            continue;
+        }
+        m = &t->members[t->nmembers++];
+        m->index = i;
+        m->offset = workers[i]->hash.def % t->size;
+        m->skip = workers[i]->hash.fnv % (t->size - 1) + 1;
+        m->next = 0;
+        m->weight = workers[i]->s->lbfactor > 0 ? workers[i]->s->lbfactor : 1;
+    }
+    t->wupdated = balancer->wupdated;
+
+    if (!t->nmembers) {
+        return;
+    }
+
+    /* the same table in every child, whatever the order of the members */
+    qsort(t->members, t->nmembers, sizeof(byhash_member_t), byhash_member_cmp);
+
+    for (c = 0; c < t->size; c++) {
+        t->lookup[c] = BYHASH_EMPTY;
+    }
+    /*
+     * The size being prime, each permutation goes through all the slots,
+     * so the next free one is always found.
+     */
+    filled = 0;
+    while (filled < t->size) {
+        for (k = 0; k < t->nmembers && filled < t->size; k++) {
+            byhash_member_t *m = &t->members[k];
+            int turns;
+
+            for (turns = m->weight; turns > 0 && filled < t->size; turns--) {
+                do {
+                    c = (apr_uint32_t)((m->offset
+                                        + (apr_uint64_t)m->next++ * m->skip)
+                                       % t->size);
+                } while (t->lookup[c] != BYHASH_EMPTY);
+                t->lookup[c] = (apr_uint16_t)m->index;
+                filled++;
+            }
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02887)
+                 "proxy: byhash table of %u slots for BALANCER (%s), "
+                 "%d members of lbset %d", t->size, balancer->s->name,
+                 t->nmembers, lbset);
+}
+
+static int byhash_usable(proxy_worker *worker, request_rec *r)
+{
+    /* If the worker is in error state run
+     * retry on that worker. It will be marked as
+     * operational if the retry timeout is elapsed.
+     * The worker might still be unusable, but we try
+     * anyway.
+     */
+    if (!PROXY_WORKER_IS_USABLE(worker)) {
+        ap_proxy_retry_worker_fn("BALANCER", worker, r->server);
+    }
+    return PROXY_WORKER_IS_USABLE(worker);
+}
+
+/*
+ * The usable member with the highest hash of the key and its name, in the
+ * lowest lbset having one, when none of the table is usable.
+ */
+static proxy_worker *byhash_scan(proxy_balancer *balancer, request_rec *r,
+                                 apr_uint32_t hash)
+{
+    int i;
+    proxy_worker **worker;
+    proxy_worker *mycandidate = NULL;
+    apr_uint32_t score, best = 0;
+    int cur_lbset = 0;
+    int max_lbset = 0;
+    int checking_standby;
+    int checked_standby;
+
+    do {
+
+        checking_standby = checked_standby = 0;
+        while (!mycandidate && !checked_standby) {
+
+            worker = (proxy_worker **)balancer->workers->elts;
+            for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+                if  (!checking_standby) {    /* first time through */
+                    if ((*worker)->s->lbset > max_lbset)
+                        max_lbset = (*worker)->s->lbset;
+                }
+                if (
+                    ((*worker)->s->lbset != cur_lbset) ||
+                    (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker) : PROXY_WORKER_IS_STANDBY(*worker)) ||
+                    (PROXY_WORKER_IS_DRAINING(*worker))
+                    ) {
+                    continue;
+                }
+
+                if (byhash_usable(*worker, r)) {
+                    score = byhash_mix(hash ^ (*worker)->hash.def);
+                    if (!mycandidate || score > best) {
+                        mycandidate = *worker;
+                        best = score;
+                    }
+                }
+
+            }
+
+            checked_standby = checking_standby++;
+
+        }
+
+        cur_lbset++;
+
+    } while (cur_lbset <= max_lbset && !mycandidate);
+
+    return mycandidate;
+}
+
+/* assumed to be mutex protected by caller */
+static proxy_worker *find_best_byhash(proxy_balancer *balancer,
+                                      request_rec *r)
+{
+    byhash_dir_conf *conf = ap_get_module_config(r->per_dir_config,
+                                                 &lbmethod_byhash_module);
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    proxy_worker *mycandidate = NULL;
+    byhash_table_t *t;
+    const char *key = NULL;
+    apr_uint32_t hash, slot, c;
+    char *tried = NULL;
+    int ntried = 0;
+
+    if (!ap_proxy_retry_worker_fn) {
+        ap_proxy_retry_worker_fn =
+                APR_RETRIEVE_OPTIONAL_FN(ap_proxy_retry_worker);
+        if (!ap_proxy_retry_worker_fn) {
+            /* can only happen if mod_proxy isn't loaded */
+            return NULL;
+        }
+    }
+
+    if (conf->key) {
+        const char *err = NULL;
+
+        key = ap_expr_str_exec(r, conf->key, &err);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02888)
+                          "proxy: byhash: can't evaluate BalancerHashKey "
+                          "for BALANCER (%s): %s", balancer->s->name, err);
+            key = NULL;
+        }
+    }
+    if (!key) {
+        key = r->uri ? r->uri : "";
+    }
+    hash = byhash_mix(ap_proxy_hashfunc(key, PROXY_HASHFUNC_FNV));
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(02889)
+                 "proxy: Entering byhash for BALANCER (%s), key \"%s\"",
+                 balancer->s->name, key);
+
+    t = byhash_table(balancer);
+    if (t->wupdated != balancer->wupdated) {
+        byhash_build(balancer, t, r->server);
+    }
+
+    /*
+     * The member of the key's slot, or if it is failing the next usable
+     * member of the table, which is a different one for each slot of
+     * the failing member.
+     */
+    if (t->nmembers) {
+        slot = hash % t->size;
+        for (c = 0; c < t->size && ntried < t->nmembers; c++) {
+            apr_uint16_t index = t->lookup[(slot + c) % t->size];
+
+            if (index >= balancer->workers->nelts) {
+                continue;
+            }
+            if (tried && tried[index]) {
+                continue;
+            }
+            if (byhash_usable(workers[index], r)) {
+                mycandidate = workers[index];
+                break;
+            }
+            if (!tried) {
+                tried = apr_pcalloc(r->pool, balancer->workers->nelts);
+            }
+            tried[index] = 1;
+            ntried++;
+        }
+    }
+
+    if (!mycandidate) {
+        mycandidate = byhash_scan(balancer, r, hash);
+    }
+
+    if (mycandidate) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(02890)
+                     "proxy: byhash selected worker \"%s\" : key hash %u",
+                     mycandidate->s->name, hash);
+    }
+
+    return mycandidate;
+}
+
+/* The key alone makes the choice, no status to update */
+static apr_status_t updatelbstatus(proxy_balancer *balancer,
+                                   proxy_worker *elected, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        (*worker)->s->lbstatus = 0;
+        (*worker)->s->busy = 0;
+    }
+    byhash_build(balancer, byhash_table(balancer), s);
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method byhash =
+{
+    "byhash",
+    &find_best_byhash,
+    NULL,
+    &reset,
+    &age,
+    &updatelbstatus
+};
+
+static void *create_byhash_dir_config(apr_pool_t *p, char *dummy)
+{
+    return apr_pcalloc(p, sizeof(byhash_dir_conf));
+}
+
+static void *merge_byhash_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    byhash_dir_conf *base = (byhash_dir_conf *)basev;
+    byhash_dir_conf *add = (byhash_dir_conf *)addv;
+    byhash_dir_conf *new = apr_palloc(p, sizeof(byhash_dir_conf));
+
+    new->key = add->key ? add->key : base->key;
+    return new;
+}
+
+static const char *set_hash_key(cmd_parms *cmd, void *dconf, const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+    const char *err = NULL;
+
+    conf->key = ap_expr_parse_cmd(cmd, arg, AP_EXPR_FLAG_STRING_RESULT|
+                                            AP_EXPR_FLAG_DONT_VARY,
+                                  &err, NULL);
+    if (err) {
+        return apr_psprintf(cmd->pool,
+                            "Could not parse hash key expression '%s': %s",
+                            arg, err);
+    }
+    return NULL;
+}
+
+static const command_rec byhash_cmds[] =
+{
+    AP_INIT_TAKE1("BalancerHashKey", set_hash_key, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "An expression giving the key hashed by the byhash lbmethod"),
+    {NULL}
+};
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "byhash", "0", &byhash);
+}
+
+AP_DECLARE_MODULE(lbmethod_byhash) = {
+    STANDARD20_MODULE_STUFF,
+    create_byhash_dir_config,   /* create per-directory config structure */
+    merge_byhash_dir_config,    /* merge per-directory config structures */
+    NULL,                       /* create per-server config structure */
+    NULL,                       /* merge per-server config structures */
+    byhash_cmds,                /* command apr_table_t */
+    register_hook               /* register hooks */
+};
@@ -0,0 +1,331 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latency based load balancing: each worker keeps in its shared slot an
+ * exponentially weighted moving average of the time to the first byte of
+ * its responses, and its count of requests in flight ("busy", maintained
+ * by mod_proxy_balancer).  A request goes to the better of two members
+ * picked at random, the one expected to answer sooner from its latency
+ * times the requests it already serves, which needs neither the balancer
+ * lock nor a walk through all the members.
+ */
+
+#include "mod_proxy.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_version.h"
+#include "apr_atomic.h"
+#include "ap_hooks.h"
+#include "util_filter.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_bylatency_module;
+
+static int (*ap_proxy_retry_worker_fn)(const char *proxy_function,
+        proxy_worker *worker, server_rec *s) = NULL;
+
+static ap_filter_rec_t *bylatency_filter_handle;
+
+/* Weight of a new sample in the average, 1/8 */
+#define BYLATENCY_EWMA_SHIFT 3
+
+/* Members picked at random for the two candidates before scanning them */
+#define BYLATENCY_SAMPLES 8
+
+/* The member a request was sent to, and when */
+typedef struct {
+    proxy_worker *worker;
+    apr_time_t start;
+} bylatency_req_t;
+
+/* splitmix64, seeded per request */
+static apr_uint64_t bylatency_random(apr_uint64_t *state)
+{
+    apr_uint64_t z = (*state += APR_UINT64_C(0x9e3779b97f4a7c15));
+
+    z = (z ^ (z >> 30)) * APR_UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * APR_UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/*
+ * Non-zero if worker a is expected to answer sooner than worker b, from
+ * their time to first byte times the requests they are serving plus
+ * this one, relative to their lbfactor.  A member with no latency yet
+ * is taken for as fast as the other one.
+ */
+static int bylatency_better(proxy_worker *a, proxy_worker *b)
+{
+    apr_uint64_t la = apr_atomic_read32(&a->s->ttfb);
+    apr_uint64_t lb = apr_atomic_read32(&b->s->ttfb);
+
+    if (!la) {
+        la = lb ? lb : 1;
+    }
+    if (!lb) {
+        lb = la;
+    }
+    return la * (a->s->busy + 1) * b->s->lbfactor
+           < lb * (b->s->busy + 1) * a->s->lbfactor;
+}
+
+static int bylatency_usable(proxy_worker *worker, request_rec *r)
+{
+    /* If the worker is in error state run
+     * retry on that worker. It will be marked as
+     * operational if the retry timeout is elapsed.
+     * The worker might still be unusable, but we try
+     * anyway.
+     */
+    if (!PROXY_WORKER_IS_USABLE(worker)) {
+        ap_proxy_retry_worker_fn("BALANCER", worker, r->server);
+    }
+    return PROXY_WORKER_IS_USABLE(worker);
+}
+
+/*
+ * The best member of the lowest lbset with a usable one, looking at all
+ * of them, when sampling found no usable member of lbset 0.
+ */
+static proxy_worker *bylatency_scan(proxy_balancer *balancer,
+                                    request_rec *r)
+{
+    int i;
+    proxy_worker **worker;
+    proxy_worker *mycandidate = NULL;
+    int cur_lbset = 0;
+    int max_lbset = 0;
+    int checking_standby;
+    int checked_standby;
+
+    do {
+
+        checking_standby = checked_standby = 0;
+        while (!mycandidate && !checked_standby) {
+
+            worker = (proxy_worker **)balancer->workers->elts;
+            for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+                if  (!checking_standby) {    /* first time through */
+                    if ((*worker)->s->lbset > max_lbset)
+                        max_lbset = (*worker)->s->lbset;
+                }
+                if (
+                    ((*worker)->s->lbset != cur_lbset) ||
+                    (checking_standby ? !PROXY_WORKER_IS_STANDBY(*worker) : PROXY_WORKER_IS_STANDBY(*worker)) ||
+                    (PROXY_WORKER_IS_DRAINING(*worker))
+                    ) {
+                    continue;
+                }
+
+                if (bylatency_usable(*worker, r)
+                    && (!mycandidate || bylatency_better(*worker, mycandidate))) {
+                    mycandidate = *worker;
+                }
+
+            }
+
+            checked_standby = checking_standby++;
+
+        }
+
+        cur_lbset++;
+
+    } while (cur_lbset <= max_lbset && !mycandidate);
+
+    return mycandidate;
+}
+
+/* Time the first byte of the response of the request's member */
+static void bylatency_track(request_rec *r, proxy_worker *worker)
+{
+    bylatency_req_t *req = ap_get_module_config(r->request_config,
+                                                &lbmethod_bylatency_module);
+
+    if (!req) {
+        req = apr_palloc(r->pool, sizeof(bylatency_req_t));
+        ap_set_module_config(r->request_config, &lbmethod_bylatency_module,
+                             req);
+        ap_add_output_filter_handle(bylatency_filter_handle, req, r,
+                                    r->connection);
+    }
+    /* on failover, the latest member */
+    req->worker = worker;
+    req->start = apr_time_now();
+}
+
+static proxy_worker *find_best_bylatency(proxy_balancer *balancer,
+                                         request_rec *r)
+{
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    int nelts = balancer->workers->nelts;
+    proxy_worker *a = NULL, *b = NULL, *mycandidate;
+    apr_uint64_t seed;
+    int i;
+
+    if (!ap_proxy_retry_worker_fn) {
+        ap_proxy_retry_worker_fn =
+                APR_RETRIEVE_OPTIONAL_FN(ap_proxy_retry_worker);
+        if (!ap_proxy_retry_worker_fn) {
+            /* can only happen if mod_proxy isn't loaded */
+            return NULL;
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(02885)
+                 "proxy: Entering bylatency for BALANCER (%s)",
+                 balancer->s->name);
+
+    if (!nelts) {
+        return NULL;
+    }
+
+    /*
+     * Any usable member of lbset 0 is a valid choice, so pick two of
+     * them at random; the lbsets and standby members are only walked
+     * when none shows up.
+     */
+    seed = (apr_uint64_t)apr_time_now() ^ (apr_uint64_t)(apr_uintptr_t)r;
+    for (i = 0; i < BYLATENCY_SAMPLES && !b; i++) {
+        proxy_worker *worker = workers[bylatency_random(&seed) % nelts];
+
+        if (worker == a || worker->s->lbset
+            || PROXY_WORKER_IS_STANDBY(worker)
+            || PROXY_WORKER_IS_DRAINING(worker)
+            || !bylatency_usable(worker, r)) {
+            continue;
+        }
+        if (!a) {
+            a = worker;
+        }
+        else {
+            b = worker;
+        }
+    }
+
+    if (b) {
+        mycandidate = bylatency_better(b, a) ? b : a;
+    }
+    else if (a) {
+        mycandidate = a;
+    }
+    else {
+        mycandidate = bylatency_scan(balancer, r);
+    }
+
+    if (mycandidate) {
+        bylatency_track(r, mycandidate);
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, r->server, APLOGNO(02886)
+                     "proxy: bylatency selected worker \"%s\" : busy %"
+                     APR_SIZE_T_FMT " : ttfb %u",
+                     mycandidate->s->name, mycandidate->s->busy,
+                     apr_atomic_read32(&mycandidate->s->ttfb));
+    }
+
+    return mycandidate;
+}
+
+static void bylatency_sample(proxy_worker *worker, apr_interval_time_t t)
+{
+    apr_uint32_t old, ewma, sample;
+
+    sample = t >= APR_UINT32_MAX ? APR_UINT32_MAX : t > 0 ? t : 1;
+    do {
+        old = apr_atomic_read32(&worker->s->ttfb);
+        if (old) {
+            ewma = old - (old >> BYLATENCY_EWMA_SHIFT)
+                       + (sample >> BYLATENCY_EWMA_SHIFT);
+        }
+        else {
+            ewma = sample;
+        }
+    } while (apr_atomic_cas32(&worker->s->ttfb, ewma ? ewma : 1, old) != old);
+}
+
+static apr_status_t bylatency_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    bylatency_req_t *req = f->ctx;
+    request_rec *r = f->r;
+    const char *name = apr_table_get(r->subprocess_env,
+                                     "BALANCER_WORKER_NAME");
+
+    /*
+     * The first output of the handler, unless it is an error of its own
+     * or the request ended up on another member by its route.
+     */
+    if (r->status < HTTP_INTERNAL_SERVER_ERROR
+        && name && !strcmp(name, req->worker->s->name)) {
+        bylatency_sample(req->worker, apr_time_now() - req->start);
+    }
+    ap_remove_output_filter(f);
+
+    return ap_pass_brigade(f->next, bb);
+}
+
+/* The latency and busy counts are the status, nothing to update */
+static apr_status_t updatelbstatus(proxy_balancer *balancer,
+                                   proxy_worker *elected, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        (*worker)->s->lbstatus = 0;
+        (*worker)->s->busy = 0;
+        apr_atomic_set32(&(*worker)->s->ttfb, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method bylatency =
+{
+    "bylatency",
+    &find_best_bylatency,
+    NULL,
+    &reset,
+    &age,
+    &updatelbstatus
+};
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "bylatency", "0", &bylatency);
+    ap_register_provider(p, PROXY_LBMETHOD, "bylatency",
+                         PROXY_LBMETHOD_LOCKLESS, &bylatency);
+    bylatency_filter_handle =
+        ap_register_output_filter("PROXY_BYLATENCY", bylatency_filter,
+                                  NULL, AP_FTYPE_RESOURCE);
+}
+
+AP_DECLARE_MODULE(lbmethod_bylatency) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,       /* create per-directory config structure */
+    NULL,       /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    NULL,       /* command apr_table_t */
+    register_hook /* register hooks */
+};
@@ -19,6 +19,8 @@
 #include "apr_optional.h"
 #include "scoreboard.h"
 #include "mod_status.h"
+#include "mod_watchdog.h"
+#include "ap_mpm.h"
 #include "proxy_util.h"
 
 #if (MODULE_MAGIC_NUMBER_MAJOR > 20020903)
@@ -894,7 +896,7 @@ static int proxy_needsdomain(request_rec *r, const char *url, const char *domain
      || strcasecmp(r->parsed_uri.hostname, "localhost") == 0)
         return DECLINED;    /* host name has a dot already */
 
-    ref = apr_table_get(r->headers_in, "Referer");
+    ref = ap_get_request_header(r, AP_HEADER_REFERER);
 
     /* Reassemble the request, but insert the domain after the host name */
     /* Note that the domain name always starts with a dot */
@@ -917,6 +919,51 @@ static int proxy_needsdomain(request_rec *r, const char *url, const char *domain
 /* -------------------------------------------------------------- */
 /* Invoke handler */
 
+/* What proxy_handler() leaves for ap_proxy_suspended_done() to finish */
+typedef struct {
+    proxy_worker *worker;
+    proxy_balancer *balancer;
+    proxy_server_conf *conf;
+    int attempts;
+} proxy_suspended_t;
+
+#define PROXY_SUSPENDED_KEY "mod_proxy-suspended"
+
+/*
+ * Run the post_request and request_status hooks once the scheme handler
+ * is done with the request.
+ */
+static int proxy_handler_done(request_rec *r, proxy_worker *worker,
+                              proxy_balancer *balancer,
+                              proxy_server_conf *conf, int attempts,
+                              int access_status)
+{
+    int saved_status;
+
+    /*
+     * Save current r->status and set it to the value of access_status which
+     * might be different (e.g. r->status could be HTTP_OK if e.g. we override
+     * the error page on the proxy or if the error was not generated by the
+     * backend itself but by the proxy e.g. a bad gateway) in order to give
+     * ap_proxy_post_request a chance to act correctly on the status code.
+     */
+    saved_status = r->status;
+    r->status = access_status;
+    ap_proxy_post_request(worker, balancer, r, conf);
+    /*
+     * Only restore r->status if it has not been changed by
+     * ap_proxy_post_request as we assume that this change was intentional.
+     */
+    if (r->status == access_status) {
+        r->status = saved_status;
+    }
+
+    proxy_run_request_status(&access_status, r);
+    AP_PROXY_RUN_FINISHED(r, attempts, access_status);
+
+    return access_status;
+}
+
 static int proxy_handler(request_rec *r)
 {
     char *uri, *scheme, *p;
@@ -934,7 +981,6 @@ static int proxy_handler(request_rec *r)
     proxy_worker *worker = NULL;
     int attempts = 0, max_attempts = 0;
     struct dirconn_entry *list = (struct dirconn_entry *)conf->dirconn->elts;
-    int saved_status;
 
     /* is this for us? */
     if (!r->filename) {
@@ -957,7 +1003,7 @@ static int proxy_handler(request_rec *r)
     }
 
     /* handle max-forwards / OPTIONS / TRACE */
-    if ((str = apr_table_get(r->headers_in, "Max-Forwards"))) {
+    if ((str = ap_get_request_header(r, AP_HEADER_MAX_FORWARDS))) {
         char *end;
         maxfwd = apr_strtoi64(str, &end, 10);
         if (maxfwd < 0 || maxfwd == APR_INT64_MAX || *end) {
@@ -1127,7 +1173,8 @@ static int proxy_handler(request_rec *r)
                         if (access_status != HTTP_BAD_GATEWAY) {
                             goto cleanup;
                         }
-                        cl_a = apr_table_get(r->headers_in, "Content-Length");
+                        cl_a = ap_get_request_header(r,
+                                                AP_HEADER_CONTENT_LENGTH);
                         if (cl_a) {
                             apr_strtoff(&cl, cl_a, &end, 10);
                             /*
@@ -1145,7 +1192,8 @@ static int proxy_handler(request_rec *r)
                          * a request body. We cannot retry with a direct
                          * connection for the same reason as above.
                          */
-                        if (apr_table_get(r->headers_in, "Transfer-Encoding")) {
+                        if (ap_get_request_header(r,
+                                    AP_HEADER_TRANSFER_ENCODING)) {
                             goto cleanup;
                         }
                     }
@@ -1210,28 +1258,37 @@ static int proxy_handler(request_rec *r)
         goto cleanup;
     }
 cleanup:
-    /*
-     * Save current r->status and set it to the value of access_status which
-     * might be different (e.g. r->status could be HTTP_OK if e.g. we override
-     * the error page on the proxy or if the error was not generated by the
-     * backend itself but by the proxy e.g. a bad gateway) in order to give
-     * ap_proxy_post_request a chance to act correctly on the status code.
-     */
-    saved_status = r->status;
-    r->status = access_status;
-    ap_proxy_post_request(worker, balancer, r, conf);
-    /*
-     * Only restore r->status if it has not been changed by
-     * ap_proxy_post_request as we assume that this change was intentional.
-     */
-    if (r->status == access_status) {
-        r->status = saved_status;
-    }
+    if (access_status == SUSPENDED) {
+        /*
+         * The scheme handler completes the request from an MPM callback,
+         * and calls ap_proxy_suspended_done() once it knows how it ends.
+         */
+        proxy_suspended_t *suspended = apr_palloc(r->pool,
+                                                  sizeof(*suspended));
+        suspended->worker = worker;
+        suspended->balancer = balancer;
+        suspended->conf = conf;
+        suspended->attempts = attempts;
+        apr_pool_userdata_setn(suspended, PROXY_SUSPENDED_KEY, NULL, r->pool);
+        return SUSPENDED;
+    }
+
+    return proxy_handler_done(r, worker, balancer, conf, attempts,
+                              access_status);
+}
 
-    proxy_run_request_status(&access_status, r);
-    AP_PROXY_RUN_FINISHED(r, attempts, access_status);
+PROXY_DECLARE(int) ap_proxy_suspended_done(request_rec *r, int status)
+{
+    proxy_suspended_t *suspended = NULL;
 
-    return access_status;
+    apr_pool_userdata_get((void **)&suspended, PROXY_SUSPENDED_KEY, r->pool);
+    if (!suspended) {
+        return status;
+    }
+    apr_pool_userdata_setn(NULL, PROXY_SUSPENDED_KEY, NULL, r->pool);
+
+    return proxy_handler_done(r, suspended->worker, suspended->balancer,
+                              suspended->conf, suspended->attempts, status);
 }
 
 /* -------------------------------------------------------------- */
@@ -2551,9 +2608,48 @@ PROXY_DECLARE(const char *) ap_proxy_ssl_val(apr_pool_t *p, server_rec *s,
         return NULL;
 }
 
+/*
+ * Check the idle backend connections of the workers of all the servers,
+ * from the child's default watchdog thread.
+ */
+static apr_status_t proxy_watchdog_callback(int state, void *data,
+                                            apr_pool_t *pool)
+{
+    server_rec *s;
+
+    if (state != AP_WATCHDOG_STATE_RUNNING) {
+        return APR_SUCCESS;
+    }
+    for (s = (server_rec *)data; s; s = s->next) {
+        proxy_server_conf *conf = ap_get_module_config(s->module_config,
+                                                       &proxy_module);
+        proxy_balancer *balancer;
+        proxy_worker *worker;
+        /* ProxyRemote'd workers connect through the remote proxy */
+        int prewarm = !conf->proxies->nelts;
+        int i, n;
+
+        worker = (proxy_worker *)conf->workers->elts;
+        for (i = 0; i < conf->workers->nelts; i++, worker++) {
+            proxy_util_maintain_connections(worker, s, prewarm, pool);
+        }
+        balancer = (proxy_balancer *)conf->balancers->elts;
+        for (i = 0; i < conf->balancers->nelts; i++, balancer++) {
+            proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; n++) {
+                proxy_util_maintain_connections(workers[n], s, prewarm, pool);
+            }
+        }
+    }
+    return APR_SUCCESS;
+}
+
 static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *s)
 {
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *proxy_watchdog_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *proxy_watchdog_register_callback;
+    int mpm_threads = 0;
     apr_status_t rv = ap_global_mutex_create(&proxy_mutex, NULL,
             proxy_id, NULL, s, pconf, 0);
     if (rv != APR_SUCCESS) {
@@ -2562,6 +2658,32 @@ static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         return rv;
     }
 
+    /*
+     * Pooled connections (threaded MPMs only) are checked and opened in
+     * advance by the watchdog when mod_watchdog is loaded, or else checked
+     * when reused.
+     */
+    proxy_watchdog_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    proxy_watchdog_register_callback = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    ap_mpm_query(AP_MPMQ_MAX_THREADS, &mpm_threads);
+    if (proxy_watchdog_get_instance && proxy_watchdog_register_callback
+        && mpm_threads > 1) {
+        ap_watchdog_t *watchdog;
+
+        rv = proxy_watchdog_get_instance(&watchdog, AP_WATCHDOG_DEFAULT,
+                                         0, 0, pconf);
+        if (rv == APR_SUCCESS) {
+            rv = proxy_watchdog_register_callback(watchdog,
+                                                  PROXY_CONN_CHECK_INTERVAL,
+                                                  s, proxy_watchdog_callback);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(02884)
+                         "failed to register the watchdog callback, pooled "
+                         "connections will be checked when reused");
+        }
+    }
+
     proxy_ssl_enable = APR_RETRIEVE_OPTIONAL_FN(ssl_proxy_enable);
     proxy_ssl_disable = APR_RETRIEVE_OPTIONAL_FN(ssl_engine_disable);
     proxy_is_https = APR_RETRIEVE_OPTIONAL_FN(ssl_is_https);
@@ -253,6 +253,8 @@ typedef struct {
     unsigned int need_flush:1; /* Flag to decide whether we need to flush the
                                 * filter chain or not */
     unsigned int inreslist:1;  /* connection in apr_reslist? */
+    unsigned int validated:1;  /* socket recently found connected by the
+                                * watchdog, no need to check it again */
     const char   *uds_path;    /* Unix domain socket path */
     const char   *ssl_hostname;/* Hostname (SNI) in use by SSL connection */
 } proxy_conn_rec;
@@ -266,8 +268,9 @@ typedef struct {
 struct proxy_conn_pool {
     apr_pool_t     *pool;   /* The pool used in constructor and destructor calls */
     apr_sockaddr_t *addr;   /* Preparsed remote address info */
-    apr_reslist_t  *res;    /* Connection resource list */
+    apr_reslist_t  *res;    /* Unused, see stack below */
     proxy_conn_rec *conn;   /* Single connection for prefork mpm */
+    struct proxy_conn_stack *stack; /* Idle connections, warmest on top */
 };
 
 /* Keep below in sync with proxy_util.c! */
@@ -343,6 +346,14 @@ typedef struct {
     unsigned int fnv;
 } proxy_hashes ;
 
+/*
+ * Backend connect times are counted in PROXY_CONNECT_HIST_BUCKETS buckets,
+ * bucket i for times below PROXY_CONNECT_HIST_BOUND(i) microseconds (250us,
+ * 1ms, 4ms...), the last one for anything slower.
+ */
+#define PROXY_CONNECT_HIST_BUCKETS 8
+#define PROXY_CONNECT_HIST_BOUND(i) (APR_TIME_C(250) << (2 * (i)))
+
 /* Runtime worker status informations. Shared in scoreboard */
 typedef struct {
     char      name[PROXY_WORKER_MAX_NAME_SIZE];
@@ -399,6 +410,10 @@ typedef struct {
     unsigned int     disablereuse_set:1;
     unsigned int     was_malloced:1;
     unsigned int     is_name_matchable:1;
+    apr_size_t      pool_hits;  /* Connections acquired already connected */
+    apr_size_t      pool_misses;/* Connections acquired needing a connect */
+    apr_size_t      connect_hist[PROXY_CONNECT_HIST_BUCKETS]; /* connect times */
+    apr_uint32_t    ttfb;       /* EWMA of the time to first byte in usec (bylatency) */
 } proxy_worker_shared;
 
 #define ALIGNED_PROXY_WORKER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_worker_shared)))
@@ -814,6 +829,17 @@ PROXY_DECLARE(int) ap_proxy_post_request(proxy_worker *worker,
                                          request_rec *r,
                                          proxy_server_conf *conf);
 
+/**
+ * Finish a request whose scheme handler returned SUSPENDED
+ * @param r        current request
+ * @param status   OK, DONE or the HTTP_XXX error the request ends with
+ * @return         the status as amended by the request_status hooks
+ * @note The scheme handler must call it from the callback that completes
+ * the request, before the response is finalized, to run the post_request
+ * and request_status hooks that the proxy handler deferred.
+ */
+PROXY_DECLARE(int) ap_proxy_suspended_done(request_rec *r, int status);
+
 /**
  * Determine backend hostname and port
  * @param p       memory pool used for processing
@@ -1033,6 +1059,42 @@ PROXY_DECLARE(int) ap_proxy_pass_brigade(apr_bucket_alloc_t *bucket_alloc,
                                          conn_rec *origin, apr_bucket_brigade *bb,
                                          int flush);
 
+/**
+ * Opaque state of a zero-copy relay between two connections.
+ */
+typedef struct proxy_splice_t proxy_splice_t;
+
+/**
+ * Prepare to relay the data readable on @a c_in to @a c_out with splice(2),
+ * the bytes going through a pipe without ever being copied to userspace.
+ * This bypasses the filters so it is only possible when the input filters
+ * of @a c_in and the output filters of @a c_out are the core ones alone
+ * (no SSL, no mod_logio...), and the caller must first have consumed what
+ * they buffered (i.e. a nonblocking read from @a c_in returned EAGAIN).
+ * @param ps            the relay, allocated from @a p
+ * @param c_in          the connection to read from
+ * @param c_out         the connection to write to
+ * @param p             pool for the relay and its pipe
+ * @return              APR_ENOTIMPL if the connections or the platform
+ *                      do not allow it
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_create(proxy_splice_t **ps,
+                                                   conn_rec *c_in,
+                                                   conn_rec *c_out,
+                                                   apr_pool_t *p);
+
+/**
+ * Move everything readable on the input connection to the output one;
+ * writes block up to the output socket timeout, like the core output
+ * filter does when flushing.
+ * @param ps            the relay
+ * @param transferred   set to the number of bytes moved
+ * @return              APR_SUCCESS once reading would block, APR_EOF when
+ *                      the input is closed, or the error
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_transfer(proxy_splice_t *ps,
+                                                     apr_off_t *transferred);
+
 /**
  * Clear the headers referenced by the Connection header from the given
  * table, and remove the Connection header.
@@ -1052,6 +1114,11 @@ PROXY_DECLARE(int) ap_proxy_is_socket_connected(apr_socket_t *socket);
 
 #define PROXY_LBMETHOD "proxylbmethod"
 
+/* A method whose finder needs no balancer lock registers the same
+ * proxy_balancer_method under this version too, besides "0"
+ */
+#define PROXY_LBMETHOD_LOCKLESS "lockless"
+
 /* The number of dynamic workers that can be added when reconfiguring.
  * If this limit is reached you must stop and restart the server.
  */
@@ -328,22 +328,32 @@ static proxy_worker *find_best_worker(proxy_balancer *balancer,
     proxy_worker *candidate = NULL;
     apr_status_t rv;
 
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01163)
-                      "%s: Lock failed for find_best_worker()",
-                      balancer->s->name);
-        return NULL;
+    if (ap_lookup_provider(PROXY_LBMETHOD, balancer->lbmethod->name,
+                           PROXY_LBMETHOD_LOCKLESS) == balancer->lbmethod) {
+        /* The method reads the shared stats as they are */
+        candidate = (*balancer->lbmethod->finder)(balancer, r);
+
+        if (candidate)
+            candidate->s->elected++;
     }
+    else {
+        if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01163)
+                          "%s: Lock failed for find_best_worker()",
+                          balancer->s->name);
+            return NULL;
+        }
 
-    candidate = (*balancer->lbmethod->finder)(balancer, r);
+        candidate = (*balancer->lbmethod->finder)(balancer, r);
 
-    if (candidate)
-        candidate->s->elected++;
+        if (candidate)
+            candidate->s->elected++;
 
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01164)
-                      "%s: Unlock failed for find_best_worker()",
-                      balancer->s->name);
+        if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01164)
+                          "%s: Unlock failed for find_best_worker()",
+                          balancer->s->name);
+        }
     }
 
     if (candidate == NULL) {
@@ -977,6 +987,24 @@ static void push2table(const char *input, apr_table_t *params,
  * TODO:
  *   /.../<whatever>/balancer/worker/nonce
  */
+/* Label of bucket i of the connect time histogram */
+static const char *connect_hist_label(apr_pool_t *p, int i)
+{
+    apr_interval_time_t bound;
+
+    if (i == PROXY_CONNECT_HIST_BUCKETS - 1) {
+        i--;
+        bound = PROXY_CONNECT_HIST_BOUND(i);
+        return apr_psprintf(p, "&gt;%" APR_TIME_T_FMT "ms",
+                            apr_time_msec(bound));
+    }
+    bound = PROXY_CONNECT_HIST_BOUND(i);
+    if (bound < 1000) {
+        return apr_psprintf(p, "&lt;%" APR_TIME_T_FMT "us", bound);
+    }
+    return apr_psprintf(p, "&lt;%" APR_TIME_T_FMT "ms", apr_time_msec(bound));
+}
+
 static int balancer_handler(request_rec *r)
 {
     void *sconf;
@@ -1070,6 +1098,9 @@ static int balancer_handler(request_rec *r)
     if (wsel && ok2change) {
         const char *val;
         int was_usable = PROXY_WORKER_IS_USABLE(wsel);
+        unsigned int was_status = wsel->s->status;
+        int was_lbfactor = wsel->s->lbfactor;
+        int was_lbset = wsel->s->lbset;
 
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01192) "settings worker params");
 
@@ -1115,6 +1146,12 @@ static int balancer_handler(request_rec *r)
         if (bsel && !was_usable && PROXY_WORKER_IS_USABLE(wsel)) {
             bsel->s->need_reset = 1;
         }
+        /* let the lbmethods of all the children see the new member set */
+        if (bsel && (wsel->s->status != was_status
+                     || wsel->s->lbfactor != was_lbfactor
+                     || wsel->s->lbset != was_lbset)) {
+            bsel->s->wupdated = apr_time_now();
+        }
 
     }
 
@@ -1281,6 +1318,7 @@ static int balancer_handler(request_rec *r)
             ap_rputs("      <httpd:workers>\n", r);
             workers = (proxy_worker **)balancer->workers->elts;
             for (n = 0; n < balancer->workers->nelts; n++) {
+                int k;
                 worker = *workers;
                 /* Start proxy_worker */
                 ap_rputs("        <httpd:worker>\n", r);
@@ -1377,6 +1415,26 @@ static int balancer_handler(request_rec *r)
                            worker->s->busy);
                 ap_rprintf(r, "          <httpd:lbset>%d</httpd:lbset>\n",
                            worker->s->lbset);
+                ap_rprintf(r,
+                           "          <httpd:pool_hits>%" APR_SIZE_T_FMT "</httpd:pool_hits>\n",
+                           worker->s->pool_hits);
+                ap_rprintf(r,
+                           "          <httpd:pool_misses>%" APR_SIZE_T_FMT "</httpd:pool_misses>\n",
+                           worker->s->pool_misses);
+                ap_rputs("          <httpd:connect_times>\n", r);
+                for (k = 0; k < PROXY_CONNECT_HIST_BUCKETS; k++) {
+                    if (k < PROXY_CONNECT_HIST_BUCKETS - 1) {
+                        ap_rprintf(r, "            <httpd:connect_time "
+                                   "below=\"%" APR_TIME_T_FMT "\">",
+                                   PROXY_CONNECT_HIST_BOUND(k));
+                    }
+                    else {
+                        ap_rputs("            <httpd:connect_time>", r);
+                    }
+                    ap_rprintf(r, "%" APR_SIZE_T_FMT "</httpd:connect_time>\n",
+                               worker->s->connect_hist[k]);
+                }
+                ap_rputs("          </httpd:connect_times>\n", r);
                 /* End proxy_worker_stat */
                 if (!strcasecmp(worker->s->scheme, "ajp")) {
                     ap_rputs("          <httpd:flushpackets>", r);
@@ -1521,6 +1579,7 @@ static int balancer_handler(request_rec *r)
                 "<th>Route</th><th>RouteRedir</th>"
                 "<th>Factor</th><th>Set</th><th>Status</th>"
                 "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>"
+                "<th>Pool Hits</th><th>Pool Misses</th>"
                 "</tr>\n", r);
 
             workers = (proxy_worker **)balancer->workers->elts;
@@ -1549,8 +1608,34 @@ static int balancer_handler(request_rec *r)
                 ap_rputs(apr_strfsize(worker->s->transferred, fbuf), r);
                 ap_rputs("</td><td>", r);
                 ap_rputs(apr_strfsize(worker->s->read, fbuf), r);
-                ap_rputs("</td></tr>\n", r);
+                ap_rprintf(r, "</td><td>%" APR_SIZE_T_FMT "</td>",
+                           worker->s->pool_hits);
+                ap_rprintf(r, "<td>%" APR_SIZE_T_FMT "</td></tr>\n",
+                           worker->s->pool_misses);
+
+                ++workers;
+            }
+            ap_rputs("</table>\n", r);
 
+            /* Backend connect times */
+            ap_rputs("\n<br /><table><tr><th>Connect Time</th>", r);
+            for (n = 0; n < PROXY_CONNECT_HIST_BUCKETS; n++) {
+                ap_rvputs(r, "<th>", connect_hist_label(r->pool, n), "</th>",
+                          NULL);
+            }
+            ap_rputs("</tr>\n", r);
+            workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; n++) {
+                int k;
+                worker = *workers;
+                ap_rvputs(r, "<tr>\n<td>",
+                          ap_proxy_worker_name(r->pool, worker), "</td>",
+                          NULL);
+                for (k = 0; k < PROXY_CONNECT_HIST_BUCKETS; k++) {
+                    ap_rprintf(r, "<td>%" APR_SIZE_T_FMT "</td>",
+                               worker->s->connect_hist[k]);
+                }
+                ap_rputs("</tr>\n", r);
                 ++workers;
             }
             ap_rputs("</table>\n", r);
@@ -143,14 +143,28 @@ static int proxy_connect_canon(request_rec *r, char *url)
     return OK;
 }
 
-/* read available data (in blocks of CONN_BLKSZ) from c_i and copy to c_o */
+/* read available data (in blocks of CONN_BLKSZ) from c_i and copy to c_o,
+ * or splice it directly once possible (see ap_proxy_splice_create())
+ */
 static int proxy_connect_transfer(request_rec *r, conn_rec *c_i, conn_rec *c_o,
-                                  apr_bucket_brigade *bb, char *name)
+                                  apr_bucket_brigade *bb, proxy_splice_t **ps,
+                                  char *name)
 {
     int rv;
-#ifdef DEBUGGING
     apr_off_t len;
-#endif
+
+    if (*ps) {
+        if (c_o->aborted)
+            return APR_EPIPE;
+        rv = ap_proxy_splice_transfer(*ps, &len);
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE5, rv, r,
+                      "spliced %" APR_OFF_T_FMT " bytes from %s", len, name);
+        if (rv != APR_SUCCESS && !APR_STATUS_IS_EOF(rv)) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02830)
+                          "error on %s - splice", name);
+        }
+        return rv;
+    }
 
     do {
         apr_brigade_cleanup(bb);
@@ -185,6 +199,13 @@ static int proxy_connect_transfer(request_rec *r, conn_rec *c_i, conn_rec *c_o,
     } while (rv == APR_SUCCESS);
 
     if (APR_STATUS_IS_EAGAIN(rv)) {
+        /* Nothing is buffered by the filters anymore, so the next reads
+         * can bypass them if they are not needed.
+         */
+        if (ap_proxy_splice_create(ps, c_i, c_o, r->pool) == APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                          "splicing data from %s", name);
+        }
         rv = APR_SUCCESS;
     }
     return rv;
@@ -221,6 +242,8 @@ static int proxy_connect_handler(request_rec *r, proxy_worker *worker,
     const char *connectname;
     apr_port_t connectport = 0;
 
+    proxy_splice_t *splice_client = NULL, *splice_backend = NULL;
+
     /* is this for us? */
     if (r->method_number != M_CONNECT) {
         ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "declining URL %s", url);
@@ -438,7 +461,8 @@ static int proxy_connect_handler(request_rec *r, proxy_worker *worker,
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01025)
                                   "sock was readable");
 #endif
-                    rv = proxy_connect_transfer(r, backconn, c, bb, "sock");
+                    rv = proxy_connect_transfer(r, backconn, c, bb,
+                                                &splice_backend, "sock");
                 }
                 else if (pollevent & APR_POLLERR) {
                     rv = APR_EPIPE;
@@ -454,7 +478,8 @@ static int proxy_connect_handler(request_rec *r, proxy_worker *worker,
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01027)
                                   "client was readable");
 #endif
-                    rv = proxy_connect_transfer(r, c, backconn, bb, "client");
+                    rv = proxy_connect_transfer(r, c, backconn, bb,
+                                                &splice_client, "client");
                 }
                 else if (pollevent & APR_POLLERR) {
                     rv = APR_EPIPE;
@@ -18,12 +18,105 @@
 #include "util_fcgi.h"
 #include "util_script.h"
 
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#endif
+
 module AP_MODULE_DECLARE_DATA proxy_fcgi_module;
 
 typedef struct {
     int need_dirwalk;
 } fcgi_req_config_t;
 
+#define FCGI_MUX_UNSET -1
+#define FCGI_MUX_OFF    0
+#define FCGI_MUX_ON     1
+#define FCGI_MUX_AUTO   2
+
+/* Multiplexed connections per worker and child */
+#define FCGI_MUX_DEFAULT_CONNS 2
+#define FCGI_MUX_MAX_CONNS     16
+
+/* Requests per multiplexed connection, unless the backend tells
+ * FCGI_MAX_REQS
+ */
+#define FCGI_MUX_DEFAULT_REQS 64
+#define FCGI_MUX_MAX_REQS     1024
+
+/* Bytes of records queued for a request of a multiplexed connection whose
+ * thread does not keep up, at most, before the request is aborted
+ */
+#define FCGI_MUX_MAX_QUEUED (1024 * 1024)
+
+/* How long to wait for the answer to FCGI_GET_VALUES */
+#define FCGI_MUX_PROBE_TIMEOUT apr_time_from_sec(1)
+
+/* Pieces of the request body sent in a single FCGI_STDIN record, at most */
+#define FCGI_STDIN_IOVECS 16
+
+typedef struct {
+    int multiplex;              /* ProxyFCGIMultiplex */
+    int conns;
+} fcgi_dirconf_t;
+
+typedef struct fcgi_mux_conn_t fcgi_mux_conn_t;
+
+#if APR_HAS_THREADS
+
+/* A record read for a request of a multiplexed connection */
+typedef struct fcgi_record_t {
+    struct fcgi_record_t *next;
+    unsigned char type;
+    char *data;                 /* malloc()ed, NULL when empty */
+    apr_size_t len;
+} fcgi_record_t;
+
+/* A request of a multiplexed connection, by request id */
+typedef struct {
+    int in_use;
+    int aborted;                /* gone, until its FCGI_END_REQUEST */
+    int ended;                  /* got its FCGI_END_REQUEST */
+    int overflow;               /* queued too much, failed */
+    apr_size_t queued;          /* bytes of the records queued */
+    fcgi_record_t *first, *last;
+} fcgi_stream_t;
+
+/*
+ * A backend connection carrying the requests of several threads, each one
+ * with a request id of its own.  The records are written whole under
+ * wmutex.  The threads waiting for records take turns reading from the
+ * socket, and queue the records of the other requests for them.
+ */
+struct fcgi_mux_conn_t {
+    proxy_conn_rec *backend;
+    char server_portstr[32];
+    apr_thread_mutex_t *wmutex;
+    apr_thread_mutex_t *mutex;  /* for the fields below */
+    apr_thread_cond_t *cond;    /* records queued, or no one reading */
+    int reading;                /* a thread reads from the socket */
+    apr_status_t broken;        /* the connection failed, for all */
+    int nstreams;
+    int max_reqs;
+    fcgi_stream_t *streams;     /* max_reqs, request id - 1 */
+};
+
+/* The multiplexed connections of a worker in this child, in
+ * worker->context
+ */
+typedef struct {
+    int mpxs;                   /* FCGI_MPXS_CONNS, -1 unknown, -2 asking */
+    int max_reqs;
+    int nconns;
+    int opening;                /* connections being opened */
+    fcgi_mux_conn_t *conns[FCGI_MUX_MAX_CONNS];
+} fcgi_mux_worker_t;
+
+/* Protects the fcgi_mux_worker_t's */
+static apr_thread_mutex_t *mux_mutex = NULL;
+
+#endif /* APR_HAS_THREADS */
+
 /*
  * Canonicalise http-like URLs.
  * scheme is the scheme for the URL
@@ -133,8 +226,14 @@ static int proxy_fcgi_canon(request_rec *r, char *url)
     return OK;
 }
 
-/* Wrapper for apr_socket_sendv that handles updating the worker stats. */
+#if APR_HAS_THREADS
+static void mux_break(fcgi_mux_conn_t *mc, apr_status_t rv);
+#endif
+
+/* Wrapper for apr_socket_sendv that handles updating the worker stats.
+ * On a multiplexed connection (mux), the records are written whole. */
 static apr_status_t send_data(proxy_conn_rec *conn,
+                              fcgi_mux_conn_t *mux,
                               struct iovec *vec,
                               int nvec,
                               apr_size_t *len)
@@ -148,6 +247,12 @@ static apr_status_t send_data(proxy_conn_rec *conn,
         to_write += vec[i].iov_len;
     }
 
+#if APR_HAS_THREADS
+    if (mux) {
+        apr_thread_mutex_lock(mux->wmutex);
+    }
+#endif
+
     offset = 0;
     while (to_write) {
         apr_size_t n = 0;
@@ -172,6 +277,18 @@ static apr_status_t send_data(proxy_conn_rec *conn,
         }
     }
 
+#if APR_HAS_THREADS
+    if (mux) {
+        if (rv != APR_SUCCESS) {
+            /* a record cut short, the others can't follow */
+            apr_thread_mutex_lock(mux->mutex);
+            mux_break(mux, rv);
+            apr_thread_mutex_unlock(mux->mutex);
+        }
+        apr_thread_mutex_unlock(mux->wmutex);
+    }
+#endif
+
     conn->worker->s->transferred += written;
     *len = written;
 
@@ -213,6 +330,7 @@ static apr_status_t get_data_full(proxy_conn_rec *conn,
 }
 
 static apr_status_t send_begin_request(proxy_conn_rec *conn,
+                                       fcgi_mux_conn_t *mux,
                                        apr_uint16_t request_id)
 {
     struct iovec vec[2];
@@ -226,7 +344,7 @@ static apr_status_t send_begin_request(proxy_conn_rec *conn,
                            sizeof(abrb), 0);
 
     ap_fcgi_fill_in_request_body(&brb, AP_FCGI_RESPONDER,
-                                 ap_proxy_connection_reusable(conn)
+                                 (mux || ap_proxy_connection_reusable(conn))
                                      ? AP_FCGI_KEEP_CONN : 0);
 
     ap_fcgi_header_to_array(&header, farray);
@@ -237,10 +355,11 @@ static apr_status_t send_begin_request(proxy_conn_rec *conn,
     vec[1].iov_base = (void *)abrb;
     vec[1].iov_len = sizeof(abrb);
 
-    return send_data(conn, vec, 2, &len);
+    return send_data(conn, mux, vec, 2, &len);
 }
 
-static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
+static apr_status_t send_environment(proxy_conn_rec *conn,
+                                     fcgi_mux_conn_t *mux, request_rec *r,
                                      apr_pool_t *temp_pool,
                                      apr_uint16_t request_id)
 {
@@ -340,7 +459,7 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
         vec[1].iov_base = body;
         vec[1].iov_len = required_len;
 
-        rv = send_data(conn, vec, 2, &len);
+        rv = send_data(conn, mux, vec, 2, &len);
         apr_pool_clear(temp_pool);
 
         if (rv) {
@@ -355,7 +474,7 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
     vec[0].iov_base = (void *)farray;
     vec[0].iov_len = sizeof(farray);
 
-    return send_data(conn, vec, 1, &len);
+    return send_data(conn, mux, vec, 1, &len);
 }
 
 enum {
@@ -426,29 +545,391 @@ static int handle_headers(request_rec *r, int *state,
     return 0;
 }
 
+/* The response of a request, as its records come in */
+typedef struct {
+    request_rec *r;
+    proxy_dir_conf *conf;
+    apr_bucket_brigade *ob;
+    int header_state;
+    int seen_end_of_headers;
+    int ignore_body;
+    int script_error_status;
+    int done;
+} fcgi_response_t;
+
+static void init_response(fcgi_response_t *resp, request_rec *r,
+                          proxy_dir_conf *conf)
+{
+    resp->r = r;
+    resp->conf = conf;
+    resp->ob = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    resp->header_state = HDR_STATE_READING_HEADERS;
+    resp->seen_end_of_headers = 0;
+    resp->ignore_body = 0;
+    resp->script_error_status = HTTP_OK;
+    resp->done = 0;
+}
+
+/* The content of a record, from list or else malloc()ed */
+static void free_content(char *data, apr_bucket_alloc_t *list)
+{
+    if (data) {
+        if (list) {
+            apr_bucket_free(data);
+        }
+        else {
+            free(data);
+        }
+    }
+}
+
+/*
+ * Read a record from the back end.  The content gets a buffer of its own,
+ * from list for the request reading it or else malloc()ed for another
+ * request, which is passed on as a heap bucket without any copy.  On
+ * failure, *partial tells whether a part of the record was read.
+ */
+static apr_status_t read_record(proxy_conn_rec *conn, request_rec *r,
+                                apr_bucket_alloc_t *list,
+                                unsigned char *type, apr_uint16_t *rid,
+                                char **data, apr_size_t *len,
+                                int *partial)
+{
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    char padding[255];
+    apr_size_t readlen = AP_FCGI_HEADER_LEN;
+    apr_uint16_t clen;
+    unsigned char plen;
+    unsigned char version;
+    apr_status_t rv;
+
+    *data = NULL;
+    *len = 0;
+    *partial = 0;
+
+    /* First, we grab the header... */
+    rv = get_data(conn, (char *)farray, &readlen);
+    if (rv == APR_SUCCESS && readlen < AP_FCGI_HEADER_LEN) {
+        *partial = 1;
+        rv = get_data_full(conn, (char *)farray + readlen,
+                           AP_FCGI_HEADER_LEN - readlen);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01067)
+                      "Failed to read FastCGI header");
+        return rv;
+    }
+    *partial = 1;
+
+    ap_log_rdata(APLOG_MARK, APLOG_TRACE8, r, "FastCGI header",
+                 farray, AP_FCGI_HEADER_LEN, 0);
+
+    ap_fcgi_header_fields_from_array(&version, type, rid,
+                                     &clen, &plen, farray);
+
+    if (version != AP_FCGI_VERSION_1) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01068)
+                      "Got bogus version %d", (int)version);
+        return APR_EINVAL;
+    }
+
+    /* Now get the actual data, straight into its buffer */
+    if (clen) {
+        *data = list ? apr_bucket_alloc(clen, list) : ap_malloc(clen);
+        rv = get_data_full(conn, *data, clen);
+        if (rv != APR_SUCCESS) {
+            free_content(*data, list);
+            *data = NULL;
+            return rv;
+        }
+        *len = clen;
+    }
+
+    if (plen) {
+        rv = get_data_full(conn, padding, plen);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02537)
+                          "Error occurred reading padding");
+            free_content(*data, list);
+            *data = NULL;
+            *len = 0;
+            return rv;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Handle a record of the response.  Its content is handed over, and freed
+ * as allocated by read_record().
+ */
+static apr_status_t handle_record(fcgi_response_t *resp, unsigned char type,
+                                  char *data, apr_size_t len,
+                                  apr_bucket_alloc_t *list,
+                                  const char **err)
+{
+    request_rec *r = resp->r;
+    conn_rec *c = r->connection;
+    apr_bucket_brigade *ob = resp->ob;
+    apr_status_t rv = APR_SUCCESS;
+    apr_bucket *b;
+
+    switch (type) {
+    case AP_FCGI_STDOUT:
+        if (len != 0) {
+            /* The bucket takes the buffer as is */
+            b = apr_bucket_heap_create(data, len,
+                                       list ? apr_bucket_free : free,
+                                       c->bucket_alloc);
+
+            APR_BRIGADE_INSERT_TAIL(ob, b);
+
+            if (! resp->seen_end_of_headers) {
+                int st = handle_headers(r, &resp->header_state, data, len);
+
+                if (st == 1) {
+                    int status;
+                    resp->seen_end_of_headers = 1;
+
+                    status = ap_scan_script_header_err_brigade_ex(r, ob,
+                        NULL, APLOG_MODULE_INDEX);
+                    /* suck in all the rest */
+                    if (status != OK) {
+                        apr_bucket *tmp_b;
+                        apr_brigade_cleanup(ob);
+                        tmp_b = apr_bucket_eos_create(c->bucket_alloc);
+                        APR_BRIGADE_INSERT_TAIL(ob, tmp_b);
+                        r->status = status;
+                        ap_pass_brigade(r->output_filters, ob);
+                        if (status == HTTP_NOT_MODIFIED) {
+                            /* The 304 response MUST NOT contain
+                             * a message-body, ignore it. */
+                            resp->ignore_body = 1;
+                        }
+                        else {
+                            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01070)
+                                            "Error parsing script headers");
+                            rv = APR_EINVAL;
+                        }
+                        break;
+                    }
+
+                    if (resp->conf->error_override &&
+                        ap_is_HTTP_ERROR(r->status)) {
+                        /*
+                         * set script_error_status to discard
+                         * everything after the headers
+                         */
+                        resp->script_error_status = r->status;
+                        /*
+                         * prevent ap_die() from treating this as a
+                         * recursive error, initially:
+                         */
+                        r->status = HTTP_OK;
+                    }
+
+                    if (resp->script_error_status == HTTP_OK
+                        && !APR_BRIGADE_EMPTY(ob) && !resp->ignore_body) {
+                        /* Send the part of the body that we read while
+                         * reading the headers.
+                         */
+                        rv = ap_pass_brigade(r->output_filters, ob);
+                        if (rv != APR_SUCCESS) {
+                            *err = "passing brigade to output filters";
+                            break;
+                        }
+                    }
+                    apr_brigade_cleanup(ob);
+                }
+                /* else we're still looking for the end of the headers, so
+                 * this part of the data stays in ob; heap buckets need no
+                 * setaside. */
+            } else {
+                /* we've already passed along the headers, so now pass
+                 * through the content.  we could simply continue to
+                 * setaside the content and not pass until we see the
+                 * 0 content-length (below, where we append the EOS),
+                 * but that could be a huge amount of data; so we pass
+                 * along every record
+                 */
+                if (resp->script_error_status == HTTP_OK
+                    && !resp->ignore_body) {
+                    rv = ap_pass_brigade(r->output_filters, ob);
+                    if (rv != APR_SUCCESS) {
+                        *err = "passing brigade to output filters";
+                        break;
+                    }
+                }
+                apr_brigade_cleanup(ob);
+            }
+        } else {
+            /* XXX what if we haven't seen end of the headers yet? */
+
+            if (resp->script_error_status == HTTP_OK) {
+                b = apr_bucket_eos_create(c->bucket_alloc);
+                APR_BRIGADE_INSERT_TAIL(ob, b);
+                rv = ap_pass_brigade(r->output_filters, ob);
+                if (rv != APR_SUCCESS) {
+                    *err = "passing brigade to output filters";
+                    break;
+                }
+            }
+
+            /* XXX Why don't we cleanup here?  (logic from AJP) */
+        }
+        break;
+
+    case AP_FCGI_STDERR:
+        /* TODO: Should probably clean up this logging a bit... */
+        if (len) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01071)
+                          "Got error '%.*s'", (int)len, data);
+        }
+        free_content(data, list);
+        break;
+
+    case AP_FCGI_END_REQUEST:
+        resp->done = 1;
+        free_content(data, list);
+        break;
+
+    default:
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01072)
+                      "Got bogus record %d", type);
+        free_content(data, list);
+        break;
+    }
+
+    return rv;
+}
+
+static apr_status_t send_stdin_record(proxy_conn_rec *conn,
+                                      fcgi_mux_conn_t *mux,
+                                      apr_uint16_t request_id,
+                                      struct iovec *vec, int nvec,
+                                      apr_size_t clen)
+{
+    ap_fcgi_header header;
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    apr_size_t len;
+
+    ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
+                           (apr_uint16_t)clen, 0);
+    ap_fcgi_header_to_array(&header, farray);
+
+    vec[0].iov_base = (void *)farray;
+    vec[0].iov_len = sizeof(farray);
+
+    return send_data(conn, mux, vec, nvec, &len);
+}
+
+/*
+ * Read the next part of the request body and send it in FCGI_STDIN
+ * records pointing to the data of its buckets, then the empty record if
+ * it was the last part.
+ */
+static apr_status_t send_stdin(proxy_conn_rec *conn, fcgi_mux_conn_t *mux,
+                               request_rec *r, apr_bucket_brigade *ib,
+                               apr_uint16_t request_id, apr_size_t readbytes,
+                               int *last_stdin, const char **err)
+{
+    struct iovec vec[FCGI_STDIN_IOVECS + 1];
+    apr_bucket *e;
+    apr_size_t clen = 0;
+    int nvec = 1;
+    apr_status_t rv;
+
+    *last_stdin = 0;
+
+    rv = ap_get_brigade(r->input_filters, ib,
+                        AP_MODE_READBYTES, APR_BLOCK_READ,
+                        readbytes);
+    if (rv != APR_SUCCESS) {
+        *err = "reading input brigade";
+        return rv;
+    }
+
+    for (e = APR_BRIGADE_FIRST(ib);
+         e != APR_BRIGADE_SENTINEL(ib) && rv == APR_SUCCESS;
+         e = APR_BUCKET_NEXT(e)) {
+        const char *data;
+        apr_size_t dlen;
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            *last_stdin = 1;
+            break;
+        }
+        if (APR_BUCKET_IS_METADATA(e)) {
+            continue;
+        }
+
+        rv = apr_bucket_read(e, &data, &dlen, APR_BLOCK_READ);
+        if (rv != APR_SUCCESS) {
+            *err = "reading input brigade";
+            break;
+        }
+        while (dlen) {
+            apr_size_t n = AP_FCGI_MAX_CONTENT_LEN - clen;
+
+            if (n > dlen) {
+                n = dlen;
+            }
+            vec[nvec].iov_base = (void *)data;
+            vec[nvec].iov_len = n;
+            ++nvec;
+            clen += n;
+            data += n;
+            dlen -= n;
+
+            if (clen == AP_FCGI_MAX_CONTENT_LEN
+                || nvec == FCGI_STDIN_IOVECS + 1) {
+                rv = send_stdin_record(conn, mux, request_id, vec, nvec, clen);
+                if (rv != APR_SUCCESS) {
+                    *err = "sending stdin";
+                    break;
+                }
+                nvec = 1;
+                clen = 0;
+            }
+        }
+    }
+
+    if (rv == APR_SUCCESS && clen) {
+        rv = send_stdin_record(conn, mux, request_id, vec, nvec, clen);
+        if (rv != APR_SUCCESS) {
+            *err = "sending stdin";
+        }
+    }
+
+    /* the buckets were only sent from */
+    apr_brigade_cleanup(ib);
+
+    if (rv == APR_SUCCESS && *last_stdin) {
+        /* signal EOF (empty FCGI_STDIN) */
+        rv = send_stdin_record(conn, mux, request_id, vec, 1, 0);
+        if (rv != APR_SUCCESS) {
+            *err = "sending empty stdin";
+        }
+    }
+
+    return rv;
+}
+
 static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
-                             request_rec *r, apr_pool_t *setaside_pool,
-                             apr_uint16_t request_id,
+                             request_rec *r, apr_uint16_t request_id,
                              const char **err)
 {
-    apr_bucket_brigade *ib, *ob;
-    int seen_end_of_headers = 0, done = 0, ignore_body = 0;
+    apr_bucket_brigade *ib;
+    fcgi_response_t resp;
     apr_status_t rv = APR_SUCCESS;
-    int script_error_status = HTTP_OK;
     conn_rec *c = r->connection;
-    struct iovec vec[2];
-    ap_fcgi_header header;
-    unsigned char farray[AP_FCGI_HEADER_LEN];
     apr_pollfd_t pfd;
-    int header_state = HDR_STATE_READING_HEADERS;
-    char stack_iobuf[AP_IOBUFSIZE];
-    apr_size_t iobuf_size = AP_IOBUFSIZE;
-    char *iobuf = stack_iobuf;
+    apr_size_t readbytes = AP_IOBUFSIZE;
 
     *err = NULL;
     if (conn->worker->s->io_buffer_size_set) {
-        iobuf_size = conn->worker->s->io_buffer_size;
-        iobuf = apr_palloc(r->pool, iobuf_size);
+        readbytes = conn->worker->s->io_buffer_size;
     }
 
     pfd.desc_type = APR_POLL_SOCKET;
@@ -457,11 +938,10 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
     pfd.reqevents = APR_POLLIN | APR_POLLOUT;
 
     ib = apr_brigade_create(r->pool, c->bucket_alloc);
-    ob = apr_brigade_create(r->pool, c->bucket_alloc);
+    init_response(&resp, r, conf);
 
-    while (! done) {
+    while (! resp.done) {
         apr_interval_time_t timeout;
-        apr_size_t len;
         int n;
 
         /* We need SOME kind of timeout here, or virtually anything will
@@ -478,327 +958,277 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
         }
 
         if (pfd.rtnevents & APR_POLLOUT) {
-            apr_size_t to_send, writebuflen;
-            int last_stdin = 0;
-            char *iobuf_cursor;
+            int last_stdin;
 
-            rv = ap_get_brigade(r->input_filters, ib,
-                                AP_MODE_READBYTES, APR_BLOCK_READ,
-                                iobuf_size);
+            rv = send_stdin(conn, NULL, r, ib, request_id, readbytes,
+                            &last_stdin, err);
             if (rv != APR_SUCCESS) {
-                *err = "reading input brigade";
                 break;
             }
-
-            if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(ib))) {
-                last_stdin = 1;
+            if (last_stdin) {
+                pfd.reqevents = APR_POLLIN; /* Done with input data */
             }
+        }
 
-            writebuflen = iobuf_size;
-
-            rv = apr_brigade_flatten(ib, iobuf, &writebuflen);
-
-            apr_brigade_cleanup(ib);
-
+        if (pfd.rtnevents & APR_POLLIN) {
+            unsigned char type;
+            apr_uint16_t rid;
+            char *data;
+            apr_size_t len;
+            int partial;
+
+            rv = read_record(conn, r, c->bucket_alloc, &type, &rid,
+                             &data, &len, &partial);
             if (rv != APR_SUCCESS) {
-                *err = "flattening brigade";
+                if (partial) {
+                    *err = "reading response body";
+                }
                 break;
             }
 
-            to_send = writebuflen;
-            iobuf_cursor = iobuf;
-            while (to_send > 0) {
-                int nvec = 0;
-                apr_size_t write_this_time;
-
-                write_this_time =
-                    to_send < AP_FCGI_MAX_CONTENT_LEN ? to_send : AP_FCGI_MAX_CONTENT_LEN;
-
-                ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
-                                       (apr_uint16_t)write_this_time, 0);
-                ap_fcgi_header_to_array(&header, farray);
-
-                vec[nvec].iov_base = (void *)farray;
-                vec[nvec].iov_len = sizeof(farray);
-                ++nvec;
-                if (writebuflen) {
-                    vec[nvec].iov_base = iobuf_cursor;
-                    vec[nvec].iov_len = write_this_time;
-                    ++nvec;
-                }
-
-                rv = send_data(conn, vec, nvec, &len);
-                if (rv != APR_SUCCESS) {
-                    *err = "sending stdin";
-                    break;
-                }
-
-                to_send -= write_this_time;
-                iobuf_cursor += write_this_time;
+            if (rid != request_id) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01069)
+                              "Got bogus rid %d, expected %d",
+                              rid, request_id);
+                free_content(data, c->bucket_alloc);
+                rv = APR_EINVAL;
+                break;
             }
+
+            rv = handle_record(&resp, type, data, len, c->bucket_alloc, err);
+            /* Leave on the record's error. */
             if (rv != APR_SUCCESS) {
                 break;
             }
+        }
+    }
 
-            if (last_stdin) {
-                pfd.reqevents = APR_POLLIN; /* Done with input data */
+    apr_brigade_destroy(ib);
+    apr_brigade_destroy(resp.ob);
 
-                /* signal EOF (empty FCGI_STDIN) */
-                ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
-                                       0, 0);
-                ap_fcgi_header_to_array(&header, farray);
+    if (resp.script_error_status != HTTP_OK) {
+        ap_die(resp.script_error_status, r); /* send ErrorDocument */
+    }
 
-                vec[0].iov_base = (void *)farray;
-                vec[0].iov_len = sizeof(farray);
+    return rv;
+}
 
-                rv = send_data(conn, vec, 1, &len);
-                if (rv != APR_SUCCESS) {
-                    *err = "sending empty stdin";
-                    break;
-                }
-            }
-        }
+#if APR_HAS_THREADS
 
-        if (pfd.rtnevents & APR_POLLIN) {
-            apr_size_t readbuflen;
-            apr_uint16_t clen, rid;
-            apr_bucket *b;
-            unsigned char plen;
-            unsigned char type, version;
-
-            /* First, we grab the header... */
-            rv = get_data_full(conn, (char *) farray, AP_FCGI_HEADER_LEN);
-            if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01067)
-                              "Failed to read FastCGI header");
-                break;
+/*
+ * Fail the connection for all its requests, and free the ids of the
+ * aborted ones.  Called with mc->mutex held.
+ */
+static void mux_break(fcgi_mux_conn_t *mc, apr_status_t rv)
+{
+    int i;
+
+    if (!mc->broken) {
+        mc->broken = rv;
+        for (i = 0; i < mc->max_reqs; i++) {
+            if (mc->streams[i].in_use && mc->streams[i].aborted) {
+                mc->streams[i].in_use = mc->streams[i].aborted = 0;
+                mc->nstreams--;
             }
+        }
+        apr_thread_cond_broadcast(mc->cond);
+    }
+}
 
-            ap_log_rdata(APLOG_MARK, APLOG_TRACE8, r, "FastCGI header",
-                         farray, AP_FCGI_HEADER_LEN, 0);
+/*
+ * The next record of a request on a multiplexed connection: queued by the
+ * thread which read it, or read from the socket by this thread when no
+ * other one is reading.
+ */
+static apr_status_t mux_read(fcgi_mux_conn_t *mc, request_rec *r,
+                             apr_uint16_t request_id, fcgi_record_t **rec)
+{
+    fcgi_stream_t *st = &mc->streams[request_id - 1];
+    apr_status_t rv;
 
-            ap_fcgi_header_fields_from_array(&version, &type, &rid,
-                                             &clen, &plen, farray);
+    apr_thread_mutex_lock(mc->mutex);
+    for (;;) {
+        fcgi_record_t *new, *old;
+        apr_uint16_t rid;
+        int partial;
 
-            if (version != AP_FCGI_VERSION_1) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01068)
-                              "Got bogus version %d", (int)version);
-                rv = APR_EINVAL;
-                break;
+        if (st->overflow) {
+            rv = APR_ENOSPC;
+            break;
+        }
+        if (st->first) {
+            *rec = st->first;
+            if (!(st->first = (*rec)->next)) {
+                st->last = NULL;
             }
+            st->queued -= (*rec)->len;
+            rv = APR_SUCCESS;
+            break;
+        }
+        if (mc->broken) {
+            rv = mc->broken;
+            break;
+        }
+        if (mc->reading) {
+            apr_thread_cond_wait(mc->cond, mc->mutex);
+            continue;
+        }
 
-            if (rid != request_id) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01069)
-                              "Got bogus rid %d, expected %d",
-                              rid, request_id);
-                rv = APR_EINVAL;
-                break;
-            }
+        mc->reading = 1;
+        apr_thread_mutex_unlock(mc->mutex);
 
-recv_again:
-            if (clen > iobuf_size) {
-                readbuflen = iobuf_size;
-            } else {
-                readbuflen = clen;
-            }
+        new = ap_malloc(sizeof(fcgi_record_t));
+        new->next = NULL;
+        rv = read_record(mc->backend, r, NULL, &new->type, &rid,
+                         &new->data, &new->len, &partial);
 
-            /* Now get the actual data.  Yes it sucks to do this in a second
-             * recv call, this will eventually change when we move to real
-             * nonblocking recv calls. */
-            if (readbuflen != 0) {
-                rv = get_data(conn, iobuf, &readbuflen);
-                if (rv != APR_SUCCESS) {
-                    *err = "reading response body";
-                    break;
-                }
+        apr_thread_mutex_lock(mc->mutex);
+        mc->reading = 0;
+        apr_thread_cond_broadcast(mc->cond);
+
+        if (rv != APR_SUCCESS) {
+            free(new);
+            /* No record for this request in time fails it alone */
+            if (partial || !APR_STATUS_IS_TIMEUP(rv)) {
+                mux_break(mc, rv);
             }
+            break;
+        }
 
-            switch (type) {
-            case AP_FCGI_STDOUT:
-                if (clen != 0) {
-                    b = apr_bucket_transient_create(iobuf,
-                                                    readbuflen,
-                                                    c->bucket_alloc);
-
-                    APR_BRIGADE_INSERT_TAIL(ob, b);
-
-                    if (! seen_end_of_headers) {
-                        int st = handle_headers(r, &header_state,
-                                                iobuf, readbuflen);
-
-                        if (st == 1) {
-                            int status;
-                            seen_end_of_headers = 1;
-
-                            status = ap_scan_script_header_err_brigade_ex(r, ob,
-                                NULL, APLOG_MODULE_INDEX);
-                            /* suck in all the rest */
-                            if (status != OK) {
-                                apr_bucket *tmp_b;
-                                apr_brigade_cleanup(ob);
-                                tmp_b = apr_bucket_eos_create(c->bucket_alloc);
-                                APR_BRIGADE_INSERT_TAIL(ob, tmp_b);
-                                r->status = status;
-                                ap_pass_brigade(r->output_filters, ob);
-                                if (status == HTTP_NOT_MODIFIED) {
-                                    /* The 304 response MUST NOT contain
-                                     * a message-body, ignore it. */
-                                    ignore_body = 1;
-                                }
-                                else {
-                                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01070)
-                                                    "Error parsing script headers");
-                                    rv = APR_EINVAL;
-                                }
-                                break;
-                            }
-
-                            if (conf->error_override &&
-                                ap_is_HTTP_ERROR(r->status)) {
-                                /*
-                                 * set script_error_status to discard
-                                 * everything after the headers
-                                 */
-                                script_error_status = r->status;
-                                /*
-                                 * prevent ap_die() from treating this as a
-                                 * recursive error, initially:
-                                 */
-                                r->status = HTTP_OK;
-                            }
-
-                            if (script_error_status == HTTP_OK
-                                && !APR_BRIGADE_EMPTY(ob) && !ignore_body) {
-                                /* Send the part of the body that we read while
-                                 * reading the headers.
-                                 */
-                                rv = ap_pass_brigade(r->output_filters, ob);
-                                if (rv != APR_SUCCESS) {
-                                    *err = "passing brigade to output filters";
-                                    break;
-                                }
-                            }
-                            apr_brigade_cleanup(ob);
-
-                            apr_pool_clear(setaside_pool);
-                        }
-                        else {
-                            /* We're still looking for the end of the
-                             * headers, so this part of the data will need
-                             * to persist. */
-                            apr_bucket_setaside(b, setaside_pool);
-                        }
-                    } else {
-                        /* we've already passed along the headers, so now pass
-                         * through the content.  we could simply continue to
-                         * setaside the content and not pass until we see the
-                         * 0 content-length (below, where we append the EOS),
-                         * but that could be a huge amount of data; so we pass
-                         * along smaller chunks
-                         */
-                        if (script_error_status == HTTP_OK && !ignore_body) {
-                            rv = ap_pass_brigade(r->output_filters, ob);
-                            if (rv != APR_SUCCESS) {
-                                *err = "passing brigade to output filters";
-                                break;
-                            }
-                        }
-                        apr_brigade_cleanup(ob);
-                    }
+        if (rid && rid <= mc->max_reqs && mc->streams[rid - 1].in_use) {
+            fcgi_stream_t *to = &mc->streams[rid - 1];
 
-                    /* If we didn't read all the data go back and get the
-                     * rest of it. */
-                    if (clen > readbuflen) {
-                        clen -= readbuflen;
-                        goto recv_again;
+            if (!to->aborted && !to->overflow) {
+                if (to->queued + new->len <= FCGI_MUX_MAX_QUEUED) {
+                    if (to->last) {
+                        to->last->next = new;
                     }
-                } else {
-                    /* XXX what if we haven't seen end of the headers yet? */
-
-                    if (script_error_status == HTTP_OK) {
-                        b = apr_bucket_eos_create(c->bucket_alloc);
-                        APR_BRIGADE_INSERT_TAIL(ob, b);
-                        rv = ap_pass_brigade(r->output_filters, ob);
-                        if (rv != APR_SUCCESS) {
-                            *err = "passing brigade to output filters";
-                            break;
-                        }
+                    else {
+                        to->first = new;
                     }
-
-                    /* XXX Why don't we cleanup here?  (logic from AJP) */
+                    to->last = new;
+                    to->queued += new->len;
+                    continue;
                 }
-                break;
 
-            case AP_FCGI_STDERR:
-                /* TODO: Should probably clean up this logging a bit... */
-                if (clen) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01071)
-                                  "Got error '%.*s'", (int)readbuflen, iobuf);
+                /* its thread is stuck with a slow client, fail the request
+                 * rather than buffer its response without end, its
+                 * mux_detach() aborts it on the backend
+                 */
+                ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02902)
+                              "request id %d on a multiplexed connection "
+                              "has more than %d bytes waiting, failing it",
+                              rid, FCGI_MUX_MAX_QUEUED);
+                while ((old = to->first)) {
+                    to->first = old->next;
+                    free(old->data);
+                    free(old);
                 }
-
-                if (clen > readbuflen) {
-                    clen -= readbuflen;
-                    goto recv_again;
+                to->last = NULL;
+                to->queued = 0;
+                to->overflow = 1;
+            }
+            if (new->type == AP_FCGI_END_REQUEST) {
+                if (to->aborted) {
+                    /* the backend is done with it, the id can be reused */
+                    to->in_use = to->aborted = 0;
+                    mc->nstreams--;
                 }
-                break;
+                else {
+                    /* failed, but nothing left to abort */
+                    to->ended = 1;
+                }
+            }
+        }
+        else {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02896)
+                          "Got bogus rid %d on a multiplexed connection",
+                          rid);
+        }
+        free(new->data);
+        free(new);
+    }
+    apr_thread_mutex_unlock(mc->mutex);
 
-            case AP_FCGI_END_REQUEST:
-                done = 1;
-                break;
+    return rv;
+}
 
-            default:
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01072)
-                              "Got bogus record %d", type);
-                break;
-            }
-            /* Leave on above switch's inner error. */
-            if (rv != APR_SUCCESS) {
-                break;
-            }
+static apr_status_t mux_dispatch(fcgi_mux_conn_t *mc, proxy_dir_conf *conf,
+                                 request_rec *r, apr_uint16_t request_id,
+                                 const char **err)
+{
+    apr_bucket_brigade *ib;
+    fcgi_response_t resp;
+    apr_status_t rv;
+    apr_size_t readbytes = AP_IOBUFSIZE;
+    int last_stdin = 0;
 
-            if (plen) {
-                rv = get_data_full(conn, iobuf, plen);
-                if (rv != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02537)
-                                  "Error occurred reading padding");
-                    break;
-                }
-            }
+    *err = NULL;
+    if (mc->backend->worker->s->io_buffer_size_set) {
+        readbytes = mc->backend->worker->s->io_buffer_size;
+    }
+
+    ib = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    init_response(&resp, r, conf);
+
+    /* Requests with a body have connections of their own, see
+     * proxy_fcgi_handler(), this is the empty FCGI_STDIN. */
+    do {
+        rv = send_stdin(mc->backend, mc, r, ib, request_id, readbytes,
+                        &last_stdin, err);
+    } while (rv == APR_SUCCESS && !last_stdin);
+
+    while (rv == APR_SUCCESS && !resp.done) {
+        fcgi_record_t *rec;
+
+        rv = mux_read(mc, r, request_id, &rec);
+        if (rv != APR_SUCCESS) {
+            *err = "reading response";
+            break;
         }
+        rv = handle_record(&resp, rec->type, rec->data, rec->len, NULL, err);
+        free(rec);
+    }
+    if (resp.done) {
+        apr_thread_mutex_lock(mc->mutex);
+        mc->streams[request_id - 1].ended = 1;
+        apr_thread_mutex_unlock(mc->mutex);
     }
 
     apr_brigade_destroy(ib);
-    apr_brigade_destroy(ob);
+    apr_brigade_destroy(resp.ob);
 
-    if (script_error_status != HTTP_OK) {
-        ap_die(script_error_status, r); /* send ErrorDocument */
+    if (resp.script_error_status != HTTP_OK) {
+        ap_die(resp.script_error_status, r); /* send ErrorDocument */
     }
 
     return rv;
 }
 
+#endif /* APR_HAS_THREADS */
+
 /*
  * process the request and write the response.
  */
 static int fcgi_do_request(apr_pool_t *p, request_rec *r,
                            proxy_conn_rec *conn,
+                           fcgi_mux_conn_t *mux,
+                           apr_uint16_t request_id,
                            conn_rec *origin,
                            proxy_dir_conf *conf,
                            apr_uri_t *uri,
                            char *url, char *server_portstr)
 {
     /* Request IDs are arbitrary numbers that we assign to a
-     * single request. This would allow multiplex/pipelinig of
-     * multiple requests to the same FastCGI connection, but
-     * we don't support that, and always use a value of '1' to
-     * keep things simple. */
-    apr_uint16_t request_id = 1;
+     * single request. A connection of the request's own always
+     * uses '1', a multiplexed connection (mux) one of its free
+     * ids. */
     apr_status_t rv;
     apr_pool_t *temp_pool;
     const char *err;
 
     /* Step 1: Send AP_FCGI_BEGIN_REQUEST */
-    rv = send_begin_request(conn, request_id);
+    rv = send_begin_request(conn, mux, request_id);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01073)
                       "Failed Writing Request to %s:", server_portstr);
@@ -809,7 +1239,7 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     apr_pool_create(&temp_pool, r->pool);
 
     /* Step 2: Send Environment via FCGI_PARAMS */
-    rv = send_environment(conn, r, temp_pool, request_id);
+    rv = send_environment(conn, mux, r, temp_pool, request_id);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01074)
                       "Failed writing Environment to %s:", server_portstr);
@@ -818,7 +1248,13 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     }
 
     /* Step 3: Read records from the back end server and handle them. */
-    rv = dispatch(conn, conf, r, temp_pool, request_id, &err);
+#if APR_HAS_THREADS
+    if (mux) {
+        rv = mux_dispatch(mux, conf, r, request_id, &err);
+    }
+    else
+#endif
+    rv = dispatch(conn, conf, r, request_id, &err);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01075)
                       "Error dispatching request to %s: %s%s%s",
@@ -835,6 +1271,408 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
 
 #define FCGI_SCHEME "FCGI"
 
+#if APR_HAS_THREADS
+
+/* The multiplexed connections of the worker, none at first */
+static fcgi_mux_worker_t *mux_worker(proxy_worker *worker)
+{
+    fcgi_mux_worker_t *mw;
+
+    apr_thread_mutex_lock(mux_mutex);
+    if (!(mw = worker->context)) {
+        /* as long as the child, like the worker */
+        mw = ap_calloc(1, sizeof(fcgi_mux_worker_t));
+        mw->mpxs = -1;
+        mw->max_reqs = FCGI_MUX_DEFAULT_REQS;
+        worker->context = mw;
+    }
+    apr_thread_mutex_unlock(mux_mutex);
+
+    return mw;
+}
+
+/* A connection to the worker for the request, or an error status */
+static int mux_connect(request_rec *r, proxy_worker *worker,
+                       proxy_server_conf *conf, char *url,
+                       const char *proxyname, apr_port_t proxyport,
+                       char *server_portstr, int server_portstr_size,
+                       proxy_conn_rec **backend)
+{
+    apr_uri_t *uri = apr_palloc(r->pool, sizeof(*uri));
+    int status;
+
+    status = ap_proxy_acquire_connection(FCGI_SCHEME, backend, worker,
+                                         r->server);
+    if (status == OK) {
+        (*backend)->is_ssl = 0;
+        status = ap_proxy_determine_connection(r->pool, r, conf, worker,
+                                               *backend, uri, &url,
+                                               proxyname, proxyport,
+                                               server_portstr,
+                                               server_portstr_size);
+    }
+    if (status == OK
+        && ap_proxy_connect_backend(FCGI_SCHEME, *backend, worker,
+                                    r->server)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02892)
+                      "failed to make connection to backend: %s",
+                      (*backend)->hostname);
+        status = HTTP_SERVICE_UNAVAILABLE;
+    }
+    if (status != OK && *backend) {
+        (*backend)->close = 1;
+        ap_proxy_release_connection(FCGI_SCHEME, *backend, r->server);
+        *backend = NULL;
+    }
+
+    return status;
+}
+
+/* A FastCGI length of a name-value pair, 1 or 4 bytes */
+static int get_nv_len(const unsigned char **p, const unsigned char *end,
+                      apr_size_t *len)
+{
+    const unsigned char *b = *p;
+
+    if (b >= end) {
+        return 0;
+    }
+    if (!(b[0] & 0x80)) {
+        *len = b[0];
+        *p += 1;
+        return 1;
+    }
+    if (end - b < 4) {
+        return 0;
+    }
+    *len = ((apr_size_t)(b[0] & 0x7f) << 24) | ((apr_size_t)b[1] << 16)
+           | ((apr_size_t)b[2] << 8) | b[3];
+    *p += 4;
+    return 1;
+}
+
+/*
+ * Ask the back end, on a connection of its own, whether it takes several
+ * requests per connection (FCGI_MPXS_CONNS) and how many (FCGI_MAX_REQS).
+ * A back end which does not answer in time is taken for one which does
+ * not multiplex.
+ */
+static void mux_probe(request_rec *r, fcgi_mux_worker_t *mw,
+                      proxy_worker *worker, proxy_server_conf *conf,
+                      char *url, const char *proxyname, apr_port_t proxyport)
+{
+    static const char names[] = "\017\000FCGI_MPXS_CONNS"
+                                "\015\000FCGI_MAX_REQS";
+    proxy_conn_rec *backend = NULL;
+    char server_portstr[32];
+    struct iovec vec[2];
+    ap_fcgi_header header;
+    unsigned char farray[AP_FCGI_HEADER_LEN];
+    unsigned char type;
+    apr_uint16_t rid;
+    char *data = NULL;
+    apr_size_t len;
+    int partial, mpxs = 0, max_reqs = 0;
+    apr_status_t rv = APR_EGENERAL;
+
+    if (mux_connect(r, worker, conf, url, proxyname, proxyport,
+                    server_portstr, sizeof(server_portstr),
+                    &backend) == OK) {
+        apr_socket_timeout_set(backend->sock, FCGI_MUX_PROBE_TIMEOUT);
+
+        ap_fcgi_fill_in_header(&header, AP_FCGI_GET_VALUES, 0,
+                               sizeof(names) - 1, 0);
+        ap_fcgi_header_to_array(&header, farray);
+        vec[0].iov_base = (void *)farray;
+        vec[0].iov_len = sizeof(farray);
+        vec[1].iov_base = (void *)names;
+        vec[1].iov_len = sizeof(names) - 1;
+
+        rv = send_data(backend, NULL, vec, 2, &len);
+        if (rv == APR_SUCCESS) {
+            rv = read_record(backend, r, NULL, &type, &rid, &data, &len,
+                             &partial);
+        }
+        if (rv == APR_SUCCESS && type == AP_FCGI_GET_VALUES_RESULT && !rid) {
+            const unsigned char *p = (const unsigned char *)data;
+            const unsigned char *end = p + len;
+            apr_size_t nlen, vlen;
+
+            while (get_nv_len(&p, end, &nlen) && get_nv_len(&p, end, &vlen)
+                   && nlen <= (apr_size_t)(end - p)
+                   && vlen <= (apr_size_t)(end - p) - nlen) {
+                const char *value = apr_pstrmemdup(r->pool,
+                                                   (const char *)p + nlen,
+                                                   vlen);
+
+                if (nlen == 15 && !memcmp(p, "FCGI_MPXS_CONNS", 15)) {
+                    mpxs = atoi(value) > 0;
+                }
+                else if (nlen == 13 && !memcmp(p, "FCGI_MAX_REQS", 13)) {
+                    max_reqs = atoi(value);
+                }
+                p += nlen + vlen;
+            }
+        }
+        free(data);
+
+        /* not for a request */
+        backend->close = 1;
+        ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+    }
+
+    apr_thread_mutex_lock(mux_mutex);
+    mw->mpxs = mpxs;
+    if (max_reqs > 0) {
+        mw->max_reqs = max_reqs < FCGI_MUX_MAX_REQS ? max_reqs
+                                                    : FCGI_MUX_MAX_REQS;
+    }
+    apr_thread_mutex_unlock(mux_mutex);
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02895)
+                  "FastCGI backend %s: FCGI_MPXS_CONNS %d, "
+                  "FCGI_MAX_REQS %d", worker->s->name, mpxs, max_reqs);
+}
+
+/* A new multiplexed connection, or an error status */
+static int mux_open(request_rec *r, proxy_worker *worker,
+                    proxy_server_conf *conf, char *url,
+                    const char *proxyname, apr_port_t proxyport,
+                    int max_reqs, fcgi_mux_conn_t **pmc)
+{
+    proxy_conn_rec *backend = NULL;
+    fcgi_mux_conn_t *mc;
+    char server_portstr[32];
+    apr_status_t rv;
+    int status;
+
+    status = mux_connect(r, worker, conf, url, proxyname, proxyport,
+                         server_portstr, sizeof(server_portstr), &backend);
+    if (status != OK) {
+        return status;
+    }
+
+    /* as long as the socket */
+    mc = apr_pcalloc(backend->scpool, sizeof(fcgi_mux_conn_t));
+    mc->streams = apr_pcalloc(backend->scpool,
+                              max_reqs * sizeof(fcgi_stream_t));
+    mc->max_reqs = max_reqs;
+    mc->backend = backend;
+    apr_cpystrn(mc->server_portstr, server_portstr,
+                sizeof(mc->server_portstr));
+
+    if ((rv = apr_thread_mutex_create(&mc->wmutex, APR_THREAD_MUTEX_DEFAULT,
+                                      backend->scpool)) != APR_SUCCESS
+        || (rv = apr_thread_mutex_create(&mc->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                         backend->scpool)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&mc->cond,
+                                        backend->scpool)) != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02893)
+                      "can't create the locks of a multiplexed connection");
+        backend->close = 1;
+        ap_proxy_release_connection(FCGI_SCHEME, backend, r->server);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02894)
+                  "multiplexing up to %d requests on a new connection "
+                  "to %s", max_reqs, backend->hostname);
+
+    *pmc = mc;
+    return OK;
+}
+
+/* Close a multiplexed connection no request uses anymore */
+static void mux_close(fcgi_mux_conn_t *mc, server_rec *s)
+{
+    proxy_conn_rec *backend = mc->backend;
+
+    /* mc goes with the socket's pool */
+    backend->close = 1;
+    ap_proxy_release_connection(FCGI_SCHEME, backend, s);
+}
+
+/*
+ * A request id on one of the multiplexed connections of the worker, or on
+ * a new one when they are all full and there can be more of them.
+ * DECLINED when the request should rather have a connection of its own.
+ */
+static int mux_attach(request_rec *r, fcgi_mux_worker_t *mw, int maxconns,
+                      proxy_worker *worker, proxy_server_conf *conf,
+                      char *url, const char *proxyname,
+                      apr_port_t proxyport, fcgi_mux_conn_t **pmc,
+                      apr_uint16_t *request_id)
+{
+    fcgi_mux_conn_t *mc;
+    int i, j, max_reqs, status;
+
+    apr_thread_mutex_lock(mux_mutex);
+    for (i = 0; i < mw->nconns; i++) {
+        mc = mw->conns[i];
+
+        apr_thread_mutex_lock(mc->mutex);
+        if (!mc->broken && !mc->nstreams
+            && !ap_proxy_is_socket_connected(mc->backend->sock)) {
+            /* closed by the back end while idle */
+            mux_break(mc, APR_ECONNRESET);
+        }
+        if (mc->broken && !mc->nstreams) {
+            apr_thread_mutex_unlock(mc->mutex);
+            mw->conns[i--] = mw->conns[--mw->nconns];
+            mux_close(mc, r->server);
+            continue;
+        }
+        if (!mc->broken && mc->nstreams < mc->max_reqs) {
+            for (j = 0; mc->streams[j].in_use; j++) {
+                /* the first free one */ ;
+            }
+            mc->streams[j].in_use = 1;
+            mc->streams[j].ended = 0;
+            mc->nstreams++;
+            apr_thread_mutex_unlock(mc->mutex);
+            apr_thread_mutex_unlock(mux_mutex);
+
+            *pmc = mc;
+            *request_id = (apr_uint16_t)(j + 1);
+            return OK;
+        }
+        apr_thread_mutex_unlock(mc->mutex);
+    }
+    if (mw->nconns + mw->opening >= maxconns) {
+        apr_thread_mutex_unlock(mux_mutex);
+        return DECLINED;
+    }
+    mw->opening++;
+    max_reqs = mw->max_reqs;
+    apr_thread_mutex_unlock(mux_mutex);
+
+    status = mux_open(r, worker, conf, url, proxyname, proxyport,
+                      max_reqs, &mc);
+
+    apr_thread_mutex_lock(mux_mutex);
+    mw->opening--;
+    if (status == OK) {
+        /* the first request id is ours */
+        mc->streams[0].in_use = 1;
+        mc->nstreams = 1;
+        mw->conns[mw->nconns++] = mc;
+    }
+    apr_thread_mutex_unlock(mux_mutex);
+
+    if (status == OK) {
+        *pmc = mc;
+        *request_id = 1;
+    }
+    return status;
+}
+
+/*
+ * Give the request id back, or if the request did not get to its end,
+ * have the back end abort it and keep the id until the back end is done
+ * with it.
+ */
+static void mux_detach(fcgi_mux_conn_t *mc, apr_uint16_t request_id)
+{
+    fcgi_stream_t *st = &mc->streams[request_id - 1];
+    fcgi_record_t *rec;
+    apr_status_t broken;
+    int ended;
+
+    apr_thread_mutex_lock(mc->mutex);
+    broken = mc->broken;
+    ended = st->ended;
+    apr_thread_mutex_unlock(mc->mutex);
+
+    if (!ended && !broken) {
+        struct iovec vec[1];
+        ap_fcgi_header header;
+        unsigned char farray[AP_FCGI_HEADER_LEN];
+        apr_size_t len;
+
+        ap_fcgi_fill_in_header(&header, AP_FCGI_ABORT_REQUEST, request_id,
+                               0, 0);
+        ap_fcgi_header_to_array(&header, farray);
+        vec[0].iov_base = (void *)farray;
+        vec[0].iov_len = sizeof(farray);
+        send_data(mc->backend, mc, vec, 1, &len);
+    }
+
+    apr_thread_mutex_lock(mc->mutex);
+    while ((rec = st->first)) {
+        st->first = rec->next;
+        free(rec->data);
+        free(rec);
+    }
+    st->last = NULL;
+    st->queued = 0;
+    st->overflow = 0;
+    if (!st->ended && !mc->broken) {
+        st->aborted = 1;
+    }
+    else {
+        st->in_use = 0;
+        mc->nstreams--;
+    }
+    apr_thread_mutex_unlock(mc->mutex);
+}
+
+/*
+ * This handles fcgi:(dest) URLs on a connection multiplexing several
+ * requests.  DECLINED when the back end does not multiplex or the
+ * connections are full.
+ */
+static int proxy_fcgi_mux_handler(request_rec *r, proxy_worker *worker,
+                                  proxy_server_conf *conf,
+                                  proxy_dir_conf *dconf,
+                                  fcgi_dirconf_t *fconf, char *url,
+                                  const char *proxyname,
+                                  apr_port_t proxyport)
+{
+    fcgi_mux_worker_t *mw = mux_worker(worker);
+    fcgi_mux_conn_t *mc;
+    apr_uint16_t request_id;
+    int status, mpxs, probe = 0;
+
+    if (fconf->multiplex == FCGI_MUX_AUTO) {
+        apr_thread_mutex_lock(mux_mutex);
+        if (mw->mpxs == -1) {
+            mw->mpxs = -2;
+            probe = 1;
+        }
+        apr_thread_mutex_unlock(mux_mutex);
+
+        if (probe) {
+            mux_probe(r, mw, worker, conf, url, proxyname, proxyport);
+        }
+
+        apr_thread_mutex_lock(mux_mutex);
+        mpxs = mw->mpxs;
+        apr_thread_mutex_unlock(mux_mutex);
+        if (mpxs != 1) {
+            return DECLINED;
+        }
+    }
+
+    status = mux_attach(r, mw, fconf->conns, worker, conf, url, proxyname,
+                        proxyport, &mc, &request_id);
+    if (status != OK) {
+        return status;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "request id %d on a multiplexed connection to %s",
+                  request_id, mc->backend->hostname);
+
+    status = fcgi_do_request(r->pool, r, mc->backend, mc, request_id, NULL,
+                             dconf, NULL, url, mc->server_portstr);
+
+    mux_detach(mc, request_id);
+
+    return status;
+}
+
+#endif /* APR_HAS_THREADS */
+
 /*
  * This handles fcgi:(dest) URLs
  */
@@ -850,6 +1688,8 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
 
     proxy_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
                                                  &proxy_module);
+    fcgi_dirconf_t *fconf = ap_get_module_config(r->per_dir_config,
+                                                 &proxy_fcgi_module);
 
     apr_pool_t *p = r->pool;
 
@@ -866,6 +1706,21 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
 
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01078) "serving URL %s", url);
 
+#if APR_HAS_THREADS
+    /* A backend may answer before it has read the whole body, and the
+     * other requests of a shared connection would wait for it meanwhile,
+     * so bodies go over connections of their own.
+     */
+    if (fconf->multiplex > FCGI_MUX_OFF && mux_mutex
+        && !ap_request_has_body(r)) {
+        status = proxy_fcgi_mux_handler(r, worker, conf, dconf, fconf,
+                                        url, proxyname, proxyport);
+        if (status != DECLINED) {
+            return status;
+        }
+    }
+#endif
+
     /* Create space for state information */
     status = ap_proxy_acquire_connection(FCGI_SCHEME, &backend, worker,
                                          r->server);
@@ -908,7 +1763,7 @@ static int proxy_fcgi_handler(request_rec *r, proxy_worker *worker,
     }
 
     /* Step Three: Process the Request */
-    status = fcgi_do_request(p, r, backend, origin, dconf, uri, url,
+    status = fcgi_do_request(p, r, backend, NULL, 1, origin, dconf, uri, url,
                              server_portstr);
 
 cleanup:
@@ -916,18 +1771,104 @@ cleanup:
     return status;
 }
 
+static void *fcgi_create_dconf(apr_pool_t *p, char *path)
+{
+    fcgi_dirconf_t *a;
+
+    a = (fcgi_dirconf_t *)apr_pcalloc(p, sizeof(fcgi_dirconf_t));
+    a->multiplex = FCGI_MUX_UNSET;
+    a->conns = FCGI_MUX_DEFAULT_CONNS;
+
+    return a;
+}
+
+static void *fcgi_merge_dconf(apr_pool_t *p, void *basev, void *overridesv)
+{
+    fcgi_dirconf_t *a, *base, *over;
+
+    a     = (fcgi_dirconf_t *)apr_pcalloc(p, sizeof(fcgi_dirconf_t));
+    base  = (fcgi_dirconf_t *)basev;
+    over  = (fcgi_dirconf_t *)overridesv;
+
+    if (over->multiplex != FCGI_MUX_UNSET) {
+        a->multiplex = over->multiplex;
+        a->conns = over->conns;
+    }
+    else {
+        a->multiplex = base->multiplex;
+        a->conns = base->conns;
+    }
+
+    return a;
+}
+
+static const char *set_multiplex(cmd_parms *cmd, void *dconf,
+                                 const char *arg1, const char *arg2)
+{
+    fcgi_dirconf_t *conf = dconf;
+
+    if (!strcasecmp(arg1, "Off")) {
+        conf->multiplex = FCGI_MUX_OFF;
+    }
+    else if (!strcasecmp(arg1, "On")) {
+        conf->multiplex = FCGI_MUX_ON;
+    }
+    else if (!strcasecmp(arg1, "Auto")) {
+        conf->multiplex = FCGI_MUX_AUTO;
+    }
+    else {
+        return "ProxyFCGIMultiplex must be one of: Off | On | Auto";
+    }
+
+    conf->conns = FCGI_MUX_DEFAULT_CONNS;
+    if (arg2) {
+        conf->conns = atoi(arg2);
+        if (conf->conns < 1 || conf->conns > FCGI_MUX_MAX_CONNS) {
+            return apr_psprintf(cmd->pool, "ProxyFCGIMultiplex connections "
+                                "must be between 1 and %d",
+                                FCGI_MUX_MAX_CONNS);
+        }
+    }
+
+    return NULL;
+}
+
+static void fcgi_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_create(&mux_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(02891)
+                     "can't create the FastCGI multiplexing mutex, "
+                     "ProxyFCGIMultiplex is off");
+        mux_mutex = NULL;
+    }
+#endif
+}
+
+static const command_rec command_table[] = {
+    AP_INIT_TAKE12("ProxyFCGIMultiplex", set_multiplex, NULL,
+                   RSRC_CONF|ACCESS_CONF,
+                   "Off, On or Auto (as the backend tells), and the number "
+                   "of connections multiplexing the requests to a worker"),
+    { NULL }
+};
+
 static void register_hooks(apr_pool_t *p)
 {
     proxy_hook_scheme_handler(proxy_fcgi_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_fcgi_canon, NULL, NULL, APR_HOOK_FIRST);
+    ap_hook_child_init(fcgi_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(proxy_fcgi) = {
     STANDARD20_MODULE_STUFF,
-    NULL,                       /* create per-directory config structure */
-    NULL,                       /* merge per-directory config structures */
+    fcgi_create_dconf,          /* create per-directory config structure */
+    fcgi_merge_dconf,           /* merge per-directory config structures */
     NULL,                       /* create per-server config structure */
     NULL,                       /* merge per-server config structures */
-    NULL,                       /* command apr_table_t */
+    command_table,              /* command apr_table_t */
     register_hooks              /* register hooks */
 };
@@ -18,9 +18,17 @@
 
 #include "mod_proxy.h"
 #include "ap_regex.h"
+#include "ap_mpm.h"
 
 module AP_MODULE_DECLARE_DATA proxy_http_module;
 
+typedef struct {
+    int async;
+    apr_interval_time_t async_delay;
+    unsigned int async_set:1;
+    unsigned int async_delay_set:1;
+} proxy_http_dir_conf;
+
 static int (*ap_proxy_clear_connection_fn)(request_rec *r, apr_table_t *headers) =
         NULL;
 
@@ -1897,6 +1905,169 @@ apr_status_t ap_proxy_http_cleanup(const char *scheme, request_rec *r,
     return OK;
 }
 
+/*
+ * With ProxyHTTPAsync, a request whose backend has not started to respond
+ * within ProxyHTTPAsyncDelay is suspended, and the worker thread given back
+ * to the MPM, which calls us back on some thread once the backend connection
+ * is readable, or has timed out, to process the response as usual.
+ */
+typedef struct {
+    request_rec *r;
+    proxy_conn_rec *backend;
+    proxy_worker *worker;
+    proxy_server_conf *conf;
+    const char *proxy_function;
+    char *server_portstr;
+} proxy_http_baton_t;
+
+/* What proxy_http_handler() and ap_process_async_request() would have done
+ * once the handler returned status, had the request not been suspended.
+ */
+static void proxy_http_async_done(proxy_http_baton_t *baton, int status)
+{
+    request_rec *r = baton->r;
+    conn_rec *c = r->connection;
+
+    if (baton->backend) {
+        if (status != OK)
+            baton->backend->close = 1;
+        ap_proxy_http_cleanup(baton->proxy_function, r, baton->backend);
+    }
+    status = ap_proxy_suspended_done(r, status);
+
+    if (status == DONE) {
+        status = OK;
+    }
+    if (status == OK) {
+        ap_finalize_request_protocol(r);
+    }
+    else {
+        r->status = HTTP_OK;
+        ap_die(status, r);
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+    ap_process_request_after_handler(r); /* don't touch baton or r after here */
+    ap_mpm_resume_suspended(c);
+}
+
+static void proxy_http_async_callback(void *b)
+{
+    proxy_http_baton_t *baton = b;
+    request_rec *r = baton->r;
+    int status;
+
+#if APR_HAS_THREADS
+    /* wait for the thread that suspended the request to be done with it */
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "HTTP: resuming, %s:%d is responding",
+                  baton->backend->hostname, baton->backend->port);
+
+    status = ap_proxy_http_process_response(r->pool, r, &baton->backend,
+                                            baton->worker, baton->conf,
+                                            baton->server_portstr);
+    proxy_http_async_done(baton, status);
+}
+
+static void proxy_http_async_timeout(void *b)
+{
+    proxy_http_baton_t *baton = b;
+    request_rec *r = baton->r;
+    int status;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02882)
+                  "HTTP: timed out waiting for the response of "
+                  "remote server %s:%d",
+                  baton->backend->hostname, baton->backend->port);
+
+    apr_table_setn(r->notes, "proxy_timedout", "1");
+    proxy_run_detach_backend(r, baton->backend);
+    status = ap_proxyerror(r, HTTP_GATEWAY_TIME_OUT,
+                           "Error reading from remote server");
+    proxy_http_async_done(baton, status);
+}
+
+/*
+ * Suspend the request until the backend responds, if it is not responding
+ * already. Returns SUSPENDED if the response will be processed by
+ * proxy_http_async_callback(), DECLINED if it is to be processed right away.
+ */
+static int proxy_http_async(request_rec *r, proxy_conn_rec *backend,
+                            proxy_worker *worker, proxy_server_conf *conf,
+                            const char *proxy_function, char *server_portstr)
+{
+    conn_rec *c = r->connection;
+    proxy_http_dir_conf *dconf = ap_get_module_config(r->per_dir_config,
+                                                      &proxy_http_module);
+    proxy_http_baton_t *baton;
+    apr_socket_t *sockets[2] = {NULL, NULL};
+    apr_interval_time_t timeout;
+    apr_pollfd_t pfd;
+    apr_int32_t nfds;
+    apr_status_t rv;
+    int can_suspend = 0;
+
+    /* Only main requests run by the asynchronous connection handler can be
+     * suspended. A 100-Continue ping of the backend is waited for in place,
+     * it may have to be retried.
+     */
+    if (!dconf->async || r->main || r->prev || c->master || !c->cs
+            || c->clogging_input_filters
+            || (worker->s->ping_timeout_set && worker->s->ping_timeout >= 0
+                && ap_request_has_body(r))
+            || ap_mpm_query(AP_MPMQ_CAN_SUSPEND, &can_suspend) != APR_SUCCESS
+            || !can_suspend) {
+        return DECLINED;
+    }
+
+    /* Fast backends are answered without the round trip through the MPM,
+     * and errors are left to ap_proxy_http_process_response().
+     */
+    pfd.p = r->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = backend->sock;
+    pfd.client_data = NULL;
+    rv = apr_poll(&pfd, 1, &nfds, dconf->async_delay);
+    if (!APR_STATUS_IS_TIMEUP(rv)) {
+        return DECLINED;
+    }
+
+    baton = apr_pcalloc(r->pool, sizeof(*baton));
+    baton->r = r;
+    baton->backend = backend;
+    baton->worker = worker;
+    baton->conf = conf;
+    baton->proxy_function = proxy_function;
+    baton->server_portstr = apr_pstrdup(r->pool, server_portstr);
+
+    apr_socket_timeout_get(backend->sock, &timeout);
+    sockets[0] = backend->sock;
+    rv = ap_mpm_register_socket_callback_timeout(sockets, r->pool, 1,
+                                                 proxy_http_async_callback,
+                                                 proxy_http_async_timeout,
+                                                 baton, timeout);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        return DECLINED;
+    }
+    else if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02883)
+                      "HTTP: could not suspend the request");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "HTTP: suspending until %s:%d responds",
+                  backend->hostname, backend->port);
+    return SUSPENDED;
+}
+
 /*
  * This handles http:// URLs, and other URLs using a remote proxy over http
  * If proxyhost is NULL, then contact the server directly, otherwise
@@ -2059,9 +2230,19 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
 
         }
 
-        /* Step Five: Receive the Response... Fall thru to cleanup */
-        status = ap_proxy_http_process_response(p, r, &backend, worker,
-                                                conf, server_portstr);
+        /* Step Five: Receive the Response, from an MPM callback if the
+         * request is suspended meanwhile, which then cleans up...
+         * Fall thru to cleanup
+         */
+        status = proxy_http_async(r, backend, worker, conf, proxy_function,
+                                  server_portstr);
+        if (status == SUSPENDED) {
+            return SUSPENDED;
+        }
+        if (status == DECLINED) {
+            status = ap_proxy_http_process_response(p, r, &backend, worker,
+                                                    conf, server_portstr);
+        }
 
         break;
     }
@@ -2100,6 +2281,61 @@ static int proxy_http_post_config(apr_pool_t *pconf, apr_pool_t *plog,
     return OK;
 }
 
+static void *create_proxy_http_dir_config(apr_pool_t *p, char *dummy)
+{
+    return apr_pcalloc(p, sizeof(proxy_http_dir_conf));
+}
+
+static void *merge_proxy_http_dir_config(apr_pool_t *p, void *basev,
+                                         void *addv)
+{
+    proxy_http_dir_conf *new = apr_pcalloc(p, sizeof(proxy_http_dir_conf));
+    proxy_http_dir_conf *base = basev;
+    proxy_http_dir_conf *add = addv;
+
+    new->async = add->async_set ? add->async : base->async;
+    new->async_set = add->async_set || base->async_set;
+    new->async_delay = add->async_delay_set ? add->async_delay
+                                            : base->async_delay;
+    new->async_delay_set = add->async_delay_set || base->async_delay_set;
+
+    return new;
+}
+
+static const char *set_async(cmd_parms *cmd, void *conf, int flag)
+{
+    proxy_http_dir_conf *dconf = conf;
+
+    dconf->async = flag;
+    dconf->async_set = 1;
+    return NULL;
+}
+
+static const char *set_async_delay(cmd_parms *cmd, void *conf,
+                                   const char *arg)
+{
+    proxy_http_dir_conf *dconf = conf;
+
+    if (ap_timeout_parameter_parse(arg, &dconf->async_delay, "ms")
+            != APR_SUCCESS || dconf->async_delay < 0) {
+        return "ProxyHTTPAsyncDelay timeout has wrong format";
+    }
+    dconf->async_delay_set = 1;
+    return NULL;
+}
+
+static const command_rec proxy_http_cmds[] =
+{
+    AP_INIT_FLAG("ProxyHTTPAsync", set_async, NULL, RSRC_CONF|ACCESS_CONF,
+                 "on if requests waiting for the response of the backend "
+                 "should not hold a thread, where the MPM supports it"),
+    AP_INIT_TAKE1("ProxyHTTPAsyncDelay", set_async_delay, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "time to wait for the response of the backend before "
+                  "suspending the request, in milliseconds by default"),
+    {NULL}
+};
+
 static void ap_proxy_http_register_hook(apr_pool_t *p)
 {
     ap_hook_post_config(proxy_http_post_config, NULL, NULL, APR_HOOK_MIDDLE);
@@ -2110,11 +2346,11 @@ static void ap_proxy_http_register_hook(apr_pool_t *p)
 
 AP_DECLARE_MODULE(proxy_http) = {
     STANDARD20_MODULE_STUFF,
-    NULL,              /* create per-directory config structure */
-    NULL,              /* merge per-directory config structures */
+    create_proxy_http_dir_config, /* create per-directory config structure */
+    merge_proxy_http_dir_config,  /* merge per-directory config structures */
     NULL,              /* create per-server config structure */
     NULL,              /* merge per-server config structures */
-    NULL,              /* command apr_table_t */
+    proxy_http_cmds,   /* command apr_table_t */
     ap_proxy_http_register_hook/* register hooks */
 };
 
@@ -34,10 +34,13 @@ typedef struct ws_baton_t {
     apr_bucket_brigade *bb;
     apr_pool_t *subpool;        /* cleared before each suspend, destroyed when request ends */
     char *scheme;               /* required to release the proxy connection */
+    proxy_splice_t *client_splice; /* client -> backend relay, once possible */
+    proxy_splice_t *server_splice; /* backend -> client relay, once possible */
 } ws_baton_t;
 
 static apr_status_t proxy_wstunnel_transfer(request_rec *r, conn_rec *c_i, conn_rec *c_o,
-                                     apr_bucket_brigade *bb, char *name);
+                                     apr_bucket_brigade *bb, proxy_splice_t **ps,
+                                     char *name);
 static void proxy_wstunnel_callback(void *b);
 
 static int proxy_wstunnel_pump(ws_baton_t *baton, apr_time_t timeout, int try_async) {
@@ -86,7 +89,8 @@ static int proxy_wstunnel_pump(ws_baton_t *baton, apr_time_t timeout, int try_as
                 if (pollevent & (APR_POLLIN | APR_POLLHUP)) {
                     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, APLOGNO(02446)
                             "sock was readable");
-                    rv = proxy_wstunnel_transfer(r, backconn, c, bb, "sock");
+                    rv = proxy_wstunnel_transfer(r, backconn, c, bb,
+                                                 &baton->server_splice, "sock");
                 }
                 else if (pollevent & APR_POLLERR) {
                     rv = APR_EPIPE;
@@ -105,7 +109,8 @@ static int proxy_wstunnel_pump(ws_baton_t *baton, apr_time_t timeout, int try_as
                 if (pollevent & (APR_POLLIN | APR_POLLHUP)) {
                     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, APLOGNO(02448)
                             "client was readable");
-                    rv = proxy_wstunnel_transfer(r, c, backconn, bb, "client");
+                    rv = proxy_wstunnel_transfer(r, c, backconn, bb,
+                                                 &baton->client_splice, "client");
                 }
                 else if (pollevent & APR_POLLERR) {
                     rv = APR_EPIPE;
@@ -142,10 +147,14 @@ static void proxy_wstunnel_finish(ws_baton_t *baton) {
     baton->proxy_connrec->close = 1; /* new handshake expected on each back-conn */
     baton->r->connection->keepalive = AP_CONN_CLOSE;
     ap_proxy_release_connection(baton->scheme, baton->proxy_connrec, baton->r->server);
+    ap_proxy_suspended_done(baton->r, OK);
     ap_finalize_request_protocol(baton->r);
     ap_lingering_close(baton->r->connection);
     apr_socket_close(baton->client_soc);
     ap_mpm_resume_suspended(baton->r->connection);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(baton->r->invoke_mtx);
+#endif
     ap_process_request_after_handler(baton->r); /* don't touch baton or r after here */
 }
 
@@ -156,6 +165,9 @@ static void proxy_wstunnel_finish(ws_baton_t *baton) {
 static void proxy_wstunnel_cancel_callback(void *b)
 { 
     ws_baton_t *baton = (ws_baton_t*)b;
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(baton->r->invoke_mtx);
+#endif
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, baton->r, "proxy_wstunnel_cancel_callback, IO timed out");
     proxy_wstunnel_finish(baton);
     return;
@@ -163,14 +175,17 @@ static void proxy_wstunnel_cancel_callback(void *b)
 
 /* Invoked by the event loop when data is ready on either end. 
  *  Pump both ends until they'd block and then start over again 
- *  We don't need the invoke_mtx, since we never put multiple callback events
- *  in the queue.
+ *  The invoke_mtx keeps us from running before the thread that suspended
+ *  the request is done with it, mod_proxy included.
  */
 static void proxy_wstunnel_callback(void *b) { 
     int status;
     apr_socket_t *sockets[3] = {NULL, NULL, NULL};
     ws_baton_t *baton = (ws_baton_t*)b;
     proxyws_dir_conf *dconf = ap_get_module_config(baton->r->per_dir_config, &proxy_wstunnel_module);
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(baton->r->invoke_mtx);
+#endif
     apr_pool_clear(baton->subpool);
     status = proxy_wstunnel_pump(baton, dconf->async_delay, dconf->is_async);
     if (status == SUSPENDED) {
@@ -182,6 +197,9 @@ static void proxy_wstunnel_callback(void *b) {
             baton, 
             dconf->idle_timeout);
         ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, baton->r, "proxy_wstunnel_callback suspend");
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(baton->r->invoke_mtx);
+#endif
     }
     else { 
         proxy_wstunnel_finish(baton);
@@ -262,12 +280,25 @@ static int proxy_wstunnel_canon(request_rec *r, char *url)
 
 
 static apr_status_t proxy_wstunnel_transfer(request_rec *r, conn_rec *c_i, conn_rec *c_o,
-                                     apr_bucket_brigade *bb, char *name)
+                                     apr_bucket_brigade *bb, proxy_splice_t **ps,
+                                     char *name)
 {
     apr_status_t rv;
-#ifdef DEBUGGING
     apr_off_t len;
-#endif
+
+    if (*ps) {
+        if (c_o->aborted) {
+            return APR_EPIPE;
+        }
+        rv = ap_proxy_splice_transfer(*ps, &len);
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE5, rv, r,
+                      "spliced %" APR_OFF_T_FMT " bytes from %s", len, name);
+        if (rv != APR_SUCCESS && !APR_STATUS_IS_EOF(rv)) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(02831)
+                          "error on %s - splice", name);
+        }
+        return rv;
+    }
 
     do {
         apr_brigade_cleanup(bb);
@@ -306,6 +337,13 @@ static apr_status_t proxy_wstunnel_transfer(request_rec *r, conn_rec *c_i, conn_
     ap_log_rerror(APLOG_MARK, APLOG_TRACE2, rv, r, "wstunnel_transfer complete");
 
     if (APR_STATUS_IS_EAGAIN(rv)) {
+        /* Nothing is buffered by the filters anymore, so the next reads
+         * can bypass them if they are not needed.
+         */
+        if (ap_proxy_splice_create(ps, c_i, c_o, r->pool) == APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                          "splicing data from %s", name);
+        }
         rv = APR_SUCCESS;
     }
 
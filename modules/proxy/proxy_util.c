@@ -20,6 +20,7 @@
 #include "scoreboard.h"
 #include "apr_version.h"
 #include "apr_hash.h"
+#include "apr_thread_cond.h"
 #include "proxy_util.h"
 #include "ajp.h"
 #include "scgi.h"
@@ -40,6 +41,10 @@
 #include "apr_support.h"        /* for apr_wait_for_io_or_timeout() */
 #endif
 
+#if HAVE_SPLICE
+#include <fcntl.h>              /* for splice() */
+#endif
+
 APLOG_USE_MODULE(proxy);
 
 /*
@@ -1313,10 +1318,30 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_balancer(proxy_balancer *balance
  * CONNECTION related...
  */
 
+/*
+ * The idle connections of a worker with hmax, kept as a LIFO so that the
+ * most recently used (warmest) connection is handed out first while the
+ * cold ones sink to the bottom where they expire.
+ */
+typedef struct {
+    proxy_conn_rec *conn;
+    apr_time_t      released;   /* when it was put back on the stack */
+    apr_time_t      checked;    /* when the watchdog found it connected */
+} proxy_conn_idle;
+
+typedef struct proxy_conn_stack {
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t  *cond;
+    proxy_conn_idle    *idle;       /* hmax entries, the top at nidle - 1 */
+    int                 nidle;
+    int                 ntotal;     /* idle or in use connections */
+    apr_time_t          maintained; /* last pass of the watchdog */
+} proxy_conn_stack;
+
 static apr_status_t conn_pool_cleanup(void *theworker)
 {
     proxy_worker *worker = (proxy_worker *)theworker;
-    if (worker->cp->res) {
+    if (worker->cp->stack) {
         worker->cp->pool = NULL;
     }
     return APR_SUCCESS;
@@ -1351,6 +1376,128 @@ PROXY_DECLARE(int) ap_proxy_connection_reusable(proxy_conn_rec *conn)
     return ! (conn->close || !worker->s->is_address_reusable || worker->s->disablereuse);
 }
 
+static apr_status_t connection_constructor(void **resource, void *params,
+                                           apr_pool_t *pool);
+static apr_status_t connection_destructor(void *resource, void *params,
+                                          apr_pool_t *pool);
+static void socket_cleanup(proxy_conn_rec *conn);
+
+static apr_status_t init_conn_stack(proxy_worker *worker)
+{
+    apr_status_t rv;
+    proxy_conn_stack *st;
+    apr_pool_t *p = worker->cp->pool;
+    void *conn;
+    int i;
+
+    st = apr_pcalloc(p, sizeof(proxy_conn_stack));
+    st->idle = apr_pcalloc(p, worker->s->hmax * sizeof(proxy_conn_idle));
+    rv = apr_thread_mutex_create(&st->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_cond_create(&st->cond, p);
+    }
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    for (i = 0; i < worker->s->min; i++) {
+        connection_constructor(&conn, worker, p);
+        st->idle[st->nidle++].conn = conn;
+    }
+    st->ntotal = st->nidle;
+    worker->cp->stack = st;
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Destroy the coldest idle connections unused for more than ttl while
+ * more than smax are idle, like apr_reslist did. Called with the stack
+ * locked.
+ */
+static void conn_stack_expire(proxy_worker *worker, apr_time_t now)
+{
+    proxy_conn_stack *st = worker->cp->stack;
+
+    if (!worker->s->ttl) {
+        return;
+    }
+    while (st->nidle > worker->s->smax
+           && now - st->idle[0].released >= worker->s->ttl) {
+        connection_destructor(st->idle[0].conn, worker, NULL);
+        st->nidle--;
+        st->ntotal--;
+        memmove(&st->idle[0], &st->idle[1],
+                st->nidle * sizeof(proxy_conn_idle));
+    }
+}
+
+static apr_status_t conn_stack_acquire(proxy_worker *worker,
+                                       proxy_conn_rec **conn)
+{
+    proxy_conn_stack *st = worker->cp->stack;
+    apr_time_t now = apr_time_now(), deadline = now + worker->s->acquire;
+    apr_status_t rv;
+
+    if ((rv = apr_thread_mutex_lock(st->mutex)) != APR_SUCCESS) {
+        return rv;
+    }
+    while (!st->nidle && st->ntotal >= worker->s->hmax) {
+        if (!worker->s->acquire_set) {
+            rv = apr_thread_cond_wait(st->cond, st->mutex);
+        }
+        else if (deadline > (now = apr_time_now())) {
+            rv = apr_thread_cond_timedwait(st->cond, st->mutex,
+                                           deadline - now);
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                rv = APR_SUCCESS;
+            }
+        }
+        else {
+            rv = APR_EAGAIN;
+        }
+        if (rv != APR_SUCCESS) {
+            apr_thread_mutex_unlock(st->mutex);
+            return rv;
+        }
+    }
+
+    if (st->nidle) {
+        proxy_conn_idle *top = &st->idle[--st->nidle];
+        apr_time_t last = top->released > top->checked ? top->released
+                                                        : top->checked;
+        /*
+         * While the watchdog runs, a socket it checked or that was used
+         * successfully no longer than its interval ago is trusted as is.
+         */
+        *conn = top->conn;
+        (*conn)->validated = (*conn)->sock
+            && now - st->maintained < 2 * PROXY_CONN_CHECK_INTERVAL
+            && now - last < PROXY_CONN_CHECK_INTERVAL;
+    }
+    else {
+        rv = connection_constructor((void **)conn, worker, worker->cp->pool);
+        st->ntotal++;
+    }
+    apr_thread_mutex_unlock(st->mutex);
+
+    return rv;
+}
+
+static void conn_stack_release(proxy_worker *worker, proxy_conn_rec *conn)
+{
+    proxy_conn_stack *st = worker->cp->stack;
+    proxy_conn_idle *top;
+
+    apr_thread_mutex_lock(st->mutex);
+    top = &st->idle[st->nidle++];
+    top->conn = conn;
+    top->released = apr_time_now();
+    top->checked = 0;
+    conn_stack_expire(worker, top->released);
+    apr_thread_cond_signal(st->cond);
+    apr_thread_mutex_unlock(st->mutex);
+}
+
 static apr_status_t connection_cleanup(void *theconn)
 {
     proxy_conn_rec *conn = (proxy_conn_rec *)theconn;
@@ -1389,9 +1536,9 @@ static apr_status_t connection_cleanup(void *theconn)
         apr_pool_tag(conn->scpool, "proxy_conn_scpool");
     }
 
-    if (worker->s->hmax && worker->cp->res) {
+    if (worker->s->hmax && worker->cp->stack) {
         conn->inreslist = 1;
-        apr_reslist_release(worker->cp->res, (void *)conn);
+        conn_stack_release(worker, conn);
     }
     else
     {
@@ -1445,7 +1592,7 @@ PROXY_DECLARE(apr_status_t) ap_proxy_ssl_connection_cleanup(proxy_conn_rec *conn
     return APR_SUCCESS;
 }
 
-/* reslist constructor */
+/* connection stack constructor */
 static apr_status_t connection_constructor(void **resource, void *params,
                                            apr_pool_t *pool)
 {
@@ -1481,13 +1628,13 @@ static apr_status_t connection_constructor(void **resource, void *params,
     return APR_SUCCESS;
 }
 
-/* reslist destructor */
+/* connection stack destructor */
 static apr_status_t connection_destructor(void *resource, void *params,
                                           apr_pool_t *pool)
 {
     proxy_conn_rec *conn = (proxy_conn_rec *)resource;
 
-    /* Destroy the pool only if not called from reslist_destroy */
+    /* Destroy the pool only if the worker's one is not being destroyed */
     if (conn->worker->cp->pool) {
         apr_pool_destroy(conn->pool);
     }
@@ -1870,7 +2017,7 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
             }
         }
         else {
-            /* This will supress the apr_reslist creation */
+            /* This will supress the connection stack creation */
             worker->s->min = worker->s->smax = worker->s->hmax = 0;
         }
     }
@@ -1906,11 +2053,7 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
         }
 
         if (worker->s->hmax) {
-            rv = apr_reslist_create(&(worker->cp->res),
-                                    worker->s->min, worker->s->smax,
-                                    worker->s->hmax, worker->s->ttl,
-                                    connection_constructor, connection_destructor,
-                                    worker, worker->cp->pool);
+            rv = init_conn_stack(worker);
 
             apr_pool_cleanup_register(worker->cp->pool, (void *)worker,
                                       conn_pool_cleanup,
@@ -1921,11 +2064,6 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
                  getpid(), worker->s->hostname, worker->s->min,
                  worker->s->hmax, worker->s->smax);
 
-            /* Set the acquire timeout */
-            if (rv == APR_SUCCESS && worker->s->acquire_set) {
-                apr_reslist_timeout_set(worker->cp->res, worker->s->acquire);
-            }
-
         }
         else {
             void *conn;
@@ -2182,8 +2320,8 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
         }
     }
 
-    if (worker->s->hmax && worker->cp->res) {
-        rv = apr_reslist_acquire(worker->cp->res, (void **)conn);
+    if (worker->s->hmax && worker->cp->stack) {
+        rv = conn_stack_acquire(worker, conn);
     }
     else {
         /* create the new connection if the previous was destroyed */
@@ -2207,6 +2345,13 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
                  "%s: has acquired connection for (%s)",
                  proxy_function, worker->s->hostname);
 
+    if ((*conn)->sock) {
+        worker->s->pool_hits++;
+    }
+    else {
+        worker->s->pool_misses++;
+    }
+
     (*conn)->worker = worker;
     (*conn)->close  = 0;
     (*conn)->inreslist = 0;
@@ -2338,7 +2483,8 @@ ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
                      * So let's make it configurable by env.
                      * The logic here is the same used in mod_proxy_http.
                      */
-                    proxy_auth = apr_table_get(r->headers_in, "Proxy-Authorization");
+                    proxy_auth = ap_get_request_header(r,
+                                            AP_HEADER_PROXY_AUTHORIZATION);
                     if (proxy_auth != NULL &&
                         proxy_auth[0] != '\0' &&
                         r->user == NULL && /* we haven't yet authenticated */
@@ -2684,6 +2830,18 @@ PROXY_DECLARE(apr_status_t) ap_proxy_connect_uds(apr_socket_t *sock,
 }
 #endif
 
+static void connect_time_record(proxy_worker *worker, apr_interval_time_t t)
+{
+    int i;
+
+    for (i = 0; i < PROXY_CONNECT_HIST_BUCKETS - 1; i++) {
+        if (t < PROXY_CONNECT_HIST_BOUND(i)) {
+            break;
+        }
+    }
+    worker->s->connect_hist[i]++;
+}
+
 PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                                             proxy_conn_rec *conn,
                                             proxy_worker *worker,
@@ -2696,18 +2854,23 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     /* the local address to use for the outgoing connection */
     apr_sockaddr_t *local_addr;
     apr_socket_t *newsock;
+    apr_time_t start;
     void *sconf = s->module_config;
     proxy_server_conf *conf =
         (proxy_server_conf *) ap_get_module_config(sconf, &proxy_module);
 
     if (conn->sock) {
-        if (!(connected = ap_proxy_is_socket_connected(conn->sock))) {
+        if (conn->validated) {
+            connected = 1;
+        }
+        else if (!(connected = ap_proxy_is_socket_connected(conn->sock))) {
             socket_cleanup(conn);
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00951)
                          "%s: backend socket is disconnected.",
                          proxy_function);
         }
     }
+    conn->validated = 0;
     while ((backend_addr || conn->uds_path) && !connected) {
 #if APR_HAVE_SYS_UN_H
         if (conn->uds_path)
@@ -2725,6 +2888,7 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
             }
             conn->connection = NULL;
 
+            start = apr_time_now();
             rv = ap_proxy_connect_uds(newsock, conn->uds_path, conn->scpool);
             if (rv != APR_SUCCESS) {
                 apr_socket_close(newsock);
@@ -2737,6 +2901,7 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                 break;
             }
 
+            connect_time_record(worker, apr_time_now() - start);
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02823)
                          "%s: connection established with Unix domain socket "
                          "%s (%s)",
@@ -2821,6 +2986,7 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
             }
 
             /* make the connection out of the socket */
+            start = apr_time_now();
             rv = apr_socket_connect(newsock, backend_addr);
 
             /* if an error occurred, loop round and try again */
@@ -2836,6 +3002,7 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                 continue;
             }
 
+            connect_time_record(worker, apr_time_now() - start);
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02824)
                          "%s: connection established with %pI (%s)",
                          proxy_function,
@@ -2912,6 +3079,137 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     return connected ? OK : DECLINED;
 }
 
+/*
+ * Schemes whose handlers take a pooled connection as is, without any
+ * handshake of their own, so that it can be opened in advance.
+ */
+static int conn_prewarmable(proxy_worker *worker)
+{
+    return (!strcasecmp(worker->s->scheme, "http")
+            || !strcasecmp(worker->s->scheme, "ajp")
+            || !strcasecmp(worker->s->scheme, "fcgi"))
+        && !*worker->s->uds_path
+        && !PROXY_WORKER_IS_GENERIC(worker)
+        && worker->s->is_address_reusable && !worker->s->disablereuse;
+}
+
+void proxy_util_maintain_connections(proxy_worker *worker, server_rec *s,
+                                     int prewarm, apr_pool_t *p)
+{
+    proxy_conn_stack *st;
+    proxy_conn_idle *live, *dead;
+    proxy_conn_rec *conn;
+    apr_time_t now;
+    int i, nlive, ndead, nwarm;
+
+    if (!(worker->local_status & PROXY_WORKER_INITIALIZED)
+        || !worker->s->hmax || !(st = worker->cp->stack)) {
+        return;
+    }
+    /* balancer members may be met in several servers */
+    now = apr_time_now();
+    if (now - st->maintained < PROXY_CONN_CHECK_INTERVAL / 2) {
+        return;
+    }
+
+    live = apr_palloc(p, worker->s->hmax * sizeof(proxy_conn_idle));
+    dead = apr_palloc(p, worker->s->hmax * sizeof(proxy_conn_idle));
+
+    apr_thread_mutex_lock(st->mutex);
+    st->maintained = now;
+
+    /*
+     * Close the idle sockets the backend has closed, and move them below
+     * the connected ones, keeping the order of each.
+     */
+    nlive = ndead = 0;
+    for (i = 0; i < st->nidle; i++) {
+        conn = st->idle[i].conn;
+        if (!conn->sock) {
+            dead[ndead++] = st->idle[i];
+        }
+        else if (ap_proxy_is_socket_connected(conn->sock)) {
+            st->idle[i].checked = now;
+            live[nlive++] = st->idle[i];
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                         "closing idle backend connection to %s",
+                         worker->s->hostname);
+            socket_cleanup(conn);
+            dead[ndead++] = st->idle[i];
+        }
+    }
+    memcpy(&st->idle[0], dead, ndead * sizeof(proxy_conn_idle));
+    memcpy(&st->idle[ndead], live, nlive * sizeof(proxy_conn_idle));
+
+    conn_stack_expire(worker, now);
+
+    /*
+     * Connect up to min connections in advance, counting the ones in use.
+     * Each is taken off the stack while connecting, so that the lock is
+     * not held meanwhile.
+     */
+    nwarm = nlive + st->ntotal - st->nidle;
+    while (prewarm && nwarm < worker->s->min
+           && PROXY_WORKER_IS_USABLE(worker) && conn_prewarmable(worker)) {
+        if (st->nidle && !st->idle[st->nidle - 1].conn->sock) {
+            conn = st->idle[--st->nidle].conn;
+        }
+        else if (st->nidle && !st->idle[0].conn->sock) {
+            conn = st->idle[0].conn;
+            st->nidle--;
+            memmove(&st->idle[0], &st->idle[1],
+                    st->nidle * sizeof(proxy_conn_idle));
+        }
+        else if (st->ntotal < worker->s->hmax) {
+            connection_constructor((void **)&conn, worker, worker->cp->pool);
+            st->ntotal++;
+        }
+        else {
+            break;
+        }
+        apr_thread_mutex_unlock(st->mutex);
+
+        if (!worker->cp->addr) {
+            if (PROXY_THREAD_LOCK(worker) == APR_SUCCESS) {
+                if (!worker->cp->addr) {
+                    apr_sockaddr_info_get(&worker->cp->addr,
+                                          worker->s->hostname, APR_UNSPEC,
+                                          worker->s->port, 0,
+                                          worker->cp->pool);
+                }
+                PROXY_THREAD_UNLOCK(worker);
+            }
+        }
+        if (!conn->hostname) {
+            conn->hostname = apr_pstrdup(conn->pool, worker->s->hostname);
+        }
+        conn->port = worker->s->port;
+        conn->addr = worker->cp->addr;
+        conn->is_ssl = 0;
+        conn->close = 0;
+        if (conn->addr
+            && ap_proxy_connect_backend("PROXY", conn, worker, s) == OK) {
+            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                         "opened backend connection to %s in advance",
+                         worker->s->hostname);
+            nwarm++;
+        }
+        else {
+            prewarm = 0;
+        }
+
+        apr_thread_mutex_lock(st->mutex);
+        st->idle[st->nidle].conn = conn;
+        st->idle[st->nidle].released = st->idle[st->nidle].checked
+                                     = apr_time_now();
+        st->nidle++;
+        apr_thread_cond_signal(st->cond);
+    }
+    apr_thread_mutex_unlock(st->mutex);
+}
+
 static apr_status_t connection_shutdown(void *theconn)
 {
     proxy_conn_rec *conn = (proxy_conn_rec *)theconn;
@@ -3381,7 +3679,7 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
         /* don't want to use r->hostname, as the incoming header might have a
          * port attached
          */
-        const char* hostname = apr_table_get(r->headers_in,"Host");
+        const char* hostname = ap_get_request_header(r, AP_HEADER_HOST);
         if (!hostname) {
             hostname =  r->server->server_hostname;
             ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01092)
@@ -3455,7 +3753,7 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
         }
 
         /* Add the Expect header if not already there. */
-        if (((val = apr_table_get(r->headers_in, "Expect")) == NULL)
+        if (((val = ap_get_request_header(r, AP_HEADER_EXPECT)) == NULL)
                 || (strcasecmp(val, "100-Continue") != 0 /* fast path */
                     && !ap_find_token(r->pool, val, "100-Continue"))) {
             apr_table_mergen(r->headers_in, "Expect", "100-Continue");
@@ -3495,7 +3793,7 @@ PROXY_DECLARE(int) ap_proxy_create_hdrbrgd(apr_pool_t *p,
             /* Add X-Forwarded-Host: so that upstream knows what the
              * original request hostname was.
              */
-            if ((buf = apr_table_get(r->headers_in, "Host"))) {
+            if ((buf = ap_get_request_header(r, AP_HEADER_HOST))) {
                 apr_table_mergen(r->headers_in, "X-Forwarded-Host", buf);
             }
 
@@ -3625,6 +3923,142 @@ PROXY_DECLARE(int) ap_proxy_pass_brigade(apr_bucket_alloc_t *bucket_alloc,
     return OK;
 }
 
+/*
+ * Zero-copy relay: socket -> pipe -> socket with splice(2).
+ */
+#if HAVE_SPLICE
+
+/* The default capacity of a pipe on Linux */
+#define PROXY_SPLICE_CHUNK (64 * 1024)
+
+struct proxy_splice_t {
+    apr_socket_t *out;
+    int in_fd;
+    int out_fd;
+    int pipefd[2];
+};
+
+static apr_status_t proxy_splice_cleanup(void *data)
+{
+    proxy_splice_t *ps = data;
+
+    close(ps->pipefd[0]);
+    close(ps->pipefd[1]);
+    return APR_SUCCESS;
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_create(proxy_splice_t **ps,
+                                                   conn_rec *c_in,
+                                                   conn_rec *c_out,
+                                                   apr_pool_t *p)
+{
+    apr_socket_t *in = ap_get_conn_socket(c_in);
+    apr_socket_t *out = ap_get_conn_socket(c_out);
+    apr_interval_time_t t_in, t_out;
+    proxy_splice_t *sp;
+    apr_os_sock_t fd;
+
+    *ps = NULL;
+
+    /* Anything but the core filters may want to see or transform the data */
+    if (!in || !out
+        || c_in->input_filters->frec != ap_core_input_filter_handle
+        || c_in->input_filters->next
+        || c_out->output_filters->frec != ap_core_output_filter_handle
+        || c_out->output_filters->next) {
+        return APR_ENOTIMPL;
+    }
+
+    /* APR sockets with a timeout are nonblocking at the OS level, which
+     * splice() needs to return EAGAIN rather than wait.
+     */
+    apr_socket_timeout_get(in, &t_in);
+    apr_socket_timeout_get(out, &t_out);
+    if (t_in < 0 || t_out < 0) {
+        return APR_ENOTIMPL;
+    }
+
+    sp = apr_palloc(p, sizeof(*sp));
+    sp->out = out;
+    apr_os_sock_get(&fd, in);
+    sp->in_fd = fd;
+    apr_os_sock_get(&fd, out);
+    sp->out_fd = fd;
+    if (pipe(sp->pipefd) < 0) {
+        return apr_get_os_error();
+    }
+    apr_pool_cleanup_register(p, sp, proxy_splice_cleanup,
+                              apr_pool_cleanup_null);
+
+    *ps = sp;
+    return APR_SUCCESS;
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_transfer(proxy_splice_t *ps,
+                                                     apr_off_t *transferred)
+{
+    apr_status_t rv = APR_SUCCESS;
+    ssize_t n, pending;
+
+    *transferred = 0;
+    for (;;) {
+        n = splice(ps->in_fd, NULL, ps->pipefd[1], NULL, PROXY_SPLICE_CHUNK,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            return APR_EOF;
+        }
+        if (n < 0) {
+            rv = apr_get_netos_error();
+            if (APR_STATUS_IS_EINTR(rv)) {
+                continue;
+            }
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                rv = APR_SUCCESS;
+            }
+            return rv;
+        }
+
+        /* Empty the pipe before reading more, so that it never holds
+         * anything when we return.
+         */
+        for (pending = n; pending > 0; pending -= n) {
+            n = splice(ps->pipefd[0], NULL, ps->out_fd, NULL, pending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                rv = apr_get_netos_error();
+                if (APR_STATUS_IS_EAGAIN(rv)) {
+                    rv = apr_wait_for_io_or_timeout(NULL, ps->out, 0);
+                }
+                if (rv != APR_SUCCESS && !APR_STATUS_IS_EINTR(rv)) {
+                    return rv;
+                }
+                n = 0;
+            }
+            *transferred += n;
+        }
+    }
+}
+
+#else /* HAVE_SPLICE */
+
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_create(proxy_splice_t **ps,
+                                                   conn_rec *c_in,
+                                                   conn_rec *c_out,
+                                                   apr_pool_t *p)
+{
+    *ps = NULL;
+    return APR_ENOTIMPL;
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_splice_transfer(proxy_splice_t *ps,
+                                                     apr_off_t *transferred)
+{
+    *transferred = 0;
+    return APR_ENOTIMPL;
+}
+
+#endif /* HAVE_SPLICE */
+
 /* Fill in unknown schemes from apr_uri_port_of_scheme() */
 
 typedef struct proxy_schemes_t {
@@ -40,6 +40,24 @@ PROXY_DECLARE_DATA extern const apr_strmatch_pattern *ap_proxy_strmatch_domain;
  */
 void proxy_util_register_hooks(apr_pool_t *p);
 
+/**
+ * Interval of the watchdog checks of the idle backend connections, which
+ * are not checked again when reused within that time.
+ */
+#define PROXY_CONN_CHECK_INTERVAL apr_time_from_msec(250)
+
+/**
+ * Check the idle connections of a worker from the watchdog: close the ones
+ * the backend has closed, expire the ones above smax unused for ttl, and
+ * connect up to min of them in advance when prewarm is set.
+ * @param worker worker whose connection pool to maintain
+ * @param s      current server record
+ * @param prewarm non-zero to open connections to the worker in advance
+ * @param p      temporary pool
+ */
+void proxy_util_maintain_connections(proxy_worker *worker, server_rec *s,
+                                     int prewarm, apr_pool_t *p);
+
 /** @} */
 
 #endif /* PROXY_UTIL_H_ */
@@ -488,6 +488,8 @@ static void *create_core_server_config(apr_pool_t *a, server_rec *s)
 
     conf->trace_enable = AP_TRACE_UNSET;
 
+    conf->open_file_cache_valid = AP_OPEN_FILE_CACHE_VALID;
+
     return (void *)conf;
 }
 
@@ -561,6 +563,11 @@ static void *merge_core_server_configs(apr_pool_t *p, void *basev, void *virtv)
                            ? virt->merge_trailers
                            : base->merge_trailers;
 
+    conf->write_coalescing = (virt->write_coalescing
+                              != AP_WRITE_COALESCING_UNSET)
+                             ? virt->write_coalescing
+                             : base->write_coalescing;
+
     return conf;
 }
 
@@ -4136,6 +4143,50 @@ static const char *set_merge_trailers(cmd_parms *cmd, void *dummy, int arg)
     return NULL;
 }
 
+static const char *set_open_file_cache(cmd_parms *cmd, void *dummy,
+                                       const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+    conf->open_file_cache = atoi(arg);
+    if (conf->open_file_cache < 0) {
+        return "OpenFileCache must be a number of files, or 0 to disable it";
+    }
+    return NULL;
+}
+
+static const char *set_open_file_cache_valid(cmd_parms *cmd, void *dummy,
+                                             const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+    if (ap_timeout_parameter_parse(arg, &conf->open_file_cache_valid, "s")
+            != APR_SUCCESS) {
+        return "OpenFileCacheValid must be a time, in seconds by default";
+    }
+    return NULL;
+}
+
+static const char *set_write_coalescing(cmd_parms *cmd, void *dummy, int arg)
+{
+    core_server_config *conf = ap_get_module_config(cmd->server->module_config,
+                                                    &core_module);
+    conf->write_coalescing = (arg ? AP_WRITE_COALESCING_ENABLE :
+            AP_WRITE_COALESCING_DISABLE);
+
+    return NULL;
+}
+
 /* Note --- ErrorDocument will now work from .htaccess files.
  * The AllowOverride of Fileinfo allows webmasters to turn it off
  */
@@ -4392,6 +4443,15 @@ AP_INIT_TAKE1("TraceEnable", set_trace_enable, NULL, RSRC_CONF,
               "'on' (default), 'off' or 'extended' to trace request body content"),
 AP_INIT_FLAG("MergeTrailers", set_merge_trailers, NULL, RSRC_CONF,
               "merge request trailers into request headers or not"),
+AP_INIT_FLAG("EnableWriteCoalescing", set_write_coalescing, NULL, RSRC_CONF,
+              "coalesce response data into as few network writes as possible "
+              "or not"),
+AP_INIT_TAKE1("OpenFileCache", set_open_file_cache, NULL, RSRC_CONF,
+              "the number of open static files each child keeps, 0 "
+              "(default) to disable"),
+AP_INIT_TAKE1("OpenFileCacheValid", set_open_file_cache_valid, NULL, RSRC_CONF,
+              "how long the open file cache trusts a file not to have "
+              "changed, in seconds by default"),
 AP_INIT_ITERATE("HttpProtocol", set_http_protocol, NULL, RSRC_CONF,
               "'min=0.9' (default) or 'min=1.0' to allow/deny HTTP/0.9; "
               "'liberal', 'strict', 'strict,log-only'"),
@@ -4516,6 +4576,303 @@ static int core_override_type(request_rec *r)
     return OK;
 }
 
+/*
+ * The open file cache
+ *
+ * With OpenFileCache, each child keeps the apr_finfo_t of the regular
+ * files it recently served, along with the descriptor or memory map it
+ * served them from, so that a hit on a hot static file needs no stat()
+ * and no path lookup. ap_directory_walk() gets the cached stat results
+ * through the dirwalk_stat hook, the default handler a duplicate of the
+ * descriptor, or the map. An entry is stat'ed again once it is older than
+ * OpenFileCacheValid, and dropped if the file changed meanwhile; the
+ * least recently used entries make room for new ones.
+ *
+ * Each request served from an entry holds a reference to it until its
+ * main request pool goes away, that is once the response has been sent,
+ * so that the map does not go away under it. The cached descriptor never
+ * goes into a bucket: apr_file_setaside() would take it over.
+ */
+typedef struct fcache_entry fcache_entry;
+struct fcache_entry {
+    APR_RING_ENTRY(fcache_entry) link;
+    apr_pool_t *pool;
+    const char *fname;
+    apr_finfo_t finfo;
+    apr_time_t checked;         /* when finfo was stat'ed last */
+    apr_file_t *fd;             /* to sendfile from, or NULL */
+#if APR_HAS_MMAP
+    apr_mmap_t *mm;             /* to write from, or NULL */
+#endif
+    apr_uint32_t refs;          /* the cache's own, and the requests' */
+};
+
+typedef struct fcache_t {
+    apr_pool_t *pool;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    apr_hash_t *entries;
+    APR_RING_HEAD(fcache_ring, fcache_entry) lru; /* most recent first */
+    int count;
+    int max;
+    apr_interval_time_t valid;
+} fcache_t;
+
+static fcache_t *fcache = NULL;
+
+static APR_INLINE void fcache_lock(void)
+{
+#if APR_HAS_THREADS
+    if (fcache->mutex) {
+        apr_thread_mutex_lock(fcache->mutex);
+    }
+#endif
+}
+
+static APR_INLINE void fcache_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (fcache->mutex) {
+        apr_thread_mutex_unlock(fcache->mutex);
+    }
+#endif
+}
+
+/* Is this still the very same file? Any change to the inode, chmod and
+ * friends included, bumps its ctime.
+ */
+static int fcache_same(const apr_finfo_t *a, const apr_finfo_t *b)
+{
+    return a->filetype == b->filetype
+           && a->size == b->size
+           && a->mtime == b->mtime
+           && a->ctime == b->ctime
+           && a->inode == b->inode
+           && a->device == b->device;
+}
+
+/* With the lock held */
+static void fcache_unref(fcache_entry *e)
+{
+    if (--e->refs == 0) {
+        /* the descriptor was opened without a cleanup, the map goes
+         * away with the pool
+         */
+        if (e->fd) {
+            apr_file_close(e->fd);
+        }
+        apr_pool_destroy(e->pool);
+    }
+}
+
+/* With the lock held */
+static void fcache_drop(fcache_entry *e)
+{
+    apr_hash_set(fcache->entries, e->fname, APR_HASH_KEY_STRING, NULL);
+    APR_RING_REMOVE(e, link);
+    fcache->count--;
+    fcache_unref(e);
+}
+
+static apr_status_t fcache_release(void *data)
+{
+    /* the cache may be gone already when the child exits */
+    if (fcache) {
+        fcache_lock();
+        fcache_unref(data);
+        fcache_unlock();
+    }
+    return APR_SUCCESS;
+}
+
+/* Remember the stat results of a regular file */
+static void fcache_update(const char *fname, const apr_finfo_t *finfo,
+                          apr_time_t now)
+{
+    fcache_entry *e;
+    apr_pool_t *p;
+
+    fcache_lock();
+
+    e = apr_hash_get(fcache->entries, fname, APR_HASH_KEY_STRING);
+    if (e) {
+        if (fcache_same(&e->finfo, finfo)) {
+            e->checked = now;
+            fcache_unlock();
+            return;
+        }
+        fcache_drop(e);
+    }
+
+    apr_pool_create(&p, fcache->pool);
+    apr_pool_tag(p, "fcache_entry");
+    e = apr_pcalloc(p, sizeof(fcache_entry));
+    e->pool = p;
+    e->fname = apr_pstrdup(p, fname);
+    e->finfo = *finfo;
+    e->finfo.pool = p;
+    e->finfo.fname = e->fname;
+    e->finfo.name = NULL;
+    e->checked = now;
+    e->refs = 1;
+
+    apr_hash_set(fcache->entries, e->fname, APR_HASH_KEY_STRING, e);
+    APR_RING_INSERT_HEAD(&fcache->lru, e, fcache_entry, link);
+    if (++fcache->count > fcache->max) {
+        fcache_drop(APR_RING_LAST(&fcache->lru));
+    }
+
+    fcache_unlock();
+}
+
+/* The dirwalk_stat of r->filename, from the cache when fresh enough */
+static apr_status_t fcache_stat(apr_finfo_t *finfo, request_rec *r,
+                                apr_int32_t wanted)
+{
+    fcache_entry *e;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv;
+
+    fcache_lock();
+    e = apr_hash_get(fcache->entries, r->filename, APR_HASH_KEY_STRING);
+    if (e && now - e->checked < fcache->valid) {
+        *finfo = e->finfo;
+        APR_RING_REMOVE(e, link);
+        APR_RING_INSERT_HEAD(&fcache->lru, e, fcache_entry, link);
+        fcache_unlock();
+
+        finfo->pool = r->pool;
+        finfo->fname = r->filename;
+        return APR_SUCCESS;
+    }
+    fcache_unlock();
+
+    rv = apr_stat(finfo, r->filename, wanted, r->pool);
+    if (rv == APR_SUCCESS && finfo->filetype == APR_REG) {
+        fcache_update(r->filename, finfo, now);
+    }
+    return rv;
+}
+
+/* Find the entry for the file the request is about to serve, with the
+ * descriptor (sendfile) or the map (mmap) this directory asks for, and
+ * hold on to it for the lifetime of the request. *fd is set to a
+ * duplicate of the descriptor in r->pool when that is to be used.
+ */
+static fcache_entry *fcache_open(request_rec *r, core_dir_config *d,
+                                 apr_file_t **fd)
+{
+    fcache_entry *e;
+    request_rec *m;
+    apr_status_t rv = APR_ENOTIMPL;
+
+    fcache_lock();
+
+    e = apr_hash_get(fcache->entries, r->filename, APR_HASH_KEY_STRING);
+    if (!e || !fcache_same(&e->finfo, &r->finfo)) {
+        fcache_unlock();
+        return NULL;
+    }
+
+#if APR_HAS_SENDFILE
+    if (d->enable_sendfile == ENABLE_SENDFILE_ON
+        && d->enable_mmap != ENABLE_MMAP_OFF) {
+        /* The request gets a dup() of its own, closed with r->pool, which
+         * the core output filter may set aside as it likes. Buckets that
+         * need to be read rather than sendfile'd get mapped, which leaves
+         * the file offset the duplicates share alone; should that fail,
+         * APR_XTHREAD has them read from a descriptor of their own.
+         */
+        rv = APR_SUCCESS;
+        if (!e->fd) {
+            rv = apr_file_open(&e->fd, e->fname, APR_READ | APR_BINARY
+                               | APR_XTHREAD | APR_FOPEN_NOCLEANUP
+                               | APR_SENDFILE_ENABLED, 0, e->pool);
+        }
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_dup(fd, e->fd, r->pool);
+        }
+    }
+    else
+#endif
+#if APR_HAS_MMAP
+    if (d->enable_mmap != ENABLE_MMAP_OFF
+        && e->finfo.size > 0 && e->finfo.size <= APR_MMAP_LIMIT) {
+        rv = APR_SUCCESS;
+        if (!e->mm) {
+            apr_file_t *f;
+
+            rv = apr_file_open(&f, e->fname, APR_READ | APR_BINARY, 0,
+                               e->pool);
+            if (rv == APR_SUCCESS) {
+                rv = apr_mmap_create(&e->mm, f, 0, (apr_size_t)e->finfo.size,
+                                     APR_MMAP_READ, e->pool);
+                apr_file_close(f);
+            }
+        }
+        *fd = NULL;
+    }
+#endif
+
+    if (rv != APR_SUCCESS) {
+        /* nothing to keep for this one, open it as usual */
+        fcache_unlock();
+        return NULL;
+    }
+    e->refs++;
+
+    fcache_unlock();
+
+    for (m = r; m->main; m = m->main);
+    apr_pool_cleanup_register(m->pool, e, fcache_release,
+                              apr_pool_cleanup_null);
+    return e;
+}
+
+static apr_status_t fcache_cleanup(void *dummy)
+{
+    fcache = NULL;
+    return APR_SUCCESS;
+}
+
+static void fcache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    core_server_config *conf = ap_get_core_module_config(s->module_config);
+    apr_allocator_t *allocator;
+    apr_pool_t *p;
+#if APR_HAS_THREADS
+    int threaded_mpm;
+#endif
+
+    if (conf->open_file_cache <= 0) {
+        return;
+    }
+
+    /* entries come and go all the time, give them memory of their own */
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&p, pchild, NULL, allocator);
+    apr_allocator_owner_set(allocator, p);
+    apr_pool_tag(p, "fcache");
+
+    fcache = apr_pcalloc(p, sizeof(fcache_t));
+    fcache->pool = p;
+#if APR_HAS_THREADS
+    if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded_mpm) == APR_SUCCESS
+        && threaded_mpm)
+    {
+        apr_thread_mutex_create(&fcache->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    }
+#endif
+    fcache->entries = apr_hash_make(p);
+    APR_RING_INIT(&fcache->lru, fcache_entry, link);
+    fcache->max = conf->open_file_cache;
+    fcache->valid = conf->open_file_cache_valid;
+
+    /* before the entries go */
+    apr_pool_pre_cleanup_register(p, NULL, fcache_cleanup);
+}
+
 static int default_handler(request_rec *r)
 {
     conn_rec *c = r->connection;
@@ -4524,6 +4881,7 @@ static int default_handler(request_rec *r)
     core_dir_config *d;
     int errstatus;
     apr_file_t *fd = NULL;
+    fcache_entry *fe = NULL;
     apr_status_t status;
     /* XXX if/when somebody writes a content-md5 filter we either need to
      *     remove this support or coordinate when to use the filter vs.
@@ -4598,7 +4956,15 @@ static int default_handler(request_rec *r)
         }
 
 
-        if ((status = apr_file_open(&fd, r->filename, APR_READ | APR_BINARY
+        /* ap_md5digest() reads the descriptor, which a cached one can't
+         * be shared for
+         */
+        if (fcache && !bld_content_md5) {
+            fe = fcache_open(r, d, &fd);
+        }
+
+        if (!fe && (status = apr_file_open(&fd, r->filename,
+                                           APR_READ | APR_BINARY
 #if APR_HAS_SENDFILE
                             | AP_SENDFILE_ENABLED(d->enable_sendfile)
 #endif
@@ -4621,9 +4987,20 @@ static int default_handler(request_rec *r)
         bb = apr_brigade_create(r->pool, c->bucket_alloc);
 
         if ((errstatus = ap_meets_conditions(r)) != OK) {
-            apr_file_close(fd);
+            if (fd) {
+                apr_file_close(fd);
+            }
             r->status = errstatus;
         }
+#if APR_HAS_MMAP
+        else if (fe && !fd) {
+            /* the map outlives the request, see fcache_open() */
+            e = apr_bucket_immortal_create(fe->mm->mm,
+                                           (apr_size_t)r->finfo.size,
+                                           c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+        }
+#endif
         else {
             e = apr_brigade_insert_file(bb, fd, 0, r->finfo.size, r->pool);
 
@@ -5034,6 +5411,8 @@ static void core_child_init(apr_pool_t *pchild, server_rec *s)
      */
     proc.pid = getpid();
     apr_random_after_fork(&proc);
+
+    fcache_child_init(pchild, s);
 }
 
 AP_CORE_DECLARE(void) ap_random_parent_after_fork(void)
@@ -5134,6 +5513,9 @@ static apr_status_t core_insert_network_bucket(conn_rec *c,
 static apr_status_t core_dirwalk_stat(apr_finfo_t *finfo, request_rec *r,
                                       apr_int32_t wanted) 
 {
+    if (fcache && wanted == APR_FINFO_MIN) {
+        return fcache_stat(finfo, r, wanted);
+    }
     return apr_stat(finfo, r->filename, wanted, r->pool);
 }
 
@@ -52,8 +52,28 @@
 
 #include "mod_so.h" /* for ap_find_loaded_module_symbol */
 
+#include "apr_portable.h"  /* for apr_os_sock_get */
+#if APR_HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
 #define AP_MIN_SENDFILE_BYTES           (256)
 
+/* Lets the kernel hold back a write until what follows is sent, which
+ * EnableWriteCoalescing uses instead of corking the socket. MSG_MORE may
+ * be an enum constant (glibc), so test for it with #ifdef only.
+ */
+#if defined(MSG_MORE) && !defined(WIN32)
+#define AP_HAVE_SEND_MORE 1
+#define AP_SEND_MORE MSG_MORE
+#else
+#define AP_HAVE_SEND_MORE 0
+#define AP_SEND_MORE 0
+#endif
+
 /**
  * Remove all zero length buckets from the brigade.
  */
@@ -82,6 +102,7 @@ struct core_output_filter_ctx {
     apr_bucket_brigade *tmp_flush_bb;
     apr_pool_t *deferred_write_pool;
     apr_size_t bytes_written;
+    int coalesce;
 };
 
 struct core_filter_ctx {
@@ -335,21 +356,21 @@ static void setaside_remaining_output(ap_filter_t *f,
 
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
-                                             apr_size_t *bytes_written,
+                                             core_output_filter_ctx_t *ctx,
                                              conn_rec *c);
 
 static void remove_empty_buckets(apr_bucket_brigade *bb);
 
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
-                                          apr_size_t *bytes_written,
+                                          core_output_filter_ctx_t *ctx,
                                           conn_rec *c);
 
 static apr_status_t writev_nonblocking(apr_socket_t *s,
                                        struct iovec *vec, apr_size_t nvec,
                                        apr_bucket_brigade *bb,
                                        apr_size_t *cumulative_bytes_written,
-                                       conn_rec *c);
+                                       int flags, conn_rec *c);
 
 #if APR_HAS_SENDFILE
 static apr_status_t sendfile_nonblocking(apr_socket_t *s,
@@ -389,8 +410,13 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
     }
 
     if (ctx == NULL) {
+        core_server_config *sconf =
+            ap_get_core_module_config(c->base_server->module_config);
+
         ctx = apr_pcalloc(c->pool, sizeof(*ctx));
         net->out_ctx = (core_output_filter_ctx_t *)ctx;
+        ctx->coalesce = (sconf->write_coalescing
+                         == AP_WRITE_COALESCING_ENABLE);
         /*
          * Need to create tmp brigade with correct lifetime. Passing
          * NULL to apr_brigade_split_ex would result in a brigade
@@ -466,8 +492,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
      */
 
     if (new_bb == NULL) {
-        rv = send_brigade_nonblocking(net->client_socket, bb,
-                                      &(ctx->bytes_written), c);
+        rv = send_brigade_nonblocking(net->client_socket, bb, ctx, c);
         if (APR_STATUS_IS_EAGAIN(rv)) {
             rv = APR_SUCCESS;
         }
@@ -554,8 +579,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE8, 0, c,
                               "flushing now");
         }
-        rv = send_brigade_blocking(net->client_socket, bb,
-                                   &(ctx->bytes_written), c);
+        rv = send_brigade_blocking(net->client_socket, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             /* The client has aborted the connection */
             ap_log_cerror(APLOG_MARK, APLOG_TRACE1, rv, c,
@@ -581,8 +605,7 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *new_bb)
     }
 
     if (bytes_in_brigade >= THRESHOLD_MIN_WRITE) {
-        rv = send_brigade_nonblocking(net->client_socket, bb,
-                                      &(ctx->bytes_written), c);
+        rv = send_brigade_nonblocking(net->client_socket, bb, ctx, c);
         if ((rv != APR_SUCCESS) && (!APR_STATUS_IS_EAGAIN(rv))) {
             /* The client has aborted the connection */
             ap_log_cerror(APLOG_MARK, APLOG_TRACE1, rv, c,
@@ -637,23 +660,55 @@ static void setaside_remaining_output(ap_filter_t *f,
 
 #ifndef APR_MAX_IOVEC_SIZE
 #define MAX_IOVEC_TO_WRITE 16
+#define MAX_IOVEC_TO_COALESCE 16
 #else
 #if APR_MAX_IOVEC_SIZE > 16
 #define MAX_IOVEC_TO_WRITE 16
 #else
 #define MAX_IOVEC_TO_WRITE APR_MAX_IOVEC_SIZE
 #endif
+#if APR_MAX_IOVEC_SIZE > 64
+#define MAX_IOVEC_TO_COALESCE 64
+#else
+#define MAX_IOVEC_TO_COALESCE APR_MAX_IOVEC_SIZE
+#endif
 #endif
 
+/* Whether some data remains to be sent after bucket @a b */
+static int more_data_follows(apr_bucket_brigade *bb, apr_bucket *b)
+{
+    for (; b != APR_BRIGADE_SENTINEL(bb); b = APR_BUCKET_NEXT(b)) {
+        if (!APR_BUCKET_IS_METADATA(b) && b->length != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Account a write to the network in the scoreboard */
+static APR_INLINE void count_write(conn_rec *c)
+{
+    if (ap_extended_status && c->sbh) {
+        ap_get_scoreboard_worker(c->sbh)->write_count++;
+    }
+}
+
 static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                                              apr_bucket_brigade *bb,
-                                             apr_size_t *bytes_written,
+                                             core_output_filter_ctx_t *ctx,
                                              conn_rec *c)
 {
     apr_bucket *bucket, *next;
     apr_status_t rv;
-    struct iovec vec[MAX_IOVEC_TO_WRITE];
+    struct iovec vec[MAX_IOVEC_TO_COALESCE];
     apr_size_t nvec = 0;
+    apr_size_t *bytes_written = &ctx->bytes_written;
+    /* When coalescing, keep going through the whole brigade rather than
+     * returning after each file or full iovec, and use bigger iovecs.
+     */
+    int coalesce = ctx->coalesce;
+    apr_size_t max_nvec = coalesce ? MAX_IOVEC_TO_COALESCE
+                                   : MAX_IOVEC_TO_WRITE;
 
     remove_empty_buckets(bb);
 
@@ -673,15 +728,31 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
 
             if ((apr_file_flags_get(fd) & APR_SENDFILE_ENABLED) &&
                 (bucket->length >= AP_MIN_SENDFILE_BYTES)) {
-                if (nvec > 0) {
+                apr_size_t file_length = bucket->length;
+                apr_size_t written_before;
+
+                if (nvec > 0 && coalesce && AP_HAVE_SEND_MORE) {
+                    /* The file follows, so this is as good as corking
+                     * minus the setsockopt() calls.
+                     */
+                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                            AP_SEND_MORE, c);
+                    nvec = 0;
+                    if (rv != APR_SUCCESS) {
+                        return rv;
+                    }
+                }
+                else if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 1);
-                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                            0, c);
                     nvec = 0;
                     if (rv != APR_SUCCESS) {
                         (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
                         return rv;
                     }
                 }
+                written_before = *bytes_written;
                 rv = sendfile_nonblocking(s, bucket, bytes_written, c);
                 if (nvec > 0) {
                     (void)apr_socket_opt_set(s, APR_TCP_NOPUSH, 0);
@@ -689,7 +760,12 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
                 if (rv != APR_SUCCESS) {
                     return rv;
                 }
-                break;
+                if (!coalesce || *bytes_written - written_before < file_length) {
+                    break;
+                }
+                /* The whole file went out, carry on with what follows */
+                next = APR_BRIGADE_FIRST(bb);
+                continue;
             }
         }
 #endif /* APR_HAS_SENDFILE */
@@ -704,7 +780,8 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
             if (APR_STATUS_IS_EAGAIN(rv)) {
                 /* Read would block; flush any pending data and retry. */
                 if (nvec) {
-                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+                    rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                            0, c);
                     if (rv) {
                         return rv;
                     }
@@ -722,19 +799,24 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
             vec[nvec].iov_base = (char *)data;
             vec[nvec].iov_len = length;
             nvec++;
-            if (nvec == MAX_IOVEC_TO_WRITE) {
-                rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+            if (nvec == max_nvec) {
+                int more = coalesce && AP_HAVE_SEND_MORE
+                           && more_data_follows(bb, next);
+                rv = writev_nonblocking(s, vec, nvec, bb, bytes_written,
+                                        more ? AP_SEND_MORE : 0, c);
                 nvec = 0;
                 if (rv != APR_SUCCESS) {
                     return rv;
                 }
-                break;
+                if (!coalesce) {
+                    break;
+                }
             }
         }
     }
 
     if (nvec > 0) {
-        rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, c);
+        rv = writev_nonblocking(s, vec, nvec, bb, bytes_written, 0, c);
         if (rv != APR_SUCCESS) {
             return rv;
         }
@@ -756,14 +838,14 @@ static void remove_empty_buckets(apr_bucket_brigade *bb)
 
 static apr_status_t send_brigade_blocking(apr_socket_t *s,
                                           apr_bucket_brigade *bb,
-                                          apr_size_t *bytes_written,
+                                          core_output_filter_ctx_t *ctx,
                                           conn_rec *c)
 {
     apr_status_t rv;
 
     rv = APR_SUCCESS;
     while (!APR_BRIGADE_EMPTY(bb)) {
-        rv = send_brigade_nonblocking(s, bb, bytes_written, c);
+        rv = send_brigade_nonblocking(s, bb, ctx, c);
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EAGAIN(rv)) {
                 /* Wait until we can send more data */
@@ -791,11 +873,39 @@ static apr_status_t send_brigade_blocking(apr_socket_t *s,
     return rv;
 }
 
+/* apr_socket_sendv() with send flags, where the platform has any */
+static apr_status_t sendv_flags(apr_socket_t *s, const struct iovec *vec,
+                                apr_size_t nvec, int flags, apr_size_t *len)
+{
+#if AP_HAVE_SEND_MORE
+    if (flags) {
+        apr_os_sock_t sd;
+        struct msghdr msg;
+        ssize_t rv;
+
+        apr_os_sock_get(&sd, s);
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)vec;
+        msg.msg_iovlen = nvec;
+        do {
+            rv = sendmsg(sd, &msg, flags);
+        } while (rv < 0 && errno == EINTR);
+        if (rv < 0) {
+            *len = 0;
+            return apr_get_netos_error();
+        }
+        *len = rv;
+        return APR_SUCCESS;
+    }
+#endif
+    return apr_socket_sendv(s, vec, nvec, len);
+}
+
 static apr_status_t writev_nonblocking(apr_socket_t *s,
                                        struct iovec *vec, apr_size_t nvec,
                                        apr_bucket_brigade *bb,
                                        apr_size_t *cumulative_bytes_written,
-                                       conn_rec *c)
+                                       int flags, conn_rec *c)
 {
     apr_status_t rv = APR_SUCCESS, arv;
     apr_size_t bytes_written = 0, bytes_to_write = 0;
@@ -817,7 +927,8 @@ static apr_status_t writev_nonblocking(apr_socket_t *s,
     offset = 0;
     while (bytes_written < bytes_to_write) {
         apr_size_t n = 0;
-        rv = apr_socket_sendv(s, vec + offset, nvec - offset, &n);
+        rv = sendv_flags(s, vec + offset, nvec - offset, flags, &n);
+        count_write(c);
         if (n > 0) {
             bytes_written += n;
             for (i = offset; i < nvec; ) {
@@ -896,6 +1007,7 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
             return arv;
         }
         rv = apr_socket_sendfile(s, fd, NULL, &file_offset, &n, 0);
+        count_write(c);
         if (rv == APR_SUCCESS) {
             bytes_written += n;
             file_offset += n;
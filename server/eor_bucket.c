@@ -86,8 +86,22 @@ static void eor_bucket_destroy(void *data)
     request_rec *r = (request_rec *)data;
 
     if (r) {
-        /* eor_bucket_cleanup will be called when the pool gets destroyed */
-        apr_pool_destroy(r->pool);
+        conn_rec *c = r->connection;
+        apr_pool_t *p = r->pool;
+
+        /* eor_bucket_cleanup will be called when the pool gets cleared or
+         * destroyed.  Clearing runs the same cleanups as destroying, so
+         * the pool can be kept for the next request on the connection
+         * (r and c->free_request_pool must not be touched in between,
+         * r lives in the pool).
+         */
+        if (!c->free_request_pool && apr_pool_parent_get(p) == c->pool) {
+            apr_pool_clear(p);
+            c->free_request_pool = p;
+        }
+        else {
+            apr_pool_destroy(p);
+        }
     }
 }
 
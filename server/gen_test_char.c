@@ -52,11 +52,14 @@
 #define T_ESCAPE_LOGITEM      (0x10)
 #define T_ESCAPE_FORENSIC     (0x20)
 #define T_ESCAPE_URLENCODED   (0x40)
+#define T_HTTP_CTRLS          (0x80)
 
 int main(int argc, char *argv[])
 {
-    unsigned c;
+    unsigned c, i, n;
     unsigned char flags;
+    unsigned short token[16], masks[8];
+    unsigned char lo[16], hi[16];
 
     printf("/* this file is automatically generated by gen_test_char, "
            "do not edit */\n"
@@ -67,6 +70,7 @@ int main(int argc, char *argv[])
            "#define T_ESCAPE_LOGITEM       (%u)\n"
            "#define T_ESCAPE_FORENSIC      (%u)\n"
            "#define T_ESCAPE_URLENCODED    (%u)\n"
+           "#define T_HTTP_CTRLS           (%u)\n"
            "\n"
            "static const unsigned char test_char_table[256] = {",
            T_ESCAPE_SHELL_CMD,
@@ -75,8 +79,10 @@ int main(int argc, char *argv[])
            T_HTTP_TOKEN_STOP,
            T_ESCAPE_LOGITEM,
            T_ESCAPE_FORENSIC,
-           T_ESCAPE_URLENCODED);
+           T_ESCAPE_URLENCODED,
+           T_HTTP_CTRLS);
 
+    memset(token, 0, sizeof(token));
     for (c = 0; c < 256; ++c) {
         flags = 0;
         if (c % 20 == 0)
@@ -119,6 +125,16 @@ int main(int argc, char *argv[])
         if (c && (apr_iscntrl(c) || strchr(" \t()<>@,;:\\\"/[]?={}", c))) {
             flags |= T_HTTP_TOKEN_STOP;
         }
+        else if (c) {
+            token[c >> 4] |= 1 << (c & 0xf);
+        }
+
+        /* control characters allowed nowhere in a HTTP message head
+         * (i.e. all but HTAB, with DEL)
+         */
+        if (apr_iscntrl(c) && c != '\t') {
+            flags |= T_HTTP_CTRLS;
+        }
 
         /* For logging, escape all control characters,
          * double quotes (because they delimit the request in the log file)
@@ -142,5 +158,46 @@ int main(int argc, char *argv[])
 
     printf("\n};\n");
 
+    /* The same token characters in a form usable by SIMD byte shuffles:
+     * c is a token character iff (lo[c & 0xf] & hi[c >> 4]) != 0.  Each
+     * distinct set of low nibbles gets its own bit, which works as long as
+     * there are no more than 8 such sets.
+     */
+    memset(lo, 0, sizeof(lo));
+    memset(hi, 0, sizeof(hi));
+    for (c = 0, n = 0; c < 16 && n <= 8; ++c) {
+        if (!token[c]) {
+            continue;
+        }
+        for (i = 0; i < n && masks[i] != token[c]; ++i)
+            ;
+        if (i == n && n++ < 8) {
+            masks[i] = token[c];
+        }
+        hi[c] = 1 << i;
+    }
+    if (n <= 8) {
+        for (i = 0; i < n; ++i) {
+            for (c = 0; c < 16; ++c) {
+                if (masks[i] & (1 << c)) {
+                    lo[c] |= 1 << i;
+                }
+            }
+        }
+        printf("\n#define T_HTTP_TOKEN_NIBBLES   1\n"
+               "#ifdef TEST_CHAR_WANT_NIBBLES\n"
+               "static const unsigned char test_char_token_lo[16] = {");
+        for (c = 0; c < 16; ++c) {
+            printf("%u%c", lo[c], (c < 15) ? ',' : ' ');
+        }
+        printf("};\n"
+               "static const unsigned char test_char_token_hi[16] = {");
+        for (c = 0; c < 16; ++c) {
+            printf("%u%c", hi[c], (c < 15) ? ',' : ' ');
+        }
+        printf("};\n"
+               "#endif\n");
+    }
+
     return 0;
 }
@@ -38,6 +38,10 @@
 #include <systemd/sd-daemon.h>
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
 /* we know core's module_index is 0 */
 #undef APLOG_MODULE_INDEX
 #define APLOG_MODULE_INDEX AP_CORE_MODULE_INDEX
@@ -61,6 +65,10 @@ AP_DECLARE_DATA int ap_have_so_reuseport = -1;
 static ap_listen_rec *old_listeners;
 static int ap_listenbacklog;
 static int ap_listencbratio;
+static int ap_listencbaffinity;
+#define LISTEN_AFFINITY_OFF      0
+#define LISTEN_AFFINITY_ON       1  /* bind children to their bucket's CPUs */
+#define LISTEN_AFFINITY_INCOMING 2  /* and set SO_INCOMING_CPU on its sockets */
 static int send_buffer_size;
 static int receive_buffer_size;
 #ifdef HAVE_SYSTEMD
@@ -763,6 +771,68 @@ AP_DECLARE(int) ap_setup_listeners(server_rec *s)
     return num_listeners;
 }
 
+#ifdef HAVE_SCHED_SETAFFINITY
+/* Fill in @a set with the share of @a bucket among the CPUs this process
+ * may run on, which are split into @a num_buckets consecutive ranges (so
+ * that a bucket's CPUs tend to share caches and NUMA node), and return the
+ * first CPU of the share, or -1 on failure.
+ */
+static int listen_bucket_cpus(int bucket, int num_buckets, cpu_set_t *set)
+{
+    cpu_set_t allowed;
+    int i, n, num_cpus, first, last, first_cpu = -1;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    num_cpus = CPU_COUNT(&allowed);
+    if (num_cpus < 1) {
+        return -1;
+    }
+    if (num_buckets <= num_cpus) {
+        first = bucket * num_cpus / num_buckets;
+        last = (bucket + 1) * num_cpus / num_buckets;
+    }
+    else {
+        first = bucket % num_cpus;
+        last = first + 1;
+    }
+
+    CPU_ZERO(set);
+    for (i = 0, n = 0; i < CPU_SETSIZE && n < last; i++) {
+        if (CPU_ISSET(i, &allowed)) {
+            if (n >= first) {
+                CPU_SET(i, set);
+                if (first_cpu < 0) {
+                    first_cpu = i;
+                }
+            }
+            n++;
+        }
+    }
+
+    return first_cpu;
+}
+#endif
+
+AP_DECLARE(void) ap_listen_bucket_affinity(int bucket)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t set;
+
+    if (ap_listencbaffinity == LISTEN_AFFINITY_OFF
+        || ap_num_listen_buckets < 2) {
+        return;
+    }
+    if (listen_bucket_cpus(bucket, ap_num_listen_buckets, &set) < 0
+        || sched_setaffinity(0, sizeof(set), &set) != 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, errno, ap_server_conf,
+                     APLOGNO(02828) "unable to bind child process to the "
+                     "CPUs of listeners bucket %d", bucket);
+    }
+#endif
+}
+
 AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
                                                 ap_listen_rec ***buckets,
                                                 int *num_buckets)
@@ -865,6 +935,32 @@ AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
         }
     }
 
+#if defined(HAVE_SCHED_SETAFFINITY) && defined(SO_INCOMING_CPU)
+    /* Let the kernel prefer the bucket whose children run on the CPU which
+     * received the connection (eg. steered there by RSS).
+     */
+    if (ap_listencbaffinity == LISTEN_AFFINITY_INCOMING && *num_buckets > 1) {
+        for (i = 0; i < *num_buckets; i++) {
+            cpu_set_t set;
+            int cpu = listen_bucket_cpus(i, *num_buckets, &set);
+            if (cpu < 0) {
+                continue;
+            }
+            for (lr = (*buckets)[i]; lr; lr = lr->next) {
+                int thesock;
+                apr_os_sock_get(&thesock, lr->sd);
+                if (setsockopt(thesock, SOL_SOCKET, SO_INCOMING_CPU,
+                               (void *)&cpu, sizeof(cpu)) == -1) {
+                    ap_log_perror(APLOG_MARK, APLOG_WARNING, errno, p,
+                                  APLOGNO(02829) "ap_duplicate_listeners: "
+                                  "for address %pI, unable to set "
+                                  "SO_INCOMING_CPU", lr->bind_addr);
+                }
+            }
+        }
+    }
+#endif
+
     ap_listen_buckets = *buckets;
     ap_num_listen_buckets = *num_buckets;
     return APR_SUCCESS;
@@ -919,6 +1015,7 @@ AP_DECLARE(void) ap_listen_pre_config(void)
     ap_num_listen_buckets = 0;
     ap_listenbacklog = DEFAULT_LISTENBACKLOG;
     ap_listencbratio = 0;
+    ap_listencbaffinity = LISTEN_AFFINITY_OFF;
 
     /* Check once whether or not SO_REUSEPORT is supported. */
     if (ap_have_so_reuseport < 0) {
@@ -1054,6 +1151,38 @@ AP_DECLARE_NONSTD(const char *) ap_set_listencbratio(cmd_parms *cmd,
     return NULL;
 }
 
+AP_DECLARE_NONSTD(const char *) ap_set_listencbaffinity(cmd_parms *cmd,
+                                                        void *dummy,
+                                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!strcasecmp(arg, "Off")) {
+        ap_listencbaffinity = LISTEN_AFFINITY_OFF;
+        return NULL;
+    }
+#ifdef HAVE_SCHED_SETAFFINITY
+    if (!strcasecmp(arg, "On")) {
+        ap_listencbaffinity = LISTEN_AFFINITY_ON;
+        return NULL;
+    }
+#ifdef SO_INCOMING_CPU
+    if (!strcasecmp(arg, "IncomingCPU")) {
+        ap_listencbaffinity = LISTEN_AFFINITY_INCOMING;
+        return NULL;
+    }
+#endif
+    return "ListenCoresBucketsAffinity must be Off, On or IncomingCPU "
+           "(if supported by the platform)";
+#else
+    return "ListenCoresBucketsAffinity is not supported on this platform";
+#endif
+}
+
 AP_DECLARE_NONSTD(const char *) ap_set_send_buffer_size(cmd_parms *cmd,
                                                         void *dummy,
                                                         const char *arg)
@@ -6,10 +6,29 @@ APACHE_CHECK_SERF
 if test "$ac_cv_serf" = yes ; then
     APR_ADDTO(MOD_MPM_EVENT_LDADD,[\$(SERF_LIBS)])
 fi
+
+AC_ARG_ENABLE(event-uring,APACHE_HELP_STRING(--enable-event-uring,
+  [Use an io_uring based pollset rather than apr_pollset in the event MPM (Linux, requires liburing)]),
+  [
+    if test "$enableval" = "yes"; then
+      AC_CHECK_HEADERS(liburing.h, [
+        AC_CHECK_LIB(uring, io_uring_submit_and_wait_timeout,
+                     [ap_event_uring=yes])
+      ])
+      if test "$ap_event_uring" = "yes"; then
+        AC_DEFINE(HAVE_EVENT_URING, 1,
+                  [Define if the event MPM polls through io_uring])
+        APR_ADDTO(MOD_MPM_EVENT_LDADD,[-luring])
+      else
+        AC_MSG_ERROR([--enable-event-uring requires liburing 2.2 or later])
+      fi
+    fi
+  ])
 APACHE_SUBST(MOD_MPM_EVENT_LDADD)
 
-APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo fdqueue.lo,[
+APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo fdqueue.lo timerwheel.lo uring.lo,[
     AC_CHECK_FUNCS(pthread_kill)
+    AC_CHECK_HEADERS(linux/futex.h)
 ], , [\$(MOD_MPM_EVENT_LDADD)])
 
 APACHE_MPMPATH_FINISH
@@ -95,7 +95,8 @@
 #include "mpm_default.h"
 #include "http_vhost.h"
 #include "unixd.h"
-#include "apr_skiplist.h"
+#include "timerwheel.h"
+#include "uring.h"
 #include "util_time.h"
 
 #include <signal.h>
@@ -192,8 +193,7 @@ static int resource_shortage = 0;
 static fd_queue_t *worker_queue;
 static fd_queue_info_t *worker_queue_info;
 static int mpm_state = AP_MPMQ_STARTING;
-
-static apr_thread_mutex_t *timeout_mutex;
+static int num_listener_threads = 1;
 
 module AP_MODULE_DECLARE_DATA mpm_event_module;
 
@@ -219,6 +219,8 @@ struct event_conn_state_t {
     apr_pollfd_t pfd;
     /** public parts of the connection state */
     conn_state_t pub;
+    /** the listener thread (and pollset) this connection belongs to */
+    struct event_listener_t *l;
 };
 APR_RING_HEAD(timeout_head_t, event_conn_state_t);
 
@@ -227,16 +229,6 @@ struct timeout_queue {
     int count;
     const char *tag;
 };
-/*
- * Several timeout queues that use different timeouts, so that we always can
- * simply append to the end.
- *   write_completion_q uses TimeOut
- *   keepalive_q        uses KeepAliveTimeOut
- *   linger_q           uses MAX_SECS_TO_LINGER
- *   short_linger_q     uses SECONDS_TO_LINGER
- */
-static struct timeout_queue write_completion_q, keepalive_q, linger_q,
-                            short_linger_q;
 static apr_pollfd_t *listener_pollfd;
 
 /*
@@ -266,17 +258,55 @@ static apr_pollfd_t *listener_pollfd;
 /*
  * The pollset for sockets that are in any of the timeout queues. Currently
  * we use the timeout_mutex to make sure that connections are added/removed
- * atomically to/from both event_pollset and a timeout queue. Otherwise
+ * atomically to/from both the pollset and a timeout queue. Otherwise
  * some confusion can happen under high load if timeout queues and pollset
  * get out of sync.
  * XXX: It should be possible to make the lock unnecessary in many or even all
  * XXX: cases.
  */
-static apr_pollset_t *event_pollset;
+#if HAVE_EVENT_URING
+typedef ap_uring_pollset_t event_pollset_t;
+#define event_pollset_add    ap_uring_pollset_add
+#define event_pollset_remove ap_uring_pollset_remove
+#define event_pollset_poll   ap_uring_pollset_poll
+#else
+typedef apr_pollset_t event_pollset_t;
+#define event_pollset_add    apr_pollset_add
+#define event_pollset_remove apr_pollset_remove
+#define event_pollset_poll   apr_pollset_poll
+#endif
+
+/*
+ * Each listener thread (ListenerThreads) polls its own share of the
+ * connections, with its own pollset, timeout_mutex and timeout queues.
+ * Connections are handed to them round-robin when first processed.
+ * The first listener thread also polls the listening sockets and the
+ * user callbacks, and runs the timers.
+ *
+ * Several timeout queues that use different timeouts, so that we always can
+ * simply append to the end.
+ *   write_completion_q uses TimeOut
+ *   keepalive_q        uses KeepAliveTimeOut
+ *   linger_q           uses MAX_SECS_TO_LINGER
+ *   short_linger_q     uses SECONDS_TO_LINGER
+ */
+typedef struct event_listener_t {
+    int num;
+    event_pollset_t *pollset;
+    apr_thread_mutex_t *timeout_mutex;
+    struct timeout_queue write_completion_q, keepalive_q, linger_q,
+                         short_linger_q;
+    apr_thread_t *thread;
+    apr_os_thread_t *os_thread;
+} event_listener_t;
+
+static event_listener_t *listeners;
+static apr_uint32_t next_listener = 0;    /* round-robin for new connections */
+static apr_uint32_t running_listeners = 0;
 
 #if HAVE_SERF
 typedef struct {
-    apr_pollset_t *pollset;
+    event_pollset_t *pollset;
     apr_pool_t *pool;
 } s_baton_t;
 
@@ -401,7 +431,6 @@ static apr_pool_t *pchild;      /* Pool for httpd child stuff */
 static pid_t ap_my_pid;         /* Linux getpid() doesn't work except in main
                                    thread. Use this instead */
 static pid_t parent_pid;
-static apr_os_thread_t *listener_os_thread;
 
 /* The LISTENER_SIGNAL signal will be sent from the main thread to the
  * listener thread to wake it up for graceful termination (what a child
@@ -420,7 +449,7 @@ static void disable_listensocks(int process_slot)
 {
     int i;
     for (i = 0; i < num_listensocks; i++) {
-        apr_pollset_remove(event_pollset, &listener_pollfd[i]);
+        event_pollset_remove(listeners[0].pollset, &listener_pollfd[i]);
     }
     ap_scoreboard_image->parent[process_slot].not_accepting = 1;
 }
@@ -438,7 +467,7 @@ static void enable_listensocks(int process_slot)
                  apr_atomic_read32(&suspended_count),
                  ap_queue_info_get_idlers(worker_queue_info));
     for (i = 0; i < num_listensocks; i++)
-        apr_pollset_add(event_pollset, &listener_pollfd[i]);
+        event_pollset_add(listeners[0].pollset, &listener_pollfd[i]);
     /*
      * XXX: This is not yet optimal. If many workers suddenly become available,
      * XXX: the parent may kill some processes off too soon.
@@ -459,26 +488,32 @@ static void close_worker_sockets(void)
 
 static void wakeup_listener(void)
 {
+    int i;
+
     listener_may_exit = 1;
-    if (!listener_os_thread) {
+    if (!listeners || !listeners[0].os_thread) {
         /* XXX there is an obscure path that this doesn't handle perfectly:
          *     right after listener thread is created but before
-         *     listener_os_thread is set, the first worker thread hits an
+         *     its os_thread is set, the first worker thread hits an
          *     error and starts graceful termination
          */
         return;
     }
 
-    /* unblock the listener if it's waiting for a worker */
+    /* unblock the listeners if they're waiting for a worker */
     ap_queue_info_term(worker_queue_info);
 
     /*
      * we should just be able to "kill(ap_my_pid, LISTENER_SIGNAL)" on all
-     * platforms and wake up the listener thread since it is the only thread
-     * with SIGHUP unblocked, but that doesn't work on Linux
+     * platforms and wake up the listener threads since they are the only
+     * threads with SIGHUP unblocked, but that doesn't work on Linux
      */
 #ifdef HAVE_PTHREAD_KILL
-    pthread_kill(*listener_os_thread, LISTENER_SIGNAL);
+    for (i = 0; i < num_listener_threads; i++) {
+        if (listeners[i].os_thread) {
+            pthread_kill(*listeners[i].os_thread, LISTENER_SIGNAL);
+        }
+    }
 #else
     kill(ap_my_pid, LISTENER_SIGNAL);
 #endif
@@ -849,13 +884,13 @@ static int start_lingering_close_common(event_conn_state_t *cs, int in_worker)
     if (apr_table_get(cs->c->notes, "short-lingering-close")) {
         cs->expiration_time =
             apr_time_now() + apr_time_from_sec(SECONDS_TO_LINGER);
-        q = &short_linger_q;
+        q = &cs->l->short_linger_q;
         cs->pub.state = CONN_STATE_LINGER_SHORT;
     }
     else {
         cs->expiration_time =
             apr_time_now() + apr_time_from_sec(MAX_SECS_TO_LINGER);
-        q = &linger_q;
+        q = &cs->l->linger_q;
         cs->pub.state = CONN_STATE_LINGER_NORMAL;
     }
     apr_atomic_inc32(&lingering_count);
@@ -863,20 +898,20 @@ static int start_lingering_close_common(event_conn_state_t *cs, int in_worker)
     if (in_worker) { 
         notify_suspend(cs);
     }
-    apr_thread_mutex_lock(timeout_mutex);
+    apr_thread_mutex_lock(cs->l->timeout_mutex);
     TO_QUEUE_APPEND(*q, cs);
     cs->pfd.reqevents = (
             cs->pub.sense == CONN_SENSE_WANT_WRITE ? APR_POLLOUT :
                     APR_POLLIN) | APR_POLLHUP | APR_POLLERR;
     cs->pub.sense = CONN_SENSE_DEFAULT;
-    rv = apr_pollset_add(event_pollset, &cs->pfd);
-    apr_thread_mutex_unlock(timeout_mutex);
+    rv = event_pollset_add(cs->l->pollset, &cs->pfd);
+    apr_thread_mutex_unlock(cs->l->timeout_mutex);
     if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
                      "start_lingering_close: apr_pollset_add failure");
-        apr_thread_mutex_lock(timeout_mutex);
+        apr_thread_mutex_lock(cs->l->timeout_mutex);
         TO_QUEUE_REMOVE(*q, cs);
-        apr_thread_mutex_unlock(timeout_mutex);
+        apr_thread_mutex_unlock(cs->l->timeout_mutex);
         apr_socket_close(cs->pfd.desc.s);
         ap_push_pool(worker_queue_info, cs->p);
         return 0;
@@ -1027,6 +1062,8 @@ static void process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * soc
         pt->type = PT_CSD;
         pt->baton = cs;
         cs->pfd.client_data = pt;
+        cs->l = &listeners[apr_atomic_inc32(&next_listener)
+                           % num_listener_threads];
         apr_pool_pre_cleanup_register(p, cs, ptrans_pre_cleanup);
         TO_QUEUE_ELEM_INIT(cs);
 
@@ -1114,14 +1151,14 @@ read_request:
             cs->expiration_time = ap_server_conf->timeout + apr_time_now();
             c->sbh = NULL;
             notify_suspend(cs);
-            apr_thread_mutex_lock(timeout_mutex);
-            TO_QUEUE_APPEND(write_completion_q, cs);
+            apr_thread_mutex_lock(cs->l->timeout_mutex);
+            TO_QUEUE_APPEND(cs->l->write_completion_q, cs);
             cs->pfd.reqevents = (
                     cs->pub.sense == CONN_SENSE_WANT_READ ? APR_POLLIN :
                             APR_POLLOUT) | APR_POLLHUP | APR_POLLERR;
             cs->pub.sense = CONN_SENSE_DEFAULT;
-            rc = apr_pollset_add(event_pollset, &cs->pfd);
-            apr_thread_mutex_unlock(timeout_mutex);
+            rc = event_pollset_add(cs->l->pollset, &cs->pfd);
+            apr_thread_mutex_unlock(cs->l->timeout_mutex);
             return;
         }
         else if (c->keepalive != AP_CONN_KEEPALIVE || c->aborted ||
@@ -1153,13 +1190,13 @@ read_request:
                               apr_time_now();
         c->sbh = NULL;
         notify_suspend(cs);
-        apr_thread_mutex_lock(timeout_mutex);
-        TO_QUEUE_APPEND(keepalive_q, cs);
+        apr_thread_mutex_lock(cs->l->timeout_mutex);
+        TO_QUEUE_APPEND(cs->l->keepalive_q, cs);
 
         /* Add work to pollset. */
         cs->pfd.reqevents = APR_POLLIN;
-        rc = apr_pollset_add(event_pollset, &cs->pfd);
-        apr_thread_mutex_unlock(timeout_mutex);
+        rc = event_pollset_add(cs->l->pollset, &cs->pfd);
+        apr_thread_mutex_unlock(cs->l->timeout_mutex);
 
         if (rc != APR_SUCCESS) {
             ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
@@ -1190,14 +1227,14 @@ static apr_status_t event_resume_suspended (conn_rec *c) {
     apr_atomic_dec32(&suspended_count);
     c->suspended_baton = NULL;
 
-    apr_thread_mutex_lock(timeout_mutex);
-    TO_QUEUE_APPEND(write_completion_q, cs);
+    apr_thread_mutex_lock(cs->l->timeout_mutex);
+    TO_QUEUE_APPEND(cs->l->write_completion_q, cs);
     cs->pfd.reqevents = (
             cs->pub.sense == CONN_SENSE_WANT_READ ? APR_POLLIN :
                     APR_POLLOUT) | APR_POLLHUP | APR_POLLERR;
     cs->pub.sense = CONN_SENSE_DEFAULT;
-    apr_pollset_add(event_pollset, &cs->pfd);
-    apr_thread_mutex_unlock(timeout_mutex);
+    event_pollset_add(cs->l->pollset, &cs->pfd);
+    apr_thread_mutex_unlock(cs->l->timeout_mutex);
 
     return OK;
 }
@@ -1268,7 +1305,7 @@ static apr_status_t s_socket_add(void *user_baton,
     pt->type = PT_SERF;
     pt->baton = serf_baton;
     pfd->client_data = pt;
-    return apr_pollset_add(s->pollset, pfd);
+    return event_pollset_add(s->pollset, pfd);
 }
 
 static apr_status_t s_socket_remove(void *user_baton,
@@ -1278,7 +1315,7 @@ static apr_status_t s_socket_remove(void *user_baton,
     s_baton_t *s = (s_baton_t*)user_baton;
     listener_poll_type *pt = pfd->client_data;
     free(pt);
-    return apr_pollset_remove(s->pollset, pfd);
+    return event_pollset_remove(s->pollset, pfd);
 }
 #endif
 
@@ -1291,11 +1328,6 @@ static apr_status_t init_pollset(apr_pool_t *p)
     listener_poll_type *pt;
     int i = 0;
 
-    TO_QUEUE_INIT(write_completion_q);
-    TO_QUEUE_INIT(keepalive_q);
-    TO_QUEUE_INIT(linger_q);
-    TO_QUEUE_INIT(short_linger_q);
-
     listener_pollfd = apr_palloc(p, sizeof(apr_pollfd_t) * num_listensocks);
     for (lr = my_bucket->listeners; lr != NULL; lr = lr->next, i++) {
         apr_pollfd_t *pfd;
@@ -1312,14 +1344,14 @@ static apr_status_t init_pollset(apr_pool_t *p)
         pfd->client_data = pt;
 
         apr_socket_opt_set(pfd->desc.s, APR_SO_NONBLOCK, 1);
-        apr_pollset_add(event_pollset, pfd);
+        event_pollset_add(listeners[0].pollset, pfd);
 
         lr->accept_func = ap_unixd_accept;
     }
 
 #if HAVE_SERF
     baton = apr_pcalloc(p, sizeof(*baton));
-    baton->pollset = event_pollset;
+    baton->pollset = listeners[0].pollset;
     /* TODO: subpools, threads, reuse, etc.  -- currently use malloc() inside :( */
     baton->pool = p;
 
@@ -1345,7 +1377,7 @@ static apr_status_t push_timer2worker(timer_event_t* te)
  * this function may only be called by the listener
  */
 static apr_status_t push2worker(const apr_pollfd_t * pfd,
-                                apr_pollset_t * pollset)
+                                event_pollset_t * pollset)
 {
     listener_poll_type *pt = (listener_poll_type *) pfd->client_data;
     event_conn_state_t *cs = (event_conn_state_t *) pt->baton;
@@ -1406,28 +1438,18 @@ static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
 }
 
 /* Structures to reuse */
-static APR_RING_HEAD(timer_free_ring_t, timer_event_t) timer_free_ring;
-
-static apr_skiplist *timer_skiplist;
-
-static int indexing_comp(void *a, void *b)
-{
-    apr_time_t t1 = (apr_time_t) (((timer_event_t *) a)->when);
-    apr_time_t t2 = (apr_time_t) (((timer_event_t *) b)->when);
-    AP_DEBUG_ASSERT(t1);
-    AP_DEBUG_ASSERT(t2);
-    return ((t1 < t2) ? -1 : ((t1 > t2) ? 1 : 0));
-}
+static struct timer_ring_t timer_free_ring;
 
-static int indexing_compk(void *ac, void *b)
-{
-    apr_time_t *t1 = (apr_time_t *) ac;
-    apr_time_t t2 = (apr_time_t) (((timer_event_t *) b)->when);
-    AP_DEBUG_ASSERT(t2);
-    return ((*t1 < t2) ? -1 : ((*t1 > t2) ? 1 : 0));
-}
+/*
+ * Pending timers live in a timer wheel owned by the listener thread.
+ * Other threads only push to its lock-free pending stack, so the
+ * g_timer_free_mtx below just protects the free ring and the pool the
+ * timer events are allocated from.
+ */
+static ap_timer_wheel_t *timer_wheel;
 
-static apr_thread_mutex_t *g_timer_skiplist_mtx;
+static apr_pool_t *ptimers;
+static apr_thread_mutex_t *g_timer_free_mtx;
 
 static timer_event_t * event_get_timer_event(apr_time_t t,
                                              ap_mpm_callback_fn_t *cbfn,
@@ -1436,30 +1458,29 @@ static timer_event_t * event_get_timer_event(apr_time_t t,
                                              apr_pollfd_t **remove)
 {
     timer_event_t *te;
-    /* oh yeah, and make locking smarter/fine grained. */
-
-    apr_thread_mutex_lock(g_timer_skiplist_mtx);
 
+    apr_thread_mutex_lock(g_timer_free_mtx);
     if (!APR_RING_EMPTY(&timer_free_ring, timer_event_t, link)) {
         te = APR_RING_FIRST(&timer_free_ring);
         APR_RING_REMOVE(te, link);
     }
     else {
-        te = apr_skiplist_alloc(timer_skiplist, sizeof(timer_event_t));
+        te = apr_palloc(ptimers, sizeof(timer_event_t));
         APR_RING_ELEM_INIT(te, link);
     }
+    apr_thread_mutex_unlock(g_timer_free_mtx);
 
     te->cbfunc = cbfn;
     te->baton = baton;
     te->canceled = 0;
     te->when = t;
     te->remove = remove;
+    te->pending_next = NULL;
 
     if (insert) { 
-        /* Okay, insert sorted by when.. */
-        apr_skiplist_insert(timer_skiplist, (void *)te);
+        /* The listener files it by expiry on its next iteration */
+        ap_timer_wheel_push(timer_wheel, te);
     }
-    apr_thread_mutex_unlock(g_timer_skiplist_mtx);
 
     return te;
 }
@@ -1524,7 +1545,7 @@ static apr_status_t event_register_socket_callback_ex(apr_socket_t **s,
         scb->cancel_event = event_get_timer_event(timeout + apr_time_now(), tofn, baton, 1, pfds);
     }
     for (i = 0; i<nsock; i++) { 
-        rc = apr_pollset_add(event_pollset, pfds[i]);
+        rc = event_pollset_add(listeners[0].pollset, pfds[i]);
         if (rc != APR_SUCCESS) final_rc = rc;
     }
     return final_rc;
@@ -1561,7 +1582,7 @@ static apr_status_t event_unregister_socket_callback(apr_socket_t **s, apr_pool_
         pfds[i]->reqevents = APR_POLLERR | APR_POLLHUP;
         pfds[i]->desc.s = s[i];
         pfds[i]->client_data = NULL;
-        rc = apr_pollset_remove(event_pollset, pfds[i]);
+        rc = event_pollset_remove(listeners[0].pollset, pfds[i]);
         if (rc != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rc)) final_rc = APR_SUCCESS;
     }
 
@@ -1581,7 +1602,8 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
     apr_size_t nbytes;
     apr_status_t rv;
     struct timeout_queue *q;
-    q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ?  &short_linger_q : &linger_q;
+    q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ? &cs->l->short_linger_q
+                                                    : &cs->l->linger_q;
 
     /* socket is already in non-blocking state */
     do {
@@ -1593,25 +1615,26 @@ static void process_lingering_close(event_conn_state_t *cs, const apr_pollfd_t *
         return;
     }
 
-    apr_thread_mutex_lock(timeout_mutex);
-    rv = apr_pollset_remove(event_pollset, pfd);
+    apr_thread_mutex_lock(cs->l->timeout_mutex);
+    rv = event_pollset_remove(cs->l->pollset, pfd);
     AP_DEBUG_ASSERT(rv == APR_SUCCESS);
 
     rv = apr_socket_close(csd);
     AP_DEBUG_ASSERT(rv == APR_SUCCESS);
 
     TO_QUEUE_REMOVE(*q, cs);
-    apr_thread_mutex_unlock(timeout_mutex);
+    apr_thread_mutex_unlock(cs->l->timeout_mutex);
     TO_QUEUE_ELEM_INIT(cs);
 
     ap_push_pool(worker_queue_info, cs->p);
 }
 
 /* call 'func' for all elements of 'q' with timeout less than 'timeout_time'.
- * Pre-condition: timeout_mutex must already be locked
- * Post-condition: timeout_mutex will be locked again
+ * Pre-condition: l->timeout_mutex must already be locked
+ * Post-condition: l->timeout_mutex will be locked again
  */
-static void process_timeout_queue(struct timeout_queue *q,
+static void process_timeout_queue(event_listener_t *l,
+                                  struct timeout_queue *q,
                                   apr_time_t timeout_time,
                                   int (*func)(event_conn_state_t *))
 {
@@ -1627,7 +1650,7 @@ static void process_timeout_queue(struct timeout_queue *q,
     while (cs != APR_RING_SENTINEL(&q->head, event_conn_state_t, timeout_list)
            && cs->expiration_time < timeout_time) {
         last = cs;
-        rv = apr_pollset_remove(event_pollset, &cs->pfd);
+        rv = event_pollset_remove(l->pollset, &cs->pfd);
         if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
             ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, cs->c, APLOGNO(00473)
                           "apr_pollset_remove failed");
@@ -1641,7 +1664,7 @@ static void process_timeout_queue(struct timeout_queue *q,
     APR_RING_UNSPLICE(first, last, timeout_list);
     AP_DEBUG_ASSERT(q->count >= count);
     q->count -= count;
-    apr_thread_mutex_unlock(timeout_mutex);
+    apr_thread_mutex_unlock(l->timeout_mutex);
     while (count) {
         cs = APR_RING_NEXT(first, timeout_list);
         TO_QUEUE_ELEM_INIT(first);
@@ -1649,7 +1672,7 @@ static void process_timeout_queue(struct timeout_queue *q,
         first = cs;
         count--;
     }
-    apr_thread_mutex_lock(timeout_mutex);
+    apr_thread_mutex_lock(l->timeout_mutex);
 }
 
 static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
@@ -1657,10 +1680,12 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
     apr_status_t rc;
     proc_info *ti = dummy;
     int process_slot = ti->pid;
+    event_listener_t *l = &listeners[ti->sd];
     apr_pool_t *tpool = apr_thread_pool_get(thd);
     apr_time_t timeout_time = 0, last_log;
     int closed = 0, listeners_disabled = 0;
     int have_idle_worker = 0;
+    int n;
 
     last_log = apr_time_now();
     free(ti);
@@ -1673,13 +1698,16 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 #define TIMEOUT_FUDGE_FACTOR 100000
 #define EVENT_FUDGE_FACTOR 10000
 
-    rc = init_pollset(tpool);
-    if (rc != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
-                     "failed to initialize pollset, "
-                     "attempting to shutdown process gracefully");
-        signal_threads(ST_GRACEFUL);
-        return NULL;
+    /* Only the first listener accepts connections */
+    if (l->num == 0) {
+        rc = init_pollset(tpool);
+        if (rc != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
+                         "failed to initialize pollset, "
+                         "attempting to shutdown process gracefully");
+            signal_threads(ST_GRACEFUL);
+            goto out;
+        }
     }
 
     /* Unblock the signal used to wake this thread up, and set a handler for
@@ -1690,6 +1718,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 
     for (;;) {
         timer_event_t *te;
+        struct timer_ring_t expired_ring, canceled_ring;
         const apr_pollfd_t *out_pfd;
         apr_int32_t num = 0;
         apr_uint32_t c_count, l_count, i_count;
@@ -1697,13 +1726,15 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         apr_time_t now;
         int workers_were_busy = 0;
         if (listener_may_exit) {
-            close_listeners(process_slot, &closed);
+            if (l->num == 0) {
+                close_listeners(process_slot, &closed);
+            }
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
                 break;
         }
 
-        if (conns_this_child <= 0)
+        if (l->num == 0 && conns_this_child <= 0)
             check_infinite_requests();
 
         if (APLOGtrace6(ap_server_conf)) {
@@ -1711,66 +1742,68 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             /* trace log status every second */
             if (now - last_log > apr_time_from_msec(1000)) {
                 last_log = now;
-                apr_thread_mutex_lock(timeout_mutex);
+                apr_thread_mutex_lock(l->timeout_mutex);
                 ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf,
-                             "connections: %u (clogged: %u write-completion: %d "
-                             "keep-alive: %d lingering: %d suspended: %u)",
+                             "listener %d: connections: %u (clogged: %u "
+                             "write-completion: %d keep-alive: %d "
+                             "lingering: %d suspended: %u)",
+                             l->num,
                              apr_atomic_read32(&connection_count),
                              apr_atomic_read32(&clogged_count),
-                             write_completion_q.count,
-                             keepalive_q.count,
+                             l->write_completion_q.count,
+                             l->keepalive_q.count,
                              apr_atomic_read32(&lingering_count),
                              apr_atomic_read32(&suspended_count));
-                apr_thread_mutex_unlock(timeout_mutex);
+                apr_thread_mutex_unlock(l->timeout_mutex);
             }
         }
 
+        /* The timers and user callbacks belong to the first listener,
+         * the others only wait for their connections' timeouts
+         */
+        timeout_interval = apr_time_from_msec(100);
+        if (l->num == 0) {
 #if HAVE_SERF
-        rc = serf_context_prerun(g_serf);
-        if (rc != APR_SUCCESS) {
-            /* TOOD: what should do here? ugh. */
-        }
+            rc = serf_context_prerun(g_serf);
+            if (rc != APR_SUCCESS) {
+                /* TOOD: what should do here? ugh. */
+            }
 #endif
 
-        now = apr_time_now();
-        apr_thread_mutex_lock(g_timer_skiplist_mtx);
-        te = apr_skiplist_peek(timer_skiplist);
-        if (te) {
-            if (te->when > now) {
-                timeout_interval = te->when - now;
-            }
-            else {
-                timeout_interval = 1;
-            }
-        }
-        else {
-            timeout_interval = apr_time_from_msec(100);
-        }
-        while (te) {
-            if (te->when < now + EVENT_FUDGE_FACTOR) {
-                apr_skiplist_pop(timer_skiplist, NULL);
+            now = apr_time_now();
+            APR_RING_INIT(&expired_ring, timer_event_t, link);
+            APR_RING_INIT(&canceled_ring, timer_event_t, link);
+            ap_timer_wheel_expire(timer_wheel, now + EVENT_FUDGE_FACTOR,
+                                  &expired_ring);
+            timeout_interval =
+                ap_timer_wheel_next_timeout(timer_wheel,
+                                            now + EVENT_FUDGE_FACTOR,
+                                            timeout_interval);
+            while (!APR_RING_EMPTY(&expired_ring, timer_event_t, link)) {
+                te = APR_RING_FIRST(&expired_ring);
+                APR_RING_REMOVE(te, link);
                 if (!te->canceled) { 
                     if (te->remove != NULL) {
                         apr_pollfd_t **pfds;
                         for (pfds = (te->remove); *pfds != NULL; pfds++) { 
-                            apr_pollset_remove(event_pollset, *pfds);
+                            event_pollset_remove(l->pollset, *pfds);
                         }
                     }
                     push_timer2worker(te);
                 }
                 else {
-                    APR_RING_INSERT_TAIL(&timer_free_ring, te, timer_event_t,
-                                         link);
+                    APR_RING_INSERT_TAIL(&canceled_ring, te, timer_event_t, link);
                 }
             }
-            else {
-                break;
+            if (!APR_RING_EMPTY(&canceled_ring, timer_event_t, link)) {
+                apr_thread_mutex_lock(g_timer_free_mtx);
+                APR_RING_CONCAT(&timer_free_ring, &canceled_ring, timer_event_t,
+                                link);
+                apr_thread_mutex_unlock(g_timer_free_mtx);
             }
-            te = apr_skiplist_peek(timer_skiplist);
         }
-        apr_thread_mutex_unlock(g_timer_skiplist_mtx);
 
-        rc = apr_pollset_poll(event_pollset, timeout_interval, &num, &out_pfd);
+        rc = event_pollset_poll(l->pollset, timeout_interval, &num, &out_pfd);
         if (rc != APR_SUCCESS) {
             if (APR_STATUS_IS_EINTR(rc)) {
                 continue;
@@ -1784,7 +1817,9 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         }
 
         if (listener_may_exit) {
-            close_listeners(process_slot, &closed);
+            if (l->num == 0) {
+                close_listeners(process_slot, &closed);
+            }
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
                 break;
@@ -1794,22 +1829,22 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             listener_poll_type *pt = (listener_poll_type *) out_pfd->client_data;
             if (pt->type == PT_CSD) {
                 /* one of the sockets is readable */
-                struct timeout_queue *remove_from_q = &write_completion_q;
+                struct timeout_queue *remove_from_q = &l->write_completion_q;
                 int blocking = 1;
                 event_conn_state_t *cs = (event_conn_state_t *) pt->baton;
                 switch (cs->pub.state) {
                 case CONN_STATE_CHECK_REQUEST_LINE_READABLE:
                     cs->pub.state = CONN_STATE_READ_REQUEST_LINE;
-                    remove_from_q = &keepalive_q;
+                    remove_from_q = &l->keepalive_q;
                     /* don't wait for a worker for a keepalive request */
                     blocking = 0;
                     /* FALL THROUGH */
                 case CONN_STATE_WRITE_COMPLETION:
                     get_worker(&have_idle_worker, blocking,
                                &workers_were_busy);
-                    apr_thread_mutex_lock(timeout_mutex);
+                    apr_thread_mutex_lock(l->timeout_mutex);
                     TO_QUEUE_REMOVE(*remove_from_q, cs);
-                    rc = apr_pollset_remove(event_pollset, &cs->pfd);
+                    rc = event_pollset_remove(l->pollset, &cs->pfd);
 
                     /*
                      * Some of the pollset backends, like KQueue or Epoll
@@ -1820,12 +1855,12 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     if (rc != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rc)) {
                         ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
                                      "pollset remove failed");
-                        apr_thread_mutex_unlock(timeout_mutex);
+                        apr_thread_mutex_unlock(l->timeout_mutex);
                         start_lingering_close_nonblocking(cs);
                         break;
                     }
 
-                    apr_thread_mutex_unlock(timeout_mutex);
+                    apr_thread_mutex_unlock(l->timeout_mutex);
                     TO_QUEUE_ELEM_INIT(cs);
                     /* If we didn't get a worker immediately for a keep-alive
                      * request, we close the connection, so that the client can
@@ -1835,7 +1870,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                         start_lingering_close_nonblocking(cs);
                         break;
                     }
-                    rc = push2worker(out_pfd, event_pollset);
+                    rc = push2worker(out_pfd, l->pollset);
                     if (rc != APR_SUCCESS) {
                         ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
                                      ap_server_conf, "push2worker failed");
@@ -1910,6 +1945,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                             signal_threads(ST_GRACEFUL);
                             return NULL;
                         }
+                        ap_scoreboard_image->parent[process_slot].pool_count++;
                     }
                     apr_pool_tag(ptrans, "transaction");
 
@@ -1929,6 +1965,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 
                     if (csd != NULL) {
                         conns_this_child--;
+                        ap_scoreboard_image->parent[process_slot].accept_count++;
                         rc = ap_queue_push(worker_queue, csd, NULL, ptrans);
                         if (rc != APR_SUCCESS) {
                             /* trash the connection; we couldn't queue the connected
@@ -1975,7 +2012,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                                                NULL /* no associated socket callback */);
                     /* remove all sockets in my set */
                     for (i = 0; i < baton->nsock; i++) { 
-                        apr_pollset_remove(event_pollset, baton->pfds[i]); 
+                        event_pollset_remove(l->pollset, baton->pfds[i]); 
                     }
 
                     push_timer2worker(te);
@@ -1995,41 +2032,52 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             timeout_time = now + TIMEOUT_FUDGE_FACTOR;
 
             /* handle timed out sockets */
-            apr_thread_mutex_lock(timeout_mutex);
+            apr_thread_mutex_lock(l->timeout_mutex);
 
             /* Step 1: keepalive timeouts */
             /* If all workers are busy, we kill older keep-alive connections so that they
              * may connect to another process.
              */
-            if (workers_were_busy && keepalive_q.count) {
+            if (workers_were_busy && l->keepalive_q.count) {
                 ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
                              "All workers are busy, will close %d keep-alive "
                              "connections",
-                             keepalive_q.count);
-                process_timeout_queue(&keepalive_q,
+                             l->keepalive_q.count);
+                process_timeout_queue(l, &l->keepalive_q,
                                       timeout_time + ap_server_conf->keep_alive_timeout,
                                       start_lingering_close_nonblocking);
             }
             else {
-                process_timeout_queue(&keepalive_q, timeout_time,
+                process_timeout_queue(l, &l->keepalive_q, timeout_time,
                                       start_lingering_close_nonblocking);
             }
             /* Step 2: write completion timeouts */
-            process_timeout_queue(&write_completion_q, timeout_time,
+            process_timeout_queue(l, &l->write_completion_q, timeout_time,
                                   start_lingering_close_nonblocking);
             /* Step 3: (normal) lingering close completion timeouts */
-            process_timeout_queue(&linger_q, timeout_time, stop_lingering_close);
+            process_timeout_queue(l, &l->linger_q, timeout_time,
+                                  stop_lingering_close);
             /* Step 4: (short) lingering close completion timeouts */
-            process_timeout_queue(&short_linger_q, timeout_time, stop_lingering_close);
-
-            ps = ap_get_scoreboard_process(process_slot);
-            ps->write_completion = write_completion_q.count;
-            ps->keep_alive = keepalive_q.count;
-            apr_thread_mutex_unlock(timeout_mutex);
+            process_timeout_queue(l, &l->short_linger_q, timeout_time,
+                                  stop_lingering_close);
+            apr_thread_mutex_unlock(l->timeout_mutex);
 
-            ps->connections = apr_atomic_read32(&connection_count);
-            ps->suspended = apr_atomic_read32(&suspended_count);
-            ps->lingering_close = apr_atomic_read32(&lingering_count);
+            /* The first listener reports for all of them, the other
+             * queues' counts are read unlocked, they are only a hint.
+             */
+            if (l->num == 0) {
+                int write_completion = 0, keep_alive = 0;
+                for (n = 0; n < num_listener_threads; n++) {
+                    write_completion += listeners[n].write_completion_q.count;
+                    keep_alive += listeners[n].keepalive_q.count;
+                }
+                ps = ap_get_scoreboard_process(process_slot);
+                ps->write_completion = write_completion;
+                ps->keep_alive = keep_alive;
+                ps->connections = apr_atomic_read32(&connection_count);
+                ps->suspended = apr_atomic_read32(&suspended_count);
+                ps->lingering_close = apr_atomic_read32(&lingering_count);
+            }
         }
         if (listeners_disabled && !workers_were_busy
             && ((c_count = apr_atomic_read32(&connection_count))
@@ -2048,8 +2096,15 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
          */
     }     /* listener main loop */
 
-    close_listeners(process_slot, &closed);
-    ap_queue_term(worker_queue);
+    if (l->num == 0) {
+        close_listeners(process_slot, &closed);
+    }
+
+out:
+    /* The last listener out lets the workers go */
+    if (!apr_atomic_dec32(&running_listeners)) {
+        ap_queue_term(worker_queue);
+    }
 
     apr_thread_exit(thd, APR_SUCCESS);
     return NULL;
@@ -2136,9 +2191,9 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
         if (te != NULL) {
             te->cbfunc(te->baton);
             {
-                apr_thread_mutex_lock(g_timer_skiplist_mtx);
+                apr_thread_mutex_lock(g_timer_free_mtx);
                 APR_RING_INSERT_TAIL(&timer_free_ring, te, timer_event_t, link);
-                apr_thread_mutex_unlock(g_timer_skiplist_mtx);
+                apr_thread_mutex_unlock(g_timer_free_mtx);
             }
         }
         else {
@@ -2170,26 +2225,33 @@ static int check_signal(int signum)
 
 
 
-static void create_listener_thread(thread_starter * ts)
+static void create_listener_threads(thread_starter * ts)
 {
     int my_child_num = ts->child_num_arg;
     apr_threadattr_t *thread_attr = ts->threadattr;
     proc_info *my_info;
     apr_status_t rv;
+    int i;
 
-    my_info = (proc_info *) ap_malloc(sizeof(proc_info));
-    my_info->pid = my_child_num;
-    my_info->tid = -1;          /* listener thread doesn't have a thread slot */
-    my_info->sd = 0;
-    rv = apr_thread_create(&ts->listener, thread_attr, listener_thread,
-                           my_info, pchild);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(00474)
-                     "apr_thread_create: unable to create listener thread");
-        /* let the parent decide how bad this really is */
-        clean_child_exit(APEXIT_CHILDSICK);
+    running_listeners = num_listener_threads;
+    for (i = 0; i < num_listener_threads; i++) {
+        event_listener_t *l = &listeners[i];
+
+        my_info = (proc_info *) ap_malloc(sizeof(proc_info));
+        my_info->pid = my_child_num;
+        my_info->tid = -1;      /* listener thread doesn't have a thread slot */
+        my_info->sd = i;        /* but a share of the connections */
+        rv = apr_thread_create(&l->thread, thread_attr, listener_thread,
+                               my_info, pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(00474)
+                         "apr_thread_create: unable to create listener thread");
+            /* let the parent decide how bad this really is */
+            clean_child_exit(APEXIT_CHILDSICK);
+        }
+        apr_os_thread_get(&l->os_thread, l->thread);
     }
-    apr_os_thread_get(&listener_os_thread, ts->listener);
+    ts->listener = listeners[0].thread;
 }
 
 /* XXX under some circumstances not understood, children can get stuck
@@ -2206,13 +2268,15 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
     int my_child_num = child_num_arg;
     proc_info *my_info;
     apr_status_t rv;
-    int i;
+    int i, n;
     int threads_created = 0;
     int listener_started = 0;
     int loops;
     int prev_threads_created;
     int max_recycled_pools = -1;
+#if !HAVE_EVENT_URING
     int good_methods[] = {APR_POLLSET_KQUEUE, APR_POLLSET_PORT, APR_POLLSET_EPOLL};
+#endif
 
     /* We must create the fd queues before we start up the listener
      * and worker threads. */
@@ -2239,46 +2303,74 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    /* Create the timeout mutex and main pollset before the listener
-     * thread starts.
+    /* Create the timeout mutexes and pollsets before the listener
+     * threads start.
      */
-    rv = apr_thread_mutex_create(&timeout_mutex, APR_THREAD_MUTEX_DEFAULT,
-                                 pchild);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
-                     "creation of the timeout mutex failed.");
-        clean_child_exit(APEXIT_CHILDFATAL);
-    }
+    listeners = apr_pcalloc(pchild, num_listener_threads * sizeof(*listeners));
+    for (n = 0; n < num_listener_threads; n++) {
+        event_listener_t *l = &listeners[n];
+
+        l->num = n;
+        TO_QUEUE_INIT(l->write_completion_q);
+        TO_QUEUE_INIT(l->keepalive_q);
+        TO_QUEUE_INIT(l->linger_q);
+        TO_QUEUE_INIT(l->short_linger_q);
+
+        rv = apr_thread_mutex_create(&l->timeout_mutex,
+                                     APR_THREAD_MUTEX_DEFAULT, pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                         "creation of the timeout mutex failed.");
+            clean_child_exit(APEXIT_CHILDFATAL);
+        }
 
-    /* Create the main pollset */
-    for (i = 0; i < sizeof(good_methods) / sizeof(void*); i++) {
-        rv = apr_pollset_create_ex(&event_pollset,
-                            threads_per_child*2, /* XXX don't we need more, to handle
-                                                * connections in K-A or lingering
-                                                * close?
-                                                */
-                            pchild, APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY | APR_POLLSET_NODEFAULT,
-                            good_methods[i]);
-        if (rv == APR_SUCCESS) {
-            break;
+#if HAVE_EVENT_URING
+        rv = ap_uring_pollset_create(&l->pollset, threads_per_child*2, pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(02825)
+                         "creation of the io_uring pollset failed "
+                         "(Linux 5.11 or later is required)");
+            clean_child_exit(APEXIT_CHILDFATAL);
         }
-    }
-    if (rv != APR_SUCCESS) {
-        rv = apr_pollset_create(&event_pollset,
-                               threads_per_child*2, /* XXX don't we need more, to handle
-                                                     * connections in K-A or lingering
-                                                     * close?
-                                                     */
-                               pchild, APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
-    }
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
-                     "apr_pollset_create with Thread Safety failed.");
-        clean_child_exit(APEXIT_CHILDFATAL);
+#else
+        for (i = 0; i < sizeof(good_methods) / sizeof(void*); i++) {
+            rv = apr_pollset_create_ex(&l->pollset,
+                                threads_per_child*2, /* XXX don't we need more, to handle
+                                                    * connections in K-A or lingering
+                                                    * close?
+                                                    */
+                                pchild, APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY | APR_POLLSET_NODEFAULT,
+                                good_methods[i]);
+            if (rv == APR_SUCCESS) {
+                break;
+            }
+        }
+        if (rv != APR_SUCCESS) {
+            rv = apr_pollset_create(&l->pollset,
+                                   threads_per_child*2, /* XXX don't we need more, to handle
+                                                         * connections in K-A or lingering
+                                                         * close?
+                                                         */
+                                   pchild, APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                         "apr_pollset_create with Thread Safety failed.");
+            clean_child_exit(APEXIT_CHILDFATAL);
+        }
+#endif
     }
 
+#if HAVE_EVENT_URING
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02471)
+                 "start_threads: Using io_uring, %d listener thread(s)",
+                 num_listener_threads);
+#else
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02471)
-                 "start_threads: Using %s", apr_pollset_method_name(event_pollset));
+                 "start_threads: Using %s, %d listener thread(s)",
+                 apr_pollset_method_name(listeners[0].pollset),
+                 num_listener_threads);
+#endif
     worker_sockets = apr_pcalloc(pchild, threads_per_child
                                  * sizeof(apr_socket_t *));
 
@@ -2317,7 +2409,7 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
 
         /* Start the listener only when there are workers available */
         if (!listener_started && threads_created) {
-            create_listener_thread(ts);
+            create_listener_threads(ts);
             listener_started = 1;
         }
 
@@ -2382,10 +2474,12 @@ static void join_workers(apr_thread_t * listener, apr_thread_t ** threads)
                          "the listener thread didn't stop accepting");
         }
         else {
-            rv = apr_thread_join(&thread_rv, listener);
-            if (rv != APR_SUCCESS) {
-                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00476)
-                             "apr_thread_join: unable to join listener thread");
+            for (i = 0; i < num_listener_threads; i++) {
+                rv = apr_thread_join(&thread_rv, listeners[i].thread);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00476)
+                                 "apr_thread_join: unable to join listener thread");
+                }
             }
         }
     }
@@ -2424,7 +2518,6 @@ static void child_main(int child_num_arg, int child_bucket)
     thread_starter *ts;
     apr_threadattr_t *thread_attr;
     apr_thread_t *start_thread_id;
-    apr_pool_t *pskip;
     int i;
 
     mpm_state = AP_MPMQ_STARTING;       /* for benefit of any hooks that run as this
@@ -2449,11 +2542,10 @@ static void child_main(int child_num_arg, int child_bucket)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    apr_thread_mutex_create(&g_timer_skiplist_mtx, APR_THREAD_MUTEX_DEFAULT, pchild);
+    apr_thread_mutex_create(&g_timer_free_mtx, APR_THREAD_MUTEX_DEFAULT, pchild);
     APR_RING_INIT(&timer_free_ring, timer_event_t, link);
-    apr_pool_create(&pskip, pchild);
-    apr_skiplist_init(&timer_skiplist, pskip);
-    apr_skiplist_set_compare(timer_skiplist, indexing_comp, indexing_compk);
+    apr_pool_create(&ptimers, pchild);
+    ap_timer_wheel_create(&timer_wheel, apr_time_now(), ptimers);
     ap_run_child_init(pchild, ap_server_conf);
 
     /* done with init critical section */
@@ -2642,6 +2734,11 @@ static int make_child(server_rec * s, int slot, int bucket)
                          ap_server_conf, APLOGNO(00482)
                          "processor unbind failed");
 #endif
+        /* Run on the CPUs of our listeners bucket, if configured to */
+        ap_listen_bucket_affinity(bucket);
+        ap_scoreboard_image->parent[slot].accept_count = 0;
+        ap_scoreboard_image->parent[slot].pool_count = 0;
+
         RAISE_SIGSTOP(MAKE_CHILD);
 
         apr_signal(SIGTERM, just_die);
@@ -3270,8 +3367,6 @@ static int event_open_logs(apr_pool_t * p, apr_pool_t * plog,
     }
     retained->num_buckets = num_buckets;
 
-    /* for skiplist */
-    srand((unsigned int)apr_time_now());
     return OK;
 }
 
@@ -3280,6 +3375,9 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
 {
     int no_detach, debug, foreground;
     apr_status_t rv;
+#if !HAVE_EVENT_URING
+    apr_pollset_t *event_pollset;
+#endif
     const char *userdata_key = "mpm_event_module";
 
     mpm_state = AP_MPMQ_STARTING;
@@ -3315,6 +3413,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
             return HTTP_INTERNAL_SERVER_ERROR;
         }
 
+#if !HAVE_EVENT_URING
         rv = apr_pollset_create(&event_pollset, 1, plog,
                                 APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY);
         if (rv != APR_SUCCESS) {
@@ -3325,6 +3424,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
             return HTTP_INTERNAL_SERVER_ERROR;
         }
         apr_pollset_destroy(event_pollset);
+#endif
 
         if (!one_process && !foreground) {
             /* before we detach, setup crash handlers to log to errorlog */
@@ -3349,6 +3449,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     thread_limit = DEFAULT_THREAD_LIMIT;
     ap_daemons_limit = server_limit;
     threads_per_child = DEFAULT_THREADS_PER_CHILD;
+    num_listener_threads = 1;
     max_workers = ap_daemons_limit * threads_per_child;
     had_healthy_child = 0;
     ap_extended_status = 0;
@@ -3486,6 +3587,21 @@ static int event_check_config(apr_pool_t *p, apr_pool_t *plog,
         threads_per_child = 1;
     }
 
+    if (num_listener_threads > threads_per_child) {
+        if (startup) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL, APLOGNO(02826)
+                         "WARNING: ListenerThreads of %d exceeds ThreadsPerChild "
+                         "of %d, decreasing to match",
+                         num_listener_threads, threads_per_child);
+        } else {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(02827)
+                         "ListenerThreads of %d exceeds ThreadsPerChild "
+                         "of %d, decreasing to match",
+                         num_listener_threads, threads_per_child);
+        }
+        num_listener_threads = threads_per_child;
+    }
+
     if (max_workers < threads_per_child) {
         if (startup) {
             ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL, APLOGNO(00511)
@@ -3731,6 +3847,20 @@ static const char *set_worker_factor(cmd_parms * cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_listener_threads(cmd_parms * cmd, void *dummy,
+                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    num_listener_threads = atoi(arg);
+    if (num_listener_threads < 1)
+        return "ListenerThreads argument must be a positive number";
+    return NULL;
+}
+
 
 static const command_rec event_cmds[] = {
     LISTEN_COMMANDS,
@@ -3754,6 +3884,9 @@ static const command_rec event_cmds[] = {
     AP_INIT_TAKE1("AsyncRequestWorkerFactor", set_worker_factor, NULL, RSRC_CONF,
                   "How many additional connects will be accepted per idle "
                   "worker thread"),
+    AP_INIT_TAKE1("ListenerThreads", set_listener_threads, NULL, RSRC_CONF,
+                  "Number of listener threads polling the connections of "
+                  "each child"),
     AP_GRACEFUL_SHUTDOWN_TIMEOUT_COMMAND,
     {NULL}
 };
@@ -17,6 +17,15 @@
 #include "fdqueue.h"
 #include "apr_atomic.h"
 
+#if defined(__linux__) && defined(HAVE_LINUX_FUTEX_H)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#define AP_QUEUE_FUTEX 1
+#else
+#define AP_QUEUE_FUTEX 0
+#endif
+
 static const apr_uint32_t zero_pt = APR_UINT32_MAX/2;
 
 struct recycled_pool
@@ -32,20 +41,130 @@ struct fd_queue_info_t
                               * < zero_pt:  number of threads blocked waiting
                               *             for an idle worker
                               */
-    apr_thread_mutex_t *idlers_mutex;
-    apr_thread_cond_t *wait_for_idler;
-    int terminated;
+    apr_uint32_t wakeups;    /* idle workers handed over to blocked threads */
+    fd_queue_park_t wait_for_idler;
+    volatile int terminated;
     int max_idlers;
     int max_recycled_pools;
     apr_uint32_t recycled_pools_count;
     struct recycled_pool *recycled_pools;
 };
 
+static apr_status_t park_init(fd_queue_park_t *pk, apr_pool_t *p)
+{
+#if !AP_QUEUE_FUTEX
+    apr_status_t rv;
+#endif
+
+    pk->seq = 0;
+    pk->waiters = 0;
+    pk->mutex = NULL;
+    pk->cond = NULL;
+#if !AP_QUEUE_FUTEX
+    rv = apr_thread_mutex_create(&pk->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_thread_cond_create(&pk->cond, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
+    return APR_SUCCESS;
+}
+
+static void park_destroy(fd_queue_park_t *pk)
+{
+    if (pk->cond) {
+        apr_thread_cond_destroy(pk->cond);
+    }
+    if (pk->mutex) {
+        apr_thread_mutex_destroy(pk->mutex);
+    }
+}
+
+/**
+ * Announce a waiter.  The caller must check again what it waits for
+ * before calling park_wait() with the returned key, or park_cancel().
+ */
+static APR_INLINE apr_uint32_t park_prepare(fd_queue_park_t *pk)
+{
+    apr_atomic_inc32(&pk->waiters);
+    return apr_atomic_read32(&pk->seq);
+}
+
+static APR_INLINE void park_cancel(fd_queue_park_t *pk)
+{
+    apr_atomic_dec32(&pk->waiters);
+}
+
+/**
+ * Block until park_wake() is called, unless it was already since
+ * park_prepare() returned key.  Wakeups may be spurious.
+ */
+static apr_status_t park_wait(fd_queue_park_t *pk, apr_uint32_t key)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+#if AP_QUEUE_FUTEX
+    if (syscall(SYS_futex, &pk->seq, FUTEX_WAIT_PRIVATE, key,
+                NULL, NULL, 0) == -1
+        && errno != EAGAIN && errno != EINTR) {
+        rv = errno;
+    }
+#else
+    rv = apr_thread_mutex_lock(pk->mutex);
+    if (rv == APR_SUCCESS) {
+        if (apr_atomic_read32(&pk->seq) == key) {
+            rv = apr_thread_cond_wait(pk->cond, pk->mutex);
+        }
+        apr_thread_mutex_unlock(pk->mutex);
+    }
+#endif
+    apr_atomic_dec32(&pk->waiters);
+
+    return rv;
+}
+
+/**
+ * Wake up one (or all) of the waiters, if any.  The change they wait
+ * for must be visible before this is called.
+ */
+static apr_status_t park_wake(fd_queue_park_t *pk, int all)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_atomic_inc32(&pk->seq);
+    if (!apr_atomic_read32(&pk->waiters)) {
+        return APR_SUCCESS;
+    }
+#if AP_QUEUE_FUTEX
+    if (syscall(SYS_futex, &pk->seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1,
+                NULL, NULL, 0) == -1) {
+        rv = errno;
+    }
+#else
+    rv = apr_thread_mutex_lock(pk->mutex);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    if (all) {
+        rv = apr_thread_cond_broadcast(pk->cond);
+    }
+    else {
+        rv = apr_thread_cond_signal(pk->cond);
+    }
+    apr_thread_mutex_unlock(pk->mutex);
+#endif
+
+    return rv;
+}
+
 static apr_status_t queue_info_cleanup(void *data_)
 {
     fd_queue_info_t *qi = data_;
-    apr_thread_cond_destroy(qi->wait_for_idler);
-    apr_thread_mutex_destroy(qi->idlers_mutex);
+    park_destroy(&qi->wait_for_idler);
 
     /* Clean up any pools in the recycled list */
     for (;;) {
@@ -72,12 +191,7 @@ apr_status_t ap_queue_info_create(fd_queue_info_t ** queue_info,
 
     qi = apr_pcalloc(pool, sizeof(*qi));
 
-    rv = apr_thread_mutex_create(&qi->idlers_mutex, APR_THREAD_MUTEX_DEFAULT,
-                                 pool);
-    if (rv != APR_SUCCESS) {
-        return rv;
-    }
-    rv = apr_thread_cond_create(&qi->wait_for_idler, pool);
+    rv = park_init(&qi->wait_for_idler, pool);
     if (rv != APR_SUCCESS) {
         return rv;
     }
@@ -96,26 +210,14 @@ apr_status_t ap_queue_info_create(fd_queue_info_t ** queue_info,
 apr_status_t ap_queue_info_set_idle(fd_queue_info_t * queue_info,
                                     apr_pool_t * pool_to_recycle)
 {
-    apr_status_t rv;
-
     ap_push_pool(queue_info, pool_to_recycle);
 
-    /* If other threads are waiting on a worker, wake one up */
+    /* If other threads are waiting on a worker, hand this one over to
+     * one of them.
+     */
     if (apr_atomic_inc32(&queue_info->idlers) < zero_pt) {
-        rv = apr_thread_mutex_lock(queue_info->idlers_mutex);
-        if (rv != APR_SUCCESS) {
-            AP_DEBUG_ASSERT(0);
-            return rv;
-        }
-        rv = apr_thread_cond_signal(queue_info->wait_for_idler);
-        if (rv != APR_SUCCESS) {
-            apr_thread_mutex_unlock(queue_info->idlers_mutex);
-            return rv;
-        }
-        rv = apr_thread_mutex_unlock(queue_info->idlers_mutex);
-        if (rv != APR_SUCCESS) {
-            return rv;
-        }
+        apr_atomic_inc32(&queue_info->wakeups);
+        return park_wake(&queue_info->wait_for_idler, 0);
     }
 
     return APR_SUCCESS;
@@ -146,50 +248,36 @@ apr_status_t ap_queue_info_wait_for_idler(fd_queue_info_t * queue_info,
      * that it returns the previous value (unlike dec32's bool).
      */
     if (apr_atomic_add32(&queue_info->idlers, -1) <= zero_pt) {
-        rv = apr_thread_mutex_lock(queue_info->idlers_mutex);
-        if (rv != APR_SUCCESS) {
-            AP_DEBUG_ASSERT(0);
-            apr_atomic_inc32(&(queue_info->idlers));    /* back out dec */
-            return rv;
-        }
-        /* Re-check the idle worker count to guard against a
-         * race condition.  Now that we're in the mutex-protected
-         * region, one of two things may have happened:
-         *   - If the idle worker count is still negative, the
-         *     workers are all still busy, so it's safe to
-         *     block on a condition variable.
-         *   - If the idle worker count is non-negative, then a
-         *     worker has become idle since the first check
-         *     of queue_info->idlers above.  It's possible
-         *     that the worker has also signaled the condition
-         *     variable--and if so, the listener missed it
-         *     because it wasn't yet blocked on the condition
-         *     variable.  But if the idle worker count is
-         *     now non-negative, it's safe for this function to
-         *     return immediately.
-         *
-         *     A "negative value" (relative to zero_pt) in
-         *     queue_info->idlers tells how many
-         *     threads are waiting on an idle worker.
+        /* Every worker becoming idle while the count is "negative"
+         * (relative to zero_pt) hands itself over to one of the
+         * blocked threads by bumping queue_info->wakeups, wait for
+         * one of these (or for termination).
          */
-        if (queue_info->idlers < zero_pt) {
+        for (;;) {
+            apr_uint32_t key, w = apr_atomic_read32(&queue_info->wakeups);
+            if (w && apr_atomic_cas32(&queue_info->wakeups, w - 1, w) == w) {
+                break;
+            }
+            if (queue_info->terminated) {
+                break;
+            }
+            if (w) {
+                continue;
+            }
+
+            key = park_prepare(&queue_info->wait_for_idler);
+            if (apr_atomic_read32(&queue_info->wakeups)
+                || queue_info->terminated) {
+                park_cancel(&queue_info->wait_for_idler);
+                continue;
+            }
             *had_to_block = 1;
-            rv = apr_thread_cond_wait(queue_info->wait_for_idler,
-                                      queue_info->idlers_mutex);
+            rv = park_wait(&queue_info->wait_for_idler, key);
             if (rv != APR_SUCCESS) {
-                apr_status_t rv2;
                 AP_DEBUG_ASSERT(0);
-                rv2 = apr_thread_mutex_unlock(queue_info->idlers_mutex);
-                if (rv2 != APR_SUCCESS) {
-                    return rv2;
-                }
                 return rv;
             }
         }
-        rv = apr_thread_mutex_unlock(queue_info->idlers_mutex);
-        if (rv != APR_SUCCESS) {
-            return rv;
-        }
     }
 
     if (queue_info->terminated) {
@@ -277,30 +365,13 @@ void ap_pop_pool(apr_pool_t ** recycled_pool, fd_queue_info_t * queue_info)
     }
 }
 
+
 apr_status_t ap_queue_info_term(fd_queue_info_t * queue_info)
 {
-    apr_status_t rv;
-    rv = apr_thread_mutex_lock(queue_info->idlers_mutex);
-    if (rv != APR_SUCCESS) {
-        return rv;
-    }
     queue_info->terminated = 1;
-    apr_thread_cond_broadcast(queue_info->wait_for_idler);
-    return apr_thread_mutex_unlock(queue_info->idlers_mutex);
+    return park_wake(&queue_info->wait_for_idler, 1);
 }
 
-/**
- * Detects when the fd_queue_t is full. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
- */
-#define ap_queue_full(queue) ((queue)->nelts == (queue)->bounds)
-
-/**
- * Detects when the fd_queue_t is empty. This utility function is expected
- * to be called from within critical sections, and is not threadsafe.
- */
-#define ap_queue_empty(queue) ((queue)->nelts == 0 && APR_RING_EMPTY(&queue->timers ,timer_event_t, link))
-
 /**
  * Callback routine that is called to destroy this
  * fd_queue_t when its pool is destroyed.
@@ -312,8 +383,8 @@ static apr_status_t ap_queue_destroy(void *data)
     /* Ignore errors here, we can't do anything about them anyway.
      * XXX: We should at least try to signal an error here, it is
      * indicative of a programmer error. -aaron */
-    apr_thread_cond_destroy(queue->not_empty);
-    apr_thread_mutex_destroy(queue->one_big_mutex);
+    park_destroy(&queue->not_empty);
+    apr_thread_mutex_destroy(queue->timers_mutex);
 
     return APR_SUCCESS;
 }
@@ -324,29 +395,37 @@ static apr_status_t ap_queue_destroy(void *data)
 apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
                            apr_pool_t * a)
 {
-    int i;
+    apr_uint32_t i, bounds;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_create(&queue->one_big_mutex,
+    if ((rv = apr_thread_mutex_create(&queue->timers_mutex,
                                       APR_THREAD_MUTEX_DEFAULT,
                                       a)) != APR_SUCCESS) {
         return rv;
     }
-    if ((rv = apr_thread_cond_create(&queue->not_empty, a)) != APR_SUCCESS) {
+    if ((rv = park_init(&queue->not_empty, a)) != APR_SUCCESS) {
         return rv;
     }
 
     APR_RING_INIT(&queue->timers, timer_event_t, link);
+    queue->ntimers = 0;
+    queue->ring_timers = 0;
 
-    queue->data = apr_palloc(a, queue_capacity * sizeof(fd_queue_elem_t));
-    queue->bounds = queue_capacity;
-    queue->nelts = 0;
+    /* There are at most queue_capacity sockets (one per idle worker
+     * reserved by the listener), leave as much room for timers; those
+     * beyond it go to the timers ring, so that sockets always fit.
+     */
+    for (bounds = 1; bounds < (apr_uint32_t)queue_capacity * 2; bounds <<= 1)
+        ;
+    queue->data = apr_pcalloc(a, bounds * sizeof(fd_queue_elem_t));
+    queue->bounds = bounds;
+    queue->timer_slots = bounds - (apr_uint32_t)queue_capacity;
     queue->in = 0;
     queue->out = 0;
 
-    /* Set all the sockets in the queue to NULL */
-    for (i = 0; i < queue_capacity; ++i)
-        queue->data[i].sd = NULL;
+    /* Element i is ready for the push at position i */
+    for (i = 0; i < bounds; ++i)
+        queue->data[i].seq = i;
 
     apr_pool_cleanup_register(a, queue, ap_queue_destroy,
                               apr_pool_cleanup_null);
@@ -355,61 +434,159 @@ apr_status_t ap_queue_init(fd_queue_t * queue, int queue_capacity,
 }
 
 /**
- * Push a new socket onto the queue.
- *
- * precondition: ap_queue_info_wait_for_idler has already been called
- *               to reserve an idle worker thread
+ * Lock-free push and pop on the ring (D. Vyukov's bounded MPMC queue):
+ * the element at position pos is free for a pusher when its seq is pos,
+ * and filled for a popper when its seq is pos + 1.  Each side claims the
+ * position with a CAS, then hands the element over by bumping seq.
  */
-apr_status_t ap_queue_push(fd_queue_t * queue, apr_socket_t * sd,
-                           event_conn_state_t * ecs, apr_pool_t * p)
+static int queue_push_elem(fd_queue_t *queue, apr_socket_t *sd,
+                           event_conn_state_t *ecs, apr_pool_t *p,
+                           timer_event_t *te)
 {
     fd_queue_elem_t *elem;
-    apr_status_t rv;
+    apr_uint32_t pos = apr_atomic_read32(&queue->in);
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+    for (;;) {
+        apr_int32_t diff;
+        elem = &queue->data[pos & (queue->bounds - 1)];
+        diff = (apr_int32_t)(apr_atomic_read32(&elem->seq) - pos);
+        if (diff == 0) {
+            apr_uint32_t cur = apr_atomic_cas32(&queue->in, pos + 1, pos);
+            if (cur == pos) {
+                break;
+            }
+            pos = cur;
+        }
+        else if (diff < 0) {
+            return 0;   /* full */
+        }
+        else {
+            pos = apr_atomic_read32(&queue->in);
+        }
     }
 
-    AP_DEBUG_ASSERT(!queue->terminated);
-    AP_DEBUG_ASSERT(!ap_queue_full(queue));
-
-    elem = &queue->data[queue->in];
-    queue->in++;
-    if (queue->in >= queue->bounds)
-        queue->in -= queue->bounds;
     elem->sd = sd;
     elem->ecs = ecs;
     elem->p = p;
-    queue->nelts++;
+    elem->te = te;
+    apr_atomic_add32(&elem->seq, 1);
 
-    apr_thread_cond_signal(queue->not_empty);
+    return 1;
+}
 
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+static int queue_pop_elem(fd_queue_t *queue, apr_socket_t **sd,
+                          event_conn_state_t **ecs, apr_pool_t **p,
+                          timer_event_t **te)
+{
+    fd_queue_elem_t *elem;
+    apr_uint32_t pos = apr_atomic_read32(&queue->out);
+
+    for (;;) {
+        apr_int32_t diff;
+        elem = &queue->data[pos & (queue->bounds - 1)];
+        diff = (apr_int32_t)(apr_atomic_read32(&elem->seq) - (pos + 1));
+        if (diff == 0) {
+            apr_uint32_t cur = apr_atomic_cas32(&queue->out, pos + 1, pos);
+            if (cur == pos) {
+                break;
+            }
+            pos = cur;
+        }
+        else if (diff < 0) {
+            return 0;   /* empty */
+        }
+        else {
+            pos = apr_atomic_read32(&queue->out);
+        }
     }
 
-    return APR_SUCCESS;
+    *te = elem->te;
+    if (!elem->te) {
+        *sd = elem->sd;
+        *ecs = elem->ecs;
+        *p = elem->p;
+    }
+#ifdef AP_DEBUG
+    elem->sd = NULL;
+    elem->p = NULL;
+#endif /* AP_DEBUG */
+    /* Free for the push one lap later */
+    apr_atomic_add32(&elem->seq, queue->bounds - 1);
+
+    return 1;
 }
 
-apr_status_t ap_queue_push_timer(fd_queue_t * queue, timer_event_t *te)
+static int queue_pop_any(fd_queue_t *queue, apr_socket_t **sd,
+                         event_conn_state_t **ecs, apr_pool_t **p,
+                         timer_event_t **te)
 {
-    apr_status_t rv;
+    /* Overflowed timers first, they are late already */
+    if (apr_atomic_read32(&queue->ntimers)) {
+        *te = NULL;
+        apr_thread_mutex_lock(queue->timers_mutex);
+        if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
+            *te = APR_RING_FIRST(&queue->timers);
+            APR_RING_REMOVE(*te, link);
+            apr_atomic_dec32(&queue->ntimers);
+        }
+        apr_thread_mutex_unlock(queue->timers_mutex);
+        if (*te) {
+            return 1;
+        }
+    }
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+    if (!queue_pop_elem(queue, sd, ecs, p, te)) {
+        return 0;
+    }
+    if (*te) {
+        apr_atomic_dec32(&queue->ring_timers);
     }
+    return 1;
+}
 
+/**
+ * Push a new socket onto the queue.
+ *
+ * precondition: ap_queue_info_wait_for_idler has already been called
+ *               to reserve an idle worker thread
+ */
+apr_status_t ap_queue_push(fd_queue_t * queue, apr_socket_t * sd,
+                           event_conn_state_t * ecs, apr_pool_t * p)
+{
     AP_DEBUG_ASSERT(!queue->terminated);
 
-    APR_RING_INSERT_TAIL(&queue->timers, te, timer_event_t, link);
+    if (!queue_push_elem(queue, sd, ecs, p, NULL)) {
+        /* Can't happen with a reserved idle worker */
+        AP_DEBUG_ASSERT(0);
+        return APR_EAGAIN;
+    }
 
-    apr_thread_cond_signal(queue->not_empty);
+    return park_wake(&queue->not_empty, 0);
+}
 
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
+apr_status_t ap_queue_push_timer(fd_queue_t * queue, timer_event_t *te)
+{
+    apr_status_t rv;
+
+    AP_DEBUG_ASSERT(!queue->terminated);
+
+    /* Count the timer in before pushing it and out after popping it, the
+     * count never falls short of the timers taking room from sockets
+     */
+    if (apr_atomic_inc32(&queue->ring_timers) >= queue->timer_slots
+        || !queue_push_elem(queue, NULL, NULL, NULL, te)) {
+        apr_atomic_dec32(&queue->ring_timers);
+        if ((rv = apr_thread_mutex_lock(queue->timers_mutex)) != APR_SUCCESS) {
+            return rv;
+        }
+        APR_RING_INSERT_TAIL(&queue->timers, te, timer_event_t, link);
+        apr_atomic_inc32(&queue->ntimers);
+        if ((rv = apr_thread_mutex_unlock(queue->timers_mutex)) != APR_SUCCESS) {
+            return rv;
+        }
     }
 
-    return APR_SUCCESS;
+    return park_wake(&queue->not_empty, 0);
 }
 
 /**
@@ -422,24 +599,29 @@ apr_status_t ap_queue_pop_something(fd_queue_t * queue, apr_socket_t ** sd,
                                     event_conn_state_t ** ecs, apr_pool_t ** p,
                                     timer_event_t ** te_out)
 {
-    fd_queue_elem_t *elem;
     apr_status_t rv;
 
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
+    *te_out = NULL;
 
-    /* Keep waiting until we wake up and find that the queue is not empty. */
-    if (ap_queue_empty(queue)) {
+    /* Wait only once if the queue is empty, it's up to the caller to
+     * try again when interrupted.
+     */
+    if (!queue_pop_any(queue, sd, ecs, p, te_out)) {
         if (!queue->terminated) {
-            apr_thread_cond_wait(queue->not_empty, queue->one_big_mutex);
-        }
-        /* If we wake up and it's still empty, then we were interrupted */
-        if (ap_queue_empty(queue)) {
-            rv = apr_thread_mutex_unlock(queue->one_big_mutex);
-            if (rv != APR_SUCCESS) {
+            apr_uint32_t key = park_prepare(&queue->not_empty);
+            if (queue_pop_any(queue, sd, ecs, p, te_out)) {
+                park_cancel(&queue->not_empty);
+                return APR_SUCCESS;
+            }
+            if (queue->terminated) {
+                park_cancel(&queue->not_empty);
+            }
+            else if ((rv = park_wait(&queue->not_empty, key)) != APR_SUCCESS) {
                 return rv;
             }
+        }
+        /* If we wake up and it's still empty, then we were interrupted */
+        if (!queue_pop_any(queue, sd, ecs, p, te_out)) {
             if (queue->terminated) {
                 return APR_EOF; /* no more elements ever again */
             }
@@ -449,56 +631,19 @@ apr_status_t ap_queue_pop_something(fd_queue_t * queue, apr_socket_t ** sd,
         }
     }
 
-    *te_out = NULL;
-
-    if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
-        *te_out = APR_RING_FIRST(&queue->timers);
-        APR_RING_REMOVE(*te_out, link);
-    }
-    else {
-        elem = &queue->data[queue->out];
-        queue->out++;
-        if (queue->out >= queue->bounds)
-            queue->out -= queue->bounds;
-        queue->nelts--;
-        *sd = elem->sd;
-        *ecs = elem->ecs;
-        *p = elem->p;
-#ifdef AP_DEBUG
-        elem->sd = NULL;
-        elem->p = NULL;
-#endif /* AP_DEBUG */
-    }
-
-    rv = apr_thread_mutex_unlock(queue->one_big_mutex);
-    return rv;
+    return APR_SUCCESS;
 }
 
 apr_status_t ap_queue_interrupt_all(fd_queue_t * queue)
 {
-    apr_status_t rv;
-
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
-    apr_thread_cond_broadcast(queue->not_empty);
-    return apr_thread_mutex_unlock(queue->one_big_mutex);
+    return park_wake(&queue->not_empty, 1);
 }
 
 apr_status_t ap_queue_term(fd_queue_t * queue)
 {
-    apr_status_t rv;
-
-    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
-    /* we must hold one_big_mutex when setting this... otherwise,
-     * we could end up setting it and waking everybody up just after a
-     * would-be popper checks it but right before they block
+    /* park_wake() makes this visible to any would-be popper before it
+     * blocks, see park_prepare()
      */
     queue->terminated = 1;
-    if ((rv = apr_thread_mutex_unlock(queue->one_big_mutex)) != APR_SUCCESS) {
-        return rv;
-    }
     return ap_queue_interrupt_all(queue);
 }
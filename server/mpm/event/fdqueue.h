@@ -41,6 +41,21 @@
 
 typedef struct fd_queue_info_t fd_queue_info_t;
 typedef struct event_conn_state_t event_conn_state_t;
+typedef struct timer_event_t timer_event_t;
+
+/**
+ * Where threads block until a queue changes: the waker bumps seq, the
+ * waiters sleep only while seq still has the value they saw before
+ * checking the queue.  A futex on seq is used on Linux, the mutex and
+ * condition variable elsewhere.
+ */
+typedef struct fd_queue_park_t
+{
+    volatile apr_uint32_t seq;
+    volatile apr_uint32_t waiters;
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+} fd_queue_park_t;
 
 apr_status_t ap_queue_info_create(fd_queue_info_t ** queue_info,
                                   apr_pool_t * pool, int max_idlers,
@@ -55,14 +70,14 @@ apr_uint32_t ap_queue_info_get_idlers(fd_queue_info_t * queue_info);
 
 struct fd_queue_elem_t
 {
+    volatile apr_uint32_t seq;  /* position this element is ready for */
     apr_socket_t *sd;
     apr_pool_t *p;
     event_conn_state_t *ecs;
+    timer_event_t *te;
 };
 typedef struct fd_queue_elem_t fd_queue_elem_t;
 
-typedef struct timer_event_t timer_event_t;
-
 struct timer_event_t {
     APR_RING_ENTRY(timer_event_t) link;
     apr_time_t when;
@@ -70,19 +85,32 @@ struct timer_event_t {
     void *baton;
     int canceled;           
     apr_pollfd_t **remove;  
+    timer_event_t *pending_next;    /* link in the timer wheel pending stack */
 };
 
+#define AP_QUEUE_CACHE_LINE 64
+
+/**
+ * Bounded lock-free queue of sockets and timers (any number of pushers
+ * and poppers).  Timers which don't fit go to the overflow ring, under
+ * the mutex.
+ */
 struct fd_queue_t
 {
-    APR_RING_HEAD(timers_t, timer_event_t) timers;
     fd_queue_elem_t *data;
-    unsigned int nelts;
-    unsigned int bounds;
-    unsigned int in;
-    unsigned int out;
-    apr_thread_mutex_t *one_big_mutex;
-    apr_thread_cond_t *not_empty;
-    int terminated;
+    apr_uint32_t bounds;                /* a power of two */
+    char pad0[AP_QUEUE_CACHE_LINE];
+    volatile apr_uint32_t in;           /* next position to push to */
+    char pad1[AP_QUEUE_CACHE_LINE];
+    volatile apr_uint32_t out;          /* next position to pop from */
+    char pad2[AP_QUEUE_CACHE_LINE];
+    fd_queue_park_t not_empty;
+    APR_RING_HEAD(timers_t, timer_event_t) timers;
+    volatile apr_uint32_t ntimers;      /* on the timers ring above */
+    volatile apr_uint32_t ring_timers;  /* in data, at most timer_slots */
+    apr_uint32_t timer_slots;           /* bounds less the sockets' room */
+    apr_thread_mutex_t *timers_mutex;
+    volatile int terminated;
 };
 typedef struct fd_queue_t fd_queue_t;
 
@@ -0,0 +1,211 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timerwheel.h"
+#include "apr_atomic.h"
+
+/*
+ * A tick is 2^TW_TICK_SHIFT microseconds (~1ms).  Each of the TW_LEVELS
+ * levels has TW_SLOTS slots, level N covering TW_SLOTS^(N+1) ticks, so
+ * the wheel spans 2^32 ticks (~50 days); anything further away is parked
+ * in the last slot of the top level and re-filed when it cascades down.
+ */
+#define TW_TICK_SHIFT   10
+#define TW_SLOT_BITS    8
+#define TW_SLOTS        (1 << TW_SLOT_BITS)
+#define TW_SLOT_MASK    (TW_SLOTS - 1)
+#define TW_LEVELS       4
+
+#define TW_LEVEL_SPAN(l) ((apr_uint64_t)1 << (TW_SLOT_BITS * ((l) + 1)))
+#define TW_INDEX(t, l)   (((t) >> (TW_SLOT_BITS * (l))) & TW_SLOT_MASK)
+
+struct ap_timer_wheel_t
+{
+    struct timer_ring_t slots[TW_LEVELS][TW_SLOTS];
+    apr_uint64_t tick;      /* next tick to expire; all earlier ones are done */
+    apr_uint32_t count;     /* timers filed in the slots */
+    timer_event_t *volatile pending; /* lock-free stack fed by other threads */
+};
+
+apr_status_t ap_timer_wheel_create(ap_timer_wheel_t **tw, apr_time_t now,
+                                   apr_pool_t *p)
+{
+    int i, j;
+    ap_timer_wheel_t *w = apr_pcalloc(p, sizeof(*w));
+
+    for (i = 0; i < TW_LEVELS; i++) {
+        for (j = 0; j < TW_SLOTS; j++) {
+            APR_RING_INIT(&w->slots[i][j], timer_event_t, link);
+        }
+    }
+    w->tick = (apr_uint64_t)now >> TW_TICK_SHIFT;
+    *tw = w;
+
+    return APR_SUCCESS;
+}
+
+void ap_timer_wheel_push(ap_timer_wheel_t *tw, timer_event_t *te)
+{
+    /* Same lock-free push as ap_push_pool(): any number of concurrent
+     * producers against the single consumer in ap_timer_wheel_expire().
+     */
+    for (;;) {
+        timer_event_t *next = tw->pending;
+        te->pending_next = next;
+        if (apr_atomic_casptr((void *)&tw->pending, te, next) == next) {
+            break;
+        }
+    }
+}
+
+static void tw_file(ap_timer_wheel_t *tw, timer_event_t *te)
+{
+    apr_uint64_t expires, delta;
+    int level;
+
+    expires = (te->when > 0) ? (apr_uint64_t)te->when >> TW_TICK_SHIFT : 0;
+    if (expires < tw->tick) {
+        expires = tw->tick;
+    }
+    delta = expires - tw->tick;
+    for (level = 0; level < TW_LEVELS - 1; level++) {
+        if (delta < TW_LEVEL_SPAN(level)) {
+            break;
+        }
+    }
+    if (delta >= TW_LEVEL_SPAN(TW_LEVELS - 1)) {
+        expires = tw->tick + TW_LEVEL_SPAN(TW_LEVELS - 1) - 1;
+    }
+
+    APR_RING_INSERT_TAIL(&tw->slots[level][TW_INDEX(expires, level)], te,
+                         timer_event_t, link);
+    tw->count++;
+}
+
+/* Re-file the current slot of @a level into the lower levels, returns
+ * the slot index so that the caller knows whether to cascade further up.
+ */
+static int tw_cascade(ap_timer_wheel_t *tw, int level)
+{
+    int index = TW_INDEX(tw->tick, level);
+    struct timer_ring_t *slot = &tw->slots[level][index];
+    struct timer_ring_t tmp;
+
+    APR_RING_INIT(&tmp, timer_event_t, link);
+    APR_RING_CONCAT(&tmp, slot, timer_event_t, link);
+    while (!APR_RING_EMPTY(&tmp, timer_event_t, link)) {
+        timer_event_t *te = APR_RING_FIRST(&tmp);
+        APR_RING_REMOVE(te, link);
+        tw->count--;
+        tw_file(tw, te);
+    }
+
+    return index;
+}
+
+apr_uint32_t ap_timer_wheel_expire(ap_timer_wheel_t *tw, apr_time_t now,
+                                   struct timer_ring_t *expired)
+{
+    apr_uint64_t target = (now > 0) ? (apr_uint64_t)now >> TW_TICK_SHIFT : 0;
+    apr_uint32_t nexpired = 0;
+    timer_event_t *te;
+
+    /* Grab everything pushed since the last run in one shot */
+    te = apr_atomic_xchgptr((void *)&tw->pending, NULL);
+    while (te) {
+        timer_event_t *next = te->pending_next;
+        te->pending_next = NULL;
+        tw_file(tw, te);
+        te = next;
+    }
+
+    if (!tw->count) {
+        /* Nothing to cascade, just catch up */
+        if (tw->tick <= target) {
+            tw->tick = target + 1;
+        }
+        return 0;
+    }
+
+    while (tw->tick <= target) {
+        struct timer_ring_t *slot;
+        int index = TW_INDEX(tw->tick, 0);
+
+        if (!index) {
+            int level;
+            for (level = 1; level < TW_LEVELS; level++) {
+                if (tw_cascade(tw, level)) {
+                    break;
+                }
+            }
+        }
+
+        slot = &tw->slots[0][index];
+        while (!APR_RING_EMPTY(slot, timer_event_t, link)) {
+            te = APR_RING_FIRST(slot);
+            APR_RING_REMOVE(te, link);
+            APR_RING_INSERT_TAIL(expired, te, timer_event_t, link);
+            tw->count--;
+            nexpired++;
+        }
+
+        tw->tick++;
+        if (!tw->count) {
+            if (tw->tick <= target) {
+                tw->tick = target + 1;
+            }
+            break;
+        }
+    }
+
+    return nexpired;
+}
+
+apr_interval_time_t ap_timer_wheel_next_timeout(ap_timer_wheel_t *tw,
+                                                apr_time_t now,
+                                                apr_interval_time_t max)
+{
+    apr_uint64_t tick, limit;
+    apr_interval_time_t interval;
+
+    if (!tw->count) {
+        return max;
+    }
+
+    /* Only level 0 tells exactly when a timer expires; the first slot
+     * boundary is a cascade point where upper levels may move timers
+     * down, so report it as the next wakeup.  The loop always stops at
+     * the latest on such a boundary (possibly limit itself).
+     */
+    limit = tw->tick + TW_SLOTS;
+    for (tick = tw->tick; tick < limit; tick++) {
+        if (!TW_INDEX(tick, 0)
+            || !APR_RING_EMPTY(&tw->slots[0][TW_INDEX(tick, 0)],
+                               timer_event_t, link)) {
+            break;
+        }
+    }
+    interval = (apr_time_t)(tick << TW_TICK_SHIFT) - now;
+    if (interval >= max) {
+        return max;
+    }
+    return (interval > 0) ? interval : 1;
+}
+
+apr_uint32_t ap_timer_wheel_count(ap_timer_wheel_t *tw)
+{
+    return tw->count;
+}
@@ -0,0 +1,74 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  event/timerwheel.h
+ * @brief hierarchical timer wheel declarations
+ *
+ * The timer wheel is owned by the listener thread.  Any thread may hand
+ * a timer to the wheel with ap_timer_wheel_push(), which only touches a
+ * lock-free pending stack; the listener moves pending timers into the
+ * wheel and collects the expired ones with ap_timer_wheel_expire().
+ *
+ * @addtogroup APACHE_MPM_EVENT
+ * @{
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "fdqueue.h"
+
+typedef struct ap_timer_wheel_t ap_timer_wheel_t;
+
+APR_RING_HEAD(timer_ring_t, timer_event_t);
+
+/**
+ * Create a timer wheel whose current tick is derived from @a now.
+ */
+apr_status_t ap_timer_wheel_create(ap_timer_wheel_t **tw, apr_time_t now,
+                                   apr_pool_t *p);
+
+/**
+ * Queue a timer for insertion.  Safe to call from any thread.
+ */
+void ap_timer_wheel_push(ap_timer_wheel_t *tw, timer_event_t *te);
+
+/**
+ * Move every pending timer into the wheel and append to @a expired all
+ * the timers due at or before @a now, in no particular order.
+ * May only be called by the thread owning the wheel.
+ * @return the number of expired timers
+ */
+apr_uint32_t ap_timer_wheel_expire(ap_timer_wheel_t *tw, apr_time_t now,
+                                   struct timer_ring_t *expired);
+
+/**
+ * Return the interval from @a now to the next tick which may hold an
+ * expiring timer, or @a max if nothing is due before then.
+ * May only be called by the thread owning the wheel.
+ */
+apr_interval_time_t ap_timer_wheel_next_timeout(ap_timer_wheel_t *tw,
+                                                apr_time_t now,
+                                                apr_interval_time_t max);
+
+/**
+ * Number of timers currently held by the wheel (pending ones excluded).
+ */
+apr_uint32_t ap_timer_wheel_count(ap_timer_wheel_t *tw);
+
+#endif /* TIMERWHEEL_H */
+/** @} */
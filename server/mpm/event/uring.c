@@ -0,0 +1,413 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "uring.h"
+
+#if HAVE_EVENT_URING
+
+#include "apr_portable.h"
+#include "apr_thread_mutex.h"
+
+#include <errno.h>
+#include <liburing.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define URING_MIN_ENTRIES   64
+#define URING_MAX_ENTRIES   4096
+
+/*
+ * Each registered descriptor has a token, which is what the poll requests
+ * carry as user data.  Poll requests are one-shot: when one completes, the
+ * token goes to the re-arm list and a new request is queued on the next
+ * poll (unless removed in the meantime), which gives the level triggered
+ * behaviour of the other pollsets without any additional system call.
+ *
+ * A token removed while its request is in flight is only recycled when the
+ * request completes (canceled), since that completion still refers to it.
+ */
+typedef struct uring_token_t uring_token_t;
+struct uring_token_t {
+    apr_pollfd_t pfd;
+    uring_token_t *next;        /* re-arm or free list */
+    uring_token_t *chain;       /* all the tokens, for cleanup */
+    int fd;
+    unsigned int armed:1;       /* a poll request is queued or in flight */
+    unsigned int removed:1;
+};
+
+struct ap_uring_pollset_t {
+    struct io_uring ring;
+    apr_thread_mutex_t *mutex;  /* for everything but the completion queue */
+    uring_token_t **tokens;     /* indexed by fd */
+    int ntokens;
+    uring_token_t *rearm;
+    uring_token_t *free;
+    uring_token_t *all;
+    apr_pollfd_t *result;
+    apr_uint32_t size;
+    apr_os_thread_t poller;
+    int has_poller;
+};
+
+static apr_status_t uring_pollset_cleanup(void *data)
+{
+    ap_uring_pollset_t *ps = data;
+    uring_token_t *token;
+
+    io_uring_queue_exit(&ps->ring);
+
+    while ((token = ps->all)) {
+        ps->all = token->chain;
+        free(token);
+    }
+    free(ps->tokens);
+
+    return APR_SUCCESS;
+}
+
+static APR_INLINE short uring_events(apr_int16_t reqevents)
+{
+    short events = 0;
+
+    if (reqevents & APR_POLLIN)
+        events |= POLLIN;
+    if (reqevents & APR_POLLPRI)
+        events |= POLLPRI;
+    if (reqevents & APR_POLLOUT)
+        events |= POLLOUT;
+
+    return events;
+}
+
+static APR_INLINE apr_int16_t uring_rtnevents(int revents)
+{
+    apr_int16_t rtnevents = 0;
+
+    if (revents & POLLIN)
+        rtnevents |= APR_POLLIN;
+    if (revents & POLLPRI)
+        rtnevents |= APR_POLLPRI;
+    if (revents & POLLOUT)
+        rtnevents |= APR_POLLOUT;
+    if (revents & POLLERR)
+        rtnevents |= APR_POLLERR;
+    if (revents & POLLHUP)
+        rtnevents |= APR_POLLHUP;
+    if (revents & POLLNVAL)
+        rtnevents |= APR_POLLNVAL;
+
+    return rtnevents;
+}
+
+static int uring_fd(const apr_pollfd_t *pfd)
+{
+    if (pfd->desc_type == APR_POLL_SOCKET) {
+        apr_os_sock_t sd;
+        apr_os_sock_get(&sd, pfd->desc.s);
+        return sd;
+    }
+    else {
+        apr_os_file_t fd;
+        apr_os_file_get(&fd, pfd->desc.f);
+        return fd;
+    }
+}
+
+/* Whether the caller is not the polling thread, hence needs its requests
+ * submitted now for the poller to notice them.
+ */
+static APR_INLINE int uring_foreign(ap_uring_pollset_t *ps)
+{
+    return !ps->has_poller
+           || !apr_os_thread_equal(ps->poller, apr_os_thread_current());
+}
+
+/* Must be called with the mutex held */
+static struct io_uring_sqe *uring_get_sqe(ap_uring_pollset_t *ps)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ps->ring);
+
+    if (!sqe) {
+        /* submission queue full, make room */
+        io_uring_submit(&ps->ring);
+        sqe = io_uring_get_sqe(&ps->ring);
+    }
+
+    return sqe;
+}
+
+/* Must be called with the mutex held */
+static apr_status_t uring_arm(ap_uring_pollset_t *ps, uring_token_t *token)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ps);
+
+    if (!sqe) {
+        return APR_ENOMEM;
+    }
+    io_uring_prep_poll_add(sqe, token->fd, uring_events(token->pfd.reqevents));
+    io_uring_sqe_set_data(sqe, token);
+    token->armed = 1;
+
+    return APR_SUCCESS;
+}
+
+/* Must be called with the mutex held */
+static void uring_token_free(ap_uring_pollset_t *ps, uring_token_t *token)
+{
+    token->next = ps->free;
+    ps->free = token;
+}
+
+apr_status_t ap_uring_pollset_create(ap_uring_pollset_t **pollset,
+                                     apr_uint32_t size, apr_pool_t *p)
+{
+    ap_uring_pollset_t *ps;
+    struct io_uring_params params;
+    unsigned int entries;
+    apr_status_t rv;
+    int rc;
+
+    ps = apr_pcalloc(p, sizeof(*ps));
+    rv = apr_thread_mutex_create(&ps->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    entries = size;
+    if (entries < URING_MIN_ENTRIES) {
+        entries = URING_MIN_ENTRIES;
+    }
+    else if (entries > URING_MAX_ENTRIES) {
+        entries = URING_MAX_ENTRIES;
+    }
+    memset(&params, 0, sizeof(params));
+    rc = io_uring_queue_init_params(entries, &ps->ring, &params);
+    if (rc < 0) {
+        return APR_FROM_OS_ERROR(-rc);
+    }
+
+    /* Waiting with a timeout must not touch the submission queue, which
+     * other threads may be filling meanwhile (Linux 5.11 and later).
+     */
+    if (!(params.features & IORING_FEAT_EXT_ARG)
+        || !(params.features & IORING_FEAT_NODROP)) {
+        io_uring_queue_exit(&ps->ring);
+        return APR_ENOTIMPL;
+    }
+
+    ps->size = size;
+    ps->result = apr_palloc(p, size * sizeof(apr_pollfd_t));
+    apr_pool_cleanup_register(p, ps, uring_pollset_cleanup,
+                              apr_pool_cleanup_null);
+
+    *pollset = ps;
+    return APR_SUCCESS;
+}
+
+apr_status_t ap_uring_pollset_add(ap_uring_pollset_t *ps,
+                                  const apr_pollfd_t *descriptor)
+{
+    uring_token_t *token;
+    int fd = uring_fd(descriptor);
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(ps->mutex);
+
+    if (fd >= ps->ntokens) {
+        int n = ps->ntokens ? ps->ntokens : 1024;
+        uring_token_t **tokens;
+
+        while (n <= fd) {
+            n *= 2;
+        }
+        tokens = realloc(ps->tokens, n * sizeof(*tokens));
+        if (!tokens) {
+            apr_thread_mutex_unlock(ps->mutex);
+            return APR_ENOMEM;
+        }
+        memset(tokens + ps->ntokens, 0,
+               (n - ps->ntokens) * sizeof(*tokens));
+        ps->tokens = tokens;
+        ps->ntokens = n;
+    }
+    else if (ps->tokens[fd]) {
+        apr_thread_mutex_unlock(ps->mutex);
+        return APR_EEXIST;
+    }
+
+    if (ps->free) {
+        token = ps->free;
+        ps->free = token->next;
+    }
+    else if ((token = malloc(sizeof(*token)))) {
+        token->chain = ps->all;
+        ps->all = token;
+    }
+    else {
+        apr_thread_mutex_unlock(ps->mutex);
+        return APR_ENOMEM;
+    }
+    token->pfd = *descriptor;
+    token->pfd.rtnevents = 0;
+    token->next = NULL;
+    token->fd = fd;
+    token->armed = 0;
+    token->removed = 0;
+
+    rv = uring_arm(ps, token);
+    if (rv == APR_SUCCESS) {
+        ps->tokens[fd] = token;
+        if (uring_foreign(ps)) {
+            io_uring_submit(&ps->ring);
+        }
+    }
+    else {
+        uring_token_free(ps, token);
+    }
+
+    apr_thread_mutex_unlock(ps->mutex);
+    return rv;
+}
+
+apr_status_t ap_uring_pollset_remove(ap_uring_pollset_t *ps,
+                                     const apr_pollfd_t *descriptor)
+{
+    uring_token_t *token;
+    int fd = uring_fd(descriptor);
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_thread_mutex_lock(ps->mutex);
+
+    token = (fd < ps->ntokens) ? ps->tokens[fd] : NULL;
+    if (!token) {
+        apr_thread_mutex_unlock(ps->mutex);
+        return APR_NOTFOUND;
+    }
+    ps->tokens[fd] = NULL;
+    token->removed = 1;
+
+    /* If not armed, the token is on the re-arm list and will be recycled
+     * from there, otherwise cancel its request.
+     */
+    if (token->armed) {
+        struct io_uring_sqe *sqe = uring_get_sqe(ps);
+        if (sqe) {
+            io_uring_prep_poll_remove(sqe, (__u64)(apr_uintptr_t)token);
+            io_uring_sqe_set_data(sqe, NULL);
+            if (uring_foreign(ps)) {
+                io_uring_submit(&ps->ring);
+            }
+        }
+        else {
+            /* Still unregistered, only the request will complete when
+             * the descriptor is signaled or closed.
+             */
+            rv = APR_ENOMEM;
+        }
+    }
+
+    apr_thread_mutex_unlock(ps->mutex);
+    return rv;
+}
+
+apr_status_t ap_uring_pollset_poll(ap_uring_pollset_t *ps,
+                                   apr_interval_time_t timeout,
+                                   apr_int32_t *num,
+                                   const apr_pollfd_t **descriptors)
+{
+    struct __kernel_timespec ts, *tsp = NULL;
+    struct io_uring_cqe *cqe;
+    uring_token_t *token;
+    unsigned int head, seen = 0;
+    apr_uint32_t n = 0;
+    int rc;
+
+    *num = 0;
+
+    apr_thread_mutex_lock(ps->mutex);
+    if (!ps->has_poller) {
+        ps->poller = apr_os_thread_current();
+        ps->has_poller = 1;
+    }
+    while ((token = ps->rearm)) {
+        ps->rearm = token->next;
+        if (token->removed) {
+            uring_token_free(ps, token);
+        }
+        else if (uring_arm(ps, token) != APR_SUCCESS) {
+            /* retry next time */
+            token->next = ps->rearm;
+            ps->rearm = token;
+            break;
+        }
+    }
+    /* Our own requests (re-arms, removals) go in a single submission */
+    if (io_uring_sq_ready(&ps->ring)) {
+        io_uring_submit(&ps->ring);
+    }
+    apr_thread_mutex_unlock(ps->mutex);
+
+    if (timeout >= 0) {
+        ts.tv_sec = apr_time_sec(timeout);
+        ts.tv_nsec = apr_time_usec(timeout) * 1000;
+        tsp = &ts;
+    }
+    rc = io_uring_wait_cqes(&ps->ring, &cqe, 1, tsp, NULL);
+    if (rc < 0) {
+        if (rc == -ETIME) {
+            return APR_TIMEUP;
+        }
+        return APR_FROM_OS_ERROR(-rc);
+    }
+
+    apr_thread_mutex_lock(ps->mutex);
+    io_uring_for_each_cqe(&ps->ring, head, cqe) {
+        if (n == ps->size) {
+            break;
+        }
+        seen++;
+
+        token = io_uring_cqe_get_data(cqe);
+        if (!token) {
+            /* completion of a poll removal */
+            continue;
+        }
+        token->armed = 0;
+        if (token->removed) {
+            uring_token_free(ps, token);
+            continue;
+        }
+
+        ps->result[n] = token->pfd;
+        ps->result[n].rtnevents = (cqe->res < 0) ? APR_POLLERR
+                                                 : uring_rtnevents(cqe->res);
+        n++;
+
+        token->next = ps->rearm;
+        ps->rearm = token;
+    }
+    io_uring_cq_advance(&ps->ring, seen);
+    apr_thread_mutex_unlock(ps->mutex);
+
+    *num = n;
+    *descriptors = ps->result;
+
+    return n ? APR_SUCCESS : APR_TIMEUP;
+}
+
+#endif /* HAVE_EVENT_URING */
@@ -0,0 +1,79 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  event/uring.h
+ * @brief io_uring based pollset for the event MPM
+ *
+ * A drop-in replacement for the subset of the apr_pollset API used by the
+ * event MPM (--enable-event-uring).  Poll requests are queued on the ring
+ * and submitted in one batch by the thread polling the set, other threads
+ * submit theirs right away so that the poller sees them while it waits.
+ * Descriptors stay registered until removed, like with epoll.
+ *
+ * This is a pollset only: accept, reads and writes of the connections
+ * still go through the APR socket calls, one system call each.
+ *
+ * @addtogroup APACHE_MPM_EVENT
+ * @{
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include "ap_config.h"
+
+#if HAVE_EVENT_URING
+
+#include "apr_pools.h"
+#include "apr_poll.h"
+
+typedef struct ap_uring_pollset_t ap_uring_pollset_t;
+
+/**
+ * Create an io_uring pollset able to return up to @a size descriptors
+ * per call to ap_uring_pollset_poll().
+ * @return APR_ENOTIMPL if the kernel lacks the needed io_uring features
+ */
+apr_status_t ap_uring_pollset_create(ap_uring_pollset_t **pollset,
+                                     apr_uint32_t size, apr_pool_t *p);
+
+/**
+ * Register a descriptor, the apr_pollfd_t is copied.
+ */
+apr_status_t ap_uring_pollset_add(ap_uring_pollset_t *pollset,
+                                  const apr_pollfd_t *descriptor);
+
+/**
+ * Unregister a descriptor, APR_NOTFOUND if it is not registered.
+ * No event is returned for it afterwards.
+ */
+apr_status_t ap_uring_pollset_remove(ap_uring_pollset_t *pollset,
+                                     const apr_pollfd_t *descriptor);
+
+/**
+ * Wait up to @a timeout (forever if negative) for registered descriptors
+ * to be signaled; only one thread may poll a given set.
+ */
+apr_status_t ap_uring_pollset_poll(ap_uring_pollset_t *pollset,
+                                   apr_interval_time_t timeout,
+                                   apr_int32_t *num,
+                                   const apr_pollfd_t **descriptors);
+
+#endif /* HAVE_EVENT_URING */
+
+#endif /* URING_H */
+/** @} */
@@ -713,6 +713,7 @@ static void child_main(int child_num_arg, int child_bucket)
         else if (status != APR_SUCCESS) {
             continue;
         }
+        ap_scoreboard_image->parent[my_child_num].accept_count++;
 
         /*
          * We now have a connection, so set it up with the appropriate
@@ -814,6 +815,10 @@ static int make_child(server_rec *s, int slot, int bucket)
                          ap_server_conf, APLOGNO(00160) "processor unbind failed");
         }
 #endif
+        /* Run on the CPUs of our listeners bucket, if configured to */
+        ap_listen_bucket_affinity(bucket);
+        ap_scoreboard_image->parent[slot].accept_count = 0;
+
         RAISE_SIGSTOP(MAKE_CHILD);
         AP_MONCONTROL(1);
         /* Disable the parent's signal handlers and set up proper handling in
@@ -841,6 +841,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t *thd, void * dummy)
                 apr_allocator_max_free_set(allocator, ap_max_mem_free);
                 apr_pool_create_ex(&ptrans, pconf, NULL, allocator);
                 apr_allocator_owner_set(allocator, ptrans);
+                ap_scoreboard_image->parent[process_slot].pool_count++;
             }
             apr_pool_tag(ptrans, "transaction");
             rv = lr->accept_func(&csd, lr, ptrans);
@@ -861,6 +862,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t *thd, void * dummy)
                 accept_mutex_error("unlock", rv, process_slot);
             }
             if (csd != NULL) {
+                ap_scoreboard_image->parent[process_slot].accept_count++;
                 rv = ap_queue_push(worker_queue, csd, ptrans);
                 if (rv) {
                     /* trash the connection; we couldn't queue the connected
@@ -1449,6 +1451,11 @@ static int make_child(server_rec *s, int slot, int bucket)
                          ap_server_conf, APLOGNO(00284)
                          "processor unbind failed");
 #endif
+        /* Run on the CPUs of our listeners bucket, if configured to */
+        ap_listen_bucket_affinity(bucket);
+        ap_scoreboard_image->parent[slot].accept_count = 0;
+        ap_scoreboard_image->parent[slot].pool_count = 0;
+
         RAISE_SIGSTOP(MAKE_CHILD);
 
         apr_signal(SIGTERM, just_die);
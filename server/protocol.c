@@ -553,7 +553,96 @@ AP_CORE_DECLARE(void) ap_parse_uri(request_rec *r, const char *uri)
     }
 }
 
-static int read_request_line(request_rec *r, apr_bucket_brigade *bb)
+#if !APR_CHARSET_EBCDIC
+/* Fast path for the common case of a request head (request line and header
+ * fields) already buffered whole by the input filters: peek at it, parse it
+ * in place from a single copy and consume it at once, rather than reading
+ * and copying it line by line.  Anything unusual returns APR_INCOMPLETE
+ * with nothing consumed, for ap_rgetline() and ap_get_mime_headers_core()
+ * to handle (and report) it as usual.
+ */
+static apr_status_t read_request_head(request_rec *r, apr_bucket_brigade *bb,
+                                      apr_size_t *len)
+{
+    apr_size_t size, consumed;
+    apr_ssize_t line_len;
+    apr_off_t want;
+    apr_status_t rv;
+    char *buf, *end;
+
+    /* The fields are added as they are parsed and must be removed if
+     * the slow path is needed eventually.
+     */
+    if (!apr_is_empty_table(r->headers_in)) {
+        return APR_INCOMPLETE;
+    }
+
+    apr_brigade_cleanup(bb);
+    rv = ap_get_brigade(r->proto_input_filters, bb, AP_MODE_SPECULATIVE,
+                        APR_BLOCK_READ, AP_IOBUFSIZE);
+    if (rv == APR_SUCCESS) {
+        rv = apr_brigade_pflatten(bb, &buf, &size, r->pool);
+    }
+    apr_brigade_cleanup(bb);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    /* An HTTP/1.x request line, blank lines and HTTP/0.9 are for the slow
+     * path (which has the remaining checks)
+     */
+    line_len = ap_scan_http_line(buf, size);
+    if (line_len <= 0
+        || line_len > (apr_ssize_t)r->server->limit_req_line + 2) {
+        return APR_INCOMPLETE;
+    }
+    end = buf + line_len - 1;
+    if (end > buf && end[-1] == APR_ASCII_CR) {
+        end--;
+    }
+    if (end - buf <= 9 || memcmp(end - 9, " HTTP/", 6) != 0
+        || !apr_isdigit(end[-3]) || end[-2] != '.' || !apr_isdigit(end[-1])) {
+        return APR_INCOMPLETE;
+    }
+
+    rv = ap_parse_http_fields(buf + line_len, size - line_len,
+                              r->server->limit_req_fieldsize + 2,
+                              r->server->limit_req_fields,
+                              r->headers_in, &consumed);
+    if (rv != APR_SUCCESS) {
+        apr_table_clear(r->headers_in);
+        return APR_INCOMPLETE;
+    }
+
+    /* Now really read what we parsed, it is already there */
+    want = line_len + consumed;
+    while (want > 0) {
+        apr_off_t got = 0;
+
+        rv = ap_get_brigade(r->proto_input_filters, bb, AP_MODE_READBYTES,
+                            APR_BLOCK_READ, want);
+        if (rv == APR_SUCCESS) {
+            rv = apr_brigade_length(bb, 1, &got);
+        }
+        apr_brigade_cleanup(bb);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (got <= 0) {
+            return APR_EOF;
+        }
+        want -= got;
+    }
+
+    *end = '\0';
+    r->the_request = buf;
+    *len = end - buf;
+    return APR_SUCCESS;
+}
+#endif
+
+static int read_request_line(request_rec *r, apr_bucket_brigade *bb,
+                             int *headers_read)
 {
     const char *ll;
     const char *uri;
@@ -588,14 +677,23 @@ static int read_request_line(request_rec *r, apr_bucket_brigade *bb)
      */
 
     do {
-        apr_status_t rv;
+        apr_status_t rv = APR_INCOMPLETE;
 
         /* ensure ap_rgetline allocates memory each time thru the loop
          * if there are empty lines
          */
         r->the_request = NULL;
-        rv = ap_rgetline(&(r->the_request), (apr_size_t)(r->server->limit_req_line + 2),
-                         &len, r, 0, bb);
+#if !APR_CHARSET_EBCDIC
+        if (!num_blank_lines) {
+            rv = read_request_head(r, bb, &len);
+            *headers_read = (rv == APR_SUCCESS);
+        }
+#endif
+        if (APR_STATUS_IS_INCOMPLETE(rv)) {
+            rv = ap_rgetline(&(r->the_request),
+                             (apr_size_t)(r->server->limit_req_line + 2),
+                             &len, r, 0, bb);
+        }
 
         if (rv != APR_SUCCESS) {
             r->request_time = apr_time_now();
@@ -994,10 +1092,24 @@ request_rec *ap_read_request(conn_rec *conn)
     apr_bucket_brigade *tmp_bb;
     apr_socket_t *csd;
     apr_interval_time_t cur_timeout;
+    int headers_read = 0;
 
-
-    apr_pool_create(&p, conn->pool);
-    apr_pool_tag(p, "request");
+    /* Use the pool of the previous request on this connection if the EOR
+     * bucket gave it back, it is cleared already.
+     */
+    p = conn->free_request_pool;
+    conn->free_request_pool = NULL;
+    if (ap_extended_status && conn->sbh) {
+        worker_score *ws = ap_get_scoreboard_worker(conn->sbh);
+        ws->pool_count++;
+        if (p) {
+            ws->pool_reuse_count++;
+        }
+    }
+    if (!p) {
+        apr_pool_create(&p, conn->pool);
+        apr_pool_tag(p, "request");
+    }
     r = apr_pcalloc(p, sizeof(request_rec));
     AP_READ_REQUEST_ENTRY((intptr_t)r, (uintptr_t)conn);
     r->pool            = p;
@@ -1048,7 +1160,7 @@ request_rec *ap_read_request(conn_rec *conn)
     ap_run_pre_read_request(r, conn);
 
     /* Get the request... */
-    if (!read_request_line(r, tmp_bb)) {
+    if (!read_request_line(r, tmp_bb, &headers_read)) {
         switch (r->status) {
         case HTTP_REQUEST_URI_TOO_LARGE:
         case HTTP_BAD_REQUEST:
@@ -1098,7 +1210,16 @@ request_rec *ap_read_request(conn_rec *conn)
     if (!r->assbackwards) {
         const char *tenc;
 
-        ap_get_mime_headers_core(r, tmp_bb);
+        if (!headers_read) {
+            ap_get_mime_headers_core(r, tmp_bb);
+        }
+        else {
+            /* Read along with the request line, finish like
+             * ap_get_mime_headers_core() does.
+             */
+            apr_table_compress(r->headers_in, APR_OVERLAP_TABLES_MERGE);
+            apr_table_do(table_do_fn_check_lengths, r, r->headers_in, NULL);
+        }
         if (r->status != HTTP_OK) {
             ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(00567)
                           "request failed: error reading the headers");
@@ -1109,7 +1230,7 @@ request_rec *ap_read_request(conn_rec *conn)
             goto traceout;
         }
 
-        tenc = apr_table_get(r->headers_in, "Transfer-Encoding");
+        tenc = ap_get_request_header(r, AP_HEADER_TRANSFER_ENCODING);
         if (tenc) {
             /* http://tools.ietf.org/html/draft-ietf-httpbis-p1-messaging-23
              * Section 3.3.3.3: "If a Transfer-Encoding header field is
@@ -1181,7 +1302,7 @@ request_rec *ap_read_request(conn_rec *conn)
 
     if ((!r->hostname && (r->proto_num >= HTTP_VERSION(1, 1)))
         || ((r->proto_num == HTTP_VERSION(1, 1))
-            && !apr_table_get(r->headers_in, "Host"))) {
+            && !ap_get_request_header(r, AP_HEADER_HOST))) {
         /*
          * Client sent us an HTTP/1.1 or later request without telling us the
          * hostname, either with a full URL or a Host: header. We therefore
@@ -1214,7 +1335,7 @@ request_rec *ap_read_request(conn_rec *conn)
         goto traceout;
     }
 
-    if (((expect = apr_table_get(r->headers_in, "Expect")) != NULL)
+    if (((expect = ap_get_request_header(r, AP_HEADER_EXPECT)) != NULL)
         && (expect[0] != '\0')) {
         /*
          * The Expect header field was added to HTTP/1.1 after RFC 2068
@@ -73,8 +73,23 @@
  * To make that more efficient we encode a lookup table.  The test_char_table
  * is generated automatically by gen_test_char.c.
  */
+#if defined(__SSSE3__)
+#define TEST_CHAR_WANT_NIBBLES
+#endif
 #include "test_char.h"
 
+/* The HTTP head scanners below handle 16 or 32 bytes at once when the
+ * compiler targets SSE2 (any x86-64) or AVX2, token characters are
+ * matched with the nibble tables of test_char.h which need SSSE3.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /* we assume the folks using this ensure 0 <= c < 256... which means
  * you need a cast to (unsigned char) first, you can't just plug a
  * char in here and get it to work, because if char is signed then it
@@ -2151,6 +2166,379 @@ AP_DECLARE(int) ap_has_cntrl(const char *str)
     return 0;
 }
 
+/* Length of the leading run of bytes not in T_HTTP_CTRLS */
+static apr_size_t scan_http_ctrls(const char *s, apr_size_t len)
+{
+    apr_size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i ctl32 = _mm256_set1_epi8(0x1f);
+    const __m256i del32 = _mm256_set1_epi8(0x7f);
+    const __m256i tab32 = _mm256_set1_epi8('\t');
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(
+                _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl32), v),
+                _mm256_cmpeq_epi8(v, del32));
+        unsigned int bits = (unsigned int)_mm256_movemask_epi8(
+                _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab32), m));
+        if (bits) {
+            return i + __builtin_ctz(bits);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i ctl = _mm_set1_epi8(0x1f);
+        const __m128i del = _mm_set1_epi8(0x7f);
+        const __m128i tab = _mm_set1_epi8('\t');
+
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v),
+                                     _mm_cmpeq_epi8(v, del));
+            unsigned int bits = (unsigned int)_mm_movemask_epi8(
+                    _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), m));
+            if (bits) {
+                return i + __builtin_ctz(bits);
+            }
+        }
+    }
+#endif
+
+    while (i < len && !TEST_CHAR((unsigned char)s[i], T_HTTP_CTRLS)) {
+        i++;
+    }
+    return i;
+}
+
+/* Length of the leading run of token characters (but NUL) */
+static apr_size_t scan_http_token(const char *s, apr_size_t len)
+{
+    apr_size_t i = 0;
+
+#if defined(__SSSE3__) && defined(T_HTTP_TOKEN_NIBBLES)
+    const __m128i lo = _mm_loadu_si128((const __m128i *)test_char_token_lo);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)test_char_token_hi);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i t = _mm_and_si128(
+                _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble)),
+                _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4),
+                                                   nibble)));
+        unsigned int bits = (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(t, zero));
+        if (bits) {
+            return i + __builtin_ctz(bits);
+        }
+    }
+#endif
+
+    while (i < len && s[i]
+           && !TEST_CHAR((unsigned char)s[i], T_HTTP_TOKEN_STOP)) {
+        i++;
+    }
+    return i;
+}
+
+AP_DECLARE(apr_ssize_t) ap_scan_http_line(const char *s, apr_size_t len)
+{
+    apr_size_t i = scan_http_ctrls(s, len);
+
+    if (i == len) {
+        return 0;
+    }
+    if (s[i] == APR_ASCII_CR) {
+        if (++i == len) {
+            return 0;
+        }
+        if (s[i] != APR_ASCII_LF) {
+            return -1;
+        }
+    }
+    else if (s[i] != APR_ASCII_LF) {
+        return -1;
+    }
+    return i + 1;
+}
+
+AP_DECLARE(apr_status_t) ap_parse_http_fields(char *buf, apr_size_t len,
+                                              apr_size_t max_line,
+                                              int max_fields,
+                                              apr_table_t *fields,
+                                              apr_size_t *consumed)
+{
+    apr_size_t pos = 0;
+    int nfields = 0;
+
+    for (;;) {
+        char *line = buf + pos, *value, *end;
+        apr_size_t avail = len - pos, name_len;
+        apr_ssize_t value_len;
+
+        /* The empty line ending the head */
+        if (avail == 1 && line[0] == APR_ASCII_CR) {
+            return APR_INCOMPLETE;
+        }
+        if (avail && line[0] == APR_ASCII_LF) {
+            *consumed = pos + 1;
+            return APR_SUCCESS;
+        }
+        if (avail > 1 && line[0] == APR_ASCII_CR
+                      && line[1] == APR_ASCII_LF) {
+            *consumed = pos + 2;
+            return APR_SUCCESS;
+        }
+
+        /* field-name ":" OWS field-value OWS; this also rejects obsolete
+         * line folding since SP and HTAB are not token characters.
+         */
+        name_len = scan_http_token(line, avail);
+        if (name_len == avail) {
+            return (avail > max_line) ? APR_EINVAL : APR_INCOMPLETE;
+        }
+        if (name_len == 0 || line[name_len] != ':') {
+            return APR_EINVAL;
+        }
+        value = line + name_len + 1;
+        value_len = ap_scan_http_line(value, avail - name_len - 1);
+        if (value_len < 0) {
+            return APR_EINVAL;
+        }
+        if (value_len == 0) {
+            return (avail > max_line) ? APR_EINVAL : APR_INCOMPLETE;
+        }
+        if (name_len + 1 + value_len > max_line
+            || (max_fields && ++nfields > max_fields)) {
+            return APR_EINVAL;
+        }
+        pos += name_len + 1 + value_len;
+
+        end = value + value_len - 1;
+        if (end > value && end[-1] == APR_ASCII_CR) {
+            end--;
+        }
+        while (value < end && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        line[name_len] = '\0';
+        *end = '\0';
+        apr_table_addn(fields, line, value);
+    }
+}
+
+/* Must follow the order of ap_header_e */
+static const char *const header_names[AP_HEADER_MAX] = {
+    "Accept",
+    "Accept-Charset",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Cookie",
+    "Expect",
+    "Host",
+    "If-Match",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "If-Unmodified-Since",
+    "Max-Forwards",
+    "Origin",
+    "Pragma",
+    "Proxy-Authorization",
+    "Range",
+    "Referer",
+    "TE",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+    "Via",
+    "X-Forwarded-For",
+    "X-Forwarded-Host",
+    "X-Forwarded-Server"
+};
+
+/* Index of the well-known fields of r->headers_in, kept in the
+ * AP_NOTE_HEADERS_IN request note.  It describes the table as it was
+ * when built: any apr_table_*() call which adds or removes entries
+ * changes nelts or the elements array, setting or merging the last entry
+ * changes its pointers, and the key of each indexed entry is checked
+ * before use in case the table was reordered (apr_table_compress()).
+ * Values are always read from the table, so they may change in place.
+ */
+typedef struct {
+    const apr_table_t *t;
+    const char *elts;
+    int nelts;
+    const char *last_key;
+    const char *last_val;
+    int pos[AP_HEADER_MAX];             /* entry index + 1, 0 if none */
+    const char *key[AP_HEADER_MAX];
+} headers_index_t;
+
+/* The ID of a header name, or -1 if it is not a well-known one */
+static int header_id(const char *key)
+{
+    int c = apr_tolower(*key);
+
+#define HEADER_IS(id) \
+    if (c == apr_tolower(*header_names[AP_HEADER_##id]) \
+            && !strcasecmp(key, header_names[AP_HEADER_##id])) \
+        return AP_HEADER_##id
+
+    switch (strlen(key)) {
+    case 2:
+        HEADER_IS(TE);
+        break;
+    case 3:
+        HEADER_IS(VIA);
+        break;
+    case 4:
+        HEADER_IS(HOST);
+        break;
+    case 5:
+        HEADER_IS(RANGE);
+        break;
+    case 6:
+        HEADER_IS(ACCEPT);
+        HEADER_IS(COOKIE);
+        HEADER_IS(EXPECT);
+        HEADER_IS(ORIGIN);
+        HEADER_IS(PRAGMA);
+        break;
+    case 7:
+        HEADER_IS(REFERER);
+        HEADER_IS(UPGRADE);
+        break;
+    case 8:
+        HEADER_IS(IF_MATCH);
+        HEADER_IS(IF_RANGE);
+        break;
+    case 10:
+        HEADER_IS(CONNECTION);
+        HEADER_IS(USER_AGENT);
+        break;
+    case 12:
+        HEADER_IS(CONTENT_TYPE);
+        HEADER_IS(MAX_FORWARDS);
+        break;
+    case 13:
+        HEADER_IS(AUTHORIZATION);
+        HEADER_IS(CACHE_CONTROL);
+        HEADER_IS(CONTENT_RANGE);
+        HEADER_IS(IF_NONE_MATCH);
+        break;
+    case 14:
+        HEADER_IS(ACCEPT_CHARSET);
+        HEADER_IS(CONTENT_LENGTH);
+        break;
+    case 15:
+        HEADER_IS(ACCEPT_ENCODING);
+        HEADER_IS(ACCEPT_LANGUAGE);
+        HEADER_IS(X_FORWARDED_FOR);
+        break;
+    case 16:
+        HEADER_IS(CONTENT_ENCODING);
+        HEADER_IS(X_FORWARDED_HOST);
+        break;
+    case 17:
+        HEADER_IS(IF_MODIFIED_SINCE);
+        HEADER_IS(TRANSFER_ENCODING);
+        break;
+    case 18:
+        HEADER_IS(X_FORWARDED_SERVER);
+        break;
+    case 19:
+        HEADER_IS(IF_UNMODIFIED_SINCE);
+        HEADER_IS(PROXY_AUTHORIZATION);
+        break;
+    }
+    return -1;
+#undef HEADER_IS
+}
+
+static void index_headers(headers_index_t *hi, const apr_table_t *t)
+{
+    const apr_array_header_t *arr = apr_table_elts(t);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    int i, id;
+
+    hi->t = t;
+    hi->elts = arr->elts;
+    hi->nelts = arr->nelts;
+    if (arr->nelts) {
+        hi->last_key = elts[arr->nelts - 1].key;
+        hi->last_val = elts[arr->nelts - 1].val;
+    }
+    memset(hi->pos, 0, sizeof(hi->pos));
+    for (i = 0; i < arr->nelts; i++) {
+        if (!elts[i].key || (id = header_id(elts[i].key)) < 0
+                || hi->pos[id]) {
+            continue;
+        }
+        hi->pos[id] = i + 1;
+        hi->key[id] = elts[i].key;
+    }
+}
+
+AP_DECLARE(const char *) ap_header_name(ap_header_e id)
+{
+    AP_DEBUG_ASSERT(id >= 0 && id < AP_HEADER_MAX);
+    return header_names[id];
+}
+
+AP_DECLARE(const char *) ap_get_request_header(request_rec *r,
+                                               ap_header_e id)
+{
+    const apr_array_header_t *arr;
+    const apr_table_entry_t *elts;
+    headers_index_t *hi;
+    void **note;
+    int pos;
+
+    AP_DEBUG_ASSERT(id >= 0 && id < AP_HEADER_MAX);
+    note = ap_get_request_note(r, AP_NOTE_HEADERS_IN);
+    if (!note) {
+        return apr_table_get(r->headers_in, header_names[id]);
+    }
+
+    arr = apr_table_elts(r->headers_in);
+    elts = (const apr_table_entry_t *)arr->elts;
+    hi = *note;
+    if (!hi) {
+        *note = hi = apr_palloc(r->pool, sizeof(*hi));
+        index_headers(hi, r->headers_in);
+    }
+    else if (hi->t != r->headers_in
+             || hi->elts != arr->elts
+             || hi->nelts != arr->nelts
+             || (arr->nelts
+                 && (hi->last_key != elts[arr->nelts - 1].key
+                     || hi->last_val != elts[arr->nelts - 1].val))) {
+        index_headers(hi, r->headers_in);
+    }
+
+    pos = hi->pos[id];
+    if (pos && elts[pos - 1].key != hi->key[id]) {
+        index_headers(hi, r->headers_in);
+        pos = hi->pos[id];
+    }
+    return pos ? elts[pos - 1].val : NULL;
+}
+
 AP_DECLARE(int) ap_is_directory(apr_pool_t *p, const char *path)
 {
     apr_finfo_t finfo;
@@ -1142,7 +1142,7 @@ static APR_INLINE const char *construct_host_header(request_rec *r,
 AP_DECLARE(void) ap_update_vhost_from_headers(request_rec *r)
 {
     core_server_config *conf = ap_get_core_module_config(r->server->module_config);
-    const char *host_header = apr_table_get(r->headers_in, "Host");
+    const char *host_header = ap_get_request_header(r, AP_HEADER_HOST);
     int is_v6literal = 0;
     int have_hostname_from_url = 0;
 
@@ -30,9 +30,9 @@
 #include "apr_pools.h"
 #include "apr_hash.h"
 #include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
 #include "apr_signal.h"
 #include "apr_getopt.h"
-#include "apr_md5.h"
 #include "apr_ring.h"
 #include "apr_date.h"
 #include "apr_buckets.h"
@@ -71,6 +71,13 @@
 
 #define DIRINFO (APR_FINFO_MTIME|APR_FINFO_SIZE|APR_FINFO_TYPE|APR_FINFO_LINK)
 
+#define JOURNAL_WORK  CACHE_JOURNAL_FILE ".work" /* journal being replayed */
+#define INDEX         "cache.index"     /* entries known after the last run */
+#define INDEX_TEMP    INDEX ".tmp"
+#define MAX_THREADS   64                /* for the parallel scan */
+#define MAX_LINE      8192              /* of the index and the journal */
+#define RESCAN        86400             /* secs between walks with -j */
+
 typedef struct _direntry {
     APR_RING_ENTRY(_direntry) link;
     int type;         /* type of file/fileset: TEMP, HEADER, DATA, HEADERDATA */
@@ -111,6 +118,30 @@ static apr_file_t *outfile;   /* stdout file handle */
 static apr_off_t unsolicited; /* file size summary for deleted unsolicited
                                  files */
 static APR_RING_ENTRY(_entry) root; /* ENTRY ring anchor */
+static apr_hash_t *varies;    /* vary header files by base name, kept in
+                                 the index along with the ENTRY ring */
+static apr_time_t scanned;    /* time the cache was last walked, as kept
+                                 in the index */
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *scan_mutex; /* protects the ENTRY ring, the
+                                          unsolicited summary and the work
+                                          list during a parallel scan */
+static apr_array_header_t *scan_dirs;  /* directories left to scan */
+static int scan_next;                  /* next directory to hand out */
+
+typedef struct _scanner {
+    apr_pool_t *pool;  /* private to the thread */
+    apr_off_t nodes;   /* nodes seen by the thread */
+    int failed;        /* flag: true if process_dir() failed */
+} SCANNER;
+
+#define SCAN_LOCK()   if (scan_mutex) apr_thread_mutex_lock(scan_mutex)
+#define SCAN_UNLOCK() if (scan_mutex) apr_thread_mutex_unlock(scan_mutex)
+#else
+#define SCAN_LOCK()
+#define SCAN_UNLOCK()
+#endif
 
 /* short program name as called */
 static const char *shortname = "htcacheclean";
@@ -400,6 +431,27 @@ static void delete_entry(char *path, char *basename, apr_off_t *nodes,
 
 }
 
+/*
+ * remember a vary header file found by the walk for the index
+ */
+static void add_vary(apr_pool_t *pool, DIRENTRY *d, apr_time_t expire)
+{
+    ENTRY *e;
+
+    if (!varies) {
+        return;
+    }
+
+    e = apr_pcalloc(pool, sizeof(ENTRY));
+    e->expire = expire;
+    e->htime = d->htime;
+    e->hsize = d->hsize;
+    e->basename = apr_pstrdup(pool, d->basename);
+    SCAN_LOCK();
+    apr_hash_set(varies, e->basename, APR_HASH_KEY_STRING, e);
+    SCAN_UNLOCK();
+}
+
 /*
  * list the cache directory tree
  */
@@ -591,8 +643,12 @@ static int list_urls(char *path, apr_pool_t *pool, apr_off_t round)
 
 /*
  * walk the cache directory tree
+ *
+ * if subdirs is given, directories are added to it instead of being
+ * walked, so that they can be handed out to several threads
  */
-static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
+static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes,
+        apr_array_header_t *subdirs)
 {
     apr_dir_t *dir;
     apr_pool_t *p;
@@ -684,7 +740,11 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
         }
 
         if (info.filetype == APR_DIR) {
-            if (process_dir(d->basename, pool, nodes)) {
+            if (subdirs) {
+                APR_ARRAY_PUSH(subdirs, char *) =
+                        apr_pstrdup(subdirs->pool, d->basename);
+            }
+            else if (process_dir(d->basename, pool, nodes, NULL)) {
                 return 1;
             }
             continue;
@@ -774,7 +834,9 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                                                &len) == APR_SUCCESS) {
                             apr_file_close(fd);
                             e = apr_palloc(pool, sizeof(ENTRY));
+                            SCAN_LOCK();
                             APR_RING_INSERT_TAIL(&root, e, _entry, link);
+                            SCAN_UNLOCK();
                             e->expire = disk_info.expire;
                             e->response_time = disk_info.response_time;
                             e->htime = d->htime;
@@ -795,10 +857,16 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                     }
                     else if (format == VARY_FORMAT_VERSION) {
                         apr_finfo_t finfo;
+                        apr_time_t expires;
 
                         /* This must be a URL that added Vary headers later,
                          * so kill the orphaned .data file
                          */
+                        len = sizeof(expires);
+                        if (apr_file_read_full(fd, &expires, len,
+                                               &len) != APR_SUCCESS) {
+                            expires = APR_DATE_BAD;
+                        }
                         apr_file_close(fd);
 
                         if (apr_stat(&finfo, apr_pstrcat(p, nextpath,
@@ -810,6 +878,7 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             delete_file(path, apr_pstrcat(p, path, "/",
                                     d->basename, CACHE_DATA_SUFFIX, NULL),
                                     nodes, p);
+                            add_vary(pool, d, expires);
                         }
                         break;
                     }
@@ -836,8 +905,10 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
             if (realclean || d->htime < current - deviation
                 || d->htime > current + deviation) {
                 delete_entry(path, d->basename, nodes, p);
+                SCAN_LOCK();
                 unsolicited += d->hsize;
                 unsolicited += d->dsize;
+                SCAN_UNLOCK();
             }
             break;
 
@@ -875,6 +946,9 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                             else if (expires < current) {
                                 delete_entry(path, d->basename, nodes, p);
                             }
+                            else {
+                                add_vary(pool, d, expires);
+                            }
 
                             break;
                         }
@@ -890,7 +964,9 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                                                &len) == APR_SUCCESS) {
                             apr_file_close(fd);
                             e = apr_palloc(pool, sizeof(ENTRY));
+                            SCAN_LOCK();
                             APR_RING_INSERT_TAIL(&root, e, _entry, link);
+                            SCAN_UNLOCK();
                             e->expire = disk_info.expire;
                             e->response_time = disk_info.response_time;
                             e->htime = d->htime;
@@ -918,7 +994,9 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
             if (realclean || d->htime < current - deviation
                 || d->htime > current + deviation) {
                 delete_entry(path, d->basename, nodes, p);
+                SCAN_LOCK();
                 unsolicited += d->hsize;
+                SCAN_UNLOCK();
             }
             break;
 
@@ -927,7 +1005,9 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
             if (realclean || d->dtime < current - deviation
                 || d->dtime > current + deviation) {
                 delete_entry(path, d->basename, nodes, p);
+                SCAN_LOCK();
                 unsolicited += d->dsize;
+                SCAN_UNLOCK();
             }
             break;
 
@@ -936,7 +1016,9 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
          */
         case TEMP:
             delete_file(path, d->basename, nodes, p);
+            SCAN_LOCK();
             unsolicited += d->dsize;
+            SCAN_UNLOCK();
             break;
         }
     }
@@ -958,13 +1040,480 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
     return 0;
 }
 
+#if APR_HAS_THREADS
+/*
+ * walk the directories handed out from scan_dirs
+ */
+static void * APR_THREAD_FUNC scan_thread(apr_thread_t *thd, void *data)
+{
+    SCANNER *sc = data;
+    char *dir;
+
+    while (!interrupted && !sc->failed) {
+        apr_thread_mutex_lock(scan_mutex);
+        dir = NULL;
+        if (scan_next < scan_dirs->nelts) {
+            dir = APR_ARRAY_IDX(scan_dirs, scan_next++, char *);
+        }
+        apr_thread_mutex_unlock(scan_mutex);
+
+        if (!dir) {
+            break;
+        }
+        if (process_dir(dir, sc->pool, &sc->nodes, NULL)) {
+            sc->failed = 1;
+        }
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+#endif
+
+/*
+ * walk the cache directory tree, the directories below the top level
+ * directory being shared among the given number of threads
+ */
+static int scan(char *path, apr_pool_t *pool, apr_off_t *nodes, int threads)
+{
+#if APR_HAS_THREADS
+    apr_thread_t **thds;
+    SCANNER *sc;
+    apr_status_t status;
+    int i, failed;
+
+    if (threads <= 1) {
+        return process_dir(path, pool, nodes, NULL);
+    }
+
+    scan_dirs = apr_array_make(pool, 256, sizeof(char *));
+    scan_next = 0;
+    if (process_dir(path, pool, nodes, scan_dirs)) {
+        return 1;
+    }
+
+    if (apr_thread_mutex_create(&scan_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                pool) != APR_SUCCESS) {
+        return 1;
+    }
+
+    /* pools are not thread safe, each thread gets its own allocator */
+    thds = apr_pcalloc(pool, threads * sizeof(apr_thread_t *));
+    sc = apr_pcalloc(pool, threads * sizeof(SCANNER));
+    failed = 0;
+    for (i = 0; i < threads; i++) {
+        apr_allocator_t *allocator;
+
+        if (apr_allocator_create(&allocator) != APR_SUCCESS) {
+            failed = 1;
+            break;
+        }
+        apr_pool_create_ex(&sc[i].pool, pool, NULL, allocator);
+        apr_allocator_owner_set(allocator, sc[i].pool);
+
+        status = apr_thread_create(&thds[i], NULL, scan_thread, &sc[i], pool);
+        if (status != APR_SUCCESS) {
+            thds[i] = NULL;
+            failed = 1;
+            break;
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (thds[i]) {
+            apr_thread_join(&status, thds[i]);
+            *nodes += sc[i].nodes;
+            failed |= sc[i].failed;
+        }
+    }
+
+    apr_thread_mutex_destroy(scan_mutex);
+    scan_mutex = NULL;
+
+    return failed || interrupted;
+#else
+    return process_dir(path, pool, nodes, NULL);
+#endif
+}
+
+/*
+ * parse the fields of an index line or a journal record
+ */
+static char *parse_name(char *name)
+{
+    char *end;
+
+    while (apr_isspace(*name)) {
+        name++;
+    }
+    end = name + strlen(name);
+    while (end > name && apr_isspace(end[-1])) {
+        *--end = '\0';
+    }
+    return name;
+}
+
+static ENTRY *make_vary(apr_pool_t *pool, const char *name,
+        apr_time_t expire, apr_time_t htime, apr_off_t hsize)
+{
+    ENTRY *e = apr_pcalloc(pool, sizeof(ENTRY));
+
+    e->expire = expire;
+    e->htime = htime;
+    e->hsize = hsize;
+    e->basename = apr_pstrdup(pool, name);
+    return e;
+}
+
+/*
+ * read the entries left by the previous incremental run, returns
+ * APR_ENOENT if there is no index yet
+ */
+static apr_status_t read_index(char *path, apr_pool_t *pool, apr_hash_t *h)
+{
+    apr_file_t *fd;
+    apr_status_t status;
+    char line[MAX_LINE];
+    char *name, *end;
+    ENTRY *e;
+
+    scanned = 0;
+
+    status = apr_file_open(&fd, apr_pstrcat(pool, path, "/", INDEX, NULL),
+                           APR_FOPEN_READ | APR_FOPEN_BUFFERED, APR_OS_DEFAULT,
+                           pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    while (!interrupted
+            && apr_file_gets(line, sizeof(line), fd) == APR_SUCCESS) {
+        if (line[0] == '#') {
+            scanned = apr_strtoi64(line + 1, NULL, 10);
+            continue;
+        }
+        if (line[0] == CACHE_JOURNAL_VARY) {
+            apr_time_t expire, htime;
+            apr_off_t hsize;
+
+            end = line + 1;
+            expire = apr_strtoi64(end, &end, 10);
+            htime = apr_strtoi64(end, &end, 10);
+            hsize = apr_strtoi64(end, &end, 10);
+            name = parse_name(end);
+            if (*name) {
+                e = make_vary(pool, name, expire, htime, hsize);
+                apr_hash_set(varies, e->basename, APR_HASH_KEY_STRING, e);
+            }
+            continue;
+        }
+
+        e = apr_palloc(pool, sizeof(ENTRY));
+        end = line;
+        e->expire = apr_strtoi64(end, &end, 10);
+        e->response_time = apr_strtoi64(end, &end, 10);
+        e->htime = apr_strtoi64(end, &end, 10);
+        e->dtime = apr_strtoi64(end, &end, 10);
+        e->hsize = apr_strtoi64(end, &end, 10);
+        e->dsize = apr_strtoi64(end, &end, 10);
+        name = parse_name(end);
+        if (!*name) {
+            continue;
+        }
+        e->basename = apr_pstrdup(pool, name);
+        apr_hash_set(h, e->basename, APR_HASH_KEY_STRING, e);
+    }
+
+    apr_file_close(fd);
+
+    return interrupted ? APR_EINTR : APR_SUCCESS;
+}
+
+/*
+ * apply the records of a journal written by mod_cache_disk, gap is set
+ * when a record was cut short
+ */
+static apr_status_t read_journal(const char *file, apr_pool_t *pool,
+        apr_hash_t *h, int *gap)
+{
+    apr_file_t *fd;
+    apr_status_t status;
+    char line[MAX_LINE];
+    char *name, *end;
+    ENTRY *e;
+
+    status = apr_file_open(&fd, file, APR_FOPEN_READ | APR_FOPEN_BUFFERED,
+                           APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    while (!interrupted
+            && apr_file_gets(line, sizeof(line), fd) == APR_SUCCESS) {
+        apr_time_t expire = 0, response_time = 0, time;
+        apr_off_t hsize = 0, dsize = 0;
+
+        end = line + 1;
+        if (line[0] == CACHE_JOURNAL_STORE) {
+            expire = apr_strtoi64(end, &end, 10);
+            response_time = apr_strtoi64(end, &end, 10);
+            time = apr_strtoi64(end, &end, 10);
+            hsize = apr_strtoi64(end, &end, 10);
+            dsize = apr_strtoi64(end, &end, 10);
+        }
+        else if (line[0] == CACHE_JOURNAL_REMOVE) {
+            time = apr_strtoi64(end, &end, 10);
+        }
+        else if (line[0] == CACHE_JOURNAL_VARY) {
+            expire = apr_strtoi64(end, &end, 10);
+            time = apr_strtoi64(end, &end, 10);
+            hsize = apr_strtoi64(end, &end, 10);
+        }
+        else {
+            continue;
+        }
+
+        /* a record cut short by a crash has no line end, whatever else
+         * went missing with it can only be found by a walk
+         */
+        if (line[strlen(line) - 1] != '\n') {
+            *gap = 1;
+            continue;
+        }
+        name = parse_name(end);
+        if (!*name) {
+            continue;
+        }
+
+        /* the same name may turn from an entity into a vary header file
+         * and back
+         */
+        apr_hash_set(h, name, APR_HASH_KEY_STRING, NULL);
+        apr_hash_set(varies, name, APR_HASH_KEY_STRING, NULL);
+
+        if (line[0] == CACHE_JOURNAL_REMOVE) {
+            continue;
+        }
+
+        if (line[0] == CACHE_JOURNAL_VARY) {
+            e = make_vary(pool, name, expire, time, hsize);
+            apr_hash_set(varies, e->basename, APR_HASH_KEY_STRING, e);
+            continue;
+        }
+
+        e = apr_palloc(pool, sizeof(ENTRY));
+        e->basename = apr_pstrdup(pool, name);
+        e->expire = expire;
+        e->response_time = response_time;
+        e->htime = time;
+        e->dtime = time;
+        e->hsize = hsize;
+        e->dsize = dsize;
+        apr_hash_set(h, e->basename, APR_HASH_KEY_STRING, e);
+    }
+
+    apr_file_close(fd);
+
+    return interrupted ? APR_EINTR : APR_SUCCESS;
+}
+
+/*
+ * find the cache entries from the index of the previous run and the
+ * journal written since, or from a walk of the cache directory tree if
+ * there is no index yet, if the journal is known to be incomplete, or
+ * if the last walk is older than RESCAN, so that entries missing from
+ * the journal are not kept forever
+ */
+static int process_journal(char *path, apr_pool_t *pool, apr_off_t *nodes,
+        int threads)
+{
+    apr_hash_t *h;
+    apr_hash_index_t *i;
+    apr_status_t status;
+    apr_finfo_t finfo;
+    char *journal, *work, *gapfile;
+    int gap = 0;
+    ENTRY *e;
+
+    journal = apr_pstrcat(pool, path, "/", CACHE_JOURNAL_FILE, NULL);
+    work = apr_pstrcat(pool, path, "/", JOURNAL_WORK, NULL);
+    gapfile = apr_pstrcat(pool, path, "/", CACHE_JOURNAL_GAP, NULL);
+    h = apr_hash_make(pool);
+    varies = apr_hash_make(pool);
+
+    status = read_index(path, pool, h);
+    if (status == APR_SUCCESS) {
+        gap = scanned < now - apr_time_from_sec(RESCAN) || scanned > now
+                || apr_stat(&finfo, gapfile, APR_FINFO_TYPE, pool)
+                        == APR_SUCCESS;
+    }
+    else if (status != APR_ENOENT && !APR_STATUS_IS_ENOENT(status)) {
+        return 1;
+    }
+
+    if (status == APR_SUCCESS && !gap) {
+        if (dryrun) {
+            status = read_journal(journal, pool, h, &gap);
+        }
+        else {
+            /* a journal left over by an interrupted run comes first, it
+             * is only removed once the index reflects it
+             */
+            status = read_journal(work, pool, h, &gap);
+            if (status == APR_SUCCESS || APR_STATUS_IS_ENOENT(status)) {
+                status = apr_file_rename(journal, work, pool);
+                if (status == APR_SUCCESS) {
+                    status = read_journal(work, pool, h, &gap);
+                }
+            }
+        }
+        if (status != APR_SUCCESS && !APR_STATUS_IS_ENOENT(status)) {
+            return 1;
+        }
+    }
+    else {
+        gap = 1;
+    }
+
+    if (gap) {
+
+        /* start from scratch, whatever was journaled up to now will be
+         * found by the walk
+         */
+        if (!dryrun) {
+            apr_file_remove(gapfile, pool);
+            apr_file_remove(work, pool);
+            apr_file_rename(journal, work, pool);
+            apr_file_remove(work, pool);
+        }
+        varies = apr_hash_make(pool);
+        scanned = now;
+        return scan(path, pool, nodes, threads);
+    }
+
+    /* vary header files go once expired or left without variants, as
+     * they would in a walk
+     */
+    for (i = apr_hash_first(pool, varies); i && !interrupted;
+         i = apr_hash_next(i)) {
+        void *hvalue;
+
+        apr_hash_this(i, NULL, NULL, &hvalue);
+        e = hvalue;
+        (*nodes)++;
+        if ((e->expire != APR_DATE_BAD && e->expire < now)
+                || apr_stat(&finfo, apr_pstrcat(pool, path, "/", e->basename,
+                        CACHE_HEADER_SUFFIX, CACHE_VDIR_SUFFIX, NULL),
+                        APR_FINFO_TYPE, pool)
+                || finfo.filetype != APR_DIR) {
+            delete_entry(path, e->basename, nodes, pool);
+            apr_hash_set(varies, e->basename, APR_HASH_KEY_STRING, NULL);
+        }
+    }
+
+    for (i = apr_hash_first(pool, h); i && !interrupted; i = apr_hash_next(i)) {
+        void *hvalue;
+
+        apr_hash_this(i, NULL, NULL, &hvalue);
+        e = hvalue;
+        APR_RING_INSERT_TAIL(&root, e, _entry, link);
+        (*nodes) += e->dsize ? 2 : 1;
+    }
+
+    return interrupted;
+}
+
+/*
+ * save the entries left after purging for the next incremental run
+ */
+static int write_index(char *path, apr_pool_t *pool)
+{
+    apr_file_t *fd;
+    apr_hash_index_t *i;
+    apr_status_t status;
+    char *index, *temp;
+    ENTRY *e;
+
+    if (dryrun) {
+        return 0;
+    }
+
+    index = apr_pstrcat(pool, path, "/", INDEX, NULL);
+    temp = apr_pstrcat(pool, path, "/", INDEX_TEMP, NULL);
+
+    status = apr_file_open(&fd, temp, APR_FOPEN_WRITE | APR_FOPEN_CREATE
+                           | APR_FOPEN_TRUNCATE | APR_FOPEN_BUFFERED,
+                           APR_OS_DEFAULT, pool);
+    if (status != APR_SUCCESS) {
+        return 1;
+    }
+
+    status = apr_file_printf(fd, "# %" APR_TIME_T_FMT "\n", scanned) > 0
+             ? APR_SUCCESS : APR_EGENERAL;
+
+    for (e = APR_RING_FIRST(&root);
+         e != APR_RING_SENTINEL(&root, _entry, link) && status == APR_SUCCESS;
+         e = APR_RING_NEXT(e, link)) {
+        status = apr_file_printf(fd, "%" APR_TIME_T_FMT " %" APR_TIME_T_FMT
+                                 " %" APR_TIME_T_FMT " %" APR_TIME_T_FMT
+                                 " %" APR_OFF_T_FMT " %" APR_OFF_T_FMT
+                                 " %s\n", e->expire, e->response_time,
+                                 e->htime, e->dtime, e->hsize, e->dsize,
+                                 e->basename) > 0 ? APR_SUCCESS : APR_EGENERAL;
+    }
+
+    for (i = apr_hash_first(pool, varies); i && status == APR_SUCCESS;
+         i = apr_hash_next(i)) {
+        void *hvalue;
+
+        apr_hash_this(i, NULL, NULL, &hvalue);
+        e = hvalue;
+        status = apr_file_printf(fd, "%c %" APR_TIME_T_FMT " %" APR_TIME_T_FMT
+                                 " %" APR_OFF_T_FMT " %s\n",
+                                 CACHE_JOURNAL_VARY, e->expire, e->htime,
+                                 e->hsize, e->basename) > 0
+                 ? APR_SUCCESS : APR_EGENERAL;
+    }
+
+    if (status == APR_SUCCESS) {
+        status = apr_file_close(fd);
+    }
+    else {
+        apr_file_close(fd);
+    }
+    if (status == APR_SUCCESS) {
+        status = apr_file_rename(temp, index, pool);
+    }
+    if (status != APR_SUCCESS) {
+        apr_file_remove(temp, pool);
+        return 1;
+    }
+
+    /* the index now reflects the journal */
+    apr_file_remove(apr_pstrcat(pool, path, "/", JOURNAL_WORK, NULL), pool);
+
+    return 0;
+}
+
+/*
+ * sort entries oldest first
+ */
+static int oldest_first(const void *a, const void *b)
+{
+    const ENTRY *ea = *(const ENTRY * const *)a;
+    const ENTRY *eb = *(const ENTRY * const *)b;
+
+    return (ea->dtime > eb->dtime) - (ea->dtime < eb->dtime);
+}
+
 /*
  * purge cache entries
  */
 static void purge(char *path, apr_pool_t *pool, apr_off_t max,
         apr_off_t inodes, apr_off_t nodes, apr_off_t round)
 {
-    ENTRY *e, *n, *oldest;
+    ENTRY *e, *n, *oldest, **oldests;
+    apr_off_t count, next;
 
     struct stats s;
     s.sum = 0;
@@ -1046,22 +1595,26 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
          return;
     }
 
-    /* process remaining entries oldest to newest, the check for an emtpy
-     * ring actually isn't necessary except when the compiler does
-     * corrupt 64bit arithmetics which happend to me once, so better safe
-     * than sorry
+    /* process remaining entries oldest to newest, sorted once up front
+     * rather than searching the ring for the oldest entry on each round
      */
-    while (!((!s.max || s.sum <= s.max) && (!s.inodes || s.nodes <= s.inodes))
-            && !interrupted && !APR_RING_EMPTY(&root, _entry, link)) {
-        oldest = APR_RING_FIRST(&root);
-
-        for (e = APR_RING_NEXT(oldest, link);
-             e != APR_RING_SENTINEL(&root, _entry, link);
-             e = APR_RING_NEXT(e, link)) {
-            if (e->dtime < oldest->dtime) {
-                oldest = e;
-            }
-        }
+    oldests = apr_palloc(pool, (apr_size_t)s.entries * sizeof(ENTRY *) + 1);
+    count = 0;
+    for (e = APR_RING_FIRST(&root);
+         e != APR_RING_SENTINEL(&root, _entry, link) && count < s.entries;
+         e = APR_RING_NEXT(e, link)) {
+        oldests[count++] = e;
+    }
+    qsort(oldests, (apr_size_t)count, sizeof(ENTRY *), oldest_first);
+
+    /* the check for the end of the array actually isn't necessary except
+     * when the compiler does corrupt 64bit arithmetics which happend to
+     * me once, so better safe than sorry
+     */
+    for (next = 0;
+         !((!s.max || s.sum <= s.max) && (!s.inodes || s.nodes <= s.inodes))
+            && !interrupted && next < count; next++) {
+        oldest = oldests[next];
 
         delete_entry(path, oldest->basename, &s.nodes, pool);
         s.sum -= round_up((apr_size_t)oldest->hsize, round);
@@ -1229,17 +1782,32 @@ static apr_status_t find_directory(apr_pool_t *pool, const char *base,
  */
 static apr_status_t delete_url(apr_pool_t *pool, const char *proxypath, const char *url)
 {
-    apr_md5_ctx_t context;
+    unsigned char hkey[CACHE_HASH_KEY_LEN];
     unsigned char digest[16];
     char tmp[23];
     int i, k;
     unsigned int x;
+    apr_file_t *fd;
+    apr_status_t status;
     static const char enc_table[64] =
             "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_@";
 
-    apr_md5_init(&context);
-    apr_md5_update(&context, (const unsigned char *) url, strlen(url));
-    apr_md5_final(digest, &context);
+    /* the key the server names the files of this cache root with, a root
+     * without one has nothing cached yet
+     */
+    status = apr_file_open(&fd, apr_pstrcat(pool, proxypath, "/",
+                                            CACHE_HASH_KEY_FILE, NULL),
+                           APR_FOPEN_READ | APR_FOPEN_BINARY, 0, pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    status = apr_file_read_full(fd, hkey, sizeof(hkey), NULL);
+    apr_file_close(fd);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    cache_hash_siphash(hkey, url, strlen(url), digest);
 
     /* encode 128 bits as 22 characters, using a modified uuencoding
      * the encoding is 3 bytes -> 4 characters* i.e. 128 bits is
@@ -1274,8 +1842,9 @@ static void usage(const char *error)
     }
     apr_file_printf(errfile,
     "%s -- program for cleaning the disk cache."                             NL
-    "Usage: %s [-Dvtrn] -pPATH [-lLIMIT|-LLIMIT] [-PPIDFILE]"                NL
-    "       %s [-nti] -dINTERVAL -pPATH [-lLIMIT|-LLIMIT] [-PPIDFILE]"       NL
+    "Usage: %s [-Dvtrnj] [-TTHREADS] -pPATH [-lLIMIT|-LLIMIT] [-PPIDFILE]"   NL
+    "       %s [-ntij] [-TTHREADS] -dINTERVAL -pPATH [-lLIMIT|-LLIMIT]"       NL
+    "          [-PPIDFILE]"                                                  NL
     "       %s [-Dvt] -pPATH URL ..."                                        NL
                                                                              NL
     "Options:"                                                               NL
@@ -1318,6 +1887,15 @@ static void usage(const char *error)
     "       the disk cache. This option is only possible together with the"  NL
     "       -d option."                                                      NL
                                                                              NL
+    "  -j   Clean incrementally. The cache entries found by the previous"    NL
+    "       run are kept in an index in PATH, and brought up to date from"   NL
+    "       the journal written by CacheDiskJournal, instead of walking the" NL
+    "       whole disk cache on every run. The disk cache is still walked"   NL
+    "       when there is no index yet, when the journal is incomplete, and" NL
+    "       once a day."                                                     NL
+                                                                             NL
+    "  -T   Walk the disk cache with THREADS threads in parallel."           NL
+                                                                             NL
     "  -a   List the URLs currently stored in the cache. Variants of the"    NL
     "       same URL will be listed once for each variant."                  NL
                                                                              NL
@@ -1382,6 +1960,7 @@ int main(int argc, const char * const argv[])
     apr_finfo_t info;
     apr_file_t *pidfile;
     int retries, isdaemon, limit_found, inodes_found, intelligent, dowork;
+    int journal, threads;
     char opt;
     const char *arg;
     char *proxypath, *path, *pidfilename;
@@ -1400,6 +1979,8 @@ int main(int argc, const char * const argv[])
     benice = 0;
     deldirs = 0;
     intelligent = 0;
+    journal = 0;
+    threads = 0;
     previous = 0; /* avoid compiler warning */
     proxypath = NULL;
     pidfilename = NULL;
@@ -1425,7 +2006,7 @@ int main(int argc, const char * const argv[])
     apr_getopt_init(&o, pool, argc, argv);
 
     while (1) {
-        status = apr_getopt(o, "iDnvrtd:l:L:p:P:R:aA", &opt, &arg);
+        status = apr_getopt(o, "iDnvrtjd:l:L:p:P:R:T:aA", &opt, &arg);
         if (status == APR_EOF) {
             break;
         }
@@ -1443,6 +2024,24 @@ int main(int argc, const char * const argv[])
                 intelligent = 1;
                 break;
 
+            case 'j':
+                if (journal) {
+                    usage_repeated_arg(pool, opt);
+                }
+                journal = 1;
+                break;
+
+            case 'T':
+                if (threads) {
+                    usage_repeated_arg(pool, opt);
+                }
+                threads = atoi(arg);
+                if (threads < 1 || threads > MAX_THREADS) {
+                    usage(apr_psprintf(pool, "Invalid number of threads: %s"
+                                             APR_EOL_STR APR_EOL_STR, arg));
+                }
+                break;
+
             case 'D':
                 if (dryrun) {
                     usage_repeated_arg(pool, opt);
@@ -1757,7 +2356,24 @@ int main(int argc, const char * const argv[])
 
         if (dowork && !interrupted) {
             apr_off_t nodes = 0;
-            if (!process_dir(path, instance, &nodes) && !interrupted) {
+            if (journal) {
+                if (!process_journal(path, instance, &nodes, threads)
+                        && !interrupted) {
+                    purge(path, instance, max, inodes, nodes, round);
+                    if (!interrupted && write_index(path, instance)
+                            && !isdaemon) {
+                        apr_file_printf(errfile, "Could not write the "
+                                        "index, the next run will walk "
+                                        "the disk cache." APR_EOL_STR);
+                    }
+                }
+                else if (!isdaemon && !interrupted) {
+                    apr_file_printf(errfile, "An error occurred, cache "
+                                    "cleaning aborted." APR_EOL_STR);
+                    return 1;
+                }
+            }
+            else if (!scan(path, instance, &nodes, threads) && !interrupted) {
                 purge(path, instance, max, inodes, nodes, round);
             }
             else if (!isdaemon && !interrupted) {
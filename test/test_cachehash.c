@@ -0,0 +1,310 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This program tests ap_cache_hash() and ap_cache_generate_keyed_name()
+ * in ../modules/cache/cache_util.c, which mod_cache_disk uses to name the
+ * files of each cached entity, and mod_cache_shm to index its entries.
+ *
+ * "test_cachehash check [N]" compares ap_cache_hash() with reference
+ * SipHash-2-4 128 bit values, checks that the names depend on the key,
+ * and that N cache keys get distinct names, evenly spread over the first
+ * level directories.
+ *
+ * "test_cachehash bench [N]" times the naming done for a cache hit, once
+ * for a plain URL and twice for a URL with Vary, against the MD5 based
+ * naming used before.
+ *
+ * The dummies below are just there to link cache_util.o, from this
+ * directory something like:
+ *
+     gcc -O2 -I../include -I../os/unix -I../modules/cache \
+            `apr-1-config --includes --cppflags --cflags` \
+            `apu-1-config --includes` \
+            -o test_cachehash test_cachehash.c ../modules/cache/cache_util.c \
+            `apu-1-config --link-ld --libs` `apr-1-config --link-ld --libs`
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "httpd.h"
+#include "http_config.h"
+#include "http_log.h"
+#include "ap_provider.h"
+#include "ap_mpm.h"
+#include "apr_general.h"
+#include "apr_hash.h"
+#include "apr_md5.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+#include "mod_cache.h"
+#include "cache_util.h"
+
+/*
+ * Dummy a bunch of stuff just to get a compile
+ */
+module AP_MODULE_DECLARE_DATA cache_module;
+APR_OPTIONAL_FN_TYPE(ap_cache_generate_key) *cache_generate_key;
+
+AP_DECLARE(void) ap_log_rerror_(const char *file, int line, int module_index,
+                                int level, apr_status_t status,
+                                const request_rec *r, const char *fmt, ...)
+{
+    ;
+}
+
+AP_DECLARE(void *) ap_lookup_provider(const char *provider_group,
+                                      const char *provider_name,
+                                      const char *provider_version)
+{
+    return NULL;
+}
+
+AP_DECLARE(const char *) ap_make_content_type(request_rec *r,
+                                              const char *type)
+{
+    return type;
+}
+
+AP_DECLARE(const char *) ap_get_request_header(request_rec *r,
+                                               ap_header_e header)
+{
+    return NULL;
+}
+
+AP_DECLARE(apr_status_t) ap_mpm_query(int query_code, int *result)
+{
+    return APR_ENOTIMPL;
+}
+
+AP_DECLARE(void *) ap_retained_data_get(const char *key)
+{
+    return NULL;
+}
+
+AP_DECLARE(void *) ap_retained_data_create(const char *key, apr_size_t size)
+{
+    return calloc(1, size);
+}
+
+/* The key of the SipHash test vectors: 00 01 02 ... 0f */
+static const unsigned char hkey[CACHE_HASH_KEY_LEN] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/* SipHash-2-4 with 128 bits of output of key, keyed with hkey above, as
+ * printed by the reference implementation (the first is its vector for
+ * the empty message)
+ */
+static const struct {
+    const char *key;
+    const char *hash;
+} vectors[] = {
+    { "", "a3817f04ba25a8e66df67214c7550293" },
+    { "The quick brown fox jumps over the lazy dog",
+      "7628c9301aa4412555e65227cd31964e" },
+    { "http://www.example.com:80/?",
+      "3ddfc2782c8d6e5c70d5287c2fd191e0" },
+    { "http://www.example.com:80/index.html?",
+      "e2a39abea82f43aeb088ae830414c53a" },
+    { "http://www.example.com:80/static/css/site.css?v=1.2.3",
+      "92703ec67cb9c98678a7e7ac1274710c" },
+    { NULL, NULL }
+};
+
+/* The naming of cache_util.c up to 2.5.0-dev, MD5 and a modified
+ * uuencoding of the digest
+ */
+static void md5_name(const char *it, char *val, int ndepth, int nlength)
+{
+    apr_md5_ctx_t context;
+    unsigned char digest[16];
+    char tmp[22];
+    int i, k, d;
+    unsigned int x;
+    static const char enc_table[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_@";
+
+    apr_md5_init(&context);
+    apr_md5_update(&context, (const unsigned char *) it, strlen(it));
+    apr_md5_final(digest, &context);
+
+    for (i = 0, k = 0; i < 15; i += 3) {
+        x = (digest[i] << 16) | (digest[i + 1] << 8) | digest[i + 2];
+        tmp[k++] = enc_table[x >> 18];
+        tmp[k++] = enc_table[(x >> 12) & 0x3f];
+        tmp[k++] = enc_table[(x >> 6) & 0x3f];
+        tmp[k++] = enc_table[x & 0x3f];
+    }
+    x = digest[15];
+    tmp[k++] = enc_table[x >> 2];
+    tmp[k++] = enc_table[(x << 4) & 0x3f];
+
+    for (i = k = d = 0; d < ndepth; ++d) {
+        memcpy(&val[i], &tmp[k], nlength);
+        k += nlength;
+        val[i + nlength] = '/';
+        i += nlength + 1;
+    }
+    memcpy(&val[i], &tmp[k], 22 - k);
+    val[i + 22 - k] = '\0';
+}
+
+static const char *make_key(apr_pool_t *p, long i)
+{
+    return apr_psprintf(p, "https://www.example.com:443/catalog/item/%ld/"
+                        "detail.html?lang=en&ref=%ld", i, i % 97);
+}
+
+static int check(apr_pool_t *p, long n)
+{
+    unsigned char hash[CACHE_HASH_LEN];
+    char hex[2 * CACHE_HASH_LEN + 1];
+    apr_hash_t *names = apr_hash_make(p);
+    long dirs[64] = { 0 }, i, lo, hi;
+    const char *enc =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_@";
+    int rc = 0, j;
+
+    for (i = 0; vectors[i].key; i++) {
+        ap_cache_hash(hkey, vectors[i].key, strlen(vectors[i].key), hash);
+        for (j = 0; j < CACHE_HASH_LEN; j++) {
+            apr_snprintf(hex + 2 * j, 3, "%02x", hash[j]);
+        }
+        if (strcmp(hex, vectors[i].hash)) {
+            printf("FAILED: hash of '%s' is %s, expected %s\n",
+                   vectors[i].key, hex, vectors[i].hash);
+            rc = 1;
+        }
+    }
+
+    /* the server's own key names things otherwise */
+    if (!strcmp(ap_cache_generate_name(p, 2, 2, vectors[1].key),
+                ap_cache_generate_keyed_name(p, hkey, 2, 2,
+                                             vectors[1].key))) {
+        printf("FAILED: the key does not change the name\n");
+        rc = 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        const char *name = ap_cache_generate_keyed_name(p, hkey, 2, 2,
+                                                        make_key(p, i));
+
+        if (strlen(name) != 22 + 2 || name[2] != '/' || name[5] != '/') {
+            printf("FAILED: malformed name %s\n", name);
+            return 1;
+        }
+        if (apr_hash_get(names, name, APR_HASH_KEY_STRING)) {
+            printf("FAILED: name %s given twice\n", name);
+            return 1;
+        }
+        apr_hash_set(names, name, APR_HASH_KEY_STRING, name);
+        dirs[strchr(enc, name[0]) - enc]++;
+    }
+
+    /* each first level directory should get n / 64 names, give or take */
+    lo = hi = dirs[0];
+    for (j = 1; j < 64; j++) {
+        lo = dirs[j] < lo ? dirs[j] : lo;
+        hi = dirs[j] > hi ? dirs[j] : hi;
+    }
+    printf("%ld names, %ld to %ld per first level directory\n", n, lo, hi);
+    if (n >= 64 * 1000 && (lo < n / 64 * 9 / 10 || hi > n / 64 * 11 / 10)) {
+        printf("FAILED: uneven spread\n");
+        rc = 1;
+    }
+
+    if (!rc) {
+        printf("ok\n");
+    }
+    return rc;
+}
+
+static void bench(apr_pool_t *p, long n)
+{
+    const char *key = "https://www.example.com:443/catalog/item/12345/"
+                      "detail.html?lang=en&ref=42";
+    const char *variant = "Accept-Encodinggzip, deflate, brAccept-Language"
+                          "en-US,en;q=0.5https://www.example.com:443/catalog/"
+                          "item/12345/detail.html?lang=en&ref=42";
+    char name[66];
+    apr_time_t start;
+    long i;
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        md5_name(key, name, 2, 2);
+    }
+    printf("md5 name:          %8.1f ns per hit\n",
+           (apr_time_now() - start) * 1000.0 / n);
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        ap_cache_generate_keyed_name(p, hkey, 2, 2, key);
+        if (!(i & 1023)) {
+            apr_pool_clear(p);
+        }
+    }
+    printf("name:              %8.1f ns per hit\n",
+           (apr_time_now() - start) * 1000.0 / n);
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        md5_name(key, name, 2, 2);
+        md5_name(variant, name, 2, 2);
+    }
+    printf("md5 name, vary:    %8.1f ns per hit\n",
+           (apr_time_now() - start) * 1000.0 / n);
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        ap_cache_generate_keyed_name(p, hkey, 2, 2, key);
+        ap_cache_generate_keyed_name(p, hkey, 2, 2, variant);
+        if (!(i & 1023)) {
+            apr_pool_clear(p);
+        }
+    }
+    printf("name, vary:        %8.1f ns per hit\n",
+           (apr_time_now() - start) * 1000.0 / n);
+}
+
+int main(int argc, char **argv)
+{
+    apr_pool_t *p;
+    int rc = 0;
+
+    if (argc < 2 || (strcmp(argv[1], "check") && strcmp(argv[1], "bench"))) {
+        fprintf(stderr, "usage: %s check [N]\n"
+                        "       %s bench [N]\n", argv[0], argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    apr_pool_create(&p, NULL);
+    if (cache_hash_key_init() != APR_SUCCESS) {
+        fprintf(stderr, "could not draw the cache hash key\n");
+        exit(1);
+    }
+
+    if (!strcmp(argv[1], "check")) {
+        rc = check(p, argc > 2 ? atol(argv[2]) : 1000000);
+    }
+    else {
+        bench(p, argc > 2 ? atol(argv[2]) : 1000000);
+    }
+
+    apr_terminate();
+    exit(rc);
+}
@@ -0,0 +1,440 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    test_fcgimux: a FastCGI responder for benchmarking mod_proxy_fcgi,
+    with or without ProxyFCGIMultiplex.  It takes any number of
+    requests on each connection, and answers each one from a thread of
+    its own after a delay, so that a request waiting does not hold the
+    others of its connection, like an application waiting on a database
+    would.
+
+    The query string tells the response: "delay=<ms>" (default 0) and
+    "size=<bytes>" of body (default 1024).  The request body is read and
+    thrown away.
+
+    It listens on the socket it gets as stdin, so it is started with
+    support/fcgistarter:
+
+        gcc -O2 -pthread -o test_fcgimux test_fcgimux.c
+        fcgistarter -c `pwd`/test_fcgimux -p 9000
+
+    and with the event MPM, something like
+
+        <Location "/mux/">
+            ProxyPass "fcgi://127.0.0.1:9000/" enablereuse=on
+            ProxyFCGIMultiplex Auto 2
+        </Location>
+
+        ab -k -c 200 -n 200000 "http://localhost/mux/?delay=20&size=16384"
+
+    to compare with "ProxyFCGIMultiplex Off", where each request in
+    flight needs a connection (and of a pool's like PHP-FPM, a process).
+
+    Options, in the environment since fcgistarter passes none:
+    FCGIMUX_MPXS=0 answers FCGI_MPXS_CONNS 0 to FCGI_GET_VALUES, so that
+    "Auto" does not multiplex, and FCGIMUX_MAX_REQS=<n> the
+    FCGI_MAX_REQS answered (default 100).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define FCGI_LISTENSOCK_FILENO 0
+
+#define FCGI_BEGIN_REQUEST       1
+#define FCGI_ABORT_REQUEST       2
+#define FCGI_END_REQUEST         3
+#define FCGI_PARAMS              4
+#define FCGI_STDIN               5
+#define FCGI_STDOUT              6
+#define FCGI_GET_VALUES          9
+#define FCGI_GET_VALUES_RESULT  10
+#define FCGI_UNKNOWN_TYPE       11
+
+#define FCGI_KEEP_CONN  1
+
+#define FCGI_REQUEST_COMPLETE 0
+
+#define MAX_CONTENT 65535
+
+typedef struct conn {
+    int fd;
+    int refs;                   /* the reader, and the requests */
+    pthread_mutex_t mutex;      /* refs and the writes */
+    struct req *reqs[65536];
+} conn;
+
+typedef struct req {
+    conn *c;
+    int id;
+    int keep_conn;
+    char *params;
+    size_t params_len;
+    long delay;
+    long size;
+} req;
+
+static int mpxs = 1;
+static int max_reqs = 100;
+
+static void conn_release(conn *c)
+{
+    int refs;
+
+    pthread_mutex_lock(&c->mutex);
+    refs = --c->refs;
+    pthread_mutex_unlock(&c->mutex);
+    if (!refs) {
+        close(c->fd);
+        pthread_mutex_destroy(&c->mutex);
+        free(c);
+    }
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* A whole record, between the ones of the other requests */
+static int write_record(conn *c, int type, int id, const char *data,
+                        size_t len)
+{
+    unsigned char h[8];
+    int rv;
+
+    h[0] = 1;
+    h[1] = type;
+    h[2] = id >> 8;
+    h[3] = id & 0xff;
+    h[4] = len >> 8;
+    h[5] = len & 0xff;
+    h[6] = 0;
+    h[7] = 0;
+
+    pthread_mutex_lock(&c->mutex);
+    rv = write_full(c->fd, h, sizeof(h));
+    if (!rv && len) {
+        rv = write_full(c->fd, data, len);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return rv;
+}
+
+static size_t nv_len(const unsigned char **p, const unsigned char *end)
+{
+    const unsigned char *b = *p;
+
+    if (b >= end) {
+        return (size_t)-1;
+    }
+    if (!(b[0] & 0x80)) {
+        *p += 1;
+        return b[0];
+    }
+    if (end - b < 4) {
+        return (size_t)-1;
+    }
+    *p += 4;
+    return ((size_t)(b[0] & 0x7f) << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static long query_arg(const char *query, size_t len, const char *name,
+                      long def)
+{
+    size_t n = strlen(name);
+    const char *p = query, *end = query + len;
+
+    while (p < end) {
+        if ((size_t)(end - p) > n && !strncmp(p, name, n) && p[n] == '=') {
+            return atol(p + n + 1);
+        }
+        while (p < end && *p != '&') {
+            p++;
+        }
+        p++;
+    }
+    return def;
+}
+
+/* The delay and size of the response, from QUERY_STRING */
+static void parse_params(req *q)
+{
+    const unsigned char *p = (const unsigned char *)q->params;
+    const unsigned char *end = p + q->params_len;
+
+    q->delay = 0;
+    q->size = 1024;
+    while (p < end) {
+        size_t nlen = nv_len(&p, end);
+        size_t vlen = nv_len(&p, end);
+
+        if (nlen == (size_t)-1 || vlen == (size_t)-1
+            || nlen > (size_t)(end - p) || vlen > (size_t)(end - p) - nlen) {
+            break;
+        }
+        if (nlen == 12 && !memcmp(p, "QUERY_STRING", 12)) {
+            q->delay = query_arg((const char *)p + nlen, vlen, "delay", 0);
+            q->size = query_arg((const char *)p + nlen, vlen, "size", 1024);
+        }
+        p += nlen + vlen;
+    }
+}
+
+static void *respond(void *arg)
+{
+    req *q = arg;
+    conn *c = q->c;
+    char head[256];
+    static char body[MAX_CONTENT];
+    unsigned char end[8] = { 0 };
+    long left;
+    int rv;
+
+    if (q->delay > 0) {
+        usleep(q->delay * 1000);
+    }
+
+    rv = write_record(c, FCGI_STDOUT, q->id, head,
+                      snprintf(head, sizeof(head),
+                               "Status: 200 OK\r\n"
+                               "Content-Type: text/plain\r\n"
+                               "Content-Length: %ld\r\n\r\n", q->size));
+    for (left = q->size; !rv && left > 0; ) {
+        size_t n = left < MAX_CONTENT ? left : MAX_CONTENT;
+
+        rv = write_record(c, FCGI_STDOUT, q->id, body, n);
+        left -= n;
+    }
+    if (!rv) {
+        rv = write_record(c, FCGI_STDOUT, q->id, NULL, 0);
+    }
+    if (!rv) {
+        end[4] = FCGI_REQUEST_COMPLETE;
+        rv = write_record(c, FCGI_END_REQUEST, q->id, (char *)end, 8);
+    }
+    if (rv || !q->keep_conn) {
+        shutdown(c->fd, SHUT_RDWR);
+    }
+
+    free(q->params);
+    free(q);
+    conn_release(c);
+    return NULL;
+}
+
+static void get_values(conn *c)
+{
+    char buf[128];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%c%c%s%d%c%c%s%d",
+                   15, 1, "FCGI_MPXS_CONNS", mpxs,
+                   13, (int)snprintf(NULL, 0, "%d", max_reqs),
+                   "FCGI_MAX_REQS", max_reqs);
+    write_record(c, FCGI_GET_VALUES_RESULT, 0, buf, len);
+}
+
+static void *serve(void *arg)
+{
+    conn *c = arg;
+    char *content = malloc(MAX_CONTENT + 255);
+    unsigned char h[8];
+
+    for (;;) {
+        int type, id;
+        size_t clen, plen;
+        req *q;
+
+        if (read_full(c->fd, h, sizeof(h))) {
+            break;
+        }
+        type = h[1];
+        id = (h[2] << 8) | h[3];
+        clen = (h[4] << 8) | h[5];
+        plen = h[6];
+        if (read_full(c->fd, content, clen + plen)) {
+            break;
+        }
+
+        q = c->reqs[id];
+        switch (type) {
+        case FCGI_BEGIN_REQUEST:
+            if (q || !id) {
+                break;
+            }
+            q = calloc(1, sizeof(req));
+            q->c = c;
+            q->id = id;
+            q->keep_conn = clen >= 3 && (content[2] & FCGI_KEEP_CONN);
+            q->size = 1024;
+            c->reqs[id] = q;
+            break;
+
+        case FCGI_PARAMS:
+            if (q && clen) {
+                q->params = realloc(q->params, q->params_len + clen);
+                memcpy(q->params + q->params_len, content, clen);
+                q->params_len += clen;
+            }
+            else if (q) {
+                parse_params(q);
+            }
+            break;
+
+        case FCGI_STDIN:
+            if (q && !clen) {
+                /* all read, the response is on its own */
+                pthread_t t;
+
+                c->reqs[id] = NULL;
+                pthread_mutex_lock(&c->mutex);
+                c->refs++;
+                pthread_mutex_unlock(&c->mutex);
+                if (pthread_create(&t, NULL, respond, q)) {
+                    conn_release(c);
+                    free(q->params);
+                    free(q);
+                    break;
+                }
+                pthread_detach(t);
+            }
+            break;
+
+        case FCGI_ABORT_REQUEST:
+            if (q) {
+                unsigned char end[8] = { 0 };
+
+                c->reqs[id] = NULL;
+                write_record(c, FCGI_END_REQUEST, id, (char *)end, 8);
+                free(q->params);
+                free(q);
+            }
+            break;
+
+        case FCGI_GET_VALUES:
+            get_values(c);
+            break;
+
+        default:
+            {
+                unsigned char unknown[8] = { 0 };
+
+                unknown[0] = type;
+                write_record(c, FCGI_UNKNOWN_TYPE, 0, (char *)unknown, 8);
+            }
+            break;
+        }
+    }
+
+    free(content);
+
+    /* the requests not started yet */
+    {
+        int id;
+
+        for (id = 0; id < 65536; id++) {
+            if (c->reqs[id]) {
+                free(c->reqs[id]->params);
+                free(c->reqs[id]);
+            }
+        }
+    }
+    conn_release(c);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const char *env;
+
+    if ((env = getenv("FCGIMUX_MPXS"))) {
+        mpxs = atoi(env) > 0;
+    }
+    if ((env = getenv("FCGIMUX_MAX_REQS")) && atoi(env) > 0) {
+        max_reqs = atoi(env);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;) {
+        pthread_t t;
+        conn *c;
+        int fd = accept(FCGI_LISTENSOCK_FILENO, NULL, NULL);
+
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            exit(1);
+        }
+
+        c = calloc(1, sizeof(conn));
+        c->fd = fd;
+        c->refs = 1;
+        pthread_mutex_init(&c->mutex, NULL);
+        if (pthread_create(&t, NULL, serve, c)) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(t);
+    }
+
+    return 0;
+}
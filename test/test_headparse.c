@@ -0,0 +1,516 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This program tests the ap_parse_http_fields() and ap_scan_http_line()
+ * routines in ../server/util.c, which read_request_line() uses as a fast
+ * path for buffered request heads.
+ *
+ * "test_headparse fuzz [ITERATIONS [SEED]]" feeds them randomly mangled
+ * heads and compares the outcome with a plain byte at a time reference,
+ * "test_headparse bench [N]" times them against the line by line copying
+ * ap_rgetline() does, on a typical browser request.
+ *
+ * "test_headparse lookup [N]" checks ap_get_request_header() against
+ * apr_table_get() and times the header lookups the core, mod_http,
+ * mod_deflate and mod_cache do for each request, on a request with 40
+ * header fields.
+ *
+ * The dummies below are just there to link util.o; build the server
+ * first (so that test_char.h exists), then from this directory something
+ * like:
+ *
+     gcc -O2 -march=native -I../include -I../os/unix -I../server \
+            `apr-1-config --includes --cppflags --cflags` \
+            -o test_headparse test_headparse.c ../server/util.c \
+            `apr-1-config --link-ld --libs`
+ *
+ * (-march=native, -mssse3 or -mavx2 select the vector scanners, without
+ * it the scalar ones are tested).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "httpd.h"
+#include "http_core.h"
+#include "http_log.h"
+#include "http_protocol.h"
+#include "ap_mpm.h"
+#include "scoreboard.h"
+#include "util_filter.h"
+#include "apr_general.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+/*
+ * Dummy a bunch of stuff just to get a compile
+ */
+const char *ap_server_argv0 = "test_headparse";
+AP_DECLARE_DATA int ap_extended_status = 0;
+AP_DECLARE_DATA scoreboard *ap_scoreboard_image = NULL;
+
+AP_DECLARE(void) ap_log_error_(const char *file, int line, int module_index,
+                               int level, apr_status_t status,
+                               const server_rec *s, const char *fmt, ...)
+{
+    ;
+}
+
+AP_DECLARE(void) ap_log_perror_(const char *file, int line, int module_index,
+                                int level, apr_status_t status, apr_pool_t *p,
+                                const char *fmt, ...)
+{
+    ;
+}
+
+AP_DECLARE(void) ap_log_assert(const char *szExp, const char *szFile,
+                               int nLine)
+{
+    abort();
+}
+
+AP_DECLARE(int) ap_discard_request_body(request_rec *r)
+{
+    return OK;
+}
+
+AP_DECLARE(int) ap_map_http_request_error(apr_status_t rv, int status)
+{
+    return status;
+}
+
+AP_DECLARE(apr_status_t) ap_get_brigade(ap_filter_t *filter,
+                                        apr_bucket_brigade *bucket,
+                                        ap_input_mode_t mode,
+                                        apr_read_type_e block,
+                                        apr_off_t readbytes)
+{
+    return APR_ENOTIMPL;
+}
+
+AP_DECLARE(process_score *) ap_get_scoreboard_process(int x)
+{
+    return NULL;
+}
+
+AP_DECLARE(apr_status_t) ap_mpm_query(int query_code, int *result)
+{
+    return APR_ENOTIMPL;
+}
+
+AP_DECLARE(int) ap_regcomp(ap_regex_t *preg, const char *regex, int cflags)
+{
+    return 1;
+}
+
+AP_DECLARE(void) ap_regfree(ap_regex_t *preg)
+{
+    ;
+}
+
+AP_DECLARE(apr_port_t) ap_run_default_port(const request_rec *r)
+{
+    return 80;
+}
+
+static void *headers_in_note;
+
+AP_DECLARE(void **) ap_get_request_note(request_rec *r, apr_size_t note_num)
+{
+    return note_num == AP_NOTE_HEADERS_IN ? &headers_in_note : NULL;
+}
+
+#define MAX_LINE    (DEFAULT_LIMIT_REQUEST_FIELDSIZE + 2)
+#define MAX_FIELDS  DEFAULT_LIMIT_REQUEST_FIELDS
+
+static const char request[] =
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:38.0) Gecko/20100101 "
+        "Firefox/38.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Referer: http://www.example.com/index.html\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; lang=en; "
+        "tracking=a1b2c3d4e5f6\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "\r\n";
+
+/*
+ * The reference: same rules as ap_parse_http_fields(), one byte at a time
+ * and without the test_char table.
+ */
+static int is_token(unsigned char c)
+{
+    return c > 32 && c < 127 && !strchr("()<>@,;:\\\"/[]?={}", c);
+}
+
+static int is_ctrl(unsigned char c)
+{
+    return (c < 32 && c != '\t') || c == 127;
+}
+
+static apr_status_t reference(char *buf, apr_size_t len, apr_table_t *t,
+                              apr_size_t *consumed)
+{
+    apr_size_t pos = 0, i, n, v, e;
+    int nfields = 0;
+
+    for (;;) {
+        if (pos + 1 == len && buf[pos] == '\r') {
+            return APR_INCOMPLETE;
+        }
+        if (pos < len && buf[pos] == '\n') {
+            *consumed = pos + 1;
+            return APR_SUCCESS;
+        }
+        if (pos + 1 < len && buf[pos] == '\r' && buf[pos + 1] == '\n') {
+            *consumed = pos + 2;
+            return APR_SUCCESS;
+        }
+        for (n = pos; n < len && (is_token(buf[n])
+                                  || (unsigned char)buf[n] > 127); n++)
+            ;
+        if (n == len) {
+            return (len - pos > MAX_LINE) ? APR_EINVAL : APR_INCOMPLETE;
+        }
+        if (n == pos || buf[n] != ':') {
+            return APR_EINVAL;
+        }
+        for (e = n + 1; e < len && !is_ctrl(buf[e]); e++)
+            ;
+        if (e == len || (buf[e] == '\r' && e + 1 == len)) {
+            return (len - pos > MAX_LINE) ? APR_EINVAL : APR_INCOMPLETE;
+        }
+        if (buf[e] == '\r') {
+            if (buf[e + 1] != '\n') {
+                return APR_EINVAL;
+            }
+            i = e + 2;
+        }
+        else if (buf[e] == '\n') {
+            i = e + 1;
+        }
+        else {
+            return APR_EINVAL;
+        }
+        if (i - pos > MAX_LINE || ++nfields > MAX_FIELDS) {
+            return APR_EINVAL;
+        }
+        for (v = n + 1; v < e && (buf[v] == ' ' || buf[v] == '\t'); v++)
+            ;
+        while (e > v && (buf[e - 1] == ' ' || buf[e - 1] == '\t'))
+            e--;
+        buf[n] = buf[e] = '\0';
+        apr_table_addn(t, buf + pos, buf + v);
+        pos = i;
+    }
+}
+
+static int same_tables(apr_table_t *a, apr_table_t *b)
+{
+    const apr_array_header_t *ha = apr_table_elts(a), *hb = apr_table_elts(b);
+    const apr_table_entry_t *ea = (void *)ha->elts, *eb = (void *)hb->elts;
+    int i;
+
+    if (ha->nelts != hb->nelts) {
+        return 0;
+    }
+    for (i = 0; i < ha->nelts; i++) {
+        if (strcmp(ea[i].key, eb[i].key) || strcmp(ea[i].val, eb[i].val)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void mangle(char *buf, apr_size_t *len, apr_size_t size)
+{
+    static const char nasty[] = "\r\n\t :\0\x7f\x01\x80\xff(";
+    int k, edits = rand() % 4;
+
+    for (k = 0; k < edits; k++) {
+        apr_size_t at = rand() % *len;
+
+        switch (rand() % 4) {
+        case 0: /* overwrite */
+            buf[at] = nasty[rand() % (sizeof(nasty) - 1)];
+            break;
+        case 1: /* truncate */
+            *len = at;
+            break;
+        case 2: /* obsolete folding */
+            if (*len + 3 < size) {
+                memmove(buf + at + 3, buf + at, *len - at);
+                memcpy(buf + at, "\r\n ", 3);
+                *len += 3;
+            }
+            break;
+        case 3: /* a long line */
+            if (*len + MAX_LINE < size) {
+                apr_size_t n = rand() % MAX_LINE + 1;
+                memmove(buf + at + n, buf + at, *len - at);
+                memset(buf + at, 'x', n);
+                *len += n;
+            }
+            break;
+        }
+        if (!*len) {
+            break;
+        }
+    }
+}
+
+static int fuzz(apr_pool_t *p, long iterations)
+{
+    apr_size_t size = sizeof(request) + 4 * MAX_LINE;
+    char *orig = apr_palloc(p, size), *b1 = apr_palloc(p, size),
+         *b2 = apr_palloc(p, size);
+    long i, failed = 0, outcome[3] = { 0, 0, 0 };
+
+    for (i = 0; i < iterations; i++) {
+        apr_table_t *t1 = apr_table_make(p, 16), *t2 = apr_table_make(p, 16);
+        apr_size_t len = sizeof(request) - 1, c1 = 0, c2 = 0;
+        apr_status_t rv1, rv2;
+
+        memcpy(orig, request, len);
+        mangle(orig, &len, size);
+        memcpy(b1, orig, len);
+        memcpy(b2, orig, len);
+
+        rv1 = ap_parse_http_fields(b1, len, MAX_LINE, MAX_FIELDS, t1, &c1);
+        rv2 = reference(b2, len, t2, &c2);
+        outcome[rv1 == APR_SUCCESS ? 0 : rv1 == APR_INCOMPLETE ? 1 : 2]++;
+        if (rv1 != rv2 || c1 != c2
+            || (rv1 == APR_SUCCESS && !same_tables(t1, t2))) {
+            printf("  mismatch on %.*s\n  == got %d/%" APR_SIZE_T_FMT
+                   ", expected %d/%" APR_SIZE_T_FMT "\n",
+                   (int)len, orig, rv1, c1, rv2, c2);
+            failed++;
+        }
+        if (i % 1000 == 999) {
+            apr_pool_clear(p);
+            orig = apr_palloc(p, size);
+            b1 = apr_palloc(p, size);
+            b2 = apr_palloc(p, size);
+        }
+    }
+    printf("%ld heads: %ld parsed, %ld incomplete, %ld invalid, "
+           "%ld mismatches\n", iterations, outcome[0], outcome[1], outcome[2],
+           failed);
+
+    return failed != 0;
+}
+
+/* What ap_rgetline() and ap_get_mime_headers_core() do per line */
+static void line_by_line(const char *head, apr_size_t len, apr_table_t *t,
+                         apr_pool_t *p)
+{
+    const char *pos = head, *end = head + len;
+
+    while (pos < end) {
+        const char *lf = memchr(pos, '\n', end - pos);
+        apr_size_t n = lf - pos;
+        char *line, *value, *tmp;
+
+        if (n && lf[-1] == '\r') {
+            n--;
+        }
+        if (!n) {
+            break;
+        }
+        line = apr_palloc(p, n + 1);
+        memcpy(line, pos, n);
+        line[n] = '\0';
+        if (strlen(line) < n || !(value = strchr(line, ':'))) {
+            break;
+        }
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+        tmp = line + n - 1;
+        while (tmp > value && (*tmp == ' ' || *tmp == '\t')) {
+            *tmp-- = '\0';
+        }
+        apr_table_addn(t, line, value);
+        pos = lf + 1;
+    }
+}
+
+static void bench(apr_pool_t *p, long n)
+{
+    apr_size_t len = sizeof(request) - 1, consumed;
+    apr_time_t start;
+    long i;
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        apr_table_t *t = apr_table_make(p, 25);
+        line_by_line(request, len, t, p);
+        apr_pool_clear(p);
+    }
+    printf("line by line: %8.1f ns per head\n",
+           (apr_time_now() - start) * 1000.0 / n);
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        apr_table_t *t = apr_table_make(p, 25);
+        char *buf = apr_pmemdup(p, request, len);
+        ap_parse_http_fields(buf, len, MAX_LINE, MAX_FIELDS, t, &consumed);
+        apr_pool_clear(p);
+    }
+    printf("in place:     %8.1f ns per head\n",
+           (apr_time_now() - start) * 1000.0 / n);
+}
+
+/* In the order of a GET through the core, mod_http, mod_deflate and
+ * mod_cache, most of them are not in the request
+ */
+static const ap_header_e lookups[] = {
+    AP_HEADER_TRANSFER_ENCODING, AP_HEADER_HOST, AP_HEADER_EXPECT,
+    AP_HEADER_HOST, AP_HEADER_TRANSFER_ENCODING, AP_HEADER_CONTENT_LENGTH,
+    AP_HEADER_CACHE_CONTROL, AP_HEADER_PRAGMA, AP_HEADER_AUTHORIZATION,
+    AP_HEADER_CONNECTION, AP_HEADER_VIA, AP_HEADER_IF_MATCH,
+    AP_HEADER_IF_UNMODIFIED_SINCE, AP_HEADER_IF_NONE_MATCH,
+    AP_HEADER_IF_MODIFIED_SINCE, AP_HEADER_IF_RANGE, AP_HEADER_RANGE,
+    AP_HEADER_ACCEPT_ENCODING, AP_HEADER_CONTENT_RANGE, AP_HEADER_RANGE,
+    AP_HEADER_AUTHORIZATION, AP_HEADER_CONNECTION
+};
+#define NUM_LOOKUPS (sizeof(lookups) / sizeof(lookups[0]))
+
+static apr_table_t *make_headers(apr_pool_t *p)
+{
+    apr_table_t *t = apr_table_make(p, 25);
+    apr_size_t consumed;
+    int i;
+
+    for (i = 0; i < 31; i++) {
+        apr_table_addn(t, apr_psprintf(p, "X-Extra-Field-%02d", i), "value");
+    }
+    ap_parse_http_fields(apr_pmemdup(p, request, sizeof(request) - 1),
+                         sizeof(request) - 1, MAX_LINE, MAX_FIELDS, t,
+                         &consumed);
+    return t;
+}
+
+static const char * volatile found;
+
+static int lookup(apr_pool_t *p, long n)
+{
+    request_rec r;
+    apr_time_t start, base;
+    long i;
+    int id, failed = 0;
+    apr_size_t j;
+
+    memset(&r, 0, sizeof(r));
+    r.pool = p;
+    r.headers_in = make_headers(p);
+
+    /* also through the changes that must invalidate the index */
+    for (j = 0; j < 4; j++) {
+        if (j == 1) {
+            apr_table_unset(r.headers_in, "Host");
+        }
+        else if (j == 2) {
+            apr_table_setn(r.headers_in, "Range", "bytes=0-");
+        }
+        else if (j == 3) {
+            apr_table_mergen(r.headers_in, "Range", "1-2");
+            apr_table_compress(r.headers_in, APR_OVERLAP_TABLES_MERGE);
+        }
+        for (id = 0; id < AP_HEADER_MAX; id++) {
+            const char *a = apr_table_get(r.headers_in, ap_header_name(id));
+            const char *b = ap_get_request_header(&r, id);
+            if (a != b) {
+                fprintf(stderr, "%s: \"%s\" instead of \"%s\"\n",
+                        ap_header_name(id), b ? b : "(null)",
+                        a ? a : "(null)");
+                failed++;
+            }
+        }
+    }
+    apr_pool_clear(p);
+
+    /* the cost of making the table, subtracted from the lookups */
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        make_headers(p);
+        apr_pool_clear(p);
+    }
+    base = apr_time_now() - start;
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        apr_table_t *t = make_headers(p);
+        for (j = 0; j < NUM_LOOKUPS; j++) {
+            found = apr_table_get(t, ap_header_name(lookups[j]));
+        }
+        apr_pool_clear(p);
+    }
+    printf("apr_table_get:         %8.1f ns per request\n",
+           (apr_time_now() - start - base) * 1000.0 / n);
+
+    start = apr_time_now();
+    for (i = 0; i < n; i++) {
+        r.headers_in = make_headers(p);
+        headers_in_note = NULL;
+        for (j = 0; j < NUM_LOOKUPS; j++) {
+            found = ap_get_request_header(&r, lookups[j]);
+        }
+        apr_pool_clear(p);
+    }
+    printf("ap_get_request_header: %8.1f ns per request\n",
+           (apr_time_now() - start - base) * 1000.0 / n);
+
+    printf("(%d lookups among 40 fields, %d mismatches)\n",
+           (int)NUM_LOOKUPS, failed);
+
+    return failed != 0;
+}
+
+int main(int argc, char **argv)
+{
+    apr_pool_t *p;
+    int rc = 0;
+
+    if (argc < 2 || (strcmp(argv[1], "fuzz") && strcmp(argv[1], "bench")
+                     && strcmp(argv[1], "lookup"))) {
+        fprintf(stderr, "usage: %s fuzz [ITERATIONS [SEED]]\n"
+                        "       %s bench [N]\n"
+                        "       %s lookup [N]\n", argv[0], argv[0], argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    apr_pool_create(&p, NULL);
+
+    if (!strcmp(argv[1], "fuzz")) {
+        srand(argc > 3 ? atoi(argv[3]) : 1);
+        rc = fuzz(p, argc > 2 ? atol(argv[2]) : 100000);
+    }
+    else if (!strcmp(argv[1], "bench")) {
+        bench(p, argc > 2 ? atol(argv[2]) : 1000000);
+    }
+    else {
+        rc = lookup(p, argc > 2 ? atol(argv[2]) : 1000000);
+    }
+
+    apr_terminate();
+    exit(rc);
+}
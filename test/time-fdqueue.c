@@ -0,0 +1,174 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+time-fdqueue: measure the hand-off latency of the event MPM worker queue.
+
+Like the event MPM's listener, the main thread reserves an idle worker
+with ap_queue_info_wait_for_idler() and pushes it a fake connection
+stamped with the current time, THREADS workers mark themselves idle with
+ap_queue_info_set_idle() and pop it, like worker_thread() does, noting
+how long the connection waited in the queue.
+
+From the top of the source tree, compile with something like:
+
+    gcc -O2 -o time-fdqueue -I include -I os/unix -I server/mpm/event \
+        `apr-1-config --includes --cppflags --cflags` \
+        test/time-fdqueue.c server/mpm/event/fdqueue.c \
+        `apr-1-config --link-ld --libs`
+
+(an ap_config_auto.h from a configured build is needed by fdqueue.h,
+the futex based parking is used when it defines HAVE_LINUX_FUTEX_H)
+
+Then run "time-fdqueue [N [THREADS ...]]", defaults 1000000 16 64 256.
+Build it with a previous server/mpm/event/fdqueue.c to compare.
+*/
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_thread_proc.h"
+#include "apr_time.h"
+
+#include "fdqueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static fd_queue_t *queue;
+static fd_queue_info_t *queue_info;
+
+/* push time, then queueing latency, in nanoseconds */
+static apr_uint64_t *stamps;
+
+static apr_uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (apr_uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void * APR_THREAD_FUNC worker(apr_thread_t *thd, void *data)
+{
+    int is_idle = 0;
+
+    for (;;) {
+        apr_socket_t *sd;
+        event_conn_state_t *ecs;
+        apr_pool_t *p;
+        timer_event_t *te;
+        apr_status_t rv;
+
+        if (!is_idle) {
+            ap_queue_info_set_idle(queue_info, NULL);
+            is_idle = 1;
+        }
+        rv = ap_queue_pop_something(queue, &sd, &ecs, &p, &te);
+        if (APR_STATUS_IS_EOF(rv)) {
+            break;
+        }
+        if (rv != APR_SUCCESS) {
+            continue;
+        }
+        is_idle = 0;
+        if (!te) {
+            apr_uint64_t *stamp = (apr_uint64_t *)ecs;
+            *stamp = now_ns() - *stamp;
+        }
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+    apr_uint64_t x = *(const apr_uint64_t *)a, y = *(const apr_uint64_t *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+static void run(int n, int nthreads, apr_pool_t *pool)
+{
+    apr_thread_t **threads;
+    apr_pool_t *p;
+    apr_status_t status;
+    apr_uint64_t start, elapsed;
+    int i, blocked = 0;
+
+    apr_pool_create(&p, pool);
+    queue = apr_pcalloc(p, sizeof(*queue));
+    ap_queue_init(queue, nthreads, p);
+    ap_queue_info_create(&queue_info, p, nthreads, -1);
+
+    threads = apr_palloc(p, nthreads * sizeof(*threads));
+    for (i = 0; i < nthreads; i++) {
+        apr_thread_create(&threads[i], NULL, worker, NULL, p);
+    }
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        int had_to_block = 0;
+        ap_queue_info_wait_for_idler(queue_info, &had_to_block);
+        blocked += had_to_block;
+        stamps[i] = now_ns();
+        ap_queue_push(queue, NULL, (event_conn_state_t *)&stamps[i], NULL);
+    }
+    ap_queue_term(queue);
+    for (i = 0; i < nthreads; i++) {
+        apr_thread_join(&status, threads[i]);
+    }
+    elapsed = now_ns() - start;
+
+    qsort(stamps, n, sizeof(*stamps), compare);
+    printf("%4d threads: %d hand-offs in %8.3f ms, latency (usec) "
+           "p50 %7.2f p99 %7.2f max %9.2f, listener blocked %d times\n",
+           nthreads, n, elapsed / 1e6,
+           stamps[n / 2] / 1e3, stamps[n / 100 * 99] / 1e3,
+           stamps[n - 1] / 1e3, blocked);
+
+    apr_pool_destroy(p);
+}
+
+int main(int argc, char **argv)
+{
+    static const int default_threads[] = { 16, 64, 256 };
+    apr_pool_t *p;
+    int n = 1000000, i;
+
+    if (argc > 1) n = atoi(argv[1]);
+    if (n < 100) {
+        fprintf(stderr, "usage: %s [N >= 100 [THREADS ...]]\n", argv[0]);
+        exit(1);
+    }
+
+    apr_initialize();
+    apr_pool_create(&p, NULL);
+    stamps = apr_palloc(p, n * sizeof(*stamps));
+
+    if (argc > 2) {
+        for (i = 2; i < argc; i++) {
+            run(n, atoi(argv[i]), p);
+        }
+    }
+    else {
+        for (i = 0; i < 3; i++) {
+            run(n, default_threads[i], p);
+        }
+    }
+
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,212 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+time-timers: compare the event MPM timer wheel with the APR skiplist
+it replaced.
+
+Each run fills the structure with N timers spread randomly over the
+next SPAN seconds (the pending set), then simulates the listener:
+every millisecond of virtual time new timers are inserted by THREADS
+threads and everything due is expired.  The mutex around the skiplist
+is taken exactly like event.c used to, so with THREADS > 1 the numbers
+include the contention the listener saw.
+
+From the top of the source tree, compile with something like:
+
+    gcc -O2 -o time-timers -I include -I os/unix -I server/mpm/event \
+        `apr-1-config --includes --cppflags --cflags` \
+        test/time-timers.c server/mpm/event/timerwheel.c \
+        `apr-1-config --link-ld --libs`
+
+(an ap_config_auto.h from a configured build is needed by fdqueue.h)
+
+Then run "time-timers [N [THREADS [SPAN]]]", defaults 100000 4 60.
+*/
+
+#include "apr.h"
+#include "apr_pools.h"
+#include "apr_ring.h"
+#include "apr_skiplist.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_time.h"
+
+#include "timerwheel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TICKS   2000    /* simulated listener iterations, 1ms apart */
+
+static int ntimers = 100000;
+static int nthreads = 4;
+static int span = 60;
+
+static timer_event_t *events;
+static apr_skiplist *skiplist;
+static apr_thread_mutex_t *skiplist_mtx;
+static ap_timer_wheel_t *wheel;
+static apr_time_t base;
+
+static int indexing_comp(void *a, void *b)
+{
+    apr_time_t t1 = (apr_time_t) (((timer_event_t *) a)->when);
+    apr_time_t t2 = (apr_time_t) (((timer_event_t *) b)->when);
+    return ((t1 < t2) ? -1 : ((t1 > t2) ? 1 : 0));
+}
+
+static int indexing_compk(void *ac, void *b)
+{
+    apr_time_t *t1 = (apr_time_t *) ac;
+    apr_time_t t2 = (apr_time_t) (((timer_event_t *) b)->when);
+    return ((*t1 < t2) ? -1 : ((*t1 > t2) ? 1 : 0));
+}
+
+/* cheap and thread safe pseudo random spread, rand() takes a lock */
+static void set_when(timer_event_t *te, int i, apr_time_t now)
+{
+    apr_uint64_t r = (apr_uint64_t)i * 2654435761u;
+    te->when = now + (apr_time_t)(r % ((apr_uint64_t)span * APR_USEC_PER_SEC));
+}
+
+struct producer {
+    int use_wheel;
+    int first, last;
+    apr_time_t now;
+};
+
+static void * APR_THREAD_FUNC produce(apr_thread_t *thd, void *data)
+{
+    struct producer *p = data;
+    int i;
+
+    for (i = p->first; i < p->last; i++) {
+        timer_event_t *te = &events[i];
+        set_when(te, i, p->now);
+        if (p->use_wheel) {
+            ap_timer_wheel_push(wheel, te);
+        }
+        else {
+            apr_thread_mutex_lock(skiplist_mtx);
+            apr_skiplist_insert(skiplist, te);
+            apr_thread_mutex_unlock(skiplist_mtx);
+        }
+    }
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static int run(int use_wheel, apr_pool_t *p)
+{
+    apr_thread_t **threads = apr_palloc(p, nthreads * sizeof(*threads));
+    struct producer *prods = apr_palloc(p, nthreads * sizeof(*prods));
+    int per_tick = ntimers / TICKS, expired = 0, tick, i;
+    apr_time_t now = base;
+
+    /* the initial pending set */
+    for (i = 0; i < ntimers; i++) {
+        set_when(&events[i], i, now);
+        if (use_wheel) {
+            ap_timer_wheel_push(wheel, &events[i]);
+        }
+        else {
+            apr_skiplist_insert(skiplist, &events[i]);
+        }
+    }
+    if (use_wheel) {
+        struct timer_ring_t ring;
+        APR_RING_INIT(&ring, timer_event_t, link);
+        ap_timer_wheel_expire(wheel, now - 1, &ring);
+    }
+
+    for (tick = 0; tick < TICKS; tick++) {
+        apr_status_t status;
+        int n = per_tick / nthreads + 1;
+
+        /* workers arm new timers concurrently */
+        for (i = 0; i < nthreads; i++) {
+            prods[i].use_wheel = use_wheel;
+            prods[i].now = now;
+            prods[i].first = ntimers + (tick * nthreads + i) * n;
+            prods[i].last = prods[i].first + n;
+            apr_thread_create(&threads[i], NULL, produce, &prods[i], p);
+        }
+
+        /* meanwhile the listener expires what is due */
+        if (use_wheel) {
+            struct timer_ring_t ring;
+            APR_RING_INIT(&ring, timer_event_t, link);
+            expired += ap_timer_wheel_expire(wheel, now, &ring);
+        }
+        else {
+            timer_event_t *te;
+            apr_thread_mutex_lock(skiplist_mtx);
+            while ((te = apr_skiplist_peek(skiplist)) && te->when <= now) {
+                apr_skiplist_pop(skiplist, NULL);
+                expired++;
+            }
+            apr_thread_mutex_unlock(skiplist_mtx);
+        }
+
+        for (i = 0; i < nthreads; i++) {
+            apr_thread_join(&status, threads[i]);
+        }
+        now += apr_time_from_msec(1);
+    }
+
+    return expired;
+}
+
+int main(int argc, char **argv)
+{
+    apr_pool_t *p;
+    apr_time_t start;
+    int total, expired;
+
+    if (argc > 1) ntimers = atoi(argv[1]);
+    if (argc > 2) nthreads = atoi(argv[2]);
+    if (argc > 3) span = atoi(argv[3]);
+    if (ntimers < TICKS || nthreads < 1 || span < 1) {
+        fprintf(stderr, "usage: %s [N >= %d [THREADS [SPAN]]]\n",
+                argv[0], TICKS);
+        exit(1);
+    }
+
+    apr_initialize();
+    apr_pool_create(&p, NULL);
+
+    total = ntimers + TICKS * nthreads * (ntimers / TICKS / nthreads + 1);
+    events = apr_pcalloc(p, total * sizeof(*events));
+    base = apr_time_now();
+
+    apr_thread_mutex_create(&skiplist_mtx, APR_THREAD_MUTEX_DEFAULT, p);
+    apr_skiplist_init(&skiplist, p);
+    apr_skiplist_set_compare(skiplist, indexing_comp, indexing_compk);
+    start = apr_time_now();
+    expired = run(0, p);
+    printf("skiplist:   %d timers, %d threads, %d expired in %8" APR_TIME_T_FMT
+           " usec\n", ntimers, nthreads, expired, apr_time_now() - start);
+
+    ap_timer_wheel_create(&wheel, base, p);
+    start = apr_time_now();
+    expired = run(1, p);
+    printf("timerwheel: %d timers, %d threads, %d expired in %8" APR_TIME_T_FMT
+           " usec\n", ntimers, nthreads, expired, apr_time_now() - start);
+
+    apr_terminate();
+    return 0;
+}